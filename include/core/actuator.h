@@ -0,0 +1,83 @@
+/**
+ * <actuator.h>
+ *
+ * @brief      Servo dynamics: rate limit, first-order lag, deadband and
+ *             backlash
+ *
+ * Positions are in servo travel, 0.0 to 1.0, the same as sstate.m. A servo
+ * ignores commands that move less than its deadband from the last one it
+ * acted on, follows the new command with a first-order lag, never faster
+ * than its rate limit, and drives the brake through a gear train with some
+ * play, so the brake only moves once the play is taken up.
+ *
+ * The model is used two ways:
+ *  - actuator_march() emulates the servo, the off-board simulator uses it to
+ *    turn the pulses on the servo rail into brake positions.
+ *  - actuator_shape() shapes flight commands so the servo is never sent a
+ *    step it can't follow: small changes are held back until they clear the
+ *    deadband and moves are rate limited. The lag and backlash are left to
+ *    the servo, shaping for them would only add delay or steps.
+ *
+ * Both are a handful of flops per channel and keep their state in the
+ * struct. The per-step constants are worked out once in actuator_init() for
+ * a fixed dt.
+ */
+
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+/**
+ * Parameters of one servo as given in the settings file, 0 turns each
+ * effect off
+ */
+typedef struct actuator_model_t {
+	double rate_max;	///< full travels per second
+	double tau_s;		///< time constant of the lag (s)
+	double deadband;	///< smallest command change the servo acts on (travel)
+	double backlash;	///< total play between servo and brake (travel)
+} actuator_model_t;
+
+typedef struct actuator_t {
+	double alpha;		///< lag gain per step
+	double step_max;	///< rate limit per step
+	double deadband;
+	double half_play;
+	double target;		///< last command outside the deadband
+	double pos;		///< servo position
+	double out;		///< brake position, or the shaped command
+} actuator_t;
+
+/**
+ * @brief      Works out the per-step constants of a model at a fixed time
+ *             step and puts the actuator at rest at pos.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int actuator_init(actuator_t* a, const actuator_model_t* m, double dt, double pos);
+
+/**
+ * @brief      Puts the actuator at rest at pos, keeps the model.
+ */
+void actuator_reset(actuator_t* a, double pos);
+
+/**
+ * @brief      Emulates the servo for one step.
+ *
+ * @param      a     actuator, updated
+ * @param[in]  cmd   commanded position
+ *
+ * @return     brake position
+ */
+double actuator_march(actuator_t* a, double cmd);
+
+/**
+ * @brief      Shapes a command for one step, deadband and rate limit only.
+ *
+ * @param      a     actuator, updated
+ * @param[in]  cmd   wanted position
+ *
+ * @return     position to send
+ */
+double actuator_shape(actuator_t* a, double cmd);
+
+#endif // ACTUATOR_H
@@ -0,0 +1,99 @@
+/**
+ * <aero.h>
+ *
+ * @brief      Airbrake effectiveness over deflection and Mach number
+ *
+ * The drag of the vehicle is modeled as
+ *
+ *     k(b, M) = apogee_drag_k * (1 + f(b, M))
+ *
+ * with deceleration k*v^2, where f is the drag increment of the brakes
+ * relative to the clean drag at deflection b (0 to 1) and Mach number M. f
+ * is a table with breakpoints in both directions and is interpolated
+ * bilinearly. Without aero_table_file in the settings the table is
+ * f = apogee_brake_drag_gain * b at every Mach number, the linear model used
+ * before.
+ *
+ * The file is json:
+ *
+ *     { "deflection": [0.0, ..., 1.0],
+ *       "mach": [0.0, ...],
+ *       "increment": [[f at every mach for the first deflection], ...] }
+ *
+ * f has to be 0 with the brakes in and strictly increase with deflection at
+ * every Mach number, so every increment up to the full brake one maps back
+ * to exactly one deflection.
+ *
+ * Lookups take an aero_cursor_t that remembers the cell of the last lookup.
+ * Between ticks the flight condition barely moves, so the search starts in
+ * that cell and mostly ends there too.
+ */
+
+#ifndef AERO_H
+#define AERO_H
+
+#define AERO_MAX_DEFL	16	///< deflection breakpoints a table can have
+#define AERO_MAX_MACH	16	///< Mach breakpoints a table can have
+#define AERO_MIN_Q	100.0	///< Pa, dynamic pressure floor for gain scheduling
+
+/**
+ * Cell of the last lookup, start at {0, 0}
+ */
+typedef struct aero_cursor_t {
+	int i;		///< deflection cell
+	int j;		///< Mach cell
+} aero_cursor_t;
+
+#define AERO_CURSOR_INITIALIZER {0, 0}
+
+/**
+ * @brief      Loads the table from settings.aero_table_file, or builds the
+ *             linear one if that is empty.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int aero_init(void);
+
+/**
+ * @brief      Mach number from speed and air temperature
+ *
+ * @param[in]  vel     speed (m/s), sign is ignored
+ * @param[in]  temp_c  air temperature (C)
+ */
+double aero_mach(double vel, double temp_c);
+
+/**
+ * @brief      Dynamic pressure from static pressure and Mach number
+ *
+ * @return     0.5*gamma*p*M^2 in Pa
+ */
+double aero_dynamic_pressure(double pressure_pa, double mach);
+
+/**
+ * @brief      Brake drag increment f at a deflection and Mach number
+ *
+ *             Both are clamped to the table.
+ *
+ * @param      c           cell cache, updated
+ * @param[in]  deflection  0 to 1
+ * @param[in]  mach        Mach number
+ */
+double aero_increment(aero_cursor_t* c, double deflection, double mach);
+
+/**
+ * @brief      Deflection that gives a drag increment at a Mach number
+ *
+ * @param      c          cell cache, updated
+ * @param[in]  increment  wanted f, saturates at 0 and at full brake
+ * @param[in]  mach       Mach number
+ *
+ * @return     deflection 0 to 1
+ */
+double aero_deflection(aero_cursor_t* c, double increment, double mach);
+
+/**
+ * @brief      Largest increment in the table, for sizing other tables
+ */
+double aero_max_increment(void);
+
+#endif // AERO_H
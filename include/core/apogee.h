@@ -0,0 +1,49 @@
+/**
+ * <apogee.h>
+ *
+ * @brief      Numerical apogee predictor with a per-tick time budget
+ *
+ * Integrates the remaining coast from the current altitude and climb rate
+ * with RK4 under gravity and quadratic drag,
+ *
+ *     dv/dt = -g - k*v*|v|,   k = apogee_drag_k*(1 + apogee_brake_drag_gain*b)
+ *
+ * where b is the airbrake deflection currently commanded (mean of sstate.m,
+ * 0 retracted to 1 fully out). k is scaled by the in-flight drag estimate,
+ * see drag_rls.h. Thrust is not modeled, so during the burn the prediction is
+ * the apogee if the motor cut out now.
+ *
+ * The integration stops once it has used apogee_budget_us in a tick and
+ * carries on from where it was on the next one. Until it reaches apogee the
+ * previous prediction stays published, so proj_ap is always from a finished
+ * integration, started at most a few ticks ago.
+ *
+ * With apogee_lut set the integration is done once at startup instead, for a
+ * grid of climb rates up to apogee_lut_v_max and drag coefficients (log
+ * spaced, covering every brake deflection and drag scale), and every tick is
+ * a bilinear interpolation in that table. With constant air density
+ * the rise left to apogee doesn't depend on the altitude, so the table only
+ * needs those two axes and the altitude is added on.
+ */
+
+#ifndef APOGEE_H
+#define APOGEE_H
+
+/**
+ * @brief      Reads the drag model and budget from settings.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int apogee_init(void);
+
+/**
+ * @brief      Advances the prediction within the budget, call once per tick.
+ *
+ * @param[in]  alt   current altitude (m)
+ * @param[in]  vel   current climb rate (m/s)
+ *
+ * @return     latest predicted apogee (m), same reference as alt
+ */
+double apogee_march(double alt, double vel);
+
+#endif // APOGEE_H
@@ -0,0 +1,65 @@
+/**
+ * <bmp_sampler.h>
+ *
+ * @brief      Barometer acquisition thread
+ *
+ * The BMP280 read is a blocking I2C transaction of a few hundred us, too long
+ * to sit inside __imu_isr. The sampler thread does the read instead and
+ * publishes timestamped samples through a mailbox (see mailbox.h), which is
+ * wait-free for both the producer (this thread) and the consumer
+ * (state_estimator.c).
+ *
+ * The ISR wakes the thread with bmp_sampler_trigger() right after it has
+ * finished, so the read happens while the I2C bus is idle between two IMU
+ * interrupts. In DMP mode librobotcontrol reads the IMU from its own thread
+ * and doesn't wait for us, so if it has claimed the bus the read is skipped
+ * and done on the next trigger instead.
+ */
+
+#ifndef BMP_SAMPLER_H
+#define BMP_SAMPLER_H
+
+#include <stdint.h>
+#include <rc/bmp.h>
+
+/**
+ * One barometer reading and when it was taken
+ */
+typedef struct bmp_sample_t {
+	rc_bmp_data_t data;
+	uint64_t timestamp_ns;	///< hal_nanos_since_boot() when the read finished
+	uint64_t seq;		///< increments with every published sample
+} bmp_sample_t;
+
+/**
+ * @brief      Takes the first reading synchronously and starts the thread.
+ *
+ *             hal_bmp_init() must have been called before.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int bmp_sampler_init(void);
+
+/**
+ * @brief      Asks for a new reading. Never blocks, safe to call from the ISR.
+ */
+void bmp_sampler_trigger(void);
+
+/**
+ * @brief      Gets the newest published sample without blocking.
+ *
+ * @param[out] sample  newest sample, filled in even if it was seen before
+ *
+ * @return     1 if the sample is new since the last call, 0 if not, -1 on
+ *             failure
+ */
+int bmp_sampler_get_latest(bmp_sample_t* sample);
+
+/**
+ * @brief      Stops the thread.
+ *
+ * @return     0 on clean exit, -1 on exit time out/force close
+ */
+int bmp_sampler_cleanup(void);
+
+#endif // BMP_SAMPLER_H
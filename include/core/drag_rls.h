@@ -0,0 +1,76 @@
+/**
+ * <drag_rls.h>
+ *
+ * @brief      Recursive least squares estimate of the vehicle drag in flight
+ *
+ * During the coast the only forces along the flight path are gravity and
+ * drag, so the measured deceleration gives the drag directly:
+ *
+ *     -(a + g) = c * k(b) * v*|v|
+ *
+ * where k(b) is the drag model from the settings (apogee_drag_k and the brake
+ * increment at deflection b and the current Mach number, see aero.h) and c is an
+ * unknown scale on it, the ratio of the real ballistic coefficient to the
+ * assumed one. c is estimated with scalar RLS and exponential forgetting.
+ * Only one parameter is estimated because the brakes mostly move together
+ * with the speed, which leaves clean drag and brake gain poorly separable in
+ * a single flight.
+ *
+ * Updates run during UNPOWERED_ASCENT above DRAG_RLS_MIN_VEL. Every update
+ * is a few multiply-adds on static state. Once DRAG_RLS_MIN_S worth of
+ * updates went in, drag_rls_get_scale() returns the estimate, before that 1.
+ */
+
+#ifndef DRAG_RLS_H
+#define DRAG_RLS_H
+
+/**
+ * @brief      Resets the estimate to the settings drag model.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int drag_rls_init(void);
+
+/**
+ * @brief      One RLS update, call every tick after the altitude filter.
+ *
+ *             Does nothing outside UNPOWERED_ASCENT or below
+ *             DRAG_RLS_MIN_VEL. Fills the drag_* fields of state_estimate.
+ *
+ * @param[in]  vel         climb rate (m/s)
+ * @param[in]  accel       vertical acceleration (m/s^2)
+ * @param[in]  deflection  brake deflection commanded, 0 to 1
+ */
+void drag_rls_march(double vel, double accel, double deflection);
+
+/**
+ * @brief      Scale to apply to the settings drag model.
+ *
+ * @return     estimated scale once converged, 1 before
+ */
+double drag_rls_get_scale(void);
+
+/**
+ * @brief      Mean airbrake deflection commanded on the servos, sstate.m
+ *             taken back through the thrust map
+ *
+ * @return     0 retracted to 1 fully out
+ */
+double drag_brake_deflection(void);
+
+/**
+ * @brief      Settings drag model at a brake deflection and the current Mach
+ *             number, without the scale
+ *
+ * @return     k in 1/m
+ */
+double drag_model_k(double deflection);
+
+/**
+ * @brief      Largest k of the settings drag model at any Mach number
+ *
+ * @return     k in 1/m
+ */
+double drag_model_k_max(void);
+
+#endif // DRAG_RLS_H
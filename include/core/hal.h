@@ -0,0 +1,192 @@
+/**
+ * <hal.h>
+ *
+ * @brief      Hardware abstraction layer between the flight code and the board.
+ *
+ * Everything in the flight code that touches the BeagleBone hardware (IMU,
+ * barometer, ADC, servo rail, LEDs, buttons, encoders) or reads the clock goes
+ * through the functions below instead of calling librobotcontrol directly.
+ *
+ * There are two backends, selected at compile time:
+ * - hal_rc.c  forwards every call to librobotcontrol. This is the flight build.
+ * - hal_sim.c is a pure software model of the rocket on the pad and in flight.
+ *             It is compiled in instead when OFFBOARD_TEST is defined (see
+ *             "make sim"), so the whole __imu_isr chain can run on a desktop
+ *             Linux machine. The simulated clock is advanced by the simulated
+ *             IMU interrupt and can run faster than real time.
+ *
+ * Only hardware and time live here. The math part of librobotcontrol
+ * (filters, kalman, quaternions) is plain software and is used directly.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h> // for uint64_t
+#include <pthread.h>
+
+#include <rc/mpu.h>
+#include <rc/bmp.h>
+#include <rc/led.h>
+#include <rc/cpu.h>
+
+/** @name time */
+///@{
+/**
+ * @brief      Monotonic time, use this instead of rc_nanos_since_boot()
+ *
+ * @return     nanoseconds since boot (or since simulation start)
+ */
+uint64_t hal_nanos_since_boot(void);
+
+/**
+ * @brief      Sleep for some time, use this instead of rc_usleep() in threads.
+ *
+ * With the software backend the sleep is scaled by the simulation time scale.
+ *
+ * @param[in]  us    time to sleep in microseconds
+ */
+void hal_usleep(unsigned int us);
+///@}
+
+/** @name process and system */
+///@{
+int hal_kill_existing_process(float timeout_s);
+int hal_make_pid_file(void);
+int hal_cpu_set_governor(rc_governor_t gov);
+
+/**
+ * @brief      Starts a thread, use this instead of rc_pthread_create()
+ *
+ * The software backend falls back to SCHED_OTHER when it is not allowed to
+ * use a real-time policy, so the simulation does not need root.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int hal_pthread_create(pthread_t* thread, void* (*func)(void*), void* arg,
+	int policy, int priority);
+///@}
+
+/** @name LEDs and buttons */
+///@{
+int hal_led_set(rc_led_t led, int value);
+int hal_led_blink(rc_led_t led, float hz, float duration);
+int hal_button_init(int chip, int pin, char polarity, int debounce_us);
+int hal_button_set_callbacks(int chip, int pin, void (*press_func)(void),
+	void (*release_func)(void));
+int hal_button_get_state(int chip, int pin);
+///@}
+
+/** @name ADC */
+///@{
+int hal_adc_init(void);
+double hal_adc_batt(void);
+double hal_adc_dc_jack(void);
+///@}
+
+/** @name barometer */
+///@{
+int hal_bmp_init(rc_bmp_oversample_t oversample, rc_bmp_filter_t filter);
+
+/**
+ * @brief      Reads the barometer.
+ *
+ * In DMP mode the IMU is read by librobotcontrol's own thread on the same
+ * bus. If that holds the bus the read is skipped rather than run over it.
+ *
+ * @return     0 on success, 1 if the bus was busy and nothing was read, -1 on
+ *             failure
+ */
+int hal_bmp_read(rc_bmp_data_t* data);
+///@}
+
+/**
+ * One raw accel and gyro sample out of the MPU FIFO, in the sensor frame and
+ * the same units as rc_mpu_data_t
+ */
+typedef struct hal_imu_raw_t {
+	double accel[3];	///< m/s^2
+	double gyro[3];		///< deg/s
+} hal_imu_raw_t;
+
+/** @name IMU */
+///@{
+int hal_mpu_is_gyro_calibrated(void);
+int hal_mpu_is_accel_calibrated(void);
+int hal_mpu_is_mag_calibrated(void);
+int hal_mpu_initialize_dmp(rc_mpu_data_t* data, rc_mpu_config_t conf);
+int hal_mpu_set_dmp_callback(void (*func)(void));
+
+/**
+ * @brief      Starts the IMU in raw mode instead of DMP mode.
+ *
+ * Accel and gyro are sampled at sample_rate into the MPU FIFO. The callback
+ * set with hal_mpu_set_fifo_callback() is called from a SCHED_FIFO thread at
+ * conf.dmp_interrupt_priority every time about batch samples are waiting,
+ * and should empty the FIFO with hal_mpu_read_fifo().
+ *
+ * @param      data         gets the scale factors, as with DMP mode
+ * @param[in]  conf         same config as for DMP mode
+ * @param[in]  sample_rate  FIFO rate, 1000 divided by an integer
+ * @param[in]  batch        samples per callback
+ *
+ * @return     0 on success, -1 on failure
+ */
+int hal_mpu_initialize_fifo(rc_mpu_data_t* data, rc_mpu_config_t conf,
+	int sample_rate, int batch);
+int hal_mpu_set_fifo_callback(void (*func)(void));
+
+/**
+ * @brief      Burst reads the samples waiting in the MPU FIFO, oldest first.
+ *
+ * @param[out] buf   samples
+ * @param[in]  max   size of buf, the rest stays in the FIFO
+ *
+ * @return     number of samples read, -1 on failure. If the FIFO had
+ *             overflowed it is reset and 0 is returned.
+ */
+int hal_mpu_read_fifo(hal_imu_raw_t* buf, int max);
+
+/**
+ * @brief      Stops the IMU, in DMP or raw mode.
+ */
+int hal_mpu_power_off(void);
+///@}
+
+/** @name servos */
+///@{
+int hal_servo_init(void);
+void hal_servo_cleanup(void);
+int hal_servo_power_rail_en(int en);
+int hal_servo_send_pulse_us(int ch, int us);
+
+/**
+ * @brief      Sends a pulse width to each of the first n servo channels in
+ *             one go, us[0] to channel 1 and so on.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int hal_servo_send_pulses_us(const int* us, int n);
+///@}
+
+/** @name encoders */
+///@{
+int hal_encoder_init(void);
+int hal_encoder_cleanup(void);
+int hal_encoder_read(int ch);
+///@}
+
+#ifdef OFFBOARD_TEST
+/**
+ * @brief      Ground truth of the simulated vehicle, only in the software
+ *             backend. Handy for checking the estimators off-board.
+ *
+ * @param[out] alt_m   true altitude above the pad (m)
+ * @param[out] vel_ms  true vertical velocity (m/s)
+ *
+ * @return     0 on success, -1 if the simulation is not running
+ */
+int hal_sim_get_truth(double* alt_m, double* vel_ms);
+#endif
+
+#endif // HAL_H
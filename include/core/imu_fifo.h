@@ -0,0 +1,97 @@
+/**
+ * <imu_fifo.h>
+ *
+ * @brief      Raw IMU acquisition through the MPU FIFO
+ *
+ * Alternative to DMP mode, selected with settings.imu_fifo. The MPU samples
+ * accel and gyro into its FIFO at settings.imu_fifo_hz (up to 1 kHz) and the
+ * FIFO is burst read once per control tick, so __imu_isr is no longer tied to
+ * the 200 Hz the DMP can do.
+ *
+ * Every batch is:
+ * - timestamped per sample (the newest sample is taken as "now") and kept in
+ *   a ring of IMU_RAW_RING samples that other threads read at full rate with
+ *   imu_fifo_read(), e.g. the logger
+ * - scanned for the largest vertical acceleration, see
+ *   imu_fifo_take_accel_peak(), for the event detection
+ * - run through the Mahony attitude filter at full rate (see mahony.h)
+ * - averaged down to one sample (a boxcar over the batch, which is also the
+ *   anti-alias filter for the control rate) and written to the accel and gyro
+ *   of the rc_mpu_data_t, so the rest of the estimator does not change.
+ *
+ * There is no DMP in this mode. The filter quaternion goes into dmp_quat and
+ * dmp_TaitBryan instead. The magnetometer is not read.
+ */
+
+#ifndef IMU_FIFO_H
+#define IMU_FIFO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <rc/mpu.h>
+
+#define IMU_RAW_RING		1024	///< full-rate samples kept, power of two
+#define IMU_FIFO_BATCH_MAX	20	///< most samples per control tick
+
+/**
+ * One full-rate sample, sensor frame, units as in rc_mpu_data_t
+ */
+typedef struct imu_raw_sample_t {
+	uint64_t seq;		///< increments with every sample
+	uint64_t timestamp_ns;	///< hal_nanos_since_boot()
+	double accel[3];	///< m/s^2
+	double gyro[3];		///< deg/s
+} imu_raw_sample_t;
+
+/**
+ * @brief      Starts the MPU in raw FIFO mode at settings.imu_fifo_hz with one
+ *             batch per settings.feedback_hz tick.
+ *
+ *             The FIFO is drained and the attitude integrated right away, the
+ *             callback is only called once it is set.
+ *
+ * @param      data  filled in every tick, like in DMP mode
+ * @param[in]  conf  MPU config
+ *
+ * @return     0 on success, -1 on failure
+ */
+int imu_fifo_init(rc_mpu_data_t* data, rc_mpu_config_t conf);
+
+/**
+ * @brief      Sets the function called after every batch, __imu_isr.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int imu_fifo_set_callback(void (*func)(void));
+
+/**
+ * @brief      Copies the full-rate samples since the last call.
+ *
+ *             Any thread can read, each with its own cursor starting at 0.
+ *             Samples that were overwritten before the reader got to them are
+ *             skipped, the gap shows in seq.
+ *
+ * @param      cursor  seq of the next sample to read, moved forward
+ * @param[out] out     samples, oldest first
+ * @param[in]  max     size of out
+ *
+ * @return     number of samples copied, 0 if none or not in FIFO mode
+ */
+int imu_fifo_read(uint64_t* cursor, imu_raw_sample_t* out, int max);
+
+/**
+ * @brief      Largest |specific force - 1 g| seen at full rate since the last
+ *             call, for the ignition detection. Only call from __imu_isr.
+ *
+ * @return     m/s^2, 0 when not in FIFO mode
+ */
+double imu_fifo_take_accel_peak(void);
+
+/**
+ * @brief      Prints sample, short batch and read error counts.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int imu_fifo_print(FILE* fd);
+
+#endif // IMU_FIFO_H
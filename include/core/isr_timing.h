@@ -0,0 +1,155 @@
+/**
+ * <isr_timing.h>
+ *
+ * @brief      Latency histograms for the stages of __imu_isr
+ *
+ * Every stage of the IMU interrupt is timed and dropped into its own
+ * log-linear histogram (HDR style: 32 linear sub-buckets per power of two, so
+ * about 3% resolution from 1 ns up to ~4 s). The ISR is the only writer and
+ * only does relaxed atomic increments, so any other thread can read the
+ * histograms at any time without locking and without stalling the ISR.
+ *
+ * Besides the stages there is the whole tick, the tick-to-tick period and the
+ * jitter (absolute deviation of the period from the nominal one).
+ *
+ * The stage times always use the real monotonic clock, not
+ * hal_nanos_since_boot(), because the simulated clock does not move inside a
+ * tick. In the simulation the period and jitter are therefore only meaningful
+ * with sim_time_scale = 1.
+ */
+
+#ifndef ISR_TIMING_H
+#define ISR_TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Stages of __imu_isr in the order they run, followed by the derived
+ * per-tick numbers. Stages in low-rate groups (see scheduler.h) only get a
+ * sample on the ticks they run.
+ */
+typedef enum isr_stage_t {
+	ISR_STAGE_SETPOINT,		///< setpoint_manager_update
+	ISR_STAGE_BATTERY,		///< state_estimator_batt_march
+	ISR_STAGE_STATE_EST,		///< state_estimator_march
+	ISR_STAGE_XBEE,			///< XBEE_getData
+	ISR_STAGE_SERIAL,		///< serial_getData
+	ISR_STAGE_SERIAL_TX,		///< send_serial_data
+	ISR_STAGE_FEEDBACK,		///< feedback_march
+	ISR_STAGE_ENCODERS,		///< encoder reads
+	ISR_STAGE_LOG,			///< log_manager_add_new
+	ISR_STAGE_JOBS_AFTER,		///< state_estimator_jobs_after_feedback
+	ISR_STAGE_TOTAL,		///< whole __imu_isr
+	ISR_STAGE_PERIOD,		///< start to start of consecutive ticks
+	ISR_STAGE_JITTER,		///< |period - nominal period|
+	ISR_STAGE_OUTPUT,		///< tick start to the servo pulses being committed
+	ISR_NUM_STAGES
+} isr_stage_t;
+
+#define ISR_TIMING_BUCKETS	896	///< buckets of one histogram, see isr_timing_get_stats()
+
+/**
+ * Summary of one histogram, all times in microseconds
+ */
+typedef struct isr_timing_stats_t {
+	uint64_t count;		///< number of samples
+	double mean_us;
+	double p50_us;
+	double p99_us;
+	double p999_us;
+	double max_us;
+} isr_timing_stats_t;
+
+/**
+ * @brief      Clears all histograms, call before the ISR is started.
+ *
+ * @param[in]  nominal_period_ns  expected tick period, used for the jitter
+ *
+ * @return     0 on success, -1 on failure
+ */
+int isr_timing_init(uint64_t nominal_period_ns);
+
+/**
+ * @brief      Call first thing in the ISR. Records period and jitter.
+ *
+ * @return     timestamp to pass to isr_timing_stage() and isr_timing_tick_end()
+ */
+uint64_t isr_timing_tick_start(void);
+
+/**
+ * @brief      Records the time since *t into the histogram of a stage and
+ *             moves *t forward to now, so stages can be chained.
+ *
+ * @param[in]     stage  stage that just finished
+ * @param[in,out] t      timestamp of the end of the previous stage
+ */
+void isr_timing_stage(isr_stage_t stage, uint64_t* t);
+
+/**
+ * @brief      Call last thing in the ISR. Records the total time of the tick.
+ *
+ * @param[in]  t_start  value returned by isr_timing_tick_start()
+ */
+void isr_timing_tick_end(uint64_t t_start);
+
+/**
+ * @brief      Call right after the actuator outputs were committed. Records
+ *             the time since the start of the tick as the output latency.
+ *
+ * @return     timestamp of the commit, same clock as the stage times
+ */
+uint64_t isr_timing_output_committed(void);
+
+/**
+ * @brief      Time spent in a stage during the most recent tick
+ *
+ * @return     time in microseconds
+ */
+double isr_timing_last_us(isr_stage_t stage);
+
+/**
+ * @brief      Percentiles and max of one stage since isr_timing_init()
+ *
+ *             The histogram is copied into snap first so the percentiles
+ *             agree with the count while the ISR keeps adding samples. Each
+ *             caller passes its own, so any number of threads can read at
+ *             once.
+ *
+ * @param[in]  stage  stage to summarize
+ * @param[out] stats  summary
+ * @param      snap   scratch space for the copy of the histogram
+ *
+ * @return     0 on success, -1 on failure
+ */
+int isr_timing_get_stats(isr_stage_t stage, isr_timing_stats_t* stats, uint32_t snap[ISR_TIMING_BUCKETS]);
+
+/**
+ * @brief      Human readable name of a stage
+ */
+const char* isr_timing_stage_name(isr_stage_t stage);
+
+/**
+ * @brief      Prints a table with mean/p50/p99/p99.9/max of every stage and
+ *             the share of the loop period used by the ISR.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int isr_timing_print(FILE* fd);
+
+/**
+ * @brief      Asks for a report to be printed, safe to call from a signal
+ *             handler (main() hooks this to SIGUSR1).
+ */
+void isr_timing_request_report(void);
+
+/**
+ * @brief      Prints the report to stdout if one was requested.
+ *
+ *             Called periodically from a non real-time thread.
+ *
+ * @return     1 if a report was printed, 0 if none was requested
+ */
+int isr_timing_service_report(void);
+
+#endif // ISR_TIMING_H
@@ -9,6 +9,9 @@
 #ifndef LOG_MANAGER_H
 #define LOG_MANAGER_H
 
+#include <isr_timing.h>
+#include <mix.h>
+
 
 /**
  * Struct containing all possible values that could be writen to the log. For
@@ -73,6 +76,13 @@ typedef struct log_entry_t{
 
 	///@}
 
+	/** @name drag estimate */
+	///@{
+	double	drag_scale;
+	double	drag_scale_var;
+	double	drag_resid;
+	///@}
+
 	/** @name setpoint */
 	///@{
 	double	sp_roll;
@@ -97,28 +107,19 @@ typedef struct log_entry_t{
 	double	u_Z;
 	///@}
 
-	/** @name motor commmand signals */
+	/** @name motor commmand signals, settings.num_rotors of them */
 	///@{
-	double	mot_1;
-	double	mot_2;
-	double	mot_3;
-	double	mot_4;
-	double	mot_5;
-	double	mot_6;
-	double	mot_7;
-	double	mot_8;
+	double	mot[MAX_ROTORS];
 	///@}
-    
-	/** @name motor pwm sigmals */
+
+	/** @name motor pwm sigmals, settings.num_rotors of them */
 	///@{
-    double mot_1_us;
-    double mot_2_us;
-    double mot_3_us;
-    double mot_4_us;
-    double mot_5_us;
-    double mot_6_us;
-    double mot_7_us;
-    double mot_8_us;
+	double	mot_us[MAX_ROTORS];
+	///@}
+
+	/** @name __imu_isr timing, latest sample of each stage in us */
+	///@{
+	double isr_us[ISR_NUM_STAGES];
 	///@}
 
 } log_entry_t;
@@ -146,6 +147,9 @@ int log_manager_add_new();
 /**
  * @brief      Finish writing remaining data to log and close thread.
  *
+ *             With log_isr_timing enabled this also writes the isr timing
+ *             percentiles next to the log as <n>_isr_timing.txt
+ *
  *             Used in log_manager.c
  *
  * @return     0 on sucess and clean exit, -1 on exit timeout/force close.
@@ -14,9 +14,26 @@
 #ifndef MIXING_MATRIX_H
 #define MIXING_MATRIX_H
 
+#include <stdio.h>
+#include <stdint.h>
+
 #define MAX_INPUTS 6	///< up to 6 control inputs (roll,pitch,yaw,x, y, z)
 #define MAX_ROTORS 8	///< up to 8 rotors
 
+#define MIX_ALLOC_ERR_TOL	1.0e-3	///< summed |achieved - demand| that counts as unmet
+
+/**
+ * Timing and outcome of mix_allocate() since mix_init()
+ */
+typedef struct mix_alloc_stats_t {
+	uint64_t count;				///< calls
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint64_t unmet;				///< calls that could not meet the demand
+	uint64_t iter_hist[MAX_ROTORS + 1];	///< calls by number of solver passes
+	double last_err;			///< summed |achieved - demand| of the last call
+} mix_alloc_stats_t;
+
 /**
  * @brief enum for possible mixing matrices defined here
  *
@@ -25,6 +42,7 @@
 typedef enum rotor_layout_t{
 	LAYOUT_4X,
 	LAYOUT_4PLUS,
+	LAYOUT_CUSTOM,	///< matrix from the settings file, see mix_init_matrix()
 } rotor_layout_t;
 
 /**
@@ -44,6 +62,24 @@ typedef enum rotor_layout_t{
  */
 int mix_init(rotor_layout_t layout);
 
+/**
+ * @brief      Sets up mixing with any matrix of up to MAX_ROTORS rows.
+ *
+ *             Row i holds the contribution of X Y Z roll pitch yaw to rotor
+ *             i. The matrix is copied. For every channel the rotors it moves
+ *             are listed with the reciprocals of their coefficients, so
+ *             mix_check_saturation() and mix_add_input() only touch those
+ *             rotors and never divide. mix_init() calls this for the built in
+ *             layouts.
+ *
+ * @param[in]  num_rotors  number of rows, 1 to MAX_ROTORS
+ * @param[in]  num_dof     4 to use Z through yaw only, 6 for all channels
+ * @param[in]  matrix      num_rotors x MAX_INPUTS mixing matrix
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mix_init_matrix(int num_rotors, int num_dof, double matrix[][MAX_INPUTS]);
+
 /**
  * @brief      Fills the vector mot with the linear combination of XYZ, roll
  *             pitch yaw. Not actually used, only for testing.
@@ -102,4 +138,41 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max);
 int mix_add_input(double u, int ch, double* mot);
 
 
-#endif // MIXING_MATRIX_H
\ No newline at end of file
+/**
+ * @brief      Solves for all motor outputs at once given the virtual inputs.
+ *
+ *             Finds motor signals in [0,1] whose virtual effect matches u on
+ *             the channels in mask as closely as possible, by redistributed
+ *             pseudo-inverse: the least squares solution over the free motors
+ *             is computed, motors out of range are clamped to their limit and
+ *             the rest of the demand is solved for again with the remaining
+ *             motors. This takes at most one pass per motor. Channels not in
+ *             mask are not constrained and end up wherever the solution puts
+ *             them. Works for any rotors/dof, channels the layout can't move
+ *             are ignored.
+ *
+ * @param[in]  u         MAX_INPUTS virtual inputs, indexed by VEC_*
+ * @param[in]  mask      bit (1<<VEC_*) set for every channel to allocate
+ * @param[out] mot       motor signals, one per rotor
+ * @param[out] achieved  MAX_INPUTS virtual inputs the motors actually give,
+ *                       can be NULL
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mix_allocate(const double* u, int mask, double* mot, double* achieved);
+
+/**
+ * @brief      Copies the allocator timing and outcome stats.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mix_alloc_get_stats(mix_alloc_stats_t* stats);
+
+/**
+ * @brief      Prints the allocator stats.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mix_alloc_print(FILE* fd);
+
+#endif // MIXING_MATRIX_H
@@ -16,12 +16,13 @@ typedef enum arm_state_t {
 	ARMED
 } arm_state_t;
 
-// Speed of feedback loop
-#define FEEDBACK_HZ		200
-#define DT			0.005
+// Speed of feedback loop is settings.feedback_hz, settings.dt = 1/feedback_hz.
+// The estimator noise parameters were tuned at TUNED_DT and get scaled from it.
+#define TUNED_DT		0.005
+#define DMP_MAX_HZ		200	// highest rate the MPU DMP can run at
+#define IMU_FIFO_MAX_HZ		1000	// MPU sample clock in raw FIFO mode
 
 //IMU Parameters
-#define IMU_PRIORITY    51
 #define I2C_BUS 2
 #define GPIO_INT_PIN_CHIP 3
 #define GPIO_INT_PIN_PIN  21
@@ -46,7 +47,16 @@ typedef enum arm_state_t {
 #define YAW_DEADZONE		0.02
 #define SOFT_START_SECONDS	1.0	// controller soft start seconds
 #define ALT_CUTOFF_FREQ		2.0
-#define BMP_RATE_DIV		10	// optionally sample bmp less frequently than mpu
+#define BMP_SAMPLE_HZ		20	// sample bmp less frequently than mpu
+#define BATT_SAMPLE_HZ		10	// battery ADC rate group
+#define BATT_LP_WINDOW_S	0.2	// battery moving average window
+#define ACC_LP_TC_S		0.1	// vertical accel lowpass time constant
+#define BMP_STALE_S		0.5	// ignore barometer samples older than this
+#define DRAG_RLS_MIN_VEL	20.0	// m/s, too little drag to learn from below
+#define DRAG_RLS_MIN_S		0.5	// updates before the drag estimate is used
+#define DRAG_RLS_P0		1.0	// initial variance of the drag scale
+#define DRAG_RLS_SCALE_MIN	0.5	// limits of the drag scale, the apogee
+#define DRAG_RLS_SCALE_MAX	2.0	// table covers this range
 
 // controller absolute limits
 #define MAX_ROLL_COMPONENT	1.0
@@ -58,7 +68,11 @@ typedef enum arm_state_t {
 
  // Files
 //#define LOG_DIR		"/home/debian/rcs_logs/"
+#ifdef OFFBOARD_TEST
+#define LOG_DIR		"rcs_logs/"	// simulation writes next to the binary
+#else
 #define LOG_DIR		"/mnt/SD/rcs_logs/"
+#endif
 
 // terminal emulator control sequences
 #define WRAP_DISABLE	"\033[?7l"
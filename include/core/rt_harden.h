@@ -0,0 +1,54 @@
+/**
+ * <rt_harden.h>
+ *
+ * @brief      Real-time hardening: memory locking, prefaulting and CPU pinning
+ *
+ * With settings.rt_harden set, rt_harden_init() locks all current and future
+ * memory (mlockall), stops malloc from giving memory back to the kernel or
+ * using mmap, and touches a heap reserve and the main stack once so later
+ * allocations and calls during flight don't page fault. Every thread then
+ * calls rt_harden_thread() first thing to prefault its own stack and pin
+ * itself to settings.rt_cpu or settings.non_rt_cpu.
+ *
+ * Minor and major page faults of the process are counted from arming to
+ * disarming no matter whether hardening is on, so the effect can be measured
+ * on the ground.
+ */
+
+#ifndef RT_HARDEN_H
+#define RT_HARDEN_H
+
+#include <stdio.h>
+
+/**
+ * @brief      Locks and prefaults memory and pins the calling (main) thread.
+ *
+ *             Call right after loading the settings, before any thread is
+ *             started, so all thread stacks are locked when created.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int rt_harden_init(void);
+
+/**
+ * @brief      Prefaults the stack of the calling thread and pins it.
+ *
+ * @param[in]  realtime  1 to pin to settings.rt_cpu, 0 for settings.non_rt_cpu
+ */
+void rt_harden_thread(int realtime);
+
+/**
+ * @brief      Watches the arm state and counts page faults while armed.
+ *
+ *             Called periodically from the main thread, never from the ISR.
+ */
+void rt_harden_service(void);
+
+/**
+ * @brief      Prints the page faults of the last armed period.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int rt_harden_print(FILE* fd);
+
+#endif // RT_HARDEN_H
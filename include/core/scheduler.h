@@ -0,0 +1,118 @@
+/**
+ * <scheduler.h>
+ *
+ * @brief      Multi-rate cyclic scheduler run from __imu_isr
+ *
+ * Jobs are grouped by rate. Each group runs every "divisor" IMU ticks, where
+ * the divisor is the loop rate over the group rate, and at a fixed phase
+ * inside that period so heavy low-rate groups can be kept off the same tick.
+ * Tasks run in table order, so the data flow of the loop stays the same as
+ * before regardless of which groups are due.
+ *
+ * Every task is timed into its isr_timing stage. A group overruns when its
+ * tasks take longer than its share of the loop period, and a tick overruns
+ * (a deadline miss) when all of it takes longer than the period.
+ *
+ * Load shedding: the scheduler keeps a decaying peak of the cost of every
+ * task. Before a non-critical task runs it checks whether that task plus the
+ * more important tasks still due this tick fit in the tick budget. If not, the
+ * task is shed: dropped, or deferred to the next tick if it is marked so.
+ * The estimate keeps decaying while a task is shed, and a task shed on too
+ * many due ticks in a row runs anyway, so one slow run can't starve it.
+ * Critical tasks (the control chain) always run, so lower priority work is
+ * what gives way when a tick runs long.
+ *
+ * Deadline misses, sheds, deferrals and ticks where even the critical tasks
+ * finished past the budget are counted per flight phase and printed by
+ * sched_print().
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <isr_timing.h>
+#include <setpoint_manager.h>
+
+#define SCHED_MAX_GROUPS	16
+#define SCHED_MAX_TASKS		32
+#define SCHED_NUM_PHASES	(TEST + 1)	// one per flight_status_t
+
+/**
+ * Shedding priority of a task, lower values are shed last
+ */
+typedef enum sched_prio_t {
+	SCHED_CRITICAL,		///< control chain, never shed
+	SCHED_HIGH,		///< shed only if the critical tasks need the time
+	SCHED_LOW		///< shed first
+} sched_prio_t;
+
+/**
+ * A rate group
+ */
+typedef struct sched_group_t {
+	const char* name;
+	double hz;		///< wanted rate, 0 disables the group
+	int phase;		///< tick inside the divisor period the group runs on
+	double budget;		///< share of the loop period the group may use (0-1)
+} sched_group_t;
+
+/**
+ * A job inside a rate group
+ */
+typedef struct sched_task_t {
+	int group;		///< index into the group table
+	isr_stage_t stage;	///< isr_timing histogram for this task
+	int (*func)(void);	///< the job, return value is ignored
+	int enabled;		///< 0 to skip the task entirely
+	sched_prio_t prio;	///< shedding priority
+	int defer;		///< 1 to run on the next tick when shed, 0 to drop
+} sched_task_t;
+
+/**
+ * @brief      Sets up the schedule. Tables are copied.
+ *
+ * @param[in]  base_hz     IMU interrupt rate
+ * @param[in]  budget      share of the loop period the whole tick may use
+ *                         before non-critical tasks are shed (0-1)
+ * @param[in]  groups      rate groups
+ * @param[in]  num_groups  number of groups
+ * @param[in]  tasks       tasks in the order they run inside a tick
+ * @param[in]  num_tasks   number of tasks
+ *
+ * @return     0 on success, -1 on failure
+ */
+int sched_init(int base_hz, double budget, const sched_group_t* groups, int num_groups,
+	const sched_task_t* tasks, int num_tasks);
+
+/**
+ * @brief      Runs all tasks whose group is due this tick, and those deferred
+ *             from the last tick, shedding as needed. Call from the ISR.
+ *
+ *             Counters go to the current flight_status.
+ *
+ * @param[in]  t_start  value returned by isr_timing_tick_start()
+ */
+void sched_run_tick(uint64_t t_start);
+
+/**
+ * @brief      Ticks between two runs of a group that wants to run at hz
+ *
+ *             Modules that discretize something for a group use this to get
+ *             the dt they will actually be called at.
+ *
+ * @return     divisor, at least 1
+ */
+int sched_divisor(int base_hz, double hz);
+
+/**
+ * @brief      Prints the schedule with run, overrun and shed counters, and the
+ *             deadline misses per flight phase.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int sched_print(FILE* fd);
+
+#endif // SCHEDULER_H
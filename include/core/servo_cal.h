@@ -0,0 +1,104 @@
+/**
+ * <servo_cal.h>
+ *
+ * @brief      Per-servo calibration curves from position to pulse width
+ *
+ * A curve is a list of [position, pulse_us] points, position going from 0.0
+ * (brake in) to 1.0 (brake out), drawn either as straight lines between the
+ * points or as a monotone cubic (Fritsch-Carlson) through them. The cubic
+ * never overshoots between points, so it can't command a pulse outside the
+ * measured range.
+ *
+ * In the settings file "servo_calibration" is "DEFAULT" for the table built
+ * into servos.c, or one entry per servo channel:
+ *
+ *     { "curve": "LINEAR" or "SPLINE",
+ *       "nominal_us": safe pulse width,
+ *       "points": [[0.0, us], ..., [1.0, us]] }
+ *
+ * At init every curve is compiled into SERVO_CAL_GRID equal cells of position
+ * holding a line each, the same form as the thrust map, so a lookup is one
+ * index and one multiply-add whatever the curve.
+ *
+ * servo_cal_capture() drives a servo through its range and asks for the
+ * measured position at every step, then prints the entry for the settings
+ * file. main() runs it with -c.
+ */
+
+#ifndef SERVO_CAL_H
+#define SERVO_CAL_H
+
+#include <stdio.h>
+
+#define SERVO_CAL_MAX_POINTS	16	///< points a curve can have
+#define SERVO_CAL_GRID		256	///< cells of the uniform lookup grid
+#define SERVO_CAL_MIN_US	500.0	///< widest pulse range the servo rail takes
+#define SERVO_CAL_MAX_US	2500.0
+#define SERVO_CAL_CAPTURE_STEPS	11	///< points servo_cal_capture() records
+
+typedef enum servo_curve_t {
+	SERVO_CURVE_LINEAR,	///< straight lines between the points
+	SERVO_CURVE_SPLINE	///< monotone cubic through the points
+} servo_curve_t;
+
+/**
+ * Calibration of one servo as given in the settings file
+ */
+typedef struct servo_cal_t {
+	servo_curve_t curve;
+	int points;
+	double nominal_us;			///< safe position when armed/disarmed
+	double pos[SERVO_CAL_MAX_POINTS];	///< 0.0 to 1.0, increasing
+	double us[SERVO_CAL_MAX_POINTS];	///< pulse width at each position
+} servo_cal_t;
+
+/**
+ * Compiled curve, see servo_cal_map()
+ */
+typedef struct servo_lut_t {
+	double a[SERVO_CAL_GRID + 1];	///< the extra cell catches 1.0
+	double b[SERVO_CAL_GRID + 1];
+	double min_us;			///< pulse width at position 0.0
+	double nominal_us;
+	double max_us;			///< pulse width at position 1.0
+} servo_lut_t;
+
+/**
+ * @brief      Checks a calibration and compiles it into a lookup table.
+ *
+ *             Positions have to start at 0.0, end at 1.0 and increase, pulse
+ *             widths have to stay within SERVO_CAL_MIN_US to SERVO_CAL_MAX_US
+ *             and strictly increase or decrease, and the nominal width has
+ *             to be inside the range of the curve.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int servo_cal_compile(const servo_cal_t* cal, servo_lut_t* lut);
+
+/**
+ * @brief      Pulse width for a position, clamped to 0.0 to 1.0
+ */
+double servo_cal_map(const servo_lut_t* lut, double pos);
+
+/**
+ * @brief      Records a calibration for one servo.
+ *
+ *             Powers the servo rail and steps the servo through
+ *             SERVO_CAL_CAPTURE_STEPS equal pulse widths from min_us to
+ *             max_us. At each step the measured position is read from stdin
+ *             in any unit (degrees, mm); the first and last step become 0.0
+ *             and 1.0. The servo goes back to nominal_us and the rail is
+ *             turned off before the entry for the settings file is written
+ *             to out.
+ *
+ * @param[in]  ch          servo channel, 1 to 8
+ * @param[in]  min_us      pulse width of the brake in position
+ * @param[in]  nominal_us  safe pulse width
+ * @param[in]  max_us      pulse width of the brake out position
+ * @param      out         where the entry goes
+ *
+ * @return     0 on success, -1 on failure
+ */
+int servo_cal_capture(int ch, double min_us, double nominal_us, double max_us, FILE* out);
+
+#endif // SERVO_CAL_H
@@ -5,8 +5,9 @@
  *
  * This is how the actuator command should be apllied to servos.
  * After initializing and arming was sucesfull, the feedback should call
- * servos_march to apply all of the servo signals using sstate.m[8] to 
- * active servos in sstate.ch[8]
+ * servos_march once per tick with the signals of all active servos. They are
+ * mapped to pulse widths together and committed to the servo rail in one
+ * batch, see hal_servo_send_pulses_us().
  * 
  *
  */
@@ -15,13 +16,13 @@
 #include <stdlib.h> // for atoi
 #include <stdio.h>	// for printf
 #include <signal.h>
-#include <rc/time.h>
-#include <rc/adc.h>
-#include <rc/servo.h>
+#include <hal.h>
 #include <rcs_defs.h>
 #include <mix.h>
 #include <tools.h>
 #include <settings.h>
+#include <servo_cal.h>
+#include <actuator.h>
 #include <rc/math/other.h>
 
 
@@ -37,9 +38,10 @@
 typedef struct servos_state_t {
 	arm_state_t arm_state;			///< ARMED/DISARMED
 	int initialized;				///< set to 1 after servos_init(void)
-	double m[MAX_ROTORS];		///< servo motor signals for each pin in [0 1] range
+	double m[MAX_ROTORS];		///< servo motor signals for each pin in [0 1] range, after shaping
 	double m_us[MAX_ROTORS];	///< servo motor signals for each pin in pulse width
-	double servos_lim[MAX_ROTORS][3];	///< servo minimum (first col.), nominal (second col.) and maximum values (last col.) 
+	double servos_lim[MAX_ROTORS][3];	///< servo minimum (first col.), nominal (second col.) and maximum values (last col.) from the calibration
+	uint64_t commit_ns;			///< hal_nanos_since_boot() when the last pulses were committed
 }servos_state_t;
 
 
@@ -74,11 +76,18 @@ int servos_init(void);
  * @brief      marches servos forward one step
  *
  * This is should be called at the end of feedback controller 
- * function to actually apply signals to servos.
+ * function to actually apply signals to servos. Shapes the first n signals
+ * with the actuator model if settings.actuator_shaping is on, maps them
+ * (clamped to [0 1]) to pulse widths and sends them all at once. The time
+ * from the start of the tick to the commit goes into the "output"
+ * histogram of isr_timing.
+ *
+ * @param[in]  mot  servo signals in [0 1], one per channel
+ * @param[in]  n    number of channels, starting with the first
  *
  * @return     0 on success, -1 on failure
  */
-int servos_march(int i, double* mot);
+int servos_march(const double* mot, int n);
 
 /**
  * @brief      This is how outside functions should deactivate the servo motors.
@@ -121,6 +130,19 @@ int servos_return_to_nominal(void);
 int test_servos(void);
 
 
+/**
+ * @brief      Records a new calibration curve for one servo and prints it
+ *             as an entry for servo_calibration in the settings file.
+ *
+ *	Sweeps the current range of the servo, see servo_cal_capture(). Has
+ *	to be run with the servos initialized but not armed.
+ *
+ * @param[in]  ch    servo channel, 1 to 8
+ *
+ * @return     0 on success, -1 on failure
+ */
+int servos_calibrate(int ch);
+
 /**
  * @brief      Cleanup the servo motor function, freeing memory
  *
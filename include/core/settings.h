@@ -12,6 +12,8 @@
 
 #include <flight_mode.h>
 #include <thrust_map.h>
+#include <servo_cal.h>
+#include <actuator.h>
 #include <mix.h>
 #include <input_manager.h>
 #include <rcs_defs.h>
@@ -27,6 +29,14 @@ typedef enum vertical_axis_t {
 } vertical_axis_t;
  */
 
+/**
+ * where the attitude quaternion comes from, see state_estimator.c
+ */
+typedef enum attitude_filter_t {
+	ATTITUDE_DMP,		///< MPU DMP, not available with imu_fifo
+	ATTITUDE_MAHONY		///< software filter, see mahony.h
+} attitude_filter_t;
+
 /**
  * Configuration settings read from the json settings file and passed to most
  * threads as they initialize.
@@ -41,13 +51,32 @@ typedef struct settings_t{
 	int warnings_en;
 	///@}
 
+	/** @name loop rate */
+	///@{
+	int feedback_hz;	///< rate of __imu_isr and every discrete filter
+	double dt;		///< 1/feedback_hz, not in the file
+	double isr_budget;	///< share of the period __imu_isr may use before shedding
+	int imu_fifo;		///< raw MPU FIFO instead of the DMP, see imu_fifo.h
+	int imu_fifo_hz;	///< FIFO sample rate, a multiple of feedback_hz
+	///@}
+
 	/** @name physical parameters */
 	///@{
 	int num_rotors;
 	rotor_layout_t layout;
 	int dof;
+	double mix_matrix[MAX_ROTORS][MAX_INPUTS];	///< rows per rotor, only with LAYOUT_CUSTOM
 	thrust_map_t thrust_map;
-	rc_mpu_orientation_t orientation;
+	char thrust_map_file[128];	///< csv or json map for THRUST_MAP_FILE
+	servo_cal_t servo_cal[MAX_ROTORS];	///< per servo channel, see servo_cal.h
+	int num_servo_cal;		///< 0 for the table built into servos.c
+	actuator_model_t actuator_model[MAX_ROTORS];	///< servo dynamics per channel, see actuator.h
+	int actuator_shaping;		///< rate limit servo commands with the model
+	rc_mpu_orientation_t orientation;	///< picks the vertical axis, X up or Z down
+	double mount_R[3][3];		///< sensor to body frame rotation, from mount_rotation
+	attitude_filter_t attitude_filter;
+	double mahony_kp;	///< accel/mag correction gain (rad/s)
+	double mahony_ki;	///< gyro bias learning gain (rad/s^2)
 	double v_nominal;
 	double v_nominal_jack;
 	double target_altitude_m;
@@ -66,6 +95,16 @@ typedef struct settings_t{
 	double event_landing_alt_tol;
 	double event_landing_vel_tol;
 	double event_landning_accel_tol;
+	double apogee_drag_k;		///< 0.5*rho*Cd*A/m with brakes in (1/m)
+	double apogee_brake_drag_gain;	///< extra drag multiplier at full brake deflection, > 0 without aero_table_file
+	char aero_table_file[128];	///< brake increment over deflection and Mach, see aero.h
+	double aero_ref_q_pa;		///< dynamic pressure full brake command is meant for, 0 for none
+	double apogee_step_s;		///< RK4 step of the apogee predictor
+	double apogee_budget_us;	///< apogee predictor time per tick
+	int apogee_lut;			///< use the precomputed table instead
+	double apogee_lut_v_max;	///< highest climb rate in the table (m/s)
+	int drag_rls_en;		///< learn the drag in flight, see drag_rls.h
+	double drag_rls_forget;		///< RLS forgetting factor
 	int enable_magnetometer; // we suggest leaving as 0 (mag OFF)
 	int enable_xbee;	//enable xbee serial link
 	int use_xbee_yaw;
@@ -109,6 +148,22 @@ typedef struct settings_t{
 	int log_motor_signals;
     int log_motor_signals_us;
 	int log_encoders;
+	int log_isr_timing;
+	int log_drag;
+	int log_imu_raw;	///< full-rate IMU samples to a second file in FIFO mode
+	///@}
+
+	/** @name real-time, see rt_harden.h */
+	///@{
+	int rt_harden;			///< mlockall, prefault and pin threads
+	int rt_cpu;			///< cpu for the ISR and real-time threads, -1 any
+	int non_rt_cpu;			///< cpu for everything else, -1 any
+	int imu_priority;		///< SCHED_FIFO priority of __imu_isr
+	int input_manager_priority;
+	int log_manager_priority;
+	int printf_manager_priority;
+	int bmp_sampler_priority;	///< must not be above imu_priority
+	int serial_io_priority;		///< must not be above imu_priority
 	///@}
 
 	/** @name mavlink stuff */
@@ -125,6 +180,16 @@ typedef struct settings_t{
 	rc_filter_t altitude_controller;
 	///@}
 
+#ifdef OFFBOARD_TEST
+	/** @name software-in-the-loop simulation (hal_sim.c) */
+	///@{
+	double sim_time_scale;		///< 1.0 real time, N is N times faster, 0 unpaced
+	double sim_launch_time_s;	///< simulated ignition time after start
+	double sim_auto_arm_s;		///< arm automatically after this time
+	///@}
+#endif
+
+
 }settings_t;
 
 /**
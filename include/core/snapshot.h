@@ -0,0 +1,60 @@
+/**
+ * <snapshot.h>
+ *
+ * @brief      Consistent copies of the flight state for other threads
+ *
+ * state_estimate, setpoint, fstate, sstate, events and flight_status are
+ * written by __imu_isr. Threads that read those globals directly can catch
+ * the ISR half way through an update and see a torn state. Instead the ISR
+ * publishes a copy of all of them once per tick under a seqlock, and other
+ * threads read that copy with snapshot_read().
+ *
+ * The seqlock never blocks the writer. Readers copy the snapshot and retry if
+ * the ISR published in the meantime, which at 200 Hz and a copy of a few us is
+ * rare. Retries are counted, see snapshot_get_retries().
+ *
+ * Code running inside __imu_isr keeps using the globals directly.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include <state_estimator.h>
+#include <setpoint_manager.h>
+#include <feedback.h>
+#include <servos.h>
+
+typedef struct snapshot_t {
+	uint64_t tick;			///< increments with every publish
+	state_estimate_t state_estimate;
+	setpoint_t setpoint;
+	feedback_state_t fstate;
+	servos_state_t sstate;
+	events_t events;
+	flight_status_t flight_status;
+} snapshot_t;
+
+/**
+ * @brief      Copies the globals into the snapshot, call at the end of
+ *             __imu_isr. Never blocks.
+ */
+void snapshot_publish(void);
+
+/**
+ * @brief      Gets a consistent copy of the latest published state.
+ *
+ * @param[out] snap  copy of the state
+ *
+ * @return     0 on success, -1 if nothing was published yet
+ */
+int snapshot_read(snapshot_t* snap);
+
+/**
+ * @brief      How many times readers had to retry because the ISR published
+ *             while they were copying.
+ */
+uint64_t snapshot_get_retries(void);
+
+#endif // SNAPSHOT_H
@@ -96,11 +96,21 @@ typedef struct state_estimate_t{
 	///@{
 	double bmp_pressure_raw;///< raw barometer pressure in Pascals
 	double alt_bmp_raw;		///< altitude estimate using only bmp from sea level (m)
+	double bmp_age_s;		///< age of the newest barometer sample (s)
 	double alt_bmp;			///< altitude estimate using kalman filter (IMU & bmp)
 	double alt_bmp_vel;		///< vertical velocity estimate using kalman filter (IMU & bmp)
 	double alt_bmp_accel;	///< vertical accel estimate using kalman filter (IMU & bmp)
 	///@}
 
+	/** @name drag estimate, see drag_rls.h */
+	///@{
+	double drag_scale;		///< real drag over the settings drag model
+	double drag_scale_var;	///< RLS variance of drag_scale
+	double drag_resid;		///< last deceleration residual (m/s^2)
+	double mach;			///< climb rate over the speed of sound
+	double dyn_press;		///< dynamic pressure from climb rate (Pa)
+	///@}
+
 	/** @name Motion Capture data
 	 * As mocap drop in and out the mocap_running flag will turn on and off.
 	 * Old values will remain readable after mocap drops out.
@@ -169,10 +179,22 @@ int state_estimator_init(void);
 int state_estimator_march(void);
 
 
+/**
+ * @brief      Samples the battery voltages and marches their filters
+ *
+ * Runs in the battery rate group at BATT_SAMPLE_HZ, before
+ * state_estimator_march.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int state_estimator_batt_march(void);
+
+
 /**
  * @brief      jobs the state estimator must do after feedback_controller
  *
- * Called immediately after feedback_march in the ISR. Currently this reads
+ * Called after feedback_march in the ISR, in the barometer rate group at
+ * BMP_SAMPLE_HZ. Currently this wakes the barometer sampler thread.
  *
  * @return     0 on success, -1 on failure
  */
@@ -3,16 +3,19 @@
 #ifndef THREAD_DEFS_H
 #define THREAD_DEFS_H
 
-// thread speeds, prioritites, and close timeouts
+// thread speeds and close timeouts, priorities are in the settings file
 #define INPUT_MANAGER_HZ	20
-#define INPUT_MANAGER_PRI	80
 #define INPUT_MANAGER_TOUT	0.5
 #define LOG_MANAGER_HZ		20
-#define LOG_MANAGER_PRI		50
 #define LOG_MANAGER_TOUT	2.0
 #define PRINTF_MANAGER_HZ	20
-#define PRINTF_MANAGER_PRI	60
 #define PRINTF_MANAGER_TOUT	0.5
+#define BMP_SAMPLER_TOUT	0.5
+#define BMP_SAMPLER_WAKE_NS	100000000L // idle wakeup to check for exit
+#define SERIAL_IO_TOUT		0.5
+#define SERIAL_IO_WAKE_MS	100	// idle wakeup to check for exit
+#define RT_STACK_PREFAULT_KB	64	// stack touched by rt_harden_thread()
+#define RT_HEAP_PREFAULT_KB	1024	// heap reserve touched by rt_harden_init()
 #define BUTTON_EXIT_CHECK_HZ	10
 #define BUTTON_EXIT_TIME_S	2
 
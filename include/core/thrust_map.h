@@ -9,6 +9,9 @@
 #ifndef THRUST_MAP_H
 #define THRUST_MAP_H
 
+#define THRUST_MAP_MAX_POINTS	128	///< rows a map can have
+#define THRUST_MAP_GRID		1024	///< cells of the uniform lookup grid
+
 /**
  * enum thrust_map_t
  *
@@ -21,7 +24,8 @@ typedef enum thrust_map_t{
     TEAM2_PROP,
 	MN1806_1400KV_4S,
 	F20_2300KV_2S,
-	RX2206_4S
+	RX2206_4S,
+	THRUST_MAP_FILE		///< loaded with thrust_map_init_file()
 } thrust_map_t;
 
 
@@ -32,10 +36,30 @@ typedef enum thrust_map_t{
  */
 int thrust_map_init(thrust_map_t map);
 
+/**
+ * @brief      Same as thrust_map_init() with the map read from a file.
+ *
+ *             A .json file holds an array of [signal, thrust] pairs. Any
+ *             other file is read as csv with signal and thrust on each line,
+ *             separated by a comma, semicolon or whitespace. Lines that don't
+ *             start with two numbers, like a header, are skipped. The same
+ *             checks as for the built in maps apply.
+ *
+ * @param[in]  path  file to read
+ *
+ * @return     0 on success, -1 on failure
+ */
+int thrust_map_init_file(const char* path);
+
 
 /**
  * @brief      Corrects the motor signal m for non-linear thrust curve in place.
  *
+ *             At init the map is resampled on THRUST_MAP_GRID equal cells of
+ *             thrust with the line through the ends of each cell, so this is
+ *             one index and one multiply-add. Between knots of the map that
+ *             don't fall on the grid the result is off by a little, see
+ *             tests/test_thrust_map.cpp for how much.
  *
  * @param[in]  m     thrust input, must be between 0 and 1 inclusive
  *
@@ -43,4 +67,17 @@ int thrust_map_init(thrust_map_t map);
  */
 double map_motor_signal(double m);
 
+/**
+ * @brief      Thrust input that gives the motor signal s, the inverse of
+ *             map_motor_signal().
+ *
+ *             Interpolates the map as given rather than the grid, with a
+ *             binary search over its rows.
+ *
+ * @param[in]  s     motor signal, clamped to 0 to 1
+ *
+ * @return     thrust input between 0 and 1
+ */
+double thrust_map_invert(double s);
+
 #endif // THRUST_MAP_H
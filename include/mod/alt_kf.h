@@ -0,0 +1,99 @@
+/**
+ * <alt_kf.h>
+ *
+ * @brief      Fixed-size Kalman filter for altitude, climb rate and accel bias
+ *
+ * Same model as the rc_kalman filter the state estimator used before:
+ *
+ *     x = [altitude, climb rate, accel bias]
+ *     F = [1 dt 0; 0 1 -dt; 0 0 1],  G = [dt^2/2; dt; 0],  H = [1 0 0]
+ *
+ * with diagonal Q and scalar R. With one measurement the innovation
+ * covariance is a scalar, so the update needs no matrix inverse, and with
+ * the structure of F known the predict step is a handful of multiply-adds.
+ * Everything lives in the struct, nothing is allocated.
+ *
+ * The filter predicts on every IMU tick and is corrected only when a new
+ * barometer sample comes in. The sample is fused at the time it was taken:
+ * every predict step is stamped and kept, together with its input, in a ring
+ * of the last ALT_KF_HIST steps. A correction goes to the newest step at or
+ * before the sample time and the steps after it are predicted again from
+ * the stored inputs, fusing again the samples already applied to them.
+ * Samples can come in out of order as long as they are still inside the
+ * history.
+ */
+
+#ifndef ALT_KF_H
+#define ALT_KF_H
+
+#include <stdint.h>
+
+#define ALT_KF_HIST	128	///< predict steps kept for delayed corrections
+#define ALT_KF_MEAS	2	///< corrections kept per step for the replays
+
+/**
+ * One predict step in the history
+ */
+typedef struct alt_kf_hist_t {
+	uint64_t t_ns;		///< time the step was predicted to
+	double u;		///< input used to get there
+	int n_y;		///< corrections applied to this step
+	double y[ALT_KF_MEAS];	///< their altitude
+	double r[ALT_KF_MEAS];	///< and noise
+	double x[3];		///< state after the step and its corrections
+	double P[3][3];
+} alt_kf_hist_t;
+
+typedef struct alt_kf_t {
+	double dt;
+	double q[3];		///< diagonal of the process noise
+	double r;		///< barometer noise, can be changed between updates
+	double x[3];		///< state estimate
+	double P[3][3];		///< estimate covariance
+	uint64_t step;		///< number of predict steps so far
+	uint64_t fused;		///< corrections applied
+	uint64_t dropped;	///< corrections older than the history or to a full step
+	alt_kf_hist_t hist[ALT_KF_HIST];
+	int head;		///< history entry of the current step
+} alt_kf_t;
+
+/**
+ * @brief      Sets up the filter, the state starts at zero.
+ *
+ * @param      kf    the filter
+ * @param[in]  dt    time step
+ * @param[in]  q     diagonal of the process noise
+ * @param[in]  r     measurement noise
+ * @param[in]  P0    initial covariance
+ *
+ * @return     0 on success, -1 on failure
+ */
+int alt_kf_init(alt_kf_t* kf, double dt, const double q[3], double r, const double P0[3][3]);
+
+/**
+ * @brief      Predicts one step ahead and adds it to the history.
+ *
+ * @param      kf    the filter
+ * @param[in]  u     vertical acceleration used during the last step
+ * @param[in]  t_ns  time of the new step, hal_nanos_since_boot()
+ */
+void alt_kf_predict(alt_kf_t* kf, double u, uint64_t t_ns);
+
+/**
+ * @brief      Fuses a barometer altitude taken at t_ns.
+ *
+ *             Applied to the newest step at or before t_ns, then the state is
+ *             brought forward to the current step again. A sample newer than
+ *             the current step is applied to the current step.
+ *
+ * @param      kf    the filter
+ * @param[in]  y     barometer altitude
+ * @param[in]  t_ns  time the sample was taken, hal_nanos_since_boot()
+ *
+ * @return     0 if fused, -1 if the sample is older than the history, its
+ *             step already has ALT_KF_MEAS corrections or no step has been
+ *             predicted yet
+ */
+int alt_kf_correct(alt_kf_t* kf, double y, uint64_t t_ns);
+
+#endif // ALT_KF_H
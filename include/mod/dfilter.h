@@ -0,0 +1,95 @@
+/**
+ * <dfilter.h>
+ *
+ * @brief      Fixed-size discrete SISO filter for the control loop
+ *
+ * Same difference equation, saturation and soft start as rc_filter_t, but
+ * the coefficients and the input/output histories live in the struct, sized
+ * by DFILTER_MAX_ORDER. Nothing is allocated, so a filter can be copied,
+ * reset or re-tuned from the ISR. The numerator is padded with leading zeros
+ * to the order of the denominator, which makes the march one loop over the
+ * same length for both, and the histories are shifted instead of indexed
+ * through a ring buffer. Orders 1 and 2, which is every PID, get an unrolled
+ * march.
+ *
+ * Filters are built from an rc_filter_t, so the settings file and the
+ * rc_filter_pid()/c2d code keep doing the design work. tests/test_dfilter.cpp
+ * checks that both march the same.
+ */
+
+#ifndef DFILTER_H
+#define DFILTER_H
+
+#include <stdint.h>
+#include <rc/math/filter.h>
+
+#define DFILTER_MAX_ORDER	4
+
+typedef struct dfilter_t {
+	int order;
+	double dt;
+	double gain;			///< multiplies the numerator, can be changed any time
+	double num[DFILTER_MAX_ORDER + 1];	///< b0..bn, padded to the order
+	double den[DFILTER_MAX_ORDER + 1];	///< 1, a1..an
+	double in[DFILTER_MAX_ORDER + 1];	///< in[0] is the newest input
+	double out[DFILTER_MAX_ORDER + 1];	///< out[0] is the newest output
+	int sat_en;
+	double sat_min;
+	double sat_max;
+	int sat_flag;			///< 1 if the last output was saturated
+	int ss_en;
+	double ss_steps;		///< soft start length in steps
+	uint64_t step;
+} dfilter_t;
+
+/**
+ * @brief      Copies the coefficients, gain, saturation and soft start of an
+ *             rc_filter_t. The histories start at zero.
+ *
+ * @return     0 on success, -1 if the filter is not set up or its order is
+ *             above DFILTER_MAX_ORDER
+ */
+int dfilter_from_rc(dfilter_t* f, const rc_filter_t* rc);
+
+/**
+ * @brief      Marches the filter one step, same result as rc_filter_march().
+ *
+ * @return     the new output
+ */
+double dfilter_march(dfilter_t* f, double in);
+
+/**
+ * @brief      Zeros the histories and restarts the soft start.
+ */
+void dfilter_reset(dfilter_t* f);
+
+/**
+ * @brief      Turns on saturation or moves the limits, cheap enough to call on
+ *             every step.
+ */
+void dfilter_set_saturation(dfilter_t* f, double min, double max);
+
+/**
+ * @brief      Ramps the saturation limits up from zero over the first
+ *             seconds after a reset. Needs saturation to be enabled.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int dfilter_enable_soft_start(dfilter_t* f, double seconds);
+
+/**
+ * @brief      Fills the input history with one value.
+ */
+void dfilter_prefill_inputs(dfilter_t* f, double in);
+
+/**
+ * @brief      Fills the output history with one value.
+ */
+void dfilter_prefill_outputs(dfilter_t* f, double out);
+
+/**
+ * @brief      Prints the coefficients like rc_filter_print().
+ */
+void dfilter_print(const dfilter_t* f);
+
+#endif // DFILTER_H
@@ -0,0 +1,55 @@
+/**
+ * <mahony.h>
+ *
+ * @brief      Mahony complementary attitude filter
+ *
+ * Integrates the gyro into a quaternion and pulls it towards the attitude
+ * the accelerometer (gravity) and optionally the magnetometer (heading) see,
+ * with a PI correction that also learns the gyro bias:
+ *
+ *     e = a x v + m x w,   b += ki*e*dt,   w_used = gyro + b + kp*e
+ *
+ * where v and w are gravity and the magnetic field as the current estimate
+ * expects them in the sensor frame. The quaternion has the same convention
+ * as the DMP one (sensor to world, world Z up), so it can stand in for it.
+ *
+ * The accelerometer is only trusted while its norm is within
+ * MAHONY_ACCEL_GATE of 1 g. Under thrust, drag or in free fall it is not
+ * measuring gravity and the filter just integrates the gyro.
+ */
+
+#ifndef MAHONY_H
+#define MAHONY_H
+
+#define MAHONY_ACCEL_GATE	0.1	///< accel norm tolerance, fraction of 1 g
+#define MAHONY_BIAS_MAX		0.1	///< limit of the learned gyro bias (rad/s)
+
+typedef struct mahony_t {
+	double kp;		///< proportional gain (rad/s)
+	double ki;		///< integral gain (rad/s^2)
+	double q[4];		///< attitude, W X Y Z
+	double bias[3];		///< learned gyro correction (rad/s)
+	int leveled;		///< set once the first accel sample set the attitude
+} mahony_t;
+
+/**
+ * @brief      Sets the gains, the attitude is leveled with the first
+ *             accelerometer sample.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mahony_init(mahony_t* f, double kp, double ki);
+
+/**
+ * @brief      One filter step.
+ *
+ * @param      f      the filter
+ * @param[in]  gyro   deg/s, as in rc_mpu_data_t
+ * @param[in]  accel  m/s^2
+ * @param[in]  mag    any unit, NULL to leave the heading to the gyro
+ * @param[in]  dt     time since the last step (s)
+ */
+void mahony_update(mahony_t* f, const double gyro[3], const double accel[3],
+	const double mag[3], double dt);
+
+#endif // MAHONY_H
@@ -0,0 +1,53 @@
+/**
+ * <mailbox.h>
+ *
+ * @brief      Latest-value mailbox between one producer and one consumer thread
+ *
+ * This is a triple buffer: the producer always has a buffer to write into,
+ * the consumer always has a buffer to read from, and the third one is the
+ * newest published value. Handing buffers over is a single atomic exchange,
+ * so both sides are wait-free and the consumer can safely be __imu_isr.
+ * Values the consumer did not pick up in time are simply overwritten.
+ */
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h> // for size_t
+
+typedef struct mailbox_t {
+	void* slot[3];	///< three buffers of size bytes each
+	size_t size;	///< size of one value in bytes
+	int ready;	///< published buffer, shared
+	int back;	///< buffer the producer writes next
+	int front;	///< buffer the consumer reads
+	int has_data;	///< set once the first value was published
+} mailbox_t;
+
+/**
+ * @brief      Sets up a mailbox.
+ *
+ * @param      mb       the mailbox
+ * @param      storage  memory for three values, e.g. a static array of 3
+ * @param[in]  size     size of one value in bytes
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mailbox_init(mailbox_t* mb, void* storage, size_t size);
+
+/**
+ * @brief      Publishes a new value, only call from the producer thread.
+ */
+void mailbox_publish(mailbox_t* mb, const void* data);
+
+/**
+ * @brief      Copies out the newest value, only call from the consumer thread.
+ *
+ * @param[out] data  newest value, left alone if nothing was ever published
+ *
+ * @return     1 if the value is new since the last call, 0 if not, -1 if
+ *             nothing was published yet
+ */
+int mailbox_take(mailbox_t* mb, void* data);
+
+#endif // MAILBOX_H
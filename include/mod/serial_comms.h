@@ -7,7 +7,7 @@
 #include <string.h>
 #include <stdint.h>
 
-#include <rc/time.h> // for nanos
+#include <hal.h> // for nanos
 
 #include <serial_tools.h>
 #include <settings.h>
@@ -18,11 +18,14 @@
 #include "fallback_packet.h"
 #include <crc16.h>
 #include <tools.h>
+#include <mailbox.h>
+#include <errno.h>
 
 extern fallback_packet_t serialMsg;
 extern int serial_portID;
 
 int serial_init();
+int serial_rx_service();
 int serial_getData();
 
 
@@ -50,6 +53,9 @@ extern send_serial_packet_t send_serial_packet;
  * @brief      This is the main function which needs to be marched
  *              to send data through serial
  *
+ *              Sends one packet per call, the scheduler calls it at
+ *              serial_send_update_hz.
+ *
  * @return     0 on success, -1 on failure
  */
 int send_serial_data(void);
@@ -0,0 +1,34 @@
+/**
+ * <serial_io.h>
+ *
+ * @brief      Receive thread for the companion computer and XBee serial links
+ *
+ * One thread waits on both ports with epoll, drains whatever arrived with
+ * bulk reads and runs the packet parsers. Every valid packet is published to
+ * a latest-value mailbox, so serial_getData() and XBEE_getData() in __imu_isr
+ * only copy the newest packet out and never touch the ports.
+ *
+ * Sending (send_serial_data) still happens from the ISR, it is a single
+ * write() at serial_send_update_hz.
+ */
+
+#ifndef SERIAL_IO_H
+#define SERIAL_IO_H
+
+/**
+ * @brief      Starts the thread for the links enabled in the settings.
+ *
+ *             serial_init() and/or XBEE_init() must have been called first.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int serial_io_init(void);
+
+/**
+ * @brief      Stops the thread.
+ *
+ * @return     0 on clean exit, -1 on exit time out/force close
+ */
+int serial_io_cleanup(void);
+
+#endif // SERIAL_IO_H
@@ -1,4 +1,4 @@
-#include <rc/time.h> // for nanos
+#include <hal.h> // for nanos
 #include <inttypes.h> // for PRIu64
 #include <math.h>
 #include <stdio.h> //for fscanf
@@ -8,4 +8,15 @@
  *
  * @return		time in seconds
  */
-double finddt_s(uint64_t ti);
\ No newline at end of file
+double finddt_s(uint64_t ti);
+
+/**
+ * @brief		reads the monotonic clock, for timing code
+ *
+ * This is always the real clock, also in OFFBOARD_TEST builds where
+ * hal_nanos_since_boot() is the simulated one and stands still within a
+ * tick.
+ *
+ * @return		time in nanoseconds
+ */
+uint64_t monotonic_ns(void);
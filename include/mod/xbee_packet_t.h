@@ -7,9 +7,11 @@
 #include <string.h>
 #include <stdint.h>
 
-#include <rc/time.h> // for nanos
+#include <hal.h> // for nanos
 
 #include <serial_tools.h>
+#include <mailbox.h>
+#include <errno.h>
 #include <settings.h>
 
 // Below for PRId64
@@ -38,6 +40,7 @@ extern xbee_packet_t xbeeMsg;
 extern int xbee_portID;
 
 int XBEE_init();
+int XBEE_rx_service();
 int XBEE_getData();
 void XBEE_printData();
 
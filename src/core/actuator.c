@@ -0,0 +1,60 @@
+/**
+ * @file actuator.c
+ *
+ * Servo dynamics model, see actuator.h
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include <actuator.h>
+
+int actuator_init(actuator_t* a, const actuator_model_t* m, double dt, double pos)
+{
+	if (a == NULL || m == NULL) {
+		fprintf(stderr, "ERROR in actuator_init, received NULL pointer\n");
+		return -1;
+	}
+	if (dt <= 0.0 || m->rate_max < 0.0 || m->tau_s < 0.0 || m->deadband < 0.0 || m->backlash < 0.0) {
+		fprintf(stderr, "ERROR in actuator_init, dt must be > 0 and the model >= 0\n");
+		return -1;
+	}
+	// exact step response of the lag at this dt, no lag is a gain of 1
+	a->alpha = m->tau_s > 0.0 ? 1.0 - exp(-dt / m->tau_s) : 1.0;
+	a->step_max = m->rate_max > 0.0 ? m->rate_max * dt : HUGE_VAL;
+	a->deadband = m->deadband;
+	a->half_play = 0.5 * m->backlash;
+	actuator_reset(a, pos);
+	return 0;
+}
+
+void actuator_reset(actuator_t* a, double pos)
+{
+	a->target = pos;
+	a->pos = pos;
+	a->out = pos;
+}
+
+double actuator_march(actuator_t* a, double cmd)
+{
+	double d;
+
+	if (fabs(cmd - a->target) > a->deadband) a->target = cmd;
+	d = a->alpha * (a->target - a->pos);
+	a->pos += fmax(-a->step_max, fmin(a->step_max, d));
+
+	// the brake only follows once the servo has taken up the play
+	if (a->pos - a->out > a->half_play) a->out = a->pos - a->half_play;
+	else if (a->out - a->pos > a->half_play) a->out = a->pos + a->half_play;
+	return a->out;
+}
+
+double actuator_shape(actuator_t* a, double cmd)
+{
+	double d;
+
+	if (fabs(cmd - a->target) > a->deadband) a->target = cmd;
+	d = a->target - a->out;
+	a->out += fmax(-a->step_max, fmin(a->step_max, d));
+	return a->out;
+}
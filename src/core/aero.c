@@ -0,0 +1,226 @@
+/**
+ * @file aero.c
+ *
+ * Airbrake effectiveness table, see aero.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <json-c/json.h>
+
+#include <aero.h>
+#include <settings.h>
+
+#define GAMMA_AIR	1.4
+#define R_AIR		287.05	// J/(kg K)
+
+static double defl[AERO_MAX_DEFL];
+static double mach[AERO_MAX_MACH];
+static double inc[AERO_MAX_DEFL][AERO_MAX_MACH];
+static int nd, nm;
+static double inc_max;
+
+// cell of a sorted axis holding v, starting from the cached one. Values
+// past either end stay in the end cell.
+static inline int __find(const double* x, int n, double v, int i)
+{
+	if (n < 2) return 0;
+	if (i > n - 2) i = n - 2;
+	else if (i < 0) i = 0;
+	while (i > 0 && v < x[i]) i--;
+	while (i < n - 2 && v >= x[i + 1]) i++;
+	return i;
+}
+
+// Mach cell and weight of the upper column, clamped to the table
+static inline int __mach_cell(aero_cursor_t* c, double m, double* w)
+{
+	int j;
+
+	if (nm < 2) {
+		*w = 0.0;
+		return 0;
+	}
+	j = c->j = __find(mach, nm, m, c->j);
+	*w = (m - mach[j]) / (mach[j + 1] - mach[j]);
+	if (*w < 0.0) *w = 0.0;
+	else if (*w > 1.0) *w = 1.0;
+	return j;
+}
+
+// increment at deflection breakpoint i, interpolated in Mach
+static inline double __col(int i, int j, double w)
+{
+	if (nm < 2) return inc[i][0];
+	return inc[i][j] + w * (inc[i][j + 1] - inc[i][j]);
+}
+
+static int __read_axis(json_object* jobj, const char* key, double* x, int max, int* n)
+{
+	json_object *arr, *tmp;
+	int i;
+
+	if (json_object_object_get_ex(jobj, key, &arr) == 0 ||
+		json_object_is_type(arr, json_type_array) == 0) {
+		fprintf(stderr, "ERROR in aero_init, %s should be an array\n", key);
+		return -1;
+	}
+	*n = json_object_array_length(arr);
+	if (*n < 1 || *n > max) {
+		fprintf(stderr, "ERROR in aero_init, %s should have 1 to %d entries\n", key, max);
+		return -1;
+	}
+	for (i = 0; i < *n; i++) {
+		tmp = json_object_array_get_idx(arr, i);
+		if (json_object_is_type(tmp, json_type_double) == 0 &&
+			json_object_is_type(tmp, json_type_int) == 0) {
+			fprintf(stderr, "ERROR in aero_init, %s entries should be numbers\n", key);
+			return -1;
+		}
+		x[i] = json_object_get_double(tmp);
+		if (i > 0 && x[i] <= x[i - 1]) {
+			fprintf(stderr, "ERROR in aero_init, %s must be increasing\n", key);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int __load(const char* path)
+{
+	json_object *jobj, *arr, *row, *tmp;
+	int i, j, ret = -1;
+
+	jobj = json_object_from_file(path);
+	if (jobj == NULL) {
+		fprintf(stderr, "ERROR in aero_init, can't read %s\n", path);
+		return -1;
+	}
+	if (__read_axis(jobj, "deflection", defl, AERO_MAX_DEFL, &nd)) goto out;
+	if (__read_axis(jobj, "mach", mach, AERO_MAX_MACH, &nm)) goto out;
+	if (nd < 2 || defl[0] != 0.0 || defl[nd - 1] != 1.0) {
+		fprintf(stderr, "ERROR in aero_init, deflection must go from 0.0 to 1.0\n");
+		goto out;
+	}
+	if (json_object_object_get_ex(jobj, "increment", &arr) == 0 ||
+		json_object_is_type(arr, json_type_array) == 0 ||
+		(int)json_object_array_length(arr) != nd) {
+		fprintf(stderr, "ERROR in aero_init, increment should have a row per deflection\n");
+		goto out;
+	}
+	for (i = 0; i < nd; i++) {
+		row = json_object_array_get_idx(arr, i);
+		if (json_object_is_type(row, json_type_array) == 0 ||
+			(int)json_object_array_length(row) != nm) {
+			fprintf(stderr, "ERROR in aero_init, increment rows should have an entry per mach\n");
+			goto out;
+		}
+		for (j = 0; j < nm; j++) {
+			tmp = json_object_array_get_idx(row, j);
+			if (json_object_is_type(tmp, json_type_double) == 0 &&
+				json_object_is_type(tmp, json_type_int) == 0) {
+				fprintf(stderr, "ERROR in aero_init, increment entries should be numbers\n");
+				goto out;
+			}
+			inc[i][j] = json_object_get_double(tmp);
+		}
+	}
+	ret = 0;
+out:
+	json_object_put(jobj);
+	return ret;
+}
+
+int aero_init(void)
+{
+	int i, j;
+
+	if (settings.aero_table_file[0] == '\0') {
+		// the linear model, the same at every speed
+		nd = 2;
+		nm = 1;
+		defl[0] = 0.0;
+		defl[1] = 1.0;
+		mach[0] = 0.0;
+		inc[0][0] = 0.0;
+		inc[1][0] = settings.apogee_brake_drag_gain;
+	}
+	else if (__load(settings.aero_table_file)) return -1;
+
+	// has to be invertible in deflection at every Mach number
+	inc_max = 0.0;
+	for (j = 0; j < nm; j++) {
+		if (inc[0][j] != 0.0) {
+			fprintf(stderr, "ERROR in aero_init, increment must be 0 with the brakes in\n");
+			return -1;
+		}
+		for (i = 1; i < nd; i++) {
+			if (inc[i][j] <= inc[i - 1][j]) {
+				fprintf(stderr, "ERROR in aero_init, increment must increase with deflection\n");
+				return -1;
+			}
+		}
+		if (inc[nd - 1][j] > inc_max) inc_max = inc[nd - 1][j];
+	}
+	return 0;
+}
+
+double aero_mach(double vel, double temp_c)
+{
+	return fabs(vel) / sqrt(GAMMA_AIR * R_AIR * (temp_c + 273.15));
+}
+
+double aero_dynamic_pressure(double pressure_pa, double m)
+{
+	return 0.5 * GAMMA_AIR * pressure_pa * m * m;
+}
+
+double aero_increment(aero_cursor_t* c, double deflection, double m)
+{
+	int i, j;
+	double w, u, lo, hi;
+
+	j = __mach_cell(c, m, &w);
+	if (deflection <= 0.0) return 0.0;
+	if (deflection >= 1.0) return __col(nd - 1, j, w);
+	i = c->i = __find(defl, nd, deflection, c->i);
+	u = (deflection - defl[i]) / (defl[i + 1] - defl[i]);
+	lo = __col(i, j, w);
+	hi = __col(i + 1, j, w);
+	return lo + u * (hi - lo);
+}
+
+double aero_deflection(aero_cursor_t* c, double increment, double m)
+{
+	int i, j;
+	double w, lo, hi;
+
+	j = __mach_cell(c, m, &w);
+	if (increment <= 0.0) return 0.0;
+	if (increment >= __col(nd - 1, j, w)) return 1.0;
+
+	// walk from the cached cell, the column increases with deflection
+	i = c->i;
+	if (i > nd - 2) i = nd - 2;
+	else if (i < 0) i = 0;
+	lo = __col(i, j, w);
+	while (i > 0 && increment < lo) {
+		i--;
+		lo = __col(i, j, w);
+	}
+	hi = __col(i + 1, j, w);
+	while (i < nd - 2 && increment >= hi) {
+		i++;
+		lo = hi;
+		hi = __col(i + 1, j, w);
+	}
+	c->i = i;
+	return defl[i] + (increment - lo) / (hi - lo) * (defl[i + 1] - defl[i]);
+}
+
+double aero_max_increment(void)
+{
+	return inc_max;
+}
@@ -0,0 +1,204 @@
+/**
+ * @file apogee.c
+ *
+ * Numerical apogee predictor, see apogee.h
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <apogee.h>
+#include <rcs_defs.h>
+#include <settings.h>
+#include <drag_rls.h>
+#include <tools.h>
+
+#define APOGEE_MAX_COAST_S	120.0	// give up integrating after this
+#define APOGEE_CLOCK_STEPS	8	// RK4 steps between checks of the budget
+#define APOGEE_LUT_NV		65	// climb rate grid points
+#define APOGEE_LUT_NK		33	// drag grid points, log spaced
+
+typedef struct apogee_job_t {
+	int active;
+	double h;
+	double v;
+	double k;	// drag coefficient at the start of the job
+	int steps;
+} apogee_job_t;
+
+static apogee_job_t job;
+static double proj_ap;
+static int max_steps;
+static uint64_t budget_ns;
+
+// rise left to apogee, indexed by log of the drag k and climb rate
+static double lut[APOGEE_LUT_NK][APOGEE_LUT_NV];
+static double lut_inv_dv;	// grid points per m/s
+static double lut_ln_k0;	// log of the smallest k
+static double lut_inv_dlnk;	// grid points per unit of log(k)
+
+static inline double __accel(double v, double k)
+{
+	return -GRAVITY - k * v * fabs(v);
+}
+
+// one RK4 step of h' = v, v' = -g - k*v*|v|
+static inline void __rk4_step(double* h, double* v, double k, double s)
+{
+	double v1, v2, v3, v4;
+	double a1, a2, a3, a4;
+
+	v1 = *v;
+	a1 = __accel(v1, k);
+	v2 = v1 + 0.5 * s * a1;
+	a2 = __accel(v2, k);
+	v3 = v1 + 0.5 * s * a2;
+	a3 = __accel(v3, k);
+	v4 = v1 + s * a3;
+	a4 = __accel(v4, k);
+
+	*h += s / 6.0 * (v1 + 2.0 * v2 + 2.0 * v3 + v4);
+	*v += s / 6.0 * (a1 + 2.0 * a2 + 2.0 * a3 + a4);
+}
+
+// settings model times the in-flight estimate
+static inline double __drag_k(double deflection)
+{
+	return drag_rls_get_scale() * drag_model_k(deflection);
+}
+
+// rise left to apogee in one go, used to build the table
+static double __rise(double v, double k)
+{
+	const double s = settings.apogee_step_s;
+	double h = 0.0, h1, v1;
+	int i;
+
+	if (v <= 0.0) return 0.0;
+	for (i = 0; i < max_steps; i++) {
+		h1 = h;
+		v1 = v;
+		__rk4_step(&h1, &v1, k, s);
+		if (v1 <= 0.0) return h + v * v / (2.0 * (GRAVITY + k * v * v));
+		h = h1;
+		v = v1;
+	}
+	return h;
+}
+
+// k of grid row i
+static inline double __lut_k(double i)
+{
+	return exp(lut_ln_k0 + i / lut_inv_dlnk);
+}
+
+// the drag axis covers the settings model over the whole brake range, times
+// the range the drag estimator may scale it by. The rise is much closer to
+// linear in log(k) than in k.
+static void __lut_build(void)
+{
+	int i, j;
+	double dv = settings.apogee_lut_v_max / (APOGEE_LUT_NV - 1);
+	double ln_k1 = log(DRAG_RLS_SCALE_MAX * drag_model_k_max());
+
+	lut_ln_k0 = log(DRAG_RLS_SCALE_MIN * drag_model_k(0.0));
+	lut_inv_dlnk = (APOGEE_LUT_NK - 1) / (ln_k1 - lut_ln_k0);
+	lut_inv_dv = 1.0 / dv;
+	for (i = 0; i < APOGEE_LUT_NK; i++) {
+		for (j = 0; j < APOGEE_LUT_NV; j++) lut[i][j] = __rise(j * dv, __lut_k(i));
+	}
+}
+
+static inline double __lut_rise(double v, double k)
+{
+	double fv, fk, r0, r1;
+	int i, j;
+
+	if (v < 0.0) v = 0.0;
+	fv = v * lut_inv_dv;
+	j = (int)fv;
+	if (j > APOGEE_LUT_NV - 2) j = APOGEE_LUT_NV - 2;	// extrapolate past v_max
+	fv -= j;
+
+	fk = (log(k) - lut_ln_k0) * lut_inv_dlnk;
+	if (fk < 0.0) fk = 0.0;
+	else if (fk > APOGEE_LUT_NK - 1) fk = APOGEE_LUT_NK - 1;
+	i = (int)fk;
+	if (i > APOGEE_LUT_NK - 2) i = APOGEE_LUT_NK - 2;
+	fk -= i;
+
+	r0 = lut[i][j] + fv * (lut[i][j + 1] - lut[i][j]);
+	r1 = lut[i + 1][j] + fv * (lut[i + 1][j + 1] - lut[i + 1][j]);
+	return r0 + fk * (r1 - r0);
+}
+
+static void __start_job(double alt, double vel)
+{
+	job.h = alt;
+	job.v = vel;
+	job.k = __drag_k(drag_brake_deflection());
+	job.steps = 0;
+	job.active = 1;
+}
+
+// returns 1 when the job reached apogee and proj_ap was updated
+static int __run_job(uint64_t t_start)
+{
+	const double s = settings.apogee_step_s;
+	double h, v;
+
+	while (job.steps < max_steps) {
+		// remaining rise of the last step, drag barely matters this slow
+		h = job.h;
+		v = job.v;
+		__rk4_step(&h, &v, job.k, s);
+		if (v <= 0.0) {
+			proj_ap = job.h + job.v * job.v / (2.0 * (GRAVITY + job.k * job.v * job.v));
+			job.active = 0;
+			return 1;
+		}
+		job.h = h;
+		job.v = v;
+		job.steps++;
+		if (job.steps % APOGEE_CLOCK_STEPS == 0 && monotonic_ns() - t_start > budget_ns) return 0;
+	}
+	// still climbing after APOGEE_MAX_COAST_S, publish what we have
+	proj_ap = job.h;
+	job.active = 0;
+	return 1;
+}
+
+int apogee_init(void)
+{
+	if (settings.apogee_step_s <= 0.0) {
+		fprintf(stderr, "ERROR in apogee_init, apogee_step_s must be > 0\n");
+		return -1;
+	}
+	max_steps = (int)(APOGEE_MAX_COAST_S / settings.apogee_step_s);
+	budget_ns = (uint64_t)(settings.apogee_budget_us * 1000.0);
+	job.active = 0;
+	proj_ap = 0.0;
+
+	if (settings.apogee_lut) __lut_build();
+	return 0;
+}
+
+double apogee_march(double alt, double vel)
+{
+	uint64_t t_start = monotonic_ns();
+
+	// nothing left to climb
+	if (settings.apogee_lut) {
+		proj_ap = alt + __lut_rise(vel, __drag_k(drag_brake_deflection()));
+	}
+	else if (vel <= 0.0) {
+		job.active = 0;
+		proj_ap = alt;
+	}
+	else {
+		if (!job.active) __start_job(alt, vel);
+		__run_job(t_start);
+	}
+	return proj_ap;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file bmp_sampler.c
+ *
+ * Barometer acquisition thread, see bmp_sampler.h
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <semaphore.h>
+
+#include <rc/start_stop.h>
+#include <rc/pthread.h>
+#include <hal.h>
+
+#include <thread_defs.h>
+#include <settings.h>
+#include <rt_harden.h>
+#include <bmp_sampler.h>
+#include <mailbox.h>
+
+static bmp_sample_t storage[3];
+static mailbox_t mailbox;
+static uint64_t seq;	// producer owned
+
+static sem_t trigger;
+static pthread_t bmp_sampler_thread;
+static int running;
+static int initialized = 0;
+
+// 0 once published, 1 if the bus was busy, -1 on a bad read
+static int __sample_and_publish(void)
+{
+	bmp_sample_t s;
+	int ret = hal_bmp_read(&s.data);
+
+	if (ret) return ret;
+	s.timestamp_ns = hal_nanos_since_boot();
+	s.seq = ++seq;
+	mailbox_publish(&mailbox, &s);
+	return 0;
+}
+
+static void* __bmp_sampler_func(__attribute__((unused)) void* ptr)
+{
+	struct timespec ts;
+
+	rt_harden_thread(1);
+	while (running && rc_get_state() != EXITING) {
+		// wake up now and then to notice the program exiting
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += BMP_SAMPLER_WAKE_NS;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		if (sem_timedwait(&trigger, &ts) != 0) continue;
+		if (!running) break;
+
+		// on a busy bus or a bad read just try again next time, only the
+		// bad read is worth a warning
+		if (__sample_and_publish() == -1) {
+			fprintf(stderr, "WARNING in bmp_sampler, failed to read barometer\n");
+		}
+	}
+	return NULL;
+}
+
+int bmp_sampler_init(void)
+{
+	if (initialized) {
+		fprintf(stderr, "ERROR in bmp_sampler_init, already initialized\n");
+		return -1;
+	}
+
+	if (mailbox_init(&mailbox, storage, sizeof(bmp_sample_t))) return -1;
+	seq = 0;
+
+	// first reading is done here so the estimator has something right away
+	if (__sample_and_publish()) {
+		fprintf(stderr, "ERROR in bmp_sampler_init, failed to read barometer\n");
+		return -1;
+	}
+
+	if (sem_init(&trigger, 0, 0)) {
+		perror("ERROR in bmp_sampler_init, sem_init");
+		return -1;
+	}
+
+	running = 1;
+	if (hal_pthread_create(&bmp_sampler_thread, __bmp_sampler_func, NULL,
+		SCHED_FIFO, settings.bmp_sampler_priority) == -1) {
+		fprintf(stderr, "ERROR in bmp_sampler_init, failed to start thread\n");
+		running = 0;
+		sem_destroy(&trigger);
+		return -1;
+	}
+	initialized = 1;
+	return 0;
+}
+
+void bmp_sampler_trigger(void)
+{
+	int pending;
+
+	if (!initialized) return;
+	// don't let requests pile up if the thread fell behind
+	if (sem_getvalue(&trigger, &pending) == 0 && pending > 0) return;
+	sem_post(&trigger);
+}
+
+int bmp_sampler_get_latest(bmp_sample_t* sample)
+{
+	if (sample == NULL) {
+		fprintf(stderr, "ERROR in bmp_sampler_get_latest, received NULL pointer\n");
+		return -1;
+	}
+	return mailbox_take(&mailbox, sample);
+}
+
+int bmp_sampler_cleanup(void)
+{
+	int ret;
+
+	if (!initialized) return 0;
+	running = 0;
+	sem_post(&trigger);
+	ret = rc_pthread_timed_join(bmp_sampler_thread, NULL, BMP_SAMPLER_TOUT);
+	if (ret == 1) fprintf(stderr, "WARNING: bmp_sampler_thread exit timeout\n");
+	else if (ret == -1) fprintf(stderr, "ERROR: failed to join bmp_sampler thread\n");
+	sem_destroy(&trigger);
+	initialized = 0;
+	return ret;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file drag_rls.c
+ *
+ * Drag coefficient estimator, see drag_rls.h
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include <drag_rls.h>
+#include <rcs_defs.h>
+#include <settings.h>
+#include <state_estimator.h>
+#include <setpoint_manager.h>
+#include <servos.h>
+#include <aero.h>
+#include <thrust_map.h>
+
+static double scale;	// estimate of c
+static double P;	// its variance
+static int updates;
+static int min_updates;
+
+double drag_brake_deflection(void)
+{
+	int i;
+	double sum = 0.0;
+
+	// sstate.m went through the thrust map after aero_deflection() and is
+	// shaped if that is on, undo the map to get the deflection
+	if (settings.num_rotors <= 0) return 0.0;
+	for (i = 0; i < settings.num_rotors; i++) sum += thrust_map_invert(sstate.m[i]);
+	return sum / settings.num_rotors;
+}
+
+double drag_model_k(double deflection)
+{
+	static aero_cursor_t c = AERO_CURSOR_INITIALIZER;
+	return settings.apogee_drag_k * (1.0 + aero_increment(&c, deflection, state_estimate.mach));
+}
+
+double drag_model_k_max(void)
+{
+	return settings.apogee_drag_k * (1.0 + aero_max_increment());
+}
+
+int drag_rls_init(void)
+{
+	scale = 1.0;
+	P = DRAG_RLS_P0;
+	updates = 0;
+	min_updates = (int)(DRAG_RLS_MIN_S * settings.feedback_hz);
+	state_estimate.drag_scale = scale;
+	state_estimate.drag_scale_var = P;
+	state_estimate.drag_resid = 0.0;
+	return 0;
+}
+
+void drag_rls_march(double vel, double accel, double deflection)
+{
+	double phi, y, e, K;
+
+	if (!settings.drag_rls_en || flight_status != UNPOWERED_ASCENT) return;
+	if (vel < DRAG_RLS_MIN_VEL) return;
+
+	// y = c*phi, both in m/s^2
+	y = -(accel + GRAVITY);
+	phi = drag_model_k(deflection) * vel * vel;
+
+	e = y - scale * phi;
+	K = P * phi / (settings.drag_rls_forget + phi * P * phi);
+	scale += K * e;
+	P = (P - K * phi * P) / settings.drag_rls_forget;
+
+	// keep it where the apogee table and the physics make sense
+	if (scale < DRAG_RLS_SCALE_MIN) scale = DRAG_RLS_SCALE_MIN;
+	else if (scale > DRAG_RLS_SCALE_MAX) scale = DRAG_RLS_SCALE_MAX;
+	if (P > DRAG_RLS_P0) P = DRAG_RLS_P0;	// no windup when phi gets small
+	updates++;
+
+	state_estimate.drag_scale = scale;
+	state_estimate.drag_scale_var = P;
+	state_estimate.drag_resid = e;
+}
+
+double drag_rls_get_scale(void)
+{
+	if (!settings.drag_rls_en || updates < min_updates) return 1.0;
+	return scale;
+}
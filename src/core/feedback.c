@@ -10,10 +10,8 @@
 #include <rc/math/quaternion.h>
 #include <rc/math/other.h>
 #include <rc/start_stop.h>
-#include <rc/led.h>
 #include <rc/mpu.h>
-#include <rc/servo.h>
-#include <rc/time.h>
+#include <hal.h>
 
 #include <feedback.h>
 #include <rcs_defs.h>
@@ -25,6 +23,8 @@
 #include <xbee_packet_t.h>
 #include <setpoint_manager.h>
 #include <log_manager.h>
+#include <dfilter.h>
+#include <aero.h>
 
 #define TWO_PI (M_PI*2.0)
 
@@ -33,28 +33,27 @@ feedback_state_t fstate; // extern variable in feedback.h
 // keep original controller gains for scaling later
 static double D_roll_gain_orig, D_pitch_gain_orig, D_yaw_gain_orig, D_X_gain_orig;
 
-// filters
-static rc_filter_t D_roll	= RC_FILTER_INITIALIZER;
-static rc_filter_t D_pitch	= RC_FILTER_INITIALIZER;
-static rc_filter_t D_yaw	= RC_FILTER_INITIALIZER;
-static rc_filter_t D_X		= RC_FILTER_INITIALIZER;
+// filters, fixed size so nothing in the control path touches the heap
+static dfilter_t D_roll;
+static dfilter_t D_pitch;
+static dfilter_t D_yaw;
+static dfilter_t D_X;
 
 
-static void __rpy_init(void)
+static int __rpy_init(void)
 {
 	// get controllers from settings
-
-	rc_filter_duplicate(&D_roll, settings.roll_controller);
-	rc_filter_duplicate(&D_pitch, settings.pitch_controller);
-	rc_filter_duplicate(&D_yaw, settings.yaw_controller);
+	if (dfilter_from_rc(&D_roll, &settings.roll_controller)) return -1;
+	if (dfilter_from_rc(&D_pitch, &settings.pitch_controller)) return -1;
+	if (dfilter_from_rc(&D_yaw, &settings.yaw_controller)) return -1;
 
 #ifdef DEBUG
 	printf("ROLL CONTROLLER:\n");
-	rc_filter_print(D_roll);
+	dfilter_print(&D_roll);
 	printf("PITCH CONTROLLER:\n");
-	rc_filter_print(D_pitch);
+	dfilter_print(&D_pitch);
 	printf("YAW CONTROLLER:\n");
-	rc_filter_print(D_yaw);
+	dfilter_print(&D_yaw);
 #endif
 
 	// save original gains as we will scale these by battery voltage later
@@ -63,15 +62,16 @@ static void __rpy_init(void)
 	D_yaw_gain_orig		= D_yaw.gain;
 
 
-	// enable saturation. these limits will be changed late but we need to
-	// enable now so that soft start can also be enabled
-	rc_filter_enable_saturation(&D_roll, -MAX_ROLL_COMPONENT, MAX_ROLL_COMPONENT);
-	rc_filter_enable_saturation(&D_pitch, -MAX_PITCH_COMPONENT, MAX_PITCH_COMPONENT);
-	rc_filter_enable_saturation(&D_yaw, -MAX_YAW_COMPONENT, MAX_YAW_COMPONENT);
+	// saturate each controller at its share of the actuators, the allocator
+	// takes care of the limits of the motors themselves
+	dfilter_set_saturation(&D_roll, -MAX_ROLL_COMPONENT, MAX_ROLL_COMPONENT);
+	dfilter_set_saturation(&D_pitch, -MAX_PITCH_COMPONENT, MAX_PITCH_COMPONENT);
+	dfilter_set_saturation(&D_yaw, -MAX_YAW_COMPONENT, MAX_YAW_COMPONENT);
 	// enable soft start
-	rc_filter_enable_soft_start(&D_roll, SOFT_START_SECONDS);
-	rc_filter_enable_soft_start(&D_pitch, SOFT_START_SECONDS);
-	rc_filter_enable_soft_start(&D_yaw, SOFT_START_SECONDS);
+	if (dfilter_enable_soft_start(&D_roll, SOFT_START_SECONDS)) return -1;
+	if (dfilter_enable_soft_start(&D_pitch, SOFT_START_SECONDS)) return -1;
+	if (dfilter_enable_soft_start(&D_yaw, SOFT_START_SECONDS)) return -1;
+	return 0;
 }
 
 
@@ -79,8 +79,8 @@ int feedback_disarm(void)
 {
 	fstate.arm_state = DISARMED;
 	// set LEDs
-	rc_led_set(RC_LED_RED, 1);
-	rc_led_set(RC_LED_GREEN, 0);
+	hal_led_set(RC_LED_RED, 1);
+	hal_led_set(RC_LED_GREEN, 0);
 	return 0;
 }
 
@@ -94,25 +94,25 @@ int feedback_arm(void)
 	// time so do it before touching anything else
 	if (settings.enable_logging) log_manager_init();
 	// get the current time
-	fstate.arm_time_ns = rc_nanos_since_boot();
+	fstate.arm_time_ns = hal_nanos_since_boot();
 	// reset the index
 	fstate.loop_index = 0;
 	
 	//static int last_en_alt_ctrl = 0; //make sure altitude control will go through initialization
 
 	// zero out all filters
-	rc_filter_reset(&D_roll);
-	rc_filter_reset(&D_pitch);
-	rc_filter_reset(&D_yaw);
-	rc_filter_reset(&D_X);
+	dfilter_reset(&D_roll);
+	dfilter_reset(&D_pitch);
+	dfilter_reset(&D_yaw);
+	dfilter_reset(&D_X);
 
 	// prefill filters with current error
-	//rc_filter_prefill_inputs(&D_roll, -state_estimate.roll);
-	rc_filter_prefill_inputs(&D_pitch, -state_estimate.pitch);
-	rc_filter_prefill_inputs(&D_yaw, -state_estimate.yaw);
+	//dfilter_prefill_inputs(&D_roll, -state_estimate.roll);
+	dfilter_prefill_inputs(&D_pitch, -state_estimate.pitch);
+	dfilter_prefill_inputs(&D_yaw, -state_estimate.yaw);
 	// set LEDs
-	rc_led_set(RC_LED_RED, 0);
-	rc_led_set(RC_LED_GREEN, 1);
+	hal_led_set(RC_LED_RED, 0);
+	hal_led_set(RC_LED_GREEN, 1);
 	// last thing is to flag as armed
 	fstate.arm_state = ARMED;
 	return 0;
@@ -123,20 +123,26 @@ int feedback_arm(void)
 int feedback_init(void)
 {
 
-	__rpy_init();		// roll, pitch yaw feedback initializer
-
-	rc_filter_duplicate(&D_X, settings.altitude_controller);
+	// roll, pitch yaw feedback initializer
+	if (__rpy_init()) {
+		fprintf(stderr, "ERROR in feedback_init, failed to set up attitude controllers\n");
+		return -1;
+	}
 
+	if (dfilter_from_rc(&D_X, &settings.altitude_controller)) {
+		fprintf(stderr, "ERROR in feedback_init, failed to set up altitude controller\n");
+		return -1;
+	}
 
 #ifdef DEBUG
 	printf("ALTITUDE CONTROLLER:\n");
-	rc_filter_print(D_X);
+	dfilter_print(&D_X);
 #endif
 
 	D_X_gain_orig = D_X.gain;
 
-	rc_filter_enable_saturation(&D_X, -1.0, 1.0);
-	rc_filter_enable_soft_start(&D_X, SOFT_START_SECONDS);
+	dfilter_set_saturation(&D_X, -MAX_X_COMPONENT, MAX_X_COMPONENT);
+	if (dfilter_enable_soft_start(&D_X, SOFT_START_SECONDS)) return -1;
 
 
 	// make sure everything is disarmed them start the ISR
@@ -150,8 +156,12 @@ int feedback_init(void)
 int feedback_march(void)
 {
 	int i;
-	double min, max;
+	int mask = 0;	// channels to allocate, bit 1<<VEC_*
+	double full, defl;
+	static aero_cursor_t full_c = AERO_CURSOR_INITIALIZER;
+	static aero_cursor_t brake_c[MAX_ROTORS];
 	double u[MAX_INPUTS], mot[MAX_ROTORS];
+	double v_scale;
 
 	// declare altitude control flag
 	static int last_en_alt_ctrl = 0; //0 if alt.control was not running last time 
@@ -197,9 +207,11 @@ int feedback_march(void)
 	}
 	
 	// We are about to start marching the individual SISO controllers forward.
-	// Start by zeroing out the motors signals then add from there.
-	for (i = 0; i < MAX_ROTORS; i++) mot[i] = 0.0;
+	// Start by zeroing out the inputs, the allocator fills in the motors.
 	for (i = 0; i < MAX_INPUTS; i++) u[i] = 0.0;
+
+	// scale all gains by battery voltage
+	v_scale = settings.v_nominal / state_estimate.v_batt_lp;
 	
 	/***************************************************************************
 	* Altitude Controller
@@ -213,26 +225,16 @@ int feedback_march(void)
 		if (last_en_alt_ctrl == 0)
 		{
 
-			rc_filter_reset(&D_X);   // reset the filter and reads from json
+			dfilter_reset(&D_X);   // reset the filter
 			
-			rc_filter_prefill_outputs(&D_X, 0);
+			dfilter_prefill_outputs(&D_X, 0);
 			last_en_alt_ctrl = 1;
 		}
 
-
-		mix_check_saturation(VEC_X, mot, &min, &max);
-		if (max > MAX_X_COMPONENT)  max = MAX_X_COMPONENT;
-		if (min < -MAX_X_COMPONENT) min = -MAX_X_COMPONENT;
-		if (max < 0.01 * MAX_X_COMPONENT && min > -0.01 * MAX_X_COMPONENT) {
-			//printf("WARNING: controller bounds are zeros, changing them to to MAX_X_COMPONENT...\n");
-			max = MAX_X_COMPONENT;
-			min = -MAX_X_COMPONENT;
-		}
-		rc_filter_enable_saturation(&D_X, min, max);
-		D_X.gain = D_X_gain_orig * settings.v_nominal / state_estimate.v_batt_lp; //updating the gains based on battery voltage
-		//u[VEC_X] = rc_filter_march(&D_X, (settings.target_altitude_m - setpoint.alt)); //this has to be the error between target and predicted value
-		u[VEC_X] = rc_filter_march(&D_X, (settings.target_altitude_m - setpoint.alt)/ALT_MAX_ERROR); //this has to be the error between target and predicted value
-		mix_add_input(u[VEC_X], VEC_X, mot);
+		D_X.gain = D_X_gain_orig * v_scale; //updating the gains based on battery voltage
+		//u[VEC_X] = dfilter_march(&D_X, (settings.target_altitude_m - setpoint.alt)); //this has to be the error between target and predicted value
+		u[VEC_X] = dfilter_march(&D_X, (settings.target_altitude_m - setpoint.alt)/ALT_MAX_ERROR); //this has to be the error between target and predicted value
+		mask |= 1 << VEC_X;
 	}
 
 	/***************************************************************************
@@ -240,74 +242,49 @@ int feedback_march(void)
 	***************************************************************************/
 	if (setpoint.en_r_ctrl) {
 		// Roll
-		mix_check_saturation(VEC_ROLL, mot, &min, &max);
-		if (max > MAX_ROLL_COMPONENT)  max = MAX_ROLL_COMPONENT;
-		if (min < -MAX_ROLL_COMPONENT) min = -MAX_ROLL_COMPONENT;
-		//must fix an issue with [-0.0,+0.0] saturation:
-		if (max < 0.01 * MAX_ROLL_COMPONENT && min > -0.01 * MAX_ROLL_COMPONENT) {
-			//printf("WARNING: controller bounds are zeros, changing them to to MAX_ROLL_COMPONENT...\n");
-			max = MAX_ROLL_COMPONENT;
-			min = -MAX_ROLL_COMPONENT;
-		}
-		
-		rc_filter_enable_saturation(&D_roll, min, max);
-		D_roll.gain = D_roll_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
-		u[VEC_ROLL] = rc_filter_march(&D_roll, setpoint.roll - state_estimate.roll);
-		mix_add_input(u[VEC_ROLL], VEC_ROLL, mot);
+		D_roll.gain = D_roll_gain_orig * v_scale;
+		u[VEC_ROLL] = dfilter_march(&D_roll, setpoint.roll - state_estimate.roll);
+		mask |= 1 << VEC_ROLL;
 	}
 
 	if (setpoint.en_py_ctrl) {
 		// Pitch
-		mix_check_saturation(VEC_PITCH, mot, &min, &max);
-		if (max > MAX_PITCH_COMPONENT)  max = MAX_PITCH_COMPONENT;
-		if (min < -MAX_PITCH_COMPONENT) min = -MAX_PITCH_COMPONENT;
-		//printf("\n max = %f and min = %f \n", max, min);
-		//must fix an issue with [-0.0,+0.0] saturation:
-		if (max < 0.01 * MAX_PITCH_COMPONENT && min > -0.01 * MAX_PITCH_COMPONENT) {
-			//printf("WARNING: controller bounds are zeros, changing them to to MAX_PITCH_COMPONENT...\n");
-			max = MAX_PITCH_COMPONENT;
-			min = -MAX_PITCH_COMPONENT;
-		}
-		rc_filter_enable_saturation(&D_pitch, min, max);
-		D_pitch.gain = D_pitch_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
-		u[VEC_PITCH] = rc_filter_march(&D_pitch, -(setpoint.pitch - state_estimate.pitch)); //full PID control
+		D_pitch.gain = D_pitch_gain_orig * v_scale;
+		u[VEC_PITCH] = dfilter_march(&D_pitch, -(setpoint.pitch - state_estimate.pitch)); //full PID control
 		//u[VEC_PITCH] = (setpoint.pitch - state_estimate.pitch) * 2.0; //test using just a P controller
-		mix_add_input(u[VEC_PITCH], VEC_PITCH, mot);
-		
-		//printf("\n setpoint.pitch = %f \n state_estimate.pitch = %f\n D_pitch.gain = %f\n u = %f\n ", setpoint.pitch, state_estimate.pitch, D_pitch.gain, u[VEC_PITCH]);
 
 		// Yaw
-		mix_check_saturation(VEC_YAW, mot, &min, &max);
-		if (max > MAX_YAW_COMPONENT)  max = MAX_YAW_COMPONENT;
-		if (min < -MAX_YAW_COMPONENT) min = -MAX_YAW_COMPONENT;
-		//must fix an issue with [-0.0,+0.0] saturation:
-		if (max < 0.01 * MAX_YAW_COMPONENT && min > -0.01 * MAX_YAW_COMPONENT) {
-			//printf("WARNING: controller bounds are zeros, changing them to to MAX_YAW_COMPONENT...\n");
-			max = MAX_YAW_COMPONENT;
-			min = -MAX_YAW_COMPONENT;
-		}
-		rc_filter_enable_saturation(&D_yaw, min, max);
-		D_yaw.gain = D_yaw_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
-		u[VEC_YAW] = rc_filter_march(&D_yaw, -(setpoint.yaw - state_estimate.yaw));
-		mix_add_input(u[VEC_YAW], VEC_YAW, mot);
-
-		//printf("\n mot[0] = %f, mot[1] = %f, mot[2] = %f, mot[3] = %f \n", mot[0], mot[1], mot[2], mot[3]);
+		D_yaw.gain = D_yaw_gain_orig * v_scale;
+		u[VEC_YAW] = dfilter_march(&D_yaw, -(setpoint.yaw - state_estimate.yaw));
+		mask |= (1 << VEC_PITCH) | (1 << VEC_YAW);
 	}
 
+	/***************************************************************************
+	* Allocate all requested channels at once within the actuator limits
+	***************************************************************************/
+	if (mix_allocate(u, mask, mot, NULL)) return -1;
+
 	/***************************************************************************
 	* Send Actuator signals immediately at the end of the control loop
 	***************************************************************************/
+	// mot is the share of the full brake drag increment each brake should
+	// add, at the reference dynamic pressure if there is one. Turn that into
+	// the deflection that gives it at the current Mach number.
+	full = aero_increment(&full_c, 1.0, state_estimate.mach);
+	if (settings.aero_ref_q_pa > 0.0) {
+		full *= settings.aero_ref_q_pa / fmax(state_estimate.dyn_press, AERO_MIN_Q);
+	}
 	for (i = 0; i < settings.num_rotors; i++) {
 		rc_saturate_double(&mot[i], 0.0, 1.0);
-		fstate.m[i] = map_motor_signal(mot[i]);
+		defl = aero_deflection(&brake_c[i], mot[i] * full, state_estimate.mach);
+		fstate.m[i] = map_motor_signal(defl);
 
 		// final saturation just to take care of possible rounding errors
 		// this should not change the values and is probably excessive
 		rc_saturate_double(&fstate.m[i], 0.0, 1.0);
-
-		// finally send mapped signal to servos:
-        servos_march(i, &fstate.m[i]);
 	}
+	// finally send all mapped signals to servos in one batch:
+	if (servos_march(fstate.m, settings.num_rotors) == -1) return -1;
 
 	/***************************************************************************
 	* Final cleanup, timing, and indexing
@@ -317,7 +294,7 @@ int feedback_march(void)
 	// keep track of loops since arming
 	fstate.loop_index++;
 	// log us since arming, mostly for the log
-	fstate.last_step_ns = rc_nanos_since_boot();
+	fstate.last_step_ns = hal_nanos_since_boot();
 
 	return 0;
 }
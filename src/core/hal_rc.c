@@ -0,0 +1,400 @@
+/**
+ * @file hal_rc.c
+ *
+ * Hardware backend of the HAL, forwards everything to librobotcontrol.
+ * This is what runs on the BeagleBone Blue. See hal.h
+ */
+
+#ifndef OFFBOARD_TEST
+
+#include <stdio.h>
+#include <time.h>
+
+#include <rc/start_stop.h>
+#include <rc/time.h>
+#include <rc/pthread.h>
+#include <rc/adc.h>
+#include <rc/servo.h>
+#include <rc/mpu.h>
+#include <rc/bmp.h>
+#include <rc/button.h>
+#include <rc/led.h>
+#include <rc/cpu.h>
+#include <rc/encoder.h>
+#include <rc/i2c.h>
+
+#include <hal.h>
+
+// MPU-9250 registers used in raw FIFO mode, librobotcontrol only drives the
+// FIFO itself in DMP mode
+#define MPU_SMPLRT_DIV		0x19
+#define MPU_FIFO_EN		0x23
+#define MPU_USER_CTRL		0x6A
+#define MPU_FIFO_COUNTH		0x72
+#define MPU_FIFO_R_W		0x74
+#define MPU_FIFO_EN_ACCEL_GYRO	0x78	// accel and gyro x, y, z, no temperature
+#define MPU_USER_CTRL_FIFO_EN	0x40
+#define MPU_USER_CTRL_FIFO_RST	0x04
+#define MPU_FIFO_SIZE		512	// bytes
+#define MPU_FIFO_SAMPLE_BYTES	12	// accel then gyro, big endian int16
+#define MPU_INTERNAL_HZ		1000	// sample clock with the DLPF on
+
+static rc_mpu_data_t* fifo_data;
+static rc_mpu_config_t fifo_conf;
+static void (*fifo_callback)(void);
+static pthread_t fifo_thread;
+static uint64_t fifo_period_ns;
+static int fifo_running;
+
+// rc_i2c_lock_bus() is only an advisory flag that nobody waits on, so the
+// FIFO reader and the barometer thread serialize their transactions on the
+// shared bus here. Priority inheritance keeps a preempted BMP read from
+// holding up the real-time FIFO reader for long.
+static pthread_mutex_t i2c_mutex;
+static pthread_once_t i2c_once = PTHREAD_ONCE_INIT;
+
+// bus of the IMU while librobotcontrol's DMP thread reads it, -1 otherwise
+static int dmp_bus = -1;
+
+static void __i2c_mutex_init(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&i2c_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void __i2c_lock(void)
+{
+	pthread_once(&i2c_once, __i2c_mutex_init);
+	pthread_mutex_lock(&i2c_mutex);
+}
+
+static void __i2c_unlock(void)
+{
+	pthread_mutex_unlock(&i2c_mutex);
+}
+
+static int __fifo_reset(void)
+{
+	if (rc_i2c_write_byte(fifo_conf.i2c_bus, MPU_USER_CTRL, MPU_USER_CTRL_FIFO_RST)) return -1;
+	return rc_i2c_write_byte(fifo_conf.i2c_bus, MPU_USER_CTRL, MPU_USER_CTRL_FIFO_EN);
+}
+
+// stands in for the DMP interrupt, wakes up once per batch
+static void* __fifo_func(__attribute__((unused)) void* ptr)
+{
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (fifo_running && rc_get_state() != EXITING) {
+		next.tv_nsec += fifo_period_ns;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		if (fifo_running && fifo_callback != NULL) fifo_callback();
+	}
+	return NULL;
+}
+
+uint64_t hal_nanos_since_boot(void)
+{
+	return rc_nanos_since_boot();
+}
+
+void hal_usleep(unsigned int us)
+{
+	rc_usleep(us);
+}
+
+int hal_kill_existing_process(float timeout_s)
+{
+	return rc_kill_existing_process(timeout_s);
+}
+
+int hal_make_pid_file(void)
+{
+	return rc_make_pid_file();
+}
+
+int hal_cpu_set_governor(rc_governor_t gov)
+{
+	return rc_cpu_set_governor(gov);
+}
+
+int hal_pthread_create(pthread_t* thread, void* (*func)(void*), void* arg,
+	int policy, int priority)
+{
+	return rc_pthread_create(thread, func, arg, policy, priority);
+}
+
+int hal_led_set(rc_led_t led, int value)
+{
+	return rc_led_set(led, value);
+}
+
+int hal_led_blink(rc_led_t led, float hz, float duration)
+{
+	return rc_led_blink(led, hz, duration);
+}
+
+int hal_button_init(int chip, int pin, char polarity, int debounce_us)
+{
+	return rc_button_init(chip, pin, polarity, debounce_us);
+}
+
+int hal_button_set_callbacks(int chip, int pin, void (*press_func)(void),
+	void (*release_func)(void))
+{
+	return rc_button_set_callbacks(chip, pin, press_func, release_func);
+}
+
+int hal_button_get_state(int chip, int pin)
+{
+	return rc_button_get_state(chip, pin);
+}
+
+int hal_adc_init(void)
+{
+	return rc_adc_init();
+}
+
+double hal_adc_batt(void)
+{
+	return rc_adc_batt();
+}
+
+double hal_adc_dc_jack(void)
+{
+	return rc_adc_dc_jack();
+}
+
+int hal_bmp_init(rc_bmp_oversample_t oversample, rc_bmp_filter_t filter)
+{
+	int ret;
+	__i2c_lock();
+	ret = rc_bmp_init(oversample, filter);
+	__i2c_unlock();
+	return ret;
+}
+
+int hal_bmp_read(rc_bmp_data_t* data)
+{
+	int ret, bus = __atomic_load_n(&dmp_bus, __ATOMIC_ACQUIRE);
+
+	// the DMP thread never takes i2c_mutex, it only sets the advisory bus
+	// lock. rc_bmp_read() would just warn and go ahead, so leave the bus to
+	// the DMP read and let the caller try again later.
+	if (bus >= 0 && rc_i2c_get_lock(bus)) return 1;
+	__i2c_lock();
+	ret = rc_bmp_read(data);
+	__i2c_unlock();
+	return ret;
+}
+
+int hal_mpu_is_gyro_calibrated(void)
+{
+	return rc_mpu_is_gyro_calibrated();
+}
+
+int hal_mpu_is_accel_calibrated(void)
+{
+	return rc_mpu_is_accel_calibrated();
+}
+
+int hal_mpu_is_mag_calibrated(void)
+{
+	return rc_mpu_is_mag_calibrated();
+}
+
+int hal_mpu_initialize_dmp(rc_mpu_data_t* data, rc_mpu_config_t conf)
+{
+	int ret;
+
+	__i2c_lock();
+	ret = rc_mpu_initialize_dmp(data, conf);
+	__i2c_unlock();
+	if (ret == 0) __atomic_store_n(&dmp_bus, conf.i2c_bus, __ATOMIC_RELEASE);
+	return ret;
+}
+
+int hal_mpu_set_dmp_callback(void (*func)(void))
+{
+	return rc_mpu_set_dmp_callback(func);
+}
+
+int hal_mpu_initialize_fifo(rc_mpu_data_t* data, rc_mpu_config_t conf,
+	int sample_rate, int batch)
+{
+	if (fifo_running) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, already running\n");
+		return -1;
+	}
+	if (sample_rate <= 0 || sample_rate > MPU_INTERNAL_HZ ||
+		MPU_INTERNAL_HZ % sample_rate || batch <= 0 ||
+		batch * MPU_FIFO_SAMPLE_BYTES > MPU_FIFO_SIZE / 2) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, invalid rate or batch\n");
+		return -1;
+	}
+
+	// regular setup with the DLPF from conf, loads the calibration too
+	__i2c_lock();
+	if (rc_mpu_initialize(data, conf)) {
+		__i2c_unlock();
+		return -1;
+	}
+	fifo_data = data;
+	fifo_conf = conf;
+
+	rc_i2c_lock_bus(conf.i2c_bus);
+	rc_i2c_set_device_address(conf.i2c_bus, conf.i2c_addr);
+	if (rc_i2c_write_byte(conf.i2c_bus, MPU_SMPLRT_DIV, MPU_INTERNAL_HZ / sample_rate - 1) ||
+		rc_i2c_write_byte(conf.i2c_bus, MPU_FIFO_EN, MPU_FIFO_EN_ACCEL_GYRO) ||
+		__fifo_reset()) {
+		rc_i2c_unlock_bus(conf.i2c_bus);
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, failed to set up the FIFO\n");
+		rc_mpu_power_off();
+		__i2c_unlock();
+		return -1;
+	}
+	rc_i2c_unlock_bus(conf.i2c_bus);
+	__i2c_unlock();
+
+	fifo_period_ns = 1000000000ULL * batch / sample_rate;
+	fifo_running = 1;
+	if (rc_pthread_create(&fifo_thread, __fifo_func, NULL,
+		conf.dmp_interrupt_sched_policy, conf.dmp_interrupt_priority)) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, failed to start thread\n");
+		fifo_running = 0;
+		__i2c_lock();
+		rc_mpu_power_off();
+		__i2c_unlock();
+		return -1;
+	}
+	return 0;
+}
+
+int hal_mpu_set_fifo_callback(void (*func)(void))
+{
+	fifo_callback = func;
+	return 0;
+}
+
+int hal_mpu_read_fifo(hal_imu_raw_t* buf, int max)
+{
+	uint8_t raw[MPU_FIFO_SIZE];
+	const int bus = fifo_conf.i2c_bus;
+	int count, n, i, j;
+	int16_t v;
+
+	__i2c_lock();
+	rc_i2c_lock_bus(bus);
+	rc_i2c_set_device_address(bus, fifo_conf.i2c_addr);
+	if (rc_i2c_read_bytes(bus, MPU_FIFO_COUNTH, 2, raw) != 2) {
+		rc_i2c_unlock_bus(bus);
+		__i2c_unlock();
+		return -1;
+	}
+	count = (raw[0] << 8 | raw[1]) & 0x1FFF;
+
+	// a full FIFO has dropped samples and may be out of alignment
+	if (count >= MPU_FIFO_SIZE || count % MPU_FIFO_SAMPLE_BYTES) {
+		__fifo_reset();
+		rc_i2c_unlock_bus(bus);
+		__i2c_unlock();
+		return 0;
+	}
+	n = count / MPU_FIFO_SAMPLE_BYTES;
+	if (n > max) n = max;
+	if (n > 0 && rc_i2c_read_bytes(bus, MPU_FIFO_R_W, n * MPU_FIFO_SAMPLE_BYTES, raw)
+		!= n * MPU_FIFO_SAMPLE_BYTES) {
+		rc_i2c_unlock_bus(bus);
+		__i2c_unlock();
+		return -1;
+	}
+	rc_i2c_unlock_bus(bus);
+	__i2c_unlock();
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 3; j++) {
+			v = (int16_t)(raw[i * MPU_FIFO_SAMPLE_BYTES + 2 * j] << 8 |
+				raw[i * MPU_FIFO_SAMPLE_BYTES + 2 * j + 1]);
+			buf[i].accel[j] = v * fifo_data->accel_to_ms2;
+			v = (int16_t)(raw[i * MPU_FIFO_SAMPLE_BYTES + 6 + 2 * j] << 8 |
+				raw[i * MPU_FIFO_SAMPLE_BYTES + 6 + 2 * j + 1]);
+			buf[i].gyro[j] = v * fifo_data->gyro_to_degs;
+		}
+	}
+	return n;
+}
+
+int hal_mpu_power_off(void)
+{
+	int ret;
+
+	if (fifo_running) {
+		fifo_running = 0;
+		pthread_join(fifo_thread, NULL);
+		fifo_callback = NULL;
+	}
+	__atomic_store_n(&dmp_bus, -1, __ATOMIC_RELEASE);
+	__i2c_lock();
+	ret = rc_mpu_power_off();
+	__i2c_unlock();
+	return ret;
+}
+
+int hal_servo_init(void)
+{
+	return rc_servo_init();
+}
+
+void hal_servo_cleanup(void)
+{
+	rc_servo_cleanup();
+}
+
+int hal_servo_power_rail_en(int en)
+{
+	return rc_servo_power_rail_en(en);
+}
+
+int hal_servo_send_pulse_us(int ch, int us)
+{
+	return rc_servo_send_pulse_us(ch, us);
+}
+
+int hal_servo_send_pulses_us(const int* us, int n)
+{
+	int i;
+	if (n < 1 || n > RC_SERVO_CH_MAX) {
+		fprintf(stderr, "ERROR in hal_servo_send_pulses_us, %d channels out of range\n", n);
+		return -1;
+	}
+	// the PRU picks up each width from shared memory on its next period, so
+	// writing them back to back lands them all in the same servo frame
+	for (i = 0; i < n; i++) {
+		if (rc_servo_send_pulse_us(i + 1, us[i]) == -1) return -1;
+	}
+	return 0;
+}
+
+int hal_encoder_init(void)
+{
+	return rc_encoder_init();
+}
+
+int hal_encoder_cleanup(void)
+{
+	return rc_encoder_cleanup();
+}
+
+int hal_encoder_read(int ch)
+{
+	return rc_encoder_read(ch);
+}
+
+#endif // OFFBOARD_TEST
@@ -0,0 +1,524 @@
+/**
+ * @file hal_sim.c
+ *
+ * Software backend of the HAL, only compiled in with OFFBOARD_TEST.
+ *
+ * A simple vertical flight model stands in for the hardware: the rocket sits
+ * on the pad until sim_launch_time_s, burns the motor, coasts with drag (the
+ * airbrake servos add drag) and descends under a parachute after apogee. A
+ * background thread steps the model at the configured DMP sample rate, fills the MPU data struct
+ * and calls the DMP callback just like the real IMU interrupt. In raw FIFO
+ * mode it steps at the FIFO rate instead, queues a sample per step in a FIFO
+ * as deep as the MPU one and calls the FIFO callback once per batch. The simulated
+ * clock only moves when the model steps, so with sim_time_scale > 1 the whole
+ * flight runs faster than real time and with sim_time_scale = 0 it runs as
+ * fast as the host allows. Sensor noise uses fixed seeds so runs repeat.
+ * The IMU and the barometer each have their own seed, and the barometer
+ * reading is latched by the sim thread right before every interrupt, so
+ * hal_bmp_read() on the sampler thread only copies the reading of the step
+ * that triggered it.
+ */
+
+#ifdef OFFBOARD_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include <rc/start_stop.h>
+#include <rc/pthread.h>
+
+#include <hal.h>
+#include <settings.h>
+#include <rcs_defs.h>
+#include <mix.h>
+
+// vehicle model
+#define SIM_THRUST_ACCEL	70.0	///< net motor acceleration during burn (m/s^2)
+#define SIM_BURN_TIME_S		2.5		///< motor burn time (s)
+#define SIM_DRAG_K			0.00025	///< 0.5*rho*Cd*A/m of the clean airframe (1/m)
+#define SIM_BRAKE_DRAG_GAIN	2.0		///< extra drag multiplier at full brake deflection
+#define SIM_CHUTE_VEL		6.0		///< descent rate under parachute (m/s)
+#define SIM_PAD_ALT_M		200.0	///< launch site elevation above sea level (m)
+#define SIM_SEA_LEVEL_PA	101325.0
+
+// servo pulse range treated as brakes fully in / fully out
+#define SIM_SERVO_MIN_US	1550.0
+#define SIM_SERVO_MAX_US	1950.0
+
+// sensor noise (1 sigma)
+#define SIM_BMP_NOISE_M		0.3		///< m
+#define SIM_ACCEL_NOISE		0.05	///< m/s^2
+#define SIM_GYRO_NOISE		0.02	///< deg/s
+
+#define SIM_FIFO_LEN		42		///< samples that fit in the 512 byte MPU FIFO
+
+// sleeps are shortened by this much when running as fast as possible
+#define SIM_UNPACED_SCALE	1000.0
+
+typedef struct sim_vehicle_t {
+	double alt;		///< altitude above the pad (m)
+	double vel;		///< vertical velocity (m/s)
+	double acc;		///< vertical acceleration (m/s^2)
+	double t_burn;	///< time since ignition (s)
+	int launched;
+	int landed;
+} sim_vehicle_t;
+
+static sim_vehicle_t sim;
+static uint64_t sim_time_ns;	// the simulated clock
+static int sample_rate;		// IMU interrupt rate (Hz)
+static unsigned int noise_seed = 1;	// IMU noise, sim thread only
+static unsigned int bmp_seed = 2;	// barometer noise, sim thread and init only
+static double bmp_alt;			// latched barometer altitude (m above sea level)
+
+static int servo_rail_en;
+static double servo_us[MAX_ROTORS + 1];	// index is the servo channel (1-8)
+static actuator_t servo_model[MAX_ROTORS];	// brake the servo on each channel moves
+
+static rc_mpu_data_t* mpu_data_ptr;
+static void (*dmp_callback)(void);
+static pthread_t imu_thread;
+static int imu_running;
+
+// raw FIFO mode, only touched by the sim thread and the callback it calls
+static int fifo_mode;
+static int fifo_batch;
+static void (*fifo_callback)(void);
+static hal_imu_raw_t fifo[SIM_FIFO_LEN];
+static int fifo_head, fifo_count;
+
+static double __gaussian(unsigned int* seed, double sigma)
+{
+	double u1 = (rand_r(seed) + 1.0) / ((double)RAND_MAX + 2.0);
+	double u2 = (rand_r(seed) + 1.0) / ((double)RAND_MAX + 2.0);
+	return sigma * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// what the barometer reads at the current step, picked up by hal_bmp_read()
+static void __sim_latch_bmp(void)
+{
+	double alt = SIM_PAD_ALT_M + sim.alt + __gaussian(&bmp_seed, SIM_BMP_NOISE_M);
+	__atomic_store(&bmp_alt, &alt, __ATOMIC_RELEASE);
+}
+
+// average airbrake deflection, 0 (in) to 1 (out), over the channels the
+// layout drives. Each servo follows the pulse on its channel through the
+// actuator model of the settings file.
+static double __brake_deflection(void)
+{
+	int i;
+	double frac, sum = 0.0;
+	if (!servo_rail_en) return 0.0;
+	for (i = 1; i <= settings.num_rotors; i++) {
+		frac = (servo_us[i] - SIM_SERVO_MIN_US) / (SIM_SERVO_MAX_US - SIM_SERVO_MIN_US);
+		if (frac < 0.0) frac = 0.0;
+		else if (frac > 1.0) frac = 1.0;
+		sum += actuator_march(&servo_model[i - 1], frac);
+	}
+	return sum / settings.num_rotors;
+}
+
+static void __sim_step(double dt)
+{
+	double k, defl;
+
+	// the servos move whether the vehicle does or not
+	defl = __brake_deflection();
+	if (!sim.launched) {
+		if (sim_time_ns >= (uint64_t)(settings.sim_launch_time_s * 1e9)) sim.launched = 1;
+		else return;
+	}
+	if (sim.landed) return;
+
+	sim.t_burn += dt;
+	if (sim.t_burn < SIM_BURN_TIME_S) {
+		sim.acc = SIM_THRUST_ACCEL - GRAVITY - SIM_DRAG_K * sim.vel * fabs(sim.vel);
+	}
+	else if (sim.vel >= 0.0) {
+		k = SIM_DRAG_K * (1.0 + SIM_BRAKE_DRAG_GAIN * defl);
+		sim.acc = -GRAVITY - k * sim.vel * fabs(sim.vel);
+	}
+	else {
+		k = GRAVITY / (SIM_CHUTE_VEL * SIM_CHUTE_VEL);
+		sim.acc = -GRAVITY + k * sim.vel * sim.vel;
+	}
+
+	// semi-implicit euler is plenty at this step size
+	sim.vel += sim.acc * dt;
+	sim.alt += sim.vel * dt;
+
+	if (sim.alt <= 0.0 && sim.t_burn > SIM_BURN_TIME_S) {
+		sim.alt = 0.0;
+		sim.vel = 0.0;
+		sim.acc = 0.0;
+		sim.landed = 1;
+	}
+}
+
+static void __sim_raw_sample(hal_imu_raw_t* s)
+{
+	int i;
+
+	// vehicle stays vertical with the sensor Z axis pointing up, so the
+	// accelerometer sees the specific force on Z only. see __imu_march
+	for (i = 0; i < 3; i++) {
+		s->accel[i] = __gaussian(&noise_seed, SIM_ACCEL_NOISE);
+		s->gyro[i] = __gaussian(&noise_seed, SIM_GYRO_NOISE);
+	}
+	s->accel[2] += sim.acc + GRAVITY;
+}
+
+// like the real FIFO, new samples are lost while it is full
+static void __sim_fifo_push(void)
+{
+	if (fifo_count == SIM_FIFO_LEN) return;
+	__sim_raw_sample(&fifo[(fifo_head + fifo_count) % SIM_FIFO_LEN]);
+	fifo_count++;
+}
+
+static void __sim_fill_mpu(void)
+{
+	int i;
+	hal_imu_raw_t s;
+	if (mpu_data_ptr == NULL) return;
+
+	__sim_raw_sample(&s);
+	for (i = 0; i < 3; i++) {
+		mpu_data_ptr->accel[i] = s.accel[i];
+		mpu_data_ptr->gyro[i] = s.gyro[i];
+		mpu_data_ptr->mag[i] = 0.0;
+	}
+
+	mpu_data_ptr->dmp_quat[0] = 1.0;
+	mpu_data_ptr->dmp_quat[1] = 0.0;
+	mpu_data_ptr->dmp_quat[2] = 0.0;
+	mpu_data_ptr->dmp_quat[3] = 0.0;
+	for (i = 0; i < 4; i++) mpu_data_ptr->fused_quat[i] = mpu_data_ptr->dmp_quat[i];
+	for (i = 0; i < 3; i++) {
+		mpu_data_ptr->dmp_TaitBryan[i] = 0.0;
+		mpu_data_ptr->fused_TaitBryan[i] = 0.0;
+	}
+	mpu_data_ptr->compass_heading = 0.0;
+	mpu_data_ptr->compass_heading_raw = 0.0;
+	mpu_data_ptr->temp = 25.0;
+}
+
+static void* __sim_imu_func(__attribute__((unused)) void* ptr)
+{
+	const uint64_t step_ns = 1000000000ULL / sample_rate;
+	const double dt = 1.0 / sample_rate;
+	struct timespec next;
+	uint64_t wait_ns;
+	int n = 0;
+	int i;
+
+	// the servos get marched once per simulation step
+	for (i = 0; i < settings.num_rotors; i++) {
+		if (actuator_init(&servo_model[i], &settings.actuator_model[i], dt, 0.0)) return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (imu_running && rc_get_state() != EXITING) {
+		__sim_step(dt);
+		__atomic_store_n(&sim_time_ns, sim_time_ns + step_ns, __ATOMIC_RELEASE);
+		if (fifo_mode) {
+			__sim_fifo_push();
+			if (++n == fifo_batch) {
+				n = 0;
+				__sim_latch_bmp();
+				if (fifo_callback != NULL) fifo_callback();
+			}
+		}
+		else {
+			__sim_fill_mpu();
+			__sim_latch_bmp();
+			if (dmp_callback != NULL) dmp_callback();
+		}
+
+		// pace the interrupt against the wall clock unless running unpaced
+		if (settings.sim_time_scale > 0.0) {
+			wait_ns = (uint64_t)(step_ns / settings.sim_time_scale);
+			next.tv_nsec += wait_ns % 1000000000ULL;
+			next.tv_sec += wait_ns / 1000000000ULL + next.tv_nsec / 1000000000L;
+			next.tv_nsec %= 1000000000L;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+	return NULL;
+}
+
+uint64_t hal_nanos_since_boot(void)
+{
+	return __atomic_load_n(&sim_time_ns, __ATOMIC_ACQUIRE);
+}
+
+void hal_usleep(unsigned int us)
+{
+	double scale = settings.sim_time_scale > 0.0 ? settings.sim_time_scale : SIM_UNPACED_SCALE;
+	usleep((useconds_t)(us / scale));
+}
+
+int hal_kill_existing_process(__attribute__((unused)) float timeout_s)
+{
+	return 0;
+}
+
+int hal_make_pid_file(void)
+{
+	return 0;
+}
+
+int hal_cpu_set_governor(__attribute__((unused)) rc_governor_t gov)
+{
+	return 0;
+}
+
+int hal_pthread_create(pthread_t* thread, void* (*func)(void*), void* arg,
+	int policy, int priority)
+{
+	// don't need root to run the simulation
+	if (geteuid() != 0) {
+		policy = SCHED_OTHER;
+		priority = 0;
+	}
+	return rc_pthread_create(thread, func, arg, policy, priority);
+}
+
+int hal_led_set(__attribute__((unused)) rc_led_t led, __attribute__((unused)) int value)
+{
+	return 0;
+}
+
+int hal_led_blink(__attribute__((unused)) rc_led_t led, __attribute__((unused)) float hz,
+	__attribute__((unused)) float duration)
+{
+	return 0;
+}
+
+int hal_button_init(__attribute__((unused)) int chip, __attribute__((unused)) int pin,
+	__attribute__((unused)) char polarity, __attribute__((unused)) int debounce_us)
+{
+	return 0;
+}
+
+int hal_button_set_callbacks(__attribute__((unused)) int chip, __attribute__((unused)) int pin,
+	__attribute__((unused)) void (*press_func)(void),
+	__attribute__((unused)) void (*release_func)(void))
+{
+	return 0;
+}
+
+int hal_button_get_state(__attribute__((unused)) int chip, __attribute__((unused)) int pin)
+{
+	return 0; // released
+}
+
+int hal_adc_init(void)
+{
+	return 0;
+}
+
+double hal_adc_batt(void)
+{
+	return settings.v_nominal;
+}
+
+double hal_adc_dc_jack(void)
+{
+	return settings.v_nominal_jack;
+}
+
+int hal_bmp_init(__attribute__((unused)) rc_bmp_oversample_t oversample,
+	__attribute__((unused)) rc_bmp_filter_t filter)
+{
+	// something to read before the sim thread runs
+	__sim_latch_bmp();
+	return 0;
+}
+
+int hal_bmp_read(rc_bmp_data_t* data)
+{
+	double alt;
+
+	__atomic_load(&bmp_alt, &alt, __ATOMIC_ACQUIRE);
+	data->pressure_pa = SIM_SEA_LEVEL_PA * pow(1.0 - alt / 44330.0, 5.255);
+	data->alt_m = alt;
+	data->temp_c = 25.0 - 0.0065 * alt;
+	return 0;
+}
+
+int hal_mpu_is_gyro_calibrated(void)
+{
+	return 1;
+}
+
+int hal_mpu_is_accel_calibrated(void)
+{
+	return 1;
+}
+
+int hal_mpu_is_mag_calibrated(void)
+{
+	return 1;
+}
+
+int hal_mpu_initialize_dmp(rc_mpu_data_t* data, rc_mpu_config_t conf)
+{
+	if (imu_running) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_dmp, simulation already running\n");
+		return -1;
+	}
+	if (conf.dmp_sample_rate <= 0) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_dmp, invalid sample rate\n");
+		return -1;
+	}
+	sample_rate = conf.dmp_sample_rate;
+	mpu_data_ptr = data;
+	fifo_mode = 0;
+	__sim_fill_mpu();
+
+	imu_running = 1;
+	if (pthread_create(&imu_thread, NULL, __sim_imu_func, NULL) != 0) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_dmp, failed to start sim thread\n");
+		imu_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int hal_mpu_set_dmp_callback(void (*func)(void))
+{
+	dmp_callback = func;
+	return 0;
+}
+
+int hal_mpu_initialize_fifo(rc_mpu_data_t* data, __attribute__((unused)) rc_mpu_config_t conf,
+	int rate, int batch)
+{
+	if (imu_running) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, simulation already running\n");
+		return -1;
+	}
+	if (rate <= 0 || batch <= 0 || batch > SIM_FIFO_LEN / 2) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, invalid rate or batch\n");
+		return -1;
+	}
+	sample_rate = rate;
+	mpu_data_ptr = data;
+	data->accel_to_ms2 = 1.0;
+	data->gyro_to_degs = 1.0;
+	fifo_mode = 1;
+	fifo_batch = batch;
+	fifo_head = 0;
+	fifo_count = 0;
+
+	imu_running = 1;
+	if (pthread_create(&imu_thread, NULL, __sim_imu_func, NULL) != 0) {
+		fprintf(stderr, "ERROR in hal_mpu_initialize_fifo, failed to start sim thread\n");
+		imu_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int hal_mpu_set_fifo_callback(void (*func)(void))
+{
+	fifo_callback = func;
+	return 0;
+}
+
+int hal_mpu_read_fifo(hal_imu_raw_t* buf, int max)
+{
+	int n = 0;
+
+	while (n < max && fifo_count > 0) {
+		buf[n++] = fifo[fifo_head];
+		fifo_head = (fifo_head + 1) % SIM_FIFO_LEN;
+		fifo_count--;
+	}
+	return n;
+}
+
+int hal_mpu_power_off(void)
+{
+	if (!imu_running) return 0;
+	imu_running = 0;
+	pthread_join(imu_thread, NULL);
+	dmp_callback = NULL;
+	fifo_callback = NULL;
+	return 0;
+}
+
+int hal_servo_init(void)
+{
+	int i;
+	for (i = 0; i <= MAX_ROTORS; i++) servo_us[i] = SIM_SERVO_MIN_US;
+	servo_rail_en = 0;
+	return 0;
+}
+
+void hal_servo_cleanup(void)
+{
+	servo_rail_en = 0;
+}
+
+int hal_servo_power_rail_en(int en)
+{
+	servo_rail_en = en;
+	return 0;
+}
+
+int hal_servo_send_pulse_us(int ch, int us)
+{
+	int i;
+	if (ch < 0 || ch > MAX_ROTORS) {
+		fprintf(stderr, "ERROR in hal_servo_send_pulse_us, channel %d out of range\n", ch);
+		return -1;
+	}
+	// channel 0 means all channels, same as rc_servo_send_pulse_us
+	if (ch == 0) {
+		for (i = 1; i <= MAX_ROTORS; i++) servo_us[i] = us;
+	}
+	else servo_us[ch] = us;
+	return 0;
+}
+
+int hal_servo_send_pulses_us(const int* us, int n)
+{
+	int i;
+	if (n < 1 || n > MAX_ROTORS) {
+		fprintf(stderr, "ERROR in hal_servo_send_pulses_us, %d channels out of range\n", n);
+		return -1;
+	}
+	for (i = 0; i < n; i++) servo_us[i + 1] = us[i];
+	return 0;
+}
+
+int hal_encoder_init(void)
+{
+	return 0;
+}
+
+int hal_encoder_cleanup(void)
+{
+	return 0;
+}
+
+int hal_encoder_read(__attribute__((unused)) int ch)
+{
+	return 0;
+}
+
+int hal_sim_get_truth(double* alt_m, double* vel_ms)
+{
+	if (!imu_running) return -1;
+	*alt_m = sim.alt;
+	*vel_ms = sim.vel;
+	return 0;
+}
+
+#endif // OFFBOARD_TEST
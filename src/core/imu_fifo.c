@@ -0,0 +1,181 @@
+/**
+ * @file imu_fifo.c
+ *
+ * Raw IMU acquisition through the MPU FIFO, see imu_fifo.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <rc/math/quaternion.h>
+#include <hal.h>
+
+#include <rcs_defs.h>
+#include <settings.h>
+#include <imu_fifo.h>
+#include <mahony.h>
+
+static rc_mpu_data_t* data_ptr;
+static void (*callback)(void);
+static int batch;		// samples expected per tick
+static uint64_t period_ns;	// between two samples
+static int initialized = 0;
+
+static imu_raw_sample_t ring[IMU_RAW_RING];
+static uint64_t head;		// seq of the next sample, shared
+
+static mahony_t ahrs;		// attitude at full rate
+static double accel_peak;
+
+// written by the ISR only
+static uint64_t n_samples, n_short, n_errors;
+
+static void __fifo_isr(void)
+{
+	hal_imu_raw_t buf[IMU_FIFO_BATCH_MAX];
+	const uint64_t now = hal_nanos_since_boot();
+	const double dt = period_ns / 1e9;
+	double sum_a[3] = {0.0, 0.0, 0.0}, sum_g[3] = {0.0, 0.0, 0.0};
+	double f;
+	imu_raw_sample_t* s;
+	int n, i, j;
+
+	n = hal_mpu_read_fifo(buf, IMU_FIFO_BATCH_MAX);
+	if (n < 0) {
+		n_errors++;
+		n = 0;
+	}
+	if (n < batch) n_short++;
+
+	for (i = 0; i < n; i++) {
+		// head of the slot's previous sample is out before the slot is
+		// rewritten, so a reader that copied part of the new one sees it
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		s = &ring[head & (IMU_RAW_RING - 1)];
+		s->seq = head;
+		s->timestamp_ns = now - (uint64_t)(n - 1 - i) * period_ns;
+		for (j = 0; j < 3; j++) {
+			s->accel[j] = buf[i].accel[j];
+			s->gyro[j] = buf[i].gyro[j];
+			sum_a[j] += buf[i].accel[j];
+			sum_g[j] += buf[i].gyro[j];
+		}
+		__atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+
+		f = fabs(sqrt(buf[i].accel[0] * buf[i].accel[0] + buf[i].accel[1] * buf[i].accel[1]
+			+ buf[i].accel[2] * buf[i].accel[2]) - GRAVITY);
+		if (f > accel_peak) accel_peak = f;
+
+		mahony_update(&ahrs, buf[i].gyro, buf[i].accel, NULL, dt);
+	}
+	n_samples += n;
+
+	// on an empty read the previous tick's values stay
+	if (n > 0) {
+		for (j = 0; j < 3; j++) {
+			data_ptr->accel[j] = sum_a[j] / n;
+			data_ptr->gyro[j] = sum_g[j] / n;
+		}
+		for (j = 0; j < 4; j++) data_ptr->dmp_quat[j] = ahrs.q[j];
+		rc_quaternion_to_tb_array(data_ptr->dmp_quat, data_ptr->dmp_TaitBryan);
+	}
+	if (callback != NULL) callback();
+}
+
+int imu_fifo_init(rc_mpu_data_t* data, rc_mpu_config_t conf)
+{
+	if (initialized) {
+		fprintf(stderr, "ERROR in imu_fifo_init, already initialized\n");
+		return -1;
+	}
+	if (data == NULL) {
+		fprintf(stderr, "ERROR in imu_fifo_init, received NULL pointer\n");
+		return -1;
+	}
+	if (settings.enable_magnetometer) {
+		fprintf(stderr, "ERROR in imu_fifo_init, the magnetometer is only read in DMP mode\n");
+		return -1;
+	}
+	batch = settings.imu_fifo_hz / settings.feedback_hz;
+	if (batch < 1 || batch > IMU_FIFO_BATCH_MAX) {
+		fprintf(stderr, "ERROR in imu_fifo_init, %d samples per tick not supported\n", batch);
+		return -1;
+	}
+	period_ns = 1000000000ULL / settings.imu_fifo_hz;
+
+	data_ptr = data;
+	callback = NULL;
+	head = 0;
+	accel_peak = 0.0;
+	if (mahony_init(&ahrs, settings.mahony_kp, settings.mahony_ki)) return -1;
+	n_samples = n_short = n_errors = 0;
+	memset(ring, 0, sizeof(ring));
+
+	if (hal_mpu_set_fifo_callback(__fifo_isr)) return -1;
+	if (hal_mpu_initialize_fifo(data, conf, settings.imu_fifo_hz, batch)) {
+		fprintf(stderr, "ERROR in imu_fifo_init, failed to start the MPU FIFO\n");
+		return -1;
+	}
+	initialized = 1;
+	return 0;
+}
+
+int imu_fifo_set_callback(void (*func)(void))
+{
+	if (!initialized) {
+		fprintf(stderr, "ERROR in imu_fifo_set_callback, not initialized\n");
+		return -1;
+	}
+	callback = func;
+	return 0;
+}
+
+int imu_fifo_read(uint64_t* cursor, imu_raw_sample_t* out, int max)
+{
+	uint64_t h, first;
+	int i, n, lost;
+
+	if (!initialized || cursor == NULL || out == NULL || max <= 0) return 0;
+
+	h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	// leave a margin so the ISR is not overwriting what we copy
+	first = *cursor;
+	if (h - first > IMU_RAW_RING / 2) first = h - IMU_RAW_RING / 2;
+	n = h - first < (uint64_t)max ? (int)(h - first) : max;
+	for (i = 0; i < n; i++) out[i] = ring[(first + i) & (IMU_RAW_RING - 1)];
+
+	// anything the ISR may have overwritten while copying is dropped, the
+	// slot of seq c is rewritten once head reaches c + IMU_RAW_RING. The
+	// fence keeps the plain copies above ahead of this load.
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	lost = 0;
+	if (h >= first + IMU_RAW_RING) {
+		lost = (int)(h - IMU_RAW_RING - first + 1);
+		if (lost > n) lost = n;
+		memmove(out, out + lost, (n - lost) * sizeof(*out));
+	}
+	*cursor = first + n;
+	return n - lost;
+}
+
+double imu_fifo_take_accel_peak(void)
+{
+	double p = accel_peak;
+	accel_peak = 0.0;
+	return p;
+}
+
+int imu_fifo_print(FILE* fd)
+{
+	if (fd == NULL) {
+		fprintf(stderr, "ERROR in imu_fifo_print, NULL file\n");
+		return -1;
+	}
+	if (!initialized) return 0;
+	fprintf(fd, "imu fifo: %llu samples at %d Hz, %llu short batches, %llu read errors\n",
+		(unsigned long long)n_samples, settings.imu_fifo_hz,
+		(unsigned long long)n_short, (unsigned long long)n_errors);
+	return 0;
+}
@@ -9,12 +9,14 @@
 
 #include <rc/start_stop.h>
 #include <rc/pthread.h>
-#include <rc/time.h>
+#include <hal.h>
 //#include <rc/dsm.h>
 //#include <rc/math/other.h>
 
 #include <rcs_defs.h>
 #include <thread_defs.h>
+#include <settings.h>
+#include <rt_harden.h>
 //#include <setpoint_manager.h>
 
 user_input_t user_input; // extern variable in input_manager.h
@@ -90,11 +92,19 @@ int start_pre_flight_checks(void)
 
 void* input_manager(__attribute__((unused)) void* ptr)
 {
+	rt_harden_thread(1);
 	user_input.initialized = 1;
 	// wait for first packet
 	while (rc_get_state() != EXITING) {
+#ifdef OFFBOARD_TEST
+		// no ground station in the simulation, arm ourselves after a while
+		if (hal_nanos_since_boot() >= (uint64_t)(settings.sim_auto_arm_s * 1e9)) {
+			fallback.armed_state = ARMED;
+			user_input.input_active = 1;
+		}
+#endif
 		if (user_input.input_active) break;
-		rc_usleep(1000000 / INPUT_MANAGER_HZ);
+		hal_usleep(1000000 / INPUT_MANAGER_HZ);
 	}
 
 
@@ -111,6 +121,7 @@ void* input_manager(__attribute__((unused)) void* ptr)
 				//printf("\n\nDSM ARM REQUEST\n\n");
 			}
 		}
+		hal_usleep(1000000 / INPUT_MANAGER_HZ);
 	}
 	return NULL;
 }
@@ -128,15 +139,15 @@ int input_manager_init()
 	//need to check serial connection and incoming data from other systems
 
 	// start thread
-	if (rc_pthread_create(&input_manager_thread, &input_manager, NULL,
-		SCHED_FIFO, INPUT_MANAGER_PRI) == -1) {
+	if (hal_pthread_create(&input_manager_thread, &input_manager, NULL,
+		SCHED_FIFO, settings.input_manager_priority) == -1) {
 		fprintf(stderr, "ERROR in input_manager_init, failed to start thread\n");
 		return -1;
 	}
 	// wait for thread to start
 	for (i = 0; i < 50; i++) {
 		if (user_input.initialized) return 0;
-		rc_usleep(50000);
+		hal_usleep(50000);
 	}
 	fprintf(stderr, "ERROR in input_manager_init, timeout waiting for thread to start\n");
 	return -1;
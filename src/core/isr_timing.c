@@ -0,0 +1,228 @@
+/**
+ * @file isr_timing.c
+ *
+ * Lock-free latency histograms for __imu_isr. See isr_timing.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include <isr_timing.h>
+#include <tools.h>
+
+// log-linear buckets: values below 2^SUB_BITS get one bucket each, above that
+// every power of two is split in 2^SUB_BITS equal sub-buckets
+#define SUB_BITS	5
+#define SUB_COUNT	(1 << SUB_BITS)
+#define MAX_BITS	32	// anything above 2^32 ns (4.3 s) lands in the last bucket
+#define NUM_BUCKETS	((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+
+#if NUM_BUCKETS != ISR_TIMING_BUCKETS
+#error "ISR_TIMING_BUCKETS in isr_timing.h does not match the bucket layout"
+#endif
+
+typedef struct isr_hist_t {
+	uint32_t bucket[NUM_BUCKETS];
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint64_t last_ns;
+} isr_hist_t;
+
+static isr_hist_t hist[ISR_NUM_STAGES];
+static uint64_t nominal_ns;
+static uint64_t last_tick_ns;
+static volatile sig_atomic_t report_requested;
+
+static const char* const stage_names[ISR_NUM_STAGES] = {
+	"setpoint",
+	"battery",
+	"state_estimator",
+	"xbee",
+	"serial",
+	"serial_tx",
+	"feedback",
+	"encoders",
+	"log",
+	"jobs_after_fb",
+	"total",
+	"period",
+	"jitter",
+	"output"
+};
+
+static inline int __bucket_index(uint64_t v)
+{
+	int msb, shift, i;
+	if (v < SUB_COUNT) return (int)v;
+	if (v >> MAX_BITS) return NUM_BUCKETS - 1;
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - SUB_BITS;
+	i = (shift + 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+	return i;
+}
+
+// largest value that still falls in bucket i
+static uint64_t __bucket_upper(int i)
+{
+	int shift;
+	uint64_t mant;
+	if (i < SUB_COUNT) return (uint64_t)i;
+	shift = i / SUB_COUNT - 1;
+	mant = (uint64_t)(i % SUB_COUNT + SUB_COUNT);
+	return ((mant + 1) << shift) - 1;
+}
+
+static inline void __record(isr_stage_t stage, uint64_t ns)
+{
+	isr_hist_t* h = &hist[stage];
+	// single writer (the ISR), readers only need each word to be consistent
+	__atomic_fetch_add(&h->bucket[__bucket_index(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+	if (ns > h->max_ns) __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->last_ns, ns, __ATOMIC_RELAXED);
+}
+
+int isr_timing_init(uint64_t nominal_period_ns)
+{
+	if (nominal_period_ns == 0) {
+		fprintf(stderr, "ERROR in isr_timing_init, nominal period must be > 0\n");
+		return -1;
+	}
+	memset(hist, 0, sizeof(hist));
+	nominal_ns = nominal_period_ns;
+	last_tick_ns = 0;
+	report_requested = 0;
+	return 0;
+}
+
+uint64_t isr_timing_tick_start(void)
+{
+	uint64_t now = monotonic_ns();
+	uint64_t period;
+
+	if (last_tick_ns != 0) {
+		period = now - last_tick_ns;
+		__record(ISR_STAGE_PERIOD, period);
+		__record(ISR_STAGE_JITTER, period > nominal_ns ? period - nominal_ns : nominal_ns - period);
+	}
+	last_tick_ns = now;
+	return now;
+}
+
+void isr_timing_stage(isr_stage_t stage, uint64_t* t)
+{
+	uint64_t now = monotonic_ns();
+	__record(stage, now - *t);
+	*t = now;
+}
+
+void isr_timing_tick_end(uint64_t t_start)
+{
+	__record(ISR_STAGE_TOTAL, monotonic_ns() - t_start);
+}
+
+uint64_t isr_timing_output_committed(void)
+{
+	uint64_t now = monotonic_ns();
+	// nothing to measure from before the first tick
+	if (last_tick_ns != 0) __record(ISR_STAGE_OUTPUT, now - last_tick_ns);
+	return now;
+}
+
+double isr_timing_last_us(isr_stage_t stage)
+{
+	if (stage >= ISR_NUM_STAGES) return 0.0;
+	return __atomic_load_n(&hist[stage].last_ns, __ATOMIC_RELAXED) / 1000.0;
+}
+
+int isr_timing_get_stats(isr_stage_t stage, isr_timing_stats_t* stats, uint32_t snap[ISR_TIMING_BUCKETS])
+{
+	int i;
+	uint64_t total = 0, cum = 0;
+	uint64_t n50, n99, n999;
+
+	if (stage >= ISR_NUM_STAGES || stats == NULL || snap == NULL) {
+		fprintf(stderr, "ERROR in isr_timing_get_stats, invalid argument\n");
+		return -1;
+	}
+	memset(stats, 0, sizeof(*stats));
+
+	// take a snapshot so the percentiles agree with the total
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		snap[i] = __atomic_load_n(&hist[stage].bucket[i], __ATOMIC_RELAXED);
+		total += snap[i];
+	}
+	stats->count = total;
+	stats->mean_us = total ? __atomic_load_n(&hist[stage].sum_ns, __ATOMIC_RELAXED) / 1000.0 / total : 0.0;
+	stats->max_us = __atomic_load_n(&hist[stage].max_ns, __ATOMIC_RELAXED) / 1000.0;
+	if (total == 0) return 0;
+
+	// rank of each percentile, rounded up
+	n50 = (total * 500 + 999) / 1000;
+	n99 = (total * 990 + 999) / 1000;
+	n999 = (total * 999 + 999) / 1000;
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		if (snap[i] == 0) continue;
+		cum += snap[i];
+		if (stats->p50_us == 0.0 && cum >= n50) stats->p50_us = __bucket_upper(i) / 1000.0;
+		if (stats->p99_us == 0.0 && cum >= n99) stats->p99_us = __bucket_upper(i) / 1000.0;
+		if (cum >= n999) {
+			stats->p999_us = __bucket_upper(i) / 1000.0;
+			break;
+		}
+	}
+	// bucket upper bounds can overshoot the true max
+	if (stats->p50_us > stats->max_us) stats->p50_us = stats->max_us;
+	if (stats->p99_us > stats->max_us) stats->p99_us = stats->max_us;
+	if (stats->p999_us > stats->max_us) stats->p999_us = stats->max_us;
+	return 0;
+}
+
+const char* isr_timing_stage_name(isr_stage_t stage)
+{
+	if (stage >= ISR_NUM_STAGES) return "unknown";
+	return stage_names[stage];
+}
+
+int isr_timing_print(FILE* fd)
+{
+	int i;
+	isr_timing_stats_t s;
+	uint32_t snap[ISR_TIMING_BUCKETS];
+
+	if (fd == NULL) {
+		fprintf(stderr, "ERROR in isr_timing_print, NULL file\n");
+		return -1;
+	}
+	fprintf(fd, "\n__imu_isr timing (us), nominal period %.1f us\n", nominal_ns / 1000.0);
+	fprintf(fd, "%-16s %10s %9s %9s %9s %9s %9s\n", "stage", "count", "mean", "p50", "p99", "p99.9", "max");
+	for (i = 0; i < ISR_NUM_STAGES; i++) {
+		if (isr_timing_get_stats((isr_stage_t)i, &s, snap) < 0) return -1;
+		fprintf(fd, "%-16s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", stage_names[i],
+			(unsigned long long)s.count, s.mean_us, s.p50_us, s.p99_us, s.p999_us, s.max_us);
+	}
+	// share of the loop period spent in the ISR, the rest is headroom
+	if (isr_timing_get_stats(ISR_STAGE_TOTAL, &s, snap) < 0) return -1;
+	fprintf(fd, "ISR load: %.1f%% mean, %.1f%% p99.9 of the %.1f us period\n",
+		100.0 * s.mean_us * 1000.0 / nominal_ns, 100.0 * s.p999_us * 1000.0 / nominal_ns,
+		nominal_ns / 1000.0);
+	fflush(fd);
+	return 0;
+}
+
+void isr_timing_request_report(void)
+{
+	report_requested = 1;
+}
+
+int isr_timing_service_report(void)
+{
+	if (!report_requested) return 0;
+	report_requested = 0;
+	isr_timing_print(stdout);
+	return 1;
+}
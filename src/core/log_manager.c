@@ -18,20 +18,22 @@
 
 
 #include <rc/start_stop.h>
-#include <rc/time.h>
+#include <hal.h>
 #include <rc/pthread.h>
 
 #include <rcs_defs.h>
 #include <thread_defs.h>
 #include <log_manager.h>
+#include <scheduler.h>
 #include <settings.h>
+#include <rt_harden.h>
 #include <setpoint_manager.h>
 #include <feedback.h>
 #include <state_estimator.h>
-#include <rc/encoder.h>
 #include <signal.h>
 #include <xbee_packet_t.h>
 #include <servos.h>
+#include <imu_fifo.h>
 
 #define MAX_LOG_FILES	500
 #define BUF_LEN		50
@@ -41,6 +43,10 @@ static int buffer_pos;		// position in current buffer
 static int current_buf;	// 0 or 1 to indicate which buffer is being filled
 static int needs_writing;	// flag set to 1 if a buffer is full
 static FILE* fd;		// file descriptor for the log file
+static char timing_path[100];	// isr timing summary written next to the log
+static FILE* raw_fd;		// full-rate IMU samples, FIFO mode only
+static uint64_t raw_cursor;
+static imu_raw_sample_t raw_buf[IMU_RAW_RING / 2];
 
 // array of two buffers so one can fill while writing the other to file
 static log_entry_t buffer[2][BUF_LEN];
@@ -52,6 +58,8 @@ static int logging_enabled; // set to 0 to exit the write_thread
 
 static int __write_header(FILE* fd)
 {
+	int i;
+
 	// always print loop index
 	fprintf(fd, "loop_index, counter, last_step_ns");
 	
@@ -67,6 +75,10 @@ static int __write_header(FILE* fd)
 		fprintf(fd, ",roll,pitch,yaw,X,Y,Z,Xdot,Ydot,Zdot,xp,yp,zp,xb,yb,zb,proj_ap");
 	}
 
+	if(settings.log_drag){
+		fprintf(fd, ",drag_scale,drag_scale_var,drag_resid");
+	}
+
 	if(settings.log_setpoint){
 		fprintf(fd, ",sp_roll,sp_pitch,sp_yaw,sp_X,sp_Y,sp_Z,sp_Xdot,sp_Ydot,sp_Zdot,sp_alt");
 	}
@@ -75,28 +87,23 @@ static int __write_header(FILE* fd)
 		fprintf(fd, ",u_roll,u_pitch,u_yaw,u_X,u_Y,u_Z");
 	}
 
-	if(settings.log_motor_signals && settings.num_rotors==8){
-		fprintf(fd, ",mot_1,mot_2,mot_3,mot_4,mot_5,mot_6,mot_7,mot_8");
-	}
-	if(settings.log_motor_signals && settings.num_rotors==6){
-		fprintf(fd, ",mot_1,mot_2,mot_3,mot_4,mot_5,mot_6");
+	if(settings.log_motor_signals){
+		for(i=0;i<settings.num_rotors;i++){
+			fprintf(fd, ",mot_%d", i+1);
+		}
 	}
-	if(settings.log_motor_signals && settings.num_rotors==4){
-		fprintf(fd, ",mot_1,mot_2,mot_3,mot_4");
+
+	if(settings.log_motor_signals_us){
+		for(i=0;i<settings.num_rotors;i++){
+			fprintf(fd, ",mot_%d_us", i+1);
+		}
 	}
 
-	if (settings.log_motor_signals_us && settings.num_rotors == 8)
-    {
-        fprintf(fd, ",mot_1_us,mot_2_us,mot_3_us,mot_4_us,mot_5_us,mot_6_us,mot_7_us,mot_8_us");
-    }
-    if (settings.log_motor_signals_us && settings.num_rotors == 6)
-    {
-        fprintf(fd, ",mot_1_us,mot_2_us,mot_3_us,mot_4_us,mot_5_us,mot_6_us");
-    }
-    if (settings.log_motor_signals_us && settings.num_rotors == 4)
-    {
-        fprintf(fd, ",mot_1_us,mot_2_us,mot_3_us,mot_4_us");
-    }
+	if(settings.log_isr_timing){
+		for(i=0;i<ISR_NUM_STAGES;i++){
+			fprintf(fd, ",isr_%s_us", isr_timing_stage_name((isr_stage_t)i));
+		}
+	}
 
 	fprintf(fd, "\n");
 	return 0;
@@ -107,6 +114,8 @@ static int __write_header(FILE* fd)
 
 static int __write_log_entry(FILE* fd, log_entry_t e)
 {
+	int i;
+
 	// always print loop index
 	// B: PRId64 for things who can be negative or positive
 	// B: PRIu64 can only be positive
@@ -161,6 +170,13 @@ static int __write_log_entry(FILE* fd, log_entry_t e)
 							e.proj_ap);
 	}
 
+	if(settings.log_drag){
+		fprintf(fd, ",%.5F,%.3e,%.4F",\
+							e.drag_scale,\
+							e.drag_scale_var,\
+							e.drag_resid);
+	}
+
 	if(settings.log_setpoint){
 		fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F",\
 							e.sp_roll,\
@@ -185,67 +201,50 @@ static int __write_log_entry(FILE* fd, log_entry_t e)
 							e.u_Z);
 	}
 
-	if(settings.log_motor_signals && settings.num_rotors==8){
-		fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F",	e.mot_1,\
-							e.mot_2,\
-							e.mot_3,\
-							e.mot_4,\
-							e.mot_5,\
-							e.mot_6,\
-							e.mot_7,\
-							e.mot_8);
-	}
-	if(settings.log_motor_signals && settings.num_rotors==6){
-		fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F",	e.mot_1,\
-							e.mot_2,\
-							e.mot_3,\
-							e.mot_4,\
-							e.mot_5,\
-							e.mot_6);
-	}
-	if(settings.log_motor_signals && settings.num_rotors==4){
-		fprintf(fd, ",%.4F,%.4F,%.4F,%.4F",		e.mot_1,\
-							e.mot_2,\
-							e.mot_3,\
-							e.mot_4);
-	}
-
-	if(settings.log_motor_signals_us && settings.num_rotors==8){
-		fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F",	e.mot_1_us,\
-							e.mot_2_us,\
-							e.mot_3_us,\
-							e.mot_4_us,\
-							e.mot_5_us,\
-							e.mot_6_us,\
-							e.mot_7_us,\
-							e.mot_8_us);
-	}
-    if (settings.log_motor_signals_us && settings.num_rotors == 6)
-    {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.mot_1_us,\
-							e.mot_2_us,\
-							e.mot_3_us,\
-							e.mot_4_us,\
-							e.mot_5_us,\
-							e.mot_6_us);
-	}
-    if (settings.log_motor_signals_us && settings.num_rotors == 4)
-    {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F", e.mot_1_us,\
-							e.mot_2_us,\
-							e.mot_3_us,\
-							e.mot_4_us);
+	if(settings.log_motor_signals){
+		for(i=0;i<settings.num_rotors;i++){
+			fprintf(fd, ",%.4F", e.mot[i]);
+		}
+	}
+
+	if(settings.log_motor_signals_us){
+		for(i=0;i<settings.num_rotors;i++){
+			fprintf(fd, ",%.4F", e.mot_us[i]);
+		}
 	}
 
+	if(settings.log_isr_timing){
+		for(i=0;i<ISR_NUM_STAGES;i++){
+			fprintf(fd, ",%.1F", e.isr_us[i]);
+		}
+	}
 
 	fprintf(fd, "\n");
 	return 0;
 }
 
 
+// writes out the full-rate IMU samples that came in since the last call
+static void __write_imu_raw(void)
+{
+	int i, n;
+
+	if(raw_fd == NULL) return;
+	while((n = imu_fifo_read(&raw_cursor, raw_buf, IMU_RAW_RING / 2)) > 0){
+		for(i=0;i<n;i++){
+			fprintf(raw_fd, "%" PRIu64 ",%" PRIu64 ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F\n",
+				raw_buf[i].seq, raw_buf[i].timestamp_ns,
+				raw_buf[i].accel[0], raw_buf[i].accel[1], raw_buf[i].accel[2],
+				raw_buf[i].gyro[0], raw_buf[i].gyro[1], raw_buf[i].gyro[2]);
+		}
+	}
+	fflush(raw_fd);
+}
+
 static void* __log_manager_func(__attribute__ ((unused)) void* ptr)
 {
 	int i, buf_to_write;
+	rt_harden_thread(0);
 	// while logging enabled and not exiting, write full buffers to disk
 	while(rc_get_state()!=EXITING && logging_enabled){
 		if(needs_writing){
@@ -259,7 +258,8 @@ static void* __log_manager_func(__attribute__ ((unused)) void* ptr)
 			fflush(fd);
 			needs_writing = 0;
 		}
-		rc_usleep(1000000/LOG_MANAGER_HZ);
+		__write_imu_raw();
+		hal_usleep(1000000/LOG_MANAGER_HZ);
 	}
 
 	// if program is exiting or logging got disabled, write out the rest of
@@ -270,6 +270,24 @@ static void* __log_manager_func(__attribute__ ((unused)) void* ptr)
 	}
 	fflush(fd);
 	fclose(fd);
+	if(raw_fd != NULL){
+		__write_imu_raw();
+		fclose(raw_fd);
+		raw_fd = NULL;
+	}
+
+	// percentiles over the whole run are more useful than the raw columns
+	if(settings.log_isr_timing){
+		FILE* timing_fd = fopen(timing_path, "w");
+		if(timing_fd == NULL){
+			fprintf(stderr,"ERROR: can't open %s for writing\n", timing_path);
+		}
+		else{
+			isr_timing_print(timing_fd);
+			sched_print(timing_fd);
+			fclose(timing_fd);
+		}
+	}
 
 	// zero out state
 	logging_enabled = 0;
@@ -313,6 +331,8 @@ int log_manager_init()
 		fprintf(stderr,"delete old log files before continuing\n");
 		return -1;
 	}
+	sprintf(timing_path, LOG_DIR "%d_isr_timing.txt", i);
+
 	// create and open new file for writing
 	fd = fopen(path, "w+");
 	if(fd == 0) {
@@ -323,6 +343,20 @@ int log_manager_init()
 	// write header
 	__write_header(fd);
 
+	// the ring in imu_fifo holds about a second, plenty for LOG_MANAGER_HZ
+	raw_fd = NULL;
+	if(settings.log_imu_raw && settings.imu_fifo){
+		sprintf(path, LOG_DIR "%d_imu_raw.csv", i);
+		raw_fd = fopen(path, "w");
+		if(raw_fd == NULL){
+			fprintf(stderr,"ERROR: can't open %s for writing\n", path);
+			fclose(fd);
+			return -1;
+		}
+		fprintf(raw_fd, "seq,timestamp_ns,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z\n");
+		raw_cursor = 0;
+	}
+
 	// start thread
 	logging_enabled = 1;
 	num_entries = 0;
@@ -331,16 +365,17 @@ int log_manager_init()
 	needs_writing = 0;
 
 	// start logging thread
-	if(rc_pthread_create(&pthread, __log_manager_func, NULL, SCHED_FIFO, LOG_MANAGER_PRI)<0){
+	if(hal_pthread_create(&pthread, __log_manager_func, NULL, SCHED_FIFO, settings.log_manager_priority)<0){
 		fprintf(stderr,"ERROR in start_log_manager, failed to start thread\n");
 		return -1;
 	}
-	rc_usleep(1000);
+	hal_usleep(1000);
 	return 0;
 }
 
 static log_entry_t __construct_new_entry()
 {
+	int i;
 	log_entry_t l;
 	l.loop_index= fstate.loop_index;
 //B
@@ -362,6 +397,10 @@ static log_entry_t __construct_new_entry()
 	l.alt_bmp_vel		= state_estimate.alt_bmp_vel;
 	l.alt_bmp_accel		= state_estimate.alt_bmp_accel;
 	l.proj_ap			= state_estimate.proj_ap;
+
+	l.drag_scale		= state_estimate.drag_scale;
+	l.drag_scale_var	= state_estimate.drag_scale_var;
+	l.drag_resid		= state_estimate.drag_resid;
 	l.gyro_roll			= state_estimate.gyro[0];
 	l.gyro_pitch		= state_estimate.gyro[1];
 	l.gyro_yaw			= state_estimate.gyro[2];
@@ -404,23 +443,16 @@ static log_entry_t __construct_new_entry()
 	l.u_Y		= fstate.u[VEC_X];
 	l.u_Z		= fstate.u[VEC_Z];
 
-	l.mot_1		= fstate.m[0];
-	l.mot_2		= fstate.m[1];
-	l.mot_3		= fstate.m[2];
-	l.mot_4		= fstate.m[3];
-	l.mot_5		= fstate.m[4];
-	l.mot_6		= fstate.m[5];
-	l.mot_7		= fstate.m[6];
-	l.mot_8		= fstate.m[7];
-
-	l.mot_1_us	= sstate.m_us[0];
-    l.mot_2_us	= sstate.m_us[1];
-    l.mot_3_us	= sstate.m_us[2];
-    l.mot_4_us	= sstate.m_us[3];
-    l.mot_5_us	= sstate.m_us[4];
-    l.mot_6_us	= sstate.m_us[5];
-    l.mot_7_us	= sstate.m_us[6];
-    l.mot_8_us	= sstate.m_us[7];
+	for(i=0;i<MAX_ROTORS;i++){
+		l.mot[i]	= fstate.m[i];
+		l.mot_us[i]	= sstate.m_us[i];
+	}
+
+	// this runs inside __imu_isr, so stages after the logger are from the
+	// previous tick
+	for(i=0;i<ISR_NUM_STAGES;i++){
+		l.isr_us[i] = isr_timing_last_us((isr_stage_t)i);
+	}
 
 	return l;
 }
@@ -9,15 +9,10 @@
 #include <getopt.h>
 
 #include <rc/start_stop.h>
-#include <rc/adc.h>
-#include <rc/servo.h>
 #include <rc/mpu.h>
+#include <rc/button.h> // for the button pin and polarity macros
 #include <rc/dsm.h>
-#include <rc/bmp.h>
-#include <rc/button.h>
-#include <rc/led.h>
-#include <rc/time.h>
-#include <rc/cpu.h>
+#include <hal.h>
 
 #include <settings.h> // contains extern settings variable
 #include <servos.h>
@@ -26,13 +21,18 @@
 
 //#include <serial_send.h>
 #include <serial_comms.h>
+#include <serial_io.h>
 
 #include <input_manager.h>
 #include <setpoint_manager.h>
 #include <state_estimator.h>
 #include <log_manager.h>
 #include <printf_manager.h>
-#include <rc/encoder.h>
+#include <isr_timing.h>
+#include <scheduler.h>
+#include <rt_harden.h>
+#include <snapshot.h>
+#include <imu_fifo.h>
 #include <signal.h>
 
 #include <serial_tools.h>
@@ -43,8 +43,8 @@
 
 #define FAIL(str) \
 fprintf(stderr, str); \
-rc_led_set(RC_LED_GREEN,0); \
-rc_led_blink(RC_LED_RED,8.0,2.0); \
+hal_led_set(RC_LED_GREEN,0); \
+hal_led_blink(RC_LED_RED,8.0,2.0); \
 return -1;
 
 void print_usage()
@@ -52,6 +52,7 @@ void print_usage()
 	printf("\n");
 	printf(" Options\n");
 	printf(" -s {settings file} Specify settings file to use\n");
+	printf(" -c {channel}       Record a calibration curve for one servo and exit\n");
 	printf(" -h                 Print this help message\n");
 	printf("\n");
 	printf("Some example settings files are included with the\n");
@@ -85,8 +86,8 @@ void on_pause_press()
 
 	// now keep checking to see if the button is still held down
 	for(i=0;i<samples;i++){
-		rc_usleep(quit_check_us);
-		if(rc_button_get_state(RC_BTN_PIN_PAUSE)==RC_BTN_STATE_RELEASED){
+		hal_usleep(quit_check_us);
+		if(hal_button_get_state(RC_BTN_PIN_PAUSE)==RC_BTN_STATE_RELEASED){
 			return;
 		}
 	}
@@ -95,54 +96,112 @@ void on_pause_press()
 	return;
 }
 
+// rate groups of __imu_isr, see scheduler.h
+enum {
+	GROUP_FAST,		// setpoints, estimation, control, links and logging
+	GROUP_BATTERY,
+	GROUP_TELEMETRY,
+	GROUP_BARO,
+	NUM_GROUPS
+};
+
+static int __encoders_march(void)
+{
+	int i;
+	for(i=1;i<5;i++){
+		state_estimate.rev[i-1] = hal_encoder_read(i);
+	}
+	return 0;
+}
+
+/**
+ * @brief      Builds the schedule of __imu_isr from the settings
+ *
+ * At the default 200 Hz the phases put battery, telemetry and barometer on
+ * different ticks, so no two decimated groups ever share a tick. sched_init() warns if other rates make
+ * them collide.
+ * The budget is the share of the loop period a group may use before it counts
+ * as an overrun.
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __scheduler_init(void)
+{
+	const sched_group_t groups[NUM_GROUPS] = {
+		//                   name         rate                        phase budget
+		[GROUP_FAST]      = {"fast",      settings.feedback_hz,          0, 0.60},
+		[GROUP_BATTERY]   = {"battery",   BATT_SAMPLE_HZ,                1, 0.05},
+		[GROUP_TELEMETRY] = {"telemetry", settings.serial_send_update_hz, 3, 0.10},
+		[GROUP_BARO]      = {"baro",      BMP_SAMPLE_HZ,                 5, 0.05},
+	};
+	// run order inside a tick, same data flow as a single-rate loop. The
+	// control chain (setpoints, estimator, feedback and the servo outputs in
+	// feedback_march) is critical, the rest is shed when a tick runs long:
+	// inputs and the barometer trigger last, encoders are simply dropped.
+	// Setpoints run every tick, they carry the kill switch disarm.
+	const sched_task_t tasks[] = {
+		{GROUP_FAST,      ISR_STAGE_SETPOINT,  setpoint_manager_update,
+			1, SCHED_CRITICAL, 0},
+		{GROUP_BATTERY,   ISR_STAGE_BATTERY,   state_estimator_batt_march,
+			1, SCHED_LOW, 1},
+		{GROUP_FAST,      ISR_STAGE_STATE_EST, state_estimator_march,
+			1, SCHED_CRITICAL, 0},
+		{GROUP_FAST,      ISR_STAGE_XBEE,      XBEE_getData,
+			settings.enable_xbee, SCHED_HIGH, 1},
+		{GROUP_TELEMETRY, ISR_STAGE_SERIAL_TX, send_serial_data,
+			settings.enable_serial && settings.enable_send_serial, SCHED_LOW, 1},
+		{GROUP_FAST,      ISR_STAGE_SERIAL,    serial_getData,
+			settings.enable_serial && settings.enable_receive_serial, SCHED_HIGH, 1},
+		{GROUP_FAST,      ISR_STAGE_FEEDBACK,  feedback_march,
+			1, SCHED_CRITICAL, 0},
+		{GROUP_FAST,      ISR_STAGE_ENCODERS,  __encoders_march,
+			settings.enable_encoders, SCHED_LOW, 0},
+		{GROUP_FAST,      ISR_STAGE_LOG,       log_manager_add_new,
+			settings.enable_logging, SCHED_LOW, 1},
+		{GROUP_BARO,      ISR_STAGE_JOBS_AFTER, state_estimator_jobs_after_feedback,
+			1, SCHED_HIGH, 1},
+	};
+
+	if(sched_init(settings.feedback_hz, settings.isr_budget, groups, NUM_GROUPS,
+			tasks, sizeof(tasks)/sizeof(tasks[0]))<0) return -1;
+	sched_print(stdout);
+	return 0;
+}
+
 /**
  * @brief      Interrupt service routine for IMU
  *
- * This is called every time the Invensense IMU has new data
+ * This is called every time the Invensense IMU has new data, by the DMP
+ * interrupt or after each FIFO batch with settings.imu_fifo (see imu_fifo.h)
  * 
- * __imu_isr should be running at 100 Hz (YK)
+ * __imu_isr runs at settings.feedback_hz, jobs run at the rate of their group
+ * in the schedule, see __scheduler_init()
+ *
+ * Every task is timed into the isr_timing histograms, see isr_timing.h
  */
- uint64_t temp_time;
- 
-
 static void __imu_isr(void)
 {
-	int i=0;
+	static int first_tick = 1;
+	uint64_t t_start;
 	//printf("imu interupt...\n");
-	setpoint_manager_update();
-	state_estimator_march();
-	if(settings.enable_xbee){
-		XBEE_getData();
-	}
+	// the ISR thread is created by the IMU driver, harden it on the way in
+	if(first_tick){
+		rt_harden_thread(1);
+		first_tick = 0;
+	}
+	t_start = isr_timing_tick_start();
+	sched_run_tick(t_start);
+	// let the other threads see a consistent copy of this tick
+	snapshot_publish();
+	isr_timing_tick_end(t_start);
+}
 
-	if (settings.enable_serial)
-    {
-        if (settings.enable_send_serial)
-        {
-            send_serial_data();
-        }
-        if (settings.enable_receive_serial)
-        {
-            serial_getData();
-		}
-	}
-	feedback_march();
-	
-	// we are not using encoders 
-	if (settings.enable_encoders){
-		for(i=1;i<5;i++){
-		state_estimate.rev[i-1] = rc_encoder_read(i);
-		} ;
-	}
-	if(settings.enable_logging) log_manager_add_new();
-	state_estimator_jobs_after_feedback();
-	
-	//delete this later
-	/*
-	double dt_s = (rc_nanos_since_boot()-temp_time)/(1e9); //calculate time since last successful reading
-	if (1/dt_s < 90) printf("\nWARNING, Low update frequency of __imu_isr %f (Hz)\n",1/dt_s); //check the update frequency
-	temp_time = rc_nanos_since_boot();
-	*/
+/**
+ * SIGUSR1 prints the __imu_isr timing and schedule report, e.g. "kill -USR1 $(pidof rcs)"
+ */
+static void __on_sigusr1(__attribute__((unused)) int sig)
+{
+	isr_timing_request_report();
 }
 
 
@@ -156,11 +215,12 @@ int main(int argc, char *argv[])
 {
 
 	int c;
+	int cal_channel = 0;
 	char* settings_file_path = NULL;
 
 	// parse arguments
 	opterr = 0;
-	while ((c = getopt(argc, argv, "s:h")) != -1){
+	while ((c = getopt(argc, argv, "s:c:h")) != -1){
 		switch (c){
 		// settings file option
 		case 's':
@@ -168,6 +228,16 @@ int main(int argc, char *argv[])
 			printf("User specified settings file:\n%s\n", settings_file_path);
 			break;
 
+		// servo calibration mode
+		case 'c':
+			cal_channel=atoi(optarg);
+			if(cal_channel<1){
+				printf("\nInvalid servo channel \n");
+				print_usage();
+				return -1;
+			}
+			break;
+
 		// help mode
 		case 'h':
 			print_usage();
@@ -193,29 +263,46 @@ int main(int argc, char *argv[])
 	}
 	printf("Loaded settings: %s\n", settings.name);
 
+	// lock memory before any thread exists so all their stacks get locked
+	if(rt_harden_init()<0){
+		fprintf(stderr,"ERROR: failed to apply real-time hardening\n");
+		return -1;
+	}
+
 	// before touching hardware, make sure another instance isn't running
 	// return value -3 means a root process is running and we need more
 	// privileges to stop it.
-	if(rc_kill_existing_process(2.0)==-3) return -1;
+	if(hal_kill_existing_process(2.0)==-3) return -1;
+
+	// servo calibration only needs the servos, nothing else is started
+	if(cal_channel){
+		if(servos_init()==-1){
+			fprintf(stderr,"ERROR: failed to initialize servos, probably need to run as root\n");
+			return -1;
+		}
+		c = servos_calibrate(cal_channel);
+		servos_cleanup();
+		return c;
+	}
 
 	// start with both LEDs off
-	if(rc_led_set(RC_LED_GREEN, 0)==-1){
+	if(hal_led_set(RC_LED_GREEN, 0)==-1){
 		fprintf(stderr, "ERROR in main(), failed to set RC_LED_GREEN\n");
 		return -1;
 	}
-	if(rc_led_set(RC_LED_RED, 0)==-1){
+	if(hal_led_set(RC_LED_RED, 0)==-1){
 		fprintf(stderr, "ERROR in main() failed to set RC_LED_RED\n");
 		return -1;
 	}
 
 	// make sure IMU is calibrated
-	if(!rc_mpu_is_gyro_calibrated()){
+	if(!hal_mpu_is_gyro_calibrated()){
 		FAIL("ERROR, must calibrate gyroscope with rc_calibrate_gyro first\n")
 	}
-	if(!rc_mpu_is_accel_calibrated()){
+	if(!hal_mpu_is_accel_calibrated()){
 		FAIL("ERROR, must calibrate accelerometer with rc_calibrate_accel first\n")
 	}
-	if(settings.enable_magnetometer && !rc_mpu_is_gyro_calibrated()){
+	if(settings.enable_magnetometer && !hal_mpu_is_gyro_calibrated()){
 		FAIL("ERROR, must calibrate magnetometer with rc_calibrate_mag first\n")
 	}
 
@@ -223,17 +310,27 @@ int main(int argc, char *argv[])
 	// latency servicing the IMU's interrupt service routine
 	// this also serves as an initial check for root access which is needed
 	// by the PRU later. PRU root acces might get resolved in the future.
-	if(rc_cpu_set_governor(RC_GOV_PERFORMANCE)<0){
+	if(hal_cpu_set_governor(RC_GOV_PERFORMANCE)<0){
 		FAIL("WARNING, can't set CPU governor, need to run as root\n")
 	}
 
 	// do initialization not involving threads
 	printf("initializing thrust map\n");
-	if(thrust_map_init(settings.thrust_map)<0){
+	if(settings.thrust_map==THRUST_MAP_FILE){
+		if(thrust_map_init_file(settings.thrust_map_file)<0){
+			FAIL("ERROR: failed to initialize thrust map\n")
+		}
+	}
+	else if(thrust_map_init(settings.thrust_map)<0){
 		FAIL("ERROR: failed to initialize thrust map\n")
 	}
 	printf("initializing mixing matrix\n");
-	if(mix_init(settings.layout)<0){
+	if(settings.layout==LAYOUT_CUSTOM){
+		if(mix_init_matrix(settings.num_rotors, settings.dof, settings.mix_matrix)<0){
+			FAIL("ERROR: failed to initialize mixing matrix\n")
+		}
+	}
+	else if(mix_init(settings.layout)<0){
 		FAIL("ERROR: failed to initialize mixing matrix\n")
 	}
 	printf("initializing setpoint_manager\n");
@@ -247,7 +344,7 @@ int main(int argc, char *argv[])
 		FAIL("ERROR: failed to initialize servos, probably need to run as root\n")
 	}
 	printf("initializing adc\n");
-	if(rc_adc_init()==-1){
+	if(hal_adc_init()==-1){
 		FAIL("ERROR: failed to initialize ADC")
 	}
 
@@ -265,11 +362,11 @@ int main(int argc, char *argv[])
 
 	// initialize buttons and Assign functions to be called when button
 	// events occur
-	if(rc_button_init(RC_BTN_PIN_PAUSE, RC_BTN_POLARITY_NORM_HIGH,
+	if(hal_button_init(RC_BTN_PIN_PAUSE, RC_BTN_POLARITY_NORM_HIGH,
 						RC_BTN_DEBOUNCE_DEFAULT_US)){
 		FAIL("ERROR: failed to init buttons\n")
 	}
-	rc_button_set_callbacks(RC_BTN_PIN_PAUSE,on_pause_press,NULL);
+	hal_button_set_callbacks(RC_BTN_PIN_PAUSE,on_pause_press,NULL);
 
 	// initialize log_manager if enabled in settings
 	if(settings.enable_logging){
@@ -281,14 +378,14 @@ int main(int argc, char *argv[])
 
 	// start barometer, must do before starting state estimator
 	printf("initializing Barometer\n");
-	if(rc_bmp_init(BMP_OVERSAMPLE_16, BMP_FILTER_16)){
+	if(hal_bmp_init(BMP_OVERSAMPLE_16, BMP_FILTER_16)){
 		FAIL("ERROR: failed to initialize barometer\n")
 	}
 	
 	if(settings.enable_encoders){
 		//B: initializiation on counter
 		printf("initializing revolution counter\n");
-		if(rc_encoder_init()<0){
+		if(hal_encoder_init()<0){
 			FAIL("ERROR: failed to initialize encoder\n")
 		}
 	}
@@ -322,21 +419,39 @@ int main(int argc, char *argv[])
 	mpu_conf.i2c_bus					= I2C_BUS;
     mpu_conf.gpio_interrupt_pin_chip	= GPIO_INT_PIN_CHIP;
     mpu_conf.gpio_interrupt_pin			= GPIO_INT_PIN_PIN;
-	mpu_conf.dmp_sample_rate			= FEEDBACK_HZ;
+	mpu_conf.dmp_sample_rate			= settings.feedback_hz;
 	mpu_conf.dmp_fetch_accel_gyro		= 1;
 	//mpu_conf.orient = ORIENTATION_Z_UP;
 	mpu_conf.dmp_interrupt_sched_policy = SCHED_FIFO;
-	mpu_conf.dmp_interrupt_priority		= IMU_PRIORITY;
+	mpu_conf.dmp_interrupt_priority		= settings.imu_priority;
 
 	// optionally enbale magnetometer
 	mpu_conf.enable_magnetometer = settings.enable_magnetometer;
 
-	// now set up the imu for dmp interrupt operation
-	printf("initializing MPU\n");
-	if(rc_mpu_initialize_dmp(&mpu_data, mpu_conf)){
-		fprintf(stderr,"ERROR: failed to start MPU DMP\n");
+	// the raw FIFO mode has no such limit
+#ifndef OFFBOARD_TEST
+	if(!settings.imu_fifo && settings.feedback_hz>DMP_MAX_HZ){
+		fprintf(stderr,"ERROR: feedback_hz %d is above what the DMP can do (%d)\n",
+				settings.feedback_hz, DMP_MAX_HZ);
 		return -1;
 	}
+#endif
+
+	// now set up the imu for dmp interrupt operation, or raw FIFO reads
+	if(settings.imu_fifo){
+		printf("initializing MPU raw FIFO at %d Hz\n", settings.imu_fifo_hz);
+		if(imu_fifo_init(&mpu_data, mpu_conf)){
+			fprintf(stderr,"ERROR: failed to start MPU FIFO\n");
+			return -1;
+		}
+	}
+	else{
+		printf("initializing MPU\n");
+		if(hal_mpu_initialize_dmp(&mpu_data, mpu_conf)){
+			fprintf(stderr,"ERROR: failed to start MPU DMP\n");
+			return -1;
+		}
+	}
 	printf("Initializing serial\n");
 	if (settings.enable_serial)
 	{
@@ -344,10 +459,14 @@ int main(int argc, char *argv[])
 			FAIL("ERROR: failed to initialize serial link")
 		}
 	}	
+	// receive thread for both serial links
+	if (serial_io_init() < 0) {
+		FAIL("ERROR: failed to start serial_io thread\n")
+	}
 
 
 	// final setup
-	if(rc_make_pid_file()!=0){
+	if(hal_make_pid_file()!=0){
 		FAIL("ERROR: failed to make a PID file\n")
 	}
 
@@ -356,8 +475,20 @@ int main(int argc, char *argv[])
 	servos_disarm();
 	printf("waiting for dmp to settle...\n");
 	fflush(stdout);
-	rc_usleep(3000000);
-	if(rc_mpu_set_dmp_callback(__imu_isr)!=0){
+	hal_usleep(3000000);
+	if(isr_timing_init(1000000000/settings.feedback_hz)<0){
+		FAIL("ERROR: failed to init isr timing\n")
+	}
+	if(__scheduler_init()<0){
+		FAIL("ERROR: failed to init scheduler\n")
+	}
+	signal(SIGUSR1, __on_sigusr1);
+	if(settings.imu_fifo){
+		if(imu_fifo_set_callback(__imu_isr)!=0){
+			FAIL("ERROR: failed to set imu fifo callback function\n")
+		}
+	}
+	else if(hal_mpu_set_dmp_callback(__imu_isr)!=0){
 		FAIL("ERROR: failed to set dmp callback function\n")
 	}
 
@@ -375,24 +506,34 @@ int main(int argc, char *argv[])
 	rc_set_state(RUNNING);
 	while(rc_get_state()!=EXITING){
 		usleep(50000);
+		if(isr_timing_service_report()) sched_print(stdout);
+		rt_harden_service();
 	}
 
 	// some of these, like printf_manager and log_manager, have cleanup
 	// functions that can be called even if not being used. So just call all
 	// cleanup functions here.
 	printf("cleaning up\n");
-	rc_mpu_power_off();
+	hal_mpu_power_off();
+	state_estimator_cleanup();
 	feedback_cleanup();
 	servos_cleanup();
+	serial_io_cleanup();
 	input_manager_cleanup();
 	setpoint_manager_cleanup();
 	printf_cleanup();
 	log_manager_cleanup();
-	rc_encoder_cleanup();
+	hal_encoder_cleanup();
+	isr_timing_print(stdout);
+	sched_print(stdout);
+	rt_harden_print(stdout);
+	imu_fifo_print(stdout);
+	mix_alloc_print(stdout);
+	printf("snapshot reader retries: %llu\n", (unsigned long long)snapshot_get_retries());
 
 	// turn off red LED and blink green to say shut down was safe
-	rc_led_set(RC_LED_RED,0);
-	rc_led_blink(RC_LED_GREEN,8.0,2.0); \
+	hal_led_set(RC_LED_RED,0);
+	hal_led_blink(RC_LED_GREEN,8.0,2.0); \
 	return 0;
 }
 
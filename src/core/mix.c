@@ -4,8 +4,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <float.h> // for DBL_MAX
 #include <mix.h>
+#include <tools.h>
+
+// keeps the allocator solve positive definite once actuators saturate and
+// the free ones can no longer reach every channel
+#define ALLOC_REG	1.0e-6
+// an actuator within this of its limit counts as not violating it
+#define ALLOC_TOL	1.0e-9
 
  /**
   * 4-rotor X layout for a rocket
@@ -17,7 +26,7 @@
   * columns: X Y Z Roll Pitch Yaw
   * rows: motors 1-4
   */
-static double mix_4x[][6] = { \
+static double mix_4x[][MAX_INPUTS] = { \
 {-1.0,   0.0,  0.0,   0.0,  -0.5,   0.5},\
 {-1.0,   0.0,  0.0,   0.0,   0.5,   0.5},\
 {-1.0,   0.0,  0.0,   0.0,   0.5,  -0.5},\
@@ -36,36 +45,169 @@ static double mix_4x[][6] = { \
  * columns: X Y Z Roll Pitch Yaw
  * rows: actuators 1-4
  */
-static double mix_4plus[][6] = { \
+static double mix_4plus[][MAX_INPUTS] = { \
 {-1.0,   0.0,  0.0,   0.0,   0.5,   0.0},\
 {-1.0,   0.0,  0.0,   0.0,   0.0,  -0.5},\
 {-1.0,   0.0,  0.0,   0.0,  -0.5,   0.0},\
 {-1.0,   0.0,  0.0,   0.0,   0.0,   0.5}};
 
 
-static double (*mix_matrix)[6];
+static double mix_matrix[MAX_ROTORS][MAX_INPUTS];
 static int initialized;
 static int rotors;
 static int dof;
 
+// per channel, the rotors it moves with reciprocal coefficients and the motor
+// limit a positive (hi) or negative (lo) input runs into, so the saturation
+// check is a multiply per rotor
+static int ch_ok[MAX_INPUTS];			// channel is usable with this dof
+static int ch_n[MAX_INPUTS];			// number of rotors it moves
+static int ch_idx[MAX_INPUTS][MAX_ROTORS];
+static double ch_coef[MAX_INPUTS][MAX_ROTORS];
+static double ch_recip[MAX_INPUTS][MAX_ROTORS];
+static double ch_hi[MAX_INPUTS][MAX_ROTORS];
+static double ch_lo[MAX_INPUTS][MAX_ROTORS];
+
+// allocator, set up by __alloc_init()
+static int alloc_ch[MAX_INPUTS];		// channels the layout can move
+static int alloc_k;				// number of them
+static double B[MAX_INPUTS][MAX_ROTORS];	// pinv of the mix matrix, virtual = B*mot
+static mix_alloc_stats_t alloc_stats;
+
+/**
+ * @brief      solves A*x = b in place for symmetric positive definite A
+ *
+ * @return     0 on success, -1 if A is not positive definite
+ */
+static int __cholesky_solve(int n, double A[MAX_ROTORS][MAX_ROTORS], double* b)
+{
+	int i, j, k;
+	double sum;
+
+	// A = L*L', L in the lower triangle
+	for(j=0;j<n;j++){
+		sum = A[j][j];
+		for(k=0;k<j;k++) sum -= A[j][k]*A[j][k];
+		if(sum<=0.0) return -1;
+		A[j][j] = sqrt(sum);
+		for(i=j+1;i<n;i++){
+			sum = A[i][j];
+			for(k=0;k<j;k++) sum -= A[i][k]*A[j][k];
+			A[i][j] = sum/A[j][j];
+		}
+	}
+	// forward then back substitution
+	for(i=0;i<n;i++){
+		for(k=0;k<i;k++) b[i] -= A[i][k]*b[k];
+		b[i] /= A[i][i];
+	}
+	for(i=n-1;i>=0;i--){
+		for(k=i+1;k<n;k++) b[i] -= A[k][i]*b[k];
+		b[i] /= A[i][i];
+	}
+	return 0;
+}
+
+/**
+ * @brief      picks the channels the layout can actuate and computes the
+ *             effectiveness matrix B = (M'M)^-1 M' for them, so that the
+ *             minimum norm motor vector giving virtual input v is M*v.
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __alloc_init(void)
+{
+	int i, j, c, r;
+	double MtM[MAX_ROTORS][MAX_ROTORS], col[MAX_ROTORS];
+
+	alloc_k = 0;
+	for(c=0;c<MAX_INPUTS;c++){
+		if(ch_ok[c] && ch_n[c]>0) alloc_ch[alloc_k++] = c;
+	}
+	if(alloc_k>rotors){
+		fprintf(stderr,"ERROR in mix_init, %d channels can't be allocated to %d rotors\n", alloc_k, rotors);
+		return -1;
+	}
+
+	// B = (M'M)^-1 M', one column of M' at a time
+	for(j=0;j<rotors;j++){
+		for(i=0;i<alloc_k;i++){
+			for(c=0;c<alloc_k;c++){
+				MtM[i][c] = 0.0;
+				for(r=0;r<rotors;r++) MtM[i][c] += mix_matrix[r][alloc_ch[i]]*mix_matrix[r][alloc_ch[c]];
+			}
+			col[i] = mix_matrix[j][alloc_ch[i]];
+		}
+		if(__cholesky_solve(alloc_k, MtM, col)){
+			fprintf(stderr,"ERROR in mix_init, mixing matrix columns are not independent\n");
+			return -1;
+		}
+		for(i=0;i<alloc_k;i++) B[i][j] = col[i];
+	}
+	memset(&alloc_stats, 0, sizeof(alloc_stats));
+	return 0;
+}
+
 
 int mix_init(rotor_layout_t layout)
 {
 	switch(layout){
 	case LAYOUT_4X:
-		rotors = 4;
-		dof = 4;
-		mix_matrix = mix_4x;
-		break;
+		return mix_init_matrix(4, 4, mix_4x);
 	case LAYOUT_4PLUS:
-		rotors = 4;
-		dof = 6;
-		mix_matrix = mix_4plus;
-		break;
+		return mix_init_matrix(4, 6, mix_4plus);
+	case LAYOUT_CUSTOM:
+		fprintf(stderr,"ERROR in mix_init() custom layouts need mix_init_matrix()\n");
+		return -1;
 	default:
 		fprintf(stderr,"ERROR in mix_init() unknown rotor layout\n");
 		return -1;
 	}
+}
+
+
+int mix_init_matrix(int num_rotors, int num_dof, double matrix[][MAX_INPUTS])
+{
+	int i, c, k, min_ch;
+
+	initialized = 0;
+	if(num_rotors<1 || num_rotors>MAX_ROTORS || matrix==NULL){
+		fprintf(stderr,"ERROR in mix_init_matrix, need 1 to %d rotors\n", MAX_ROTORS);
+		return -1;
+	}
+	switch(num_dof){
+	case 4:
+		min_ch = 2;
+		break;
+	case 6:
+		min_ch = 0;
+		break;
+	default:
+		fprintf(stderr,"ERROR in mix_init_matrix, dof should be 4 or 6, got %d\n", num_dof);
+		return -1;
+	}
+	rotors = num_rotors;
+	dof = num_dof;
+	memset(mix_matrix, 0, sizeof(mix_matrix));
+	for(i=0;i<rotors;i++){
+		for(c=0;c<MAX_INPUTS;c++) mix_matrix[i][c] = matrix[i][c];
+	}
+
+	for(c=0;c<MAX_INPUTS;c++){
+		ch_ok[c] = c>=min_ch;
+		k = 0;
+		for(i=0;i<rotors;i++){
+			if(mix_matrix[i][c]==0.0) continue;
+			ch_idx[c][k] = i;
+			ch_coef[c][k] = mix_matrix[i][c];
+			ch_recip[c][k] = 1.0/mix_matrix[i][c];
+			ch_hi[c][k] = mix_matrix[i][c]>0.0 ? 1.0 : 0.0;
+			ch_lo[c][k] = 1.0-ch_hi[c][k];
+			k++;
+		}
+		ch_n[c] = k;
+	}
+	if(__alloc_init()) return -1;
 
 	initialized = 1;
 	return 0;
@@ -98,7 +240,7 @@ int mix_all_controls(double u[6], double* mot)
 
 int mix_check_saturation(int ch, double* mot, double* min, double* max)
 {
-	int i, min_ch;
+	int i, k;
 	double tmp;
 	double new_max = DBL_MAX;
 	double new_min = -DBL_MAX;
@@ -107,20 +249,7 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max)
 		fprintf(stderr,"ERROR: in check_channel_saturation, mix matrix not set yet\n");
 		return -1;
 	}
-
-	switch(dof){
-	case 4:
-		min_ch = 2;
-		break;
-	case 6:
-		min_ch = 0;
-		break;
-	default:
-		fprintf(stderr,"ERROR: in check_channel_saturation, dof should be 4 or 6, currently %d\n", dof);
-		return -1;
-	}
-
-	if(ch<min_ch || ch>=6){
+	if(ch<0 || ch>=MAX_INPUTS || !ch_ok[ch]){
 		fprintf(stderr,"ERROR: in check_channel_saturation, ch out of bounds\n");
 		return -1;
 	}
@@ -131,49 +260,18 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max)
 			fprintf(stderr,"ERROR: motor channel already out of bounds\n");
 			return -1;
 		}
-		/*if (mot[i] == 0.0) {
-			//printf("\n mot[i] == 0.0, i = %d\n", i);
-			if (mix_matrix[i][ch] == 0.0) continue;
-			
-			
-			// for positive entry in mix matrix
-			if (mix_matrix[i][ch] > 0.0)	tmp = (1.0) / mix_matrix[i][ch];
-			// for negative entry in mix matrix
-			else tmp = -1.0 / mix_matrix[i][ch];
-			// set new upper limit if lower than current
-			if (tmp < new_max) new_max = tmp;
-		}*/
-	}
-
-	
-
-	// find max positive input
-	for(i=0;i<rotors;i++){
-		//printf("\n i = %d, Ch =%d  mix_matrix[i][ch] = %f and mot[i] = %f\n", i, ch, mix_matrix[i][ch],mot[i]);
-
-		// if mix channel is 0, impossible to saturate
-		if(mix_matrix[i][ch]==0.0) continue;
-		// for positive entry in mix matrix
-		if(mix_matrix[i][ch]>0.0)	tmp = (1.0-mot[i])/mix_matrix[i][ch];
-		// for negative entry in mix matrix
-		else tmp = -mot[i]/mix_matrix[i][ch];
-		// set new upper limit if lower than current
-		if(tmp<new_max) new_max = tmp;
 	}
-	//printf(" new_max = %f ", new_max);
 
-	// find min (most negative) input
-	for(i=0;i<rotors;i++){
-		// if mix channel is 0, impossible to saturate
-		if(mix_matrix[i][ch]==0.0) continue;
-		// for positive entry in mix matrix
-		if(mix_matrix[i][ch]>0.0)	tmp = -mot[i]/mix_matrix[i][ch];
-		// for negative entry in mix matrix
-		else tmp = (1.0-mot[i])/mix_matrix[i][ch];
-		// set new upper limit if lower than current
+	// rotors this channel doesn't move can't saturate
+	for(k=0;k<ch_n[ch];k++){
+		i = ch_idx[ch][k];
+		// largest positive input before this rotor hits its limit
+		tmp = (ch_hi[ch][k]-mot[i])*ch_recip[ch][k];
+		if(tmp<new_max) new_max = tmp;
+		// most negative input before it hits the other one
+		tmp = (ch_lo[ch][k]-mot[i])*ch_recip[ch][k];
 		if(tmp>new_min) new_min = tmp;
 	}
-	//printf(" new_min = %f \n", new_min);
 
 	*min = new_min;
 	*max = new_max;
@@ -183,33 +281,21 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max)
 
 int mix_add_input(double u, int ch, double* mot)
 {
-	int i;
-	int min_ch;
+	int i, k;
 
-	if(initialized!=1 || dof==0){
+	if(initialized!=1){
 		fprintf(stderr,"ERROR: in mix_add_input, mix matrix not set yet\n");
 		return -1;
 	}
-	switch(dof){
-	case 4:
-		min_ch = 2;
-		break;
-	case 6:
-		min_ch = 0;
-		break;
-	default:
-		fprintf(stderr,"ERROR: in mix_add_input, dof should be 4 or 6, currently %d\n", dof);
-		return -1;
-	}
-
-	if(ch<min_ch || ch>=6){
+	if(ch<0 || ch>=MAX_INPUTS || !ch_ok[ch]){
 		fprintf(stderr,"ERROR: in mix_add_input, ch out of bounds\n");
 		return -1;
 	}
 
 	// add inputs
-	for(i=0;i<rotors;i++){
-		mot[i] += u*mix_matrix[i][ch];
+	for(k=0;k<ch_n[ch];k++){
+		i = ch_idx[ch][k];
+		mot[i] += u*ch_coef[ch][k];
 		// ensure saturation, should not need to do this if mix_check_saturation
 		// was used properly, but here for safety anyway.
 		if(mot[i]>1.0) mot[i]=1.0;
@@ -219,3 +305,124 @@ int mix_add_input(double u, int ch, double* mot)
 }
 
 
+int mix_allocate(const double* u, int mask, double* mot, double* achieved)
+{
+	int i, j, c, it, nf, violated;
+	int rows[MAX_INPUTS], nr = 0;
+	int free_idx[MAX_ROTORS], is_free[MAX_ROTORS];
+	double v[MAX_INPUTS];
+	double A[MAX_ROTORS][MAX_ROTORS], b[MAX_ROTORS];
+	double err;
+	uint64_t t0, ns;
+
+	if(initialized!=1){
+		fprintf(stderr,"ERROR in mix_allocate, mix matrix not set yet\n");
+		return -1;
+	}
+	t0 = monotonic_ns();
+
+	// rows of B that are asked for, the rest are left to fall where they may
+	for(i=0;i<alloc_k;i++) if(mask & (1<<alloc_ch[i])) rows[nr++] = i;
+	for(j=0;j<rotors;j++){
+		mot[j] = 0.0;
+		is_free[j] = 1;
+	}
+
+	// redistributed pseudo-inverse: least squares over the free actuators,
+	// clamp the ones out of range and solve again for what is left. Every
+	// pass fixes at least one actuator so this ends within rotors passes.
+	for(it=1; nr>0 && it<=rotors; it++){
+		nf = 0;
+		for(j=0;j<rotors;j++) if(is_free[j]) free_idx[nf++] = j;
+
+		// remaining demand after the clamped actuators
+		for(i=0;i<nr;i++){
+			v[i] = u[alloc_ch[rows[i]]];
+			for(j=0;j<rotors;j++) if(!is_free[j]) v[i] -= B[rows[i]][j]*mot[j];
+		}
+		// (Bf'Bf + reg*I) mf = Bf'v
+		for(i=0;i<nf;i++){
+			for(c=0;c<=i;c++){
+				A[i][c] = 0.0;
+				for(j=0;j<nr;j++) A[i][c] += B[rows[j]][free_idx[i]]*B[rows[j]][free_idx[c]];
+				A[c][i] = A[i][c];
+			}
+			A[i][i] += ALLOC_REG;
+			b[i] = 0.0;
+			for(j=0;j<nr;j++) b[i] += B[rows[j]][free_idx[i]]*v[j];
+		}
+		if(__cholesky_solve(nf, A, b)) break; // can't happen with reg > 0
+
+		violated = 0;
+		for(i=0;i<nf;i++){
+			j = free_idx[i];
+			mot[j] = b[i];
+			if(mot[j]>1.0+ALLOC_TOL){
+				mot[j] = 1.0;
+				is_free[j] = 0;
+				violated = 1;
+			}
+			else if(mot[j]<-ALLOC_TOL){
+				mot[j] = 0.0;
+				is_free[j] = 0;
+				violated = 1;
+			}
+		}
+		if(!violated) break;
+	}
+	if(it>rotors) it = rotors;
+	for(j=0;j<rotors;j++){
+		if(mot[j]>1.0) mot[j]=1.0;
+		else if(mot[j]<0.0) mot[j]=0.0;
+	}
+
+	// what the actuators really do, and how far off the demand that is
+	err = 0.0;
+	for(i=0;i<MAX_INPUTS;i++) if(achieved!=NULL) achieved[i] = 0.0;
+	for(i=0;i<alloc_k;i++){
+		double a = 0.0;
+		for(j=0;j<rotors;j++) a += B[i][j]*mot[j];
+		if(achieved!=NULL) achieved[alloc_ch[i]] = a;
+		if(mask & (1<<alloc_ch[i])) err += fabs(a-u[alloc_ch[i]]);
+	}
+
+	ns = monotonic_ns()-t0;
+	alloc_stats.count++;
+	alloc_stats.sum_ns += ns;
+	if(ns>alloc_stats.max_ns) alloc_stats.max_ns = ns;
+	if(nr>0) alloc_stats.iter_hist[it]++;
+	if(err>MIX_ALLOC_ERR_TOL) alloc_stats.unmet++;
+	alloc_stats.last_err = err;
+	return 0;
+}
+
+
+int mix_alloc_get_stats(mix_alloc_stats_t* stats)
+{
+	if(stats==NULL){
+		fprintf(stderr,"ERROR in mix_alloc_get_stats, received NULL pointer\n");
+		return -1;
+	}
+	*stats = alloc_stats;
+	return 0;
+}
+
+
+int mix_alloc_print(FILE* fd)
+{
+	int i;
+	mix_alloc_stats_t s = alloc_stats;
+
+	if(fd==NULL){
+		fprintf(stderr,"ERROR in mix_alloc_print, NULL file\n");
+		return -1;
+	}
+	fprintf(fd, "\ncontrol allocation, %llu ticks, %.2f us mean, %.2f us max, %llu short of demand\n",
+		(unsigned long long)s.count, s.count ? s.sum_ns/1000.0/s.count : 0.0,
+		s.max_ns/1000.0, (unsigned long long)s.unmet);
+	fprintf(fd, "passes:");
+	for(i=1;i<=rotors;i++) fprintf(fd, " %d:%llu", i, (unsigned long long)s.iter_hist[i]);
+	fprintf(fd, "\n");
+	fflush(fd);
+	return 0;
+}
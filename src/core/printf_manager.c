@@ -7,7 +7,7 @@
 #include <errno.h>
 
 #include <rc/start_stop.h>
-#include <rc/time.h>
+#include <hal.h>
 #include <rc/pthread.h>
 
 #include <rcs_defs.h>
@@ -18,11 +18,12 @@
 #include <state_estimator.h>
 #include <thread_defs.h>
 #include <settings.h>
+#include <rt_harden.h>
+#include <snapshot.h>
 
 //B:
 #include <xbee_packet_t.h>
 #include <signal.h>
-#include <rc/encoder.h>
 
 
 static pthread_t printf_manager_thread;
@@ -116,6 +117,8 @@ static int __print_header()
 static void* __printf_manager_func(__attribute__ ((unused)) void* ptr)
 {
 	int i;
+	static snapshot_t snap; // consistent copy of what the ISR wrote
+	rt_harden_thread(0);
 	initialized = 1;
 	printf("\nRocket Control System is initialized.\n");
 	printf("Waiting for the remote arming sequence...\n\n");
@@ -127,15 +130,20 @@ static void* __printf_manager_func(__attribute__ ((unused)) void* ptr)
 	__print_header();
 
 	//sleep so state_estimator can run first
-	rc_usleep(100000);
+	hal_usleep(100000);
 
 	while(rc_get_state()!=EXITING){
+		// nothing to show until the ISR has published once
+		if(snapshot_read(&snap)){
+			hal_usleep(1000000/PRINTF_MANAGER_HZ);
+			continue;
+		}
 
 		printf("\r");
 		if(settings.printf_arm){
-			if(fstate.arm_state==ARMED) {
+			if(snap.fstate.arm_state==ARMED) {
 				printf("%s ARMED %s |", KRED, KNRM);
-			/*} else if (fstate.arm_state == MID_ARMING) {
+			/*} else if (snap.fstate.arm_state == MID_ARMING) {
 				printf("%sSTARTING%s|", KWHT, KNRM);*/
 			} else {
 				printf("%sDISARMED%s|", KGRN, KNRM);
@@ -144,50 +152,50 @@ static void* __printf_manager_func(__attribute__ ((unused)) void* ptr)
 		__reset_colour();
 		if (settings.printf_battery) {
 			printf("%s%+5.2f |%+5.2f |", __next_colour(),\
-					state_estimate.v_batt_lp, \
-					state_estimate.v_batt_lp_jack);
+					snap.state_estimate.v_batt_lp, \
+					snap.state_estimate.v_batt_lp_jack);
 		}
 		if(settings.printf_altitude){
 			printf("%s%+5.2f |%+5.2f |",	__next_colour(),\
-						state_estimate.alt_bmp,\
-						state_estimate.alt_bmp_vel);
+						snap.state_estimate.alt_bmp,\
+						snap.state_estimate.alt_bmp_vel);
 		}
 		if (settings.printf_proj_ap) {
 			printf("%s%+5.2f |%+5.2f |", __next_colour(), \
-				state_estimate.alt_bmp_accel,\
-				state_estimate.proj_ap);
+				snap.state_estimate.alt_bmp_accel,\
+				snap.state_estimate.proj_ap);
 		}
 		if(settings.printf_rpy){
 			printf(KCYN);
 			printf("%s%+5.2f|%+5.2f|%+5.2f|",
 							__next_colour(),\
-							state_estimate.roll,\
-							state_estimate.pitch,\
-							state_estimate.yaw);
-							//state_estimate.continuous_yaw);
+							snap.state_estimate.roll,\
+							snap.state_estimate.pitch,\
+							snap.state_estimate.yaw);
+							//snap.state_estimate.continuous_yaw);
 		}
 		if(settings.printf_setpoint){
 			printf("%s%+5.2f|%+5.2f|%+5.2f|%+5.2f|",\
 							__next_colour(),\
-							setpoint.Z,\
-							setpoint.roll,\
-							setpoint.pitch,\
-							setpoint.yaw);
+							snap.setpoint.Z,\
+							snap.setpoint.roll,\
+							snap.setpoint.pitch,\
+							snap.setpoint.yaw);
 		}
 		if(settings.printf_u){
 			printf("%s%+5.2f|%+5.2f|%+5.2f|%+5.2f|%+5.2f|%+5.2f|",\
 							__next_colour(),\
-							fstate.u[0],\
-							fstate.u[1],\
-							fstate.u[2],\
-							fstate.u[3],\
-							fstate.u[4],\
-							fstate.u[5]);
+							snap.fstate.u[0],\
+							snap.fstate.u[1],\
+							snap.fstate.u[2],\
+							snap.fstate.u[3],\
+							snap.fstate.u[4],\
+							snap.fstate.u[5]);
 		}		
 		if(settings.printf_motors){
 		//	printf("%s",__next_colour());
 			for(i=0;i<settings.num_rotors;i++){
-		//		printf("%+5.2f|", fstate.m[i]);
+		//		printf("%+5.2f|", snap.fstate.m[i]);
 			}
 		}
 		printf(KNRM);
@@ -205,7 +213,7 @@ static void* __printf_manager_func(__attribute__ ((unused)) void* ptr)
 		// we are not using encoders
  		if(settings.printf_rev){
 			for(i=0;i<4;i++){
-				printf("%10d|", state_estimate.rev[i]);
+				printf("%10d|", snap.state_estimate.rev[i]);
 			}
  		}
 
@@ -213,13 +221,13 @@ static void* __printf_manager_func(__attribute__ ((unused)) void* ptr)
 			print_flight_mode(user_input.flight_mode);
 		}
 		if (settings.printf_status) {
-			print_flight_status(flight_status);
+			print_flight_status(snap.flight_status);
 		}
 		if(settings.printf_counter){
-			printf("%d ",state_estimate.counter);
+			printf("%d ",snap.state_estimate.counter);
 		}
 		fflush(stdout);
-		rc_usleep(1000000/PRINTF_MANAGER_HZ);
+		hal_usleep(1000000/PRINTF_MANAGER_HZ);
 	}
 
 	// put linewrap back on
@@ -230,12 +238,12 @@ static void* __printf_manager_func(__attribute__ ((unused)) void* ptr)
 
 int printf_init()
 {
-	if(rc_pthread_create(&printf_manager_thread, __printf_manager_func, NULL,
-				SCHED_FIFO, PRINTF_MANAGER_PRI)==-1){
+	if(hal_pthread_create(&printf_manager_thread, __printf_manager_func, NULL,
+				SCHED_FIFO, settings.printf_manager_priority)==-1){
 		fprintf(stderr,"ERROR in start_printf_manager, failed to start thread\n");
 		return -1;
 	}
-	rc_usleep(50000);
+	hal_usleep(50000);
 	return 0;
 }
 
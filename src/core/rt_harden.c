@@ -0,0 +1,164 @@
+/**
+ * @file rt_harden.c
+ *
+ * Real-time hardening, see rt_harden.h
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <rt_harden.h>
+#include <thread_defs.h>
+#include <settings.h>
+#include <snapshot.h>
+
+static int was_armed;
+static int armed_periods;
+static long minflt_arm, majflt_arm;	// counters when last armed
+static long minflt, majflt;		// faults during the last armed period
+
+// touch every page of a stack frame this big so it is mapped and locked
+static void __prefault_stack(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT_KB * 1024];
+	size_t i;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (i = 0; i < sizeof(stack); i += page) stack[i] = 0;
+}
+
+static int __prefault_heap(void)
+{
+	unsigned char* p;
+	size_t i, size = RT_HEAP_PREFAULT_KB * 1024;
+	long page = sysconf(_SC_PAGESIZE);
+
+	// keep freed memory in the process and never hand out mmap'd chunks,
+	// so the reserve touched below is what later mallocs get
+	if (mallopt(M_TRIM_THRESHOLD, -1) != 1 || mallopt(M_MMAP_MAX, 0) != 1) {
+		fprintf(stderr, "ERROR in rt_harden_init, mallopt failed\n");
+		return -1;
+	}
+	p = malloc(size);
+	if (p == NULL) {
+		fprintf(stderr, "ERROR in rt_harden_init, failed to reserve heap\n");
+		return -1;
+	}
+	for (i = 0; i < size; i += page) p[i] = 0;
+	free(p);
+	return 0;
+}
+
+static int __pin(int cpu)
+{
+	cpu_set_t set;
+	int ret;
+
+	if (cpu < 0) return 0;
+	if (cpu >= sysconf(_SC_NPROCESSORS_ONLN)) {
+		if (settings.warnings_en) {
+			fprintf(stderr, "WARNING in rt_harden, cpu %d not online, not pinning\n", cpu);
+		}
+		return 0;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret) {
+		fprintf(stderr, "ERROR in rt_harden, failed to pin to cpu %d: %s\n", cpu, strerror(ret));
+		return -1;
+	}
+	return 0;
+}
+
+static void __faults(long* min, long* maj)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru)) {
+		*min = *maj = 0;
+		return;
+	}
+	*min = ru.ru_minflt;
+	*maj = ru.ru_majflt;
+}
+
+int rt_harden_init(void)
+{
+	if (!settings.rt_harden) return 0;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		perror("ERROR in rt_harden_init, mlockall");
+		return -1;
+	}
+	if (__prefault_heap()) return -1;
+	__prefault_stack();
+	if (__pin(settings.non_rt_cpu)) return -1;
+	return 0;
+}
+
+void rt_harden_thread(int realtime)
+{
+	if (!settings.rt_harden) return;
+	__prefault_stack();
+	__pin(realtime ? settings.rt_cpu : settings.non_rt_cpu);
+}
+
+void rt_harden_service(void)
+{
+	static snapshot_t snap;
+	long min, maj;
+	int armed;
+
+	if (snapshot_read(&snap)) return;
+	armed = snap.fstate.arm_state == ARMED;
+	if (armed == was_armed) return;
+	was_armed = armed;
+
+	__faults(&min, &maj);
+	if (armed) {
+		minflt_arm = min;
+		majflt_arm = maj;
+		return;
+	}
+	minflt = min - minflt_arm;
+	majflt = maj - majflt_arm;
+	armed_periods++;
+	if (settings.warnings_en && (minflt || majflt)) {
+		fprintf(stderr, "WARNING: %ld minor, %ld major page faults while armed\n",
+			minflt, majflt);
+	}
+}
+
+int rt_harden_print(FILE* fd)
+{
+	long min, maj;
+
+	if (fd == NULL) {
+		fprintf(stderr, "ERROR in rt_harden_print, NULL file\n");
+		return -1;
+	}
+	// still armed, count up to now
+	if (was_armed) {
+		__faults(&min, &maj);
+		minflt = min - minflt_arm;
+		majflt = maj - majflt_arm;
+	}
+	else if (armed_periods == 0) {
+		fprintf(fd, "page faults while armed: never armed\n");
+		return 0;
+	}
+	fprintf(fd, "page faults while armed: %ld minor, %ld major (rt_harden %s)\n",
+		minflt, majflt, settings.rt_harden ? "on" : "off");
+	fflush(fd);
+	return 0;
+}
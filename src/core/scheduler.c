@@ -0,0 +1,261 @@
+/**
+ * @file scheduler.c
+ *
+ * Multi-rate cyclic scheduler, see scheduler.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <scheduler.h>
+
+#define COST_DECAY_SHIFT	5	// cost estimate decays by 1/32 per run or shed
+#define MAX_SHED_STREAK		8	// ticks in a row a task may be shed before it runs anyway
+
+typedef struct sched_group_state_t {
+	sched_group_t cfg;
+	int divisor;
+	int due;		// set at the start of every tick
+	int ran;		// a task of the group ran this tick
+	uint64_t elapsed_ns;	// time used this tick
+	uint64_t budget_ns;
+	uint64_t runs;
+	uint64_t overruns;
+	uint64_t sheds;
+	uint64_t max_ns;
+} sched_group_state_t;
+
+typedef struct sched_task_state_t {
+	sched_task_t cfg;
+	int run;		// to run this tick
+	int pending;		// deferred from the last tick
+	uint64_t cost_ns;	// decaying peak of the run time
+	int shed_streak;	// ticks in a row it was due and got shed
+} sched_task_state_t;
+
+typedef struct sched_phase_stats_t {
+	uint64_t ticks;
+	uint64_t misses;	// whole tick longer than the period
+	uint64_t critical_late;	// critical tasks done past the budget
+	uint64_t sheds;
+	uint64_t defers;
+} sched_phase_stats_t;
+
+static sched_group_state_t group[SCHED_MAX_GROUPS];
+static sched_task_state_t task[SCHED_MAX_TASKS];
+static sched_phase_stats_t phase_stats[SCHED_NUM_PHASES];
+static int num_group;
+static int num_task;
+static uint64_t tick;
+static uint64_t period_ns;
+static uint64_t tick_budget_ns;
+static int initialized = 0;
+
+static const char* const phase_names[SCHED_NUM_PHASES] = {
+	"WAIT",
+	"STANDBY",
+	"POWERED_ASCENT",
+	"UNPOWERED_ASCENT",
+	"DESCENT_TO_LAND",
+	"LANDED",
+	"TEST"
+};
+
+int sched_divisor(int base_hz, double hz)
+{
+	int div;
+	if (hz <= 0.0) return 1;
+	div = (int)(base_hz / hz + 0.5);
+	return div < 1 ? 1 : div;
+}
+
+static int __gcd(int a, int b)
+{
+	int r;
+	while (b) {
+		r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+int sched_init(int base_hz, double budget, const sched_group_t* groups, int num_groups,
+	const sched_task_t* tasks, int num_tasks)
+{
+	int i;
+
+	if (base_hz <= 0 || budget <= 0.0 || groups == NULL || tasks == NULL) {
+		fprintf(stderr, "ERROR in sched_init, invalid argument\n");
+		return -1;
+	}
+	if (num_groups > SCHED_MAX_GROUPS || num_tasks > SCHED_MAX_TASKS) {
+		fprintf(stderr, "ERROR in sched_init, too many groups or tasks\n");
+		return -1;
+	}
+	for (i = 0; i < num_tasks; i++) {
+		if (tasks[i].group < 0 || tasks[i].group >= num_groups || tasks[i].func == NULL) {
+			fprintf(stderr, "ERROR in sched_init, bad task %d\n", i);
+			return -1;
+		}
+	}
+
+	memset(group, 0, sizeof(group));
+	memset(task, 0, sizeof(task));
+	memset(phase_stats, 0, sizeof(phase_stats));
+	period_ns = 1000000000ULL / base_hz;
+	tick_budget_ns = (uint64_t)(budget * period_ns);
+	for (i = 0; i < num_groups; i++) {
+		group[i].cfg = groups[i];
+		group[i].divisor = sched_divisor(base_hz, groups[i].hz);
+		group[i].cfg.phase = groups[i].phase % group[i].divisor;
+		group[i].budget_ns = (uint64_t)(groups[i].budget * period_ns);
+	}
+	// two decimated groups land on the same tick every now and then unless
+	// their phases differ modulo the gcd of their divisors
+	for (i = 0; i < num_groups; i++) {
+		int j, g;
+		if (group[i].divisor == 1 || groups[i].hz <= 0.0) continue;
+		for (j = i + 1; j < num_groups; j++) {
+			if (group[j].divisor == 1 || groups[j].hz <= 0.0) continue;
+			g = __gcd(group[i].divisor, group[j].divisor);
+			if (group[i].cfg.phase % g == group[j].cfg.phase % g) {
+				fprintf(stderr, "WARNING in sched_init, groups %s and %s share ticks\n",
+					groups[i].name, groups[j].name);
+			}
+		}
+	}
+	for (i = 0; i < num_tasks; i++) task[i].cfg = tasks[i];
+	num_group = num_groups;
+	num_task = num_tasks;
+	tick = 0;
+	initialized = 1;
+	return 0;
+}
+
+// estimated time still needed this tick by tasks after i that are more
+// important than it
+static uint64_t __reserved_after(int i)
+{
+	int j;
+	uint64_t ns = 0;
+
+	for (j = i + 1; j < num_task; j++) {
+		if (task[j].run && task[j].cfg.prio < task[i].cfg.prio) ns += task[j].cost_ns;
+	}
+	return ns;
+}
+
+static inline void __update_cost(sched_task_state_t* ts, uint64_t ns)
+{
+	if (ns > ts->cost_ns) ts->cost_ns = ns;
+	else ts->cost_ns -= (ts->cost_ns - ns) >> COST_DECAY_SHIFT;
+}
+
+void sched_run_tick(uint64_t t_start)
+{
+	int i, last_critical = -1;
+	int phase = (int)flight_status;
+	uint64_t t = t_start, t0;
+	uint64_t t_critical = t_start;
+	sched_group_state_t* g;
+	sched_task_state_t* ts;
+	sched_phase_stats_t* ps;
+
+	if (!initialized) return;
+	if (phase < 0 || phase >= SCHED_NUM_PHASES) phase = TEST;
+	ps = &phase_stats[phase];
+
+	for (i = 0; i < num_group; i++) {
+		g = &group[i];
+		g->due = g->cfg.hz > 0.0 && (int)(tick % g->divisor) == g->cfg.phase;
+		g->ran = 0;
+		g->elapsed_ns = 0;
+	}
+	for (i = 0; i < num_task; i++) {
+		ts = &task[i];
+		ts->run = ts->cfg.enabled && (group[ts->cfg.group].due || ts->pending);
+		ts->pending = 0;
+		if (ts->run && ts->cfg.prio == SCHED_CRITICAL) last_critical = i;
+	}
+
+	for (i = 0; i < num_task; i++) {
+		ts = &task[i];
+		if (!ts->run) continue;
+		g = &group[ts->cfg.group];
+
+		// a single slow run must not keep a task out for good, so the
+		// estimate also decays while it is shed and a task shed too many
+		// ticks in a row runs anyway
+		if (ts->cfg.prio != SCHED_CRITICAL && ts->shed_streak < MAX_SHED_STREAK &&
+			(t - t_start) + ts->cost_ns + __reserved_after(i) > tick_budget_ns) {
+			ts->cost_ns -= ts->cost_ns >> COST_DECAY_SHIFT;
+			ts->shed_streak++;
+			ts->run = 0;
+			g->sheds++;
+			ps->sheds++;
+			if (ts->cfg.defer) {
+				ts->pending = 1;
+				ps->defers++;
+			}
+			continue;
+		}
+
+		ts->shed_streak = 0;
+		t0 = t;
+		ts->cfg.func();
+		isr_timing_stage(ts->cfg.stage, &t);
+		__update_cost(ts, t - t0);
+		g->elapsed_ns += t - t0;
+		g->ran = 1;
+		if (i == last_critical) t_critical = t;
+	}
+
+	for (i = 0; i < num_group; i++) {
+		g = &group[i];
+		if (!g->ran) continue;
+		g->runs++;
+		if (g->elapsed_ns > g->max_ns) g->max_ns = g->elapsed_ns;
+		if (g->budget_ns && g->elapsed_ns > g->budget_ns) g->overruns++;
+	}
+	ps->ticks++;
+	if (t - t_start > period_ns) ps->misses++;
+	if (t_critical - t_start > tick_budget_ns) ps->critical_late++;
+	tick++;
+}
+
+int sched_print(FILE* fd)
+{
+	int i;
+	sched_group_state_t* g;
+	sched_phase_stats_t* ps;
+
+	if (fd == NULL) {
+		fprintf(stderr, "ERROR in sched_print, NULL file\n");
+		return -1;
+	}
+	fprintf(fd, "\nschedule, %llu ticks, tick budget %.1f us\n",
+		(unsigned long long)tick, tick_budget_ns / 1000.0);
+	fprintf(fd, "%-12s %8s %4s %5s %9s %10s %9s %9s %9s\n",
+		"group", "hz", "div", "phase", "budget", "runs", "overruns", "shed", "max(us)");
+	for (i = 0; i < num_group; i++) {
+		g = &group[i];
+		fprintf(fd, "%-12s %8.1f %4d %5d %9.1f %10llu %9llu %9llu %9.1f\n", g->cfg.name,
+			g->cfg.hz > 0.0 ? 1.0e9 / (period_ns * g->divisor) : 0.0,
+			g->divisor, g->cfg.phase, g->budget_ns / 1000.0,
+			(unsigned long long)g->runs, (unsigned long long)g->overruns,
+			(unsigned long long)g->sheds, g->max_ns / 1000.0);
+	}
+	fprintf(fd, "%-17s %10s %9s %13s %9s %9s\n",
+		"flight phase", "ticks", "misses", "critical_late", "shed", "deferred");
+	for (i = 0; i < SCHED_NUM_PHASES; i++) {
+		ps = &phase_stats[i];
+		if (ps->ticks == 0) continue;
+		fprintf(fd, "%-17s %10llu %9llu %13llu %9llu %9llu\n", phase_names[i],
+			(unsigned long long)ps->ticks, (unsigned long long)ps->misses,
+			(unsigned long long)ps->critical_late, (unsigned long long)ps->sheds,
+			(unsigned long long)ps->defers);
+	}
+	fflush(fd);
+	return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file servo_cal.c
+ *
+ * Servo calibration curves, see servo_cal.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <servo_cal.h>
+#include <hal.h>
+#include <mix.h>
+
+#define CAPTURE_PERIOD_MS	20	// servos need a pulse at least this often
+#define CAPTURE_SETTLE_PULSES	25	// pulses at nominal before the rail goes off
+
+// Fritsch-Carlson slopes at the points, keep the cubic monotone
+static void __slopes(const servo_cal_t* cal, double* d)
+{
+	double h0, h1, s0, s1;
+	int n = cal->points;
+	int i, e, k;
+
+	if (n == 2) {
+		d[0] = d[1] = (cal->us[1] - cal->us[0]) / (cal->pos[1] - cal->pos[0]);
+		return;
+	}
+	for (i = 1; i < n - 1; i++) {
+		h0 = cal->pos[i] - cal->pos[i - 1];
+		h1 = cal->pos[i + 1] - cal->pos[i];
+		s0 = (cal->us[i] - cal->us[i - 1]) / h0;
+		s1 = (cal->us[i + 1] - cal->us[i]) / h1;
+		// weighted harmonic mean, the widths have the same sign throughout
+		d[i] = (3.0 * (h0 + h1)) / ((2.0 * h1 + h0) / s0 + (h1 + 2.0 * h0) / s1);
+	}
+	// one-sided three point estimate at the ends, limited to stay monotone
+	for (i = 0; i < 2; i++) {
+		e = i ? n - 1 : 0;
+		k = i ? -1 : 1;
+		h0 = fabs(cal->pos[e + k] - cal->pos[e]);
+		h1 = fabs(cal->pos[e + 2 * k] - cal->pos[e + k]);
+		s0 = (cal->us[e + k] - cal->us[e]) / (cal->pos[e + k] - cal->pos[e]);
+		s1 = (cal->us[e + 2 * k] - cal->us[e + k]) / (cal->pos[e + 2 * k] - cal->pos[e + k]);
+		d[e] = ((2.0 * h0 + h1) * s0 - h0 * s1) / (h0 + h1);
+		if (d[e] * s0 <= 0.0) d[e] = 0.0;
+		else if (fabs(d[e]) > 3.0 * fabs(s0)) d[e] = 3.0 * s0;
+	}
+}
+
+// pulse width at a position by scanning the points, only used at init
+static double __eval(const servo_cal_t* cal, const double* d, double x)
+{
+	double h, t, t2, t3;
+	int i;
+
+	for (i = 0; i < cal->points - 2 && x > cal->pos[i + 1]; i++);
+	h = cal->pos[i + 1] - cal->pos[i];
+	t = (x - cal->pos[i]) / h;
+	if (cal->curve == SERVO_CURVE_LINEAR) {
+		return cal->us[i] + t * (cal->us[i + 1] - cal->us[i]);
+	}
+	// cubic Hermite
+	t2 = t * t;
+	t3 = t2 * t;
+	return (2.0 * t3 - 3.0 * t2 + 1.0) * cal->us[i] + (t3 - 2.0 * t2 + t) * h * d[i]
+		+ (-2.0 * t3 + 3.0 * t2) * cal->us[i + 1] + (t3 - t2) * h * d[i + 1];
+}
+
+int servo_cal_compile(const servo_cal_t* cal, servo_lut_t* lut)
+{
+	double d[SERVO_CAL_MAX_POINTS];
+	double x0, x1, y0, y1, dir;
+	int i, n;
+
+	if (cal == NULL || lut == NULL) {
+		fprintf(stderr, "ERROR in servo_cal_compile, received NULL pointer\n");
+		return -1;
+	}
+	n = cal->points;
+	if (n < 2 || n > SERVO_CAL_MAX_POINTS) {
+		fprintf(stderr, "ERROR in servo_cal_compile, need 2 to %d points\n", SERVO_CAL_MAX_POINTS);
+		return -1;
+	}
+	if (cal->pos[0] != 0.0 || cal->pos[n - 1] != 1.0) {
+		fprintf(stderr, "ERROR in servo_cal_compile, positions must go from 0.0 to 1.0\n");
+		return -1;
+	}
+	dir = cal->us[n - 1] - cal->us[0];
+	for (i = 0; i < n; i++) {
+		if (cal->us[i] < SERVO_CAL_MIN_US || cal->us[i] > SERVO_CAL_MAX_US) {
+			fprintf(stderr, "ERROR in servo_cal_compile, pulse widths must be in %.0f to %.0f us\n",
+				SERVO_CAL_MIN_US, SERVO_CAL_MAX_US);
+			return -1;
+		}
+		if (i == 0) continue;
+		if (cal->pos[i] <= cal->pos[i - 1]) {
+			fprintf(stderr, "ERROR in servo_cal_compile, positions must increase\n");
+			return -1;
+		}
+		if ((cal->us[i] - cal->us[i - 1]) * dir <= 0.0) {
+			fprintf(stderr, "ERROR in servo_cal_compile, pulse widths must strictly increase or decrease\n");
+			return -1;
+		}
+	}
+	if ((cal->nominal_us - cal->us[0]) * (cal->nominal_us - cal->us[n - 1]) > 0.0) {
+		fprintf(stderr, "ERROR in servo_cal_compile, nominal_us must be within the curve\n");
+		return -1;
+	}
+
+	if (cal->curve == SERVO_CURVE_SPLINE) __slopes(cal, d);
+	for (i = 0; i < SERVO_CAL_GRID; i++) {
+		x0 = (double)i / SERVO_CAL_GRID;
+		x1 = (double)(i + 1) / SERVO_CAL_GRID;
+		y0 = __eval(cal, d, x0);
+		y1 = __eval(cal, d, x1);
+		lut->b[i] = (y1 - y0) * SERVO_CAL_GRID;
+		lut->a[i] = y0 - lut->b[i] * x0;
+	}
+	lut->a[SERVO_CAL_GRID] = lut->a[SERVO_CAL_GRID - 1];
+	lut->b[SERVO_CAL_GRID] = lut->b[SERVO_CAL_GRID - 1];
+	lut->min_us = cal->us[0];
+	lut->nominal_us = cal->nominal_us;
+	lut->max_us = cal->us[n - 1];
+	return 0;
+}
+
+double servo_cal_map(const servo_lut_t* lut, double pos)
+{
+	if (pos < 0.0) pos = 0.0;
+	else if (pos > 1.0) pos = 1.0;
+	return fma(lut->b[(int)(pos * SERVO_CAL_GRID)], pos, lut->a[(int)(pos * SERVO_CAL_GRID)]);
+}
+
+// keeps pulsing the servo until a line comes in on stdin
+static int __hold_until_input(int ch, int us, char* line, int len)
+{
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	int ret;
+
+	for (;;) {
+		if (hal_servo_send_pulse_us(ch, us) == -1) return -1;
+		ret = poll(&pfd, 1, CAPTURE_PERIOD_MS);
+		if (ret < 0) return -1;
+		if (ret > 0) return fgets(line, len, stdin) == NULL ? -1 : 0;
+	}
+}
+
+int servo_cal_capture(int ch, double min_us, double nominal_us, double max_us, FILE* out)
+{
+	double us[SERVO_CAL_CAPTURE_STEPS], meas[SERVO_CAL_CAPTURE_STEPS], base, span;
+	char line[64], *end;
+	int i, ret = -1;
+
+	if (ch < 1 || ch > MAX_ROTORS || out == NULL) {
+		fprintf(stderr, "ERROR in servo_cal_capture, invalid argument\n");
+		return -1;
+	}
+	if (hal_servo_power_rail_en(1) == -1) {
+		fprintf(stderr, "ERROR in servo_cal_capture, failed to power the servo rail\n");
+		return -1;
+	}
+
+	printf("\nCalibrating servo %d from %.0f to %.0f us\n", ch, min_us, max_us);
+	printf("Enter the measured position at every step, in any unit\n");
+	for (i = 0; i < SERVO_CAL_CAPTURE_STEPS; i++) {
+		us[i] = min_us + i * (max_us - min_us) / (SERVO_CAL_CAPTURE_STEPS - 1);
+		for (;;) {
+			printf("%7.1f us: ", us[i]);
+			fflush(stdout);
+			if (__hold_until_input(ch, (int)(us[i] + 0.5), line, sizeof(line))) {
+				fprintf(stderr, "ERROR in servo_cal_capture, no more input\n");
+				goto out;
+			}
+			meas[i] = strtod(line, &end);
+			if (end != line) break;
+			printf("not a number, again\n");
+		}
+	}
+
+	// normalize to 0.0 at the first step and 1.0 at the last
+	base = meas[0];
+	span = meas[SERVO_CAL_CAPTURE_STEPS - 1] - meas[0];
+	if (span == 0.0) {
+		fprintf(stderr, "ERROR in servo_cal_capture, the servo did not move\n");
+		goto out;
+	}
+	for (i = 0; i < SERVO_CAL_CAPTURE_STEPS; i++) {
+		meas[i] = (meas[i] - base) / span;
+		if (i > 0 && meas[i] <= meas[i - 1]) {
+			fprintf(stderr, "ERROR in servo_cal_capture, position must keep moving the same way\n");
+			goto out;
+		}
+	}
+	fprintf(out, "{\"curve\": \"SPLINE\", \"nominal_us\": %.1f, \"points\": [", nominal_us);
+	for (i = 0; i < SERVO_CAL_CAPTURE_STEPS; i++) {
+		fprintf(out, "%s[%.4f, %.1f]", i ? ", " : "", meas[i], us[i]);
+	}
+	fprintf(out, "]}\n");
+	fflush(out);
+	ret = 0;
+
+out:
+	// give the servo time to get back before the power goes
+	for (i = 0; i < CAPTURE_SETTLE_PULSES; i++) {
+		hal_servo_send_pulse_us(ch, (int)(nominal_us + 0.5));
+		hal_usleep(CAPTURE_PERIOD_MS * 1000);
+	}
+	hal_servo_power_rail_en(0);
+	return ret;
+}
@@ -3,10 +3,16 @@
  */
 
 #include <servos.h>
+#include <isr_timing.h>
 
 servos_state_t sstate;
 servos_preflight_test_t servos_preflight;
 
+// calibration curve of every channel, compiled in servos_init()
+static servo_lut_t servos_lut[MAX_ROTORS];
+// command shaping of every channel, only with settings.actuator_shaping
+static actuator_t servos_shaper[MAX_ROTORS];
+
 /*
 This defines operating range of each servo mottor.
 First column should the minimum position of each servo 
@@ -14,9 +20,11 @@ corresponding to the servo pulse signal in miliseconds
 (see rc_test_servos.c). Second column is the nominal/safe 
 value for servos to return to when armed and before being 
 disarmed. Signal should be in the range of [500 2500]us.
-For details, see rc_servo_send_pulse_us().
+For details, see hal_servo_send_pulse_us().
+This is the "DEFAULT" servo_calibration, a straight line
+from min to max, see servo_cal.h for measured curves.
 */
-static double servos_lim[8][3] = \
+static double servos_lim_default[8][3] = \
 { {1550.0, 1550.0, 1930.0}, \
 {1525.0, 1540.0, 1960.0}, \
 {1558.0, 1558.0, 1970.0}, \
@@ -34,7 +42,8 @@ static double servos_lim[8][3] = \
 int __set_motor_nom_pulse(void)
 {
     for (int i = 0; i < MAX_ROTORS; i++) {
-        sstate.m_us[i] = servos_lim[i][1]; //have to set to calibrated nominal values
+        sstate.m_us[i] = sstate.servos_lim[i][1]; //have to set to calibrated nominal values
+        sstate.m[i] = 0.0; // nominal is the brakes in, drag_brake_deflection() reads this
     }
 
     return 0;
@@ -49,7 +58,8 @@ int __set_motor_min_pulse(void)
 {
     for (int i = 0; i < MAX_ROTORS; i++)
     {
-        sstate.m_us[i] = servos_lim[i][0];  // have to set to calibrated min values
+        sstate.m_us[i] = sstate.servos_lim[i][0];  // have to set to calibrated min values
+        sstate.m[i] = 0.0;
     }
 
     return 0;
@@ -64,7 +74,8 @@ int __set_motor_max_pulse(void)
 {
     for (int i = 0; i < MAX_ROTORS; i++)
     {
-        sstate.m_us[i] = servos_lim[i][2];  // have to set to calibrated max values
+        sstate.m_us[i] = sstate.servos_lim[i][2];  // have to set to calibrated max values
+        sstate.m[i] = 1.0;
     }
 
     return 0;
@@ -77,10 +88,10 @@ int __set_motor_max_pulse(void)
  */
 int __set_single_min_max_pulse(int i, int pos)
 {
-    if (pos == 0) sstate.m_us[i] = servos_lim[i][0];  // have to set to calibrated min values
-    else if (pos) sstate.m_us[i] = servos_lim[i][1];  // have to set to calibrated nom values
+    if (pos == 0) sstate.m_us[i] = sstate.servos_lim[i][0];  // have to set to calibrated min values
+    else if (pos) sstate.m_us[i] = sstate.servos_lim[i][1];  // have to set to calibrated nom values
     else if (pos == 2)
-        sstate.m_us[i] = servos_lim[i][2];  // have to set to calibrated max values
+        sstate.m_us[i] = sstate.servos_lim[i][2];  // have to set to calibrated max values
     else
     {
         printf("\nERROR: in __set_single_min_max_pulse, pos must be 0-min, 1-nom, or 2-max");
@@ -90,30 +101,63 @@ int __set_single_min_max_pulse(int i, int pos)
     return 0;
 }
 
-double __map_servo_signal_ms(double* m, double servos_lim_min, double servos_lim_max)
+/*
+ * Sends sstate.m_us of the first n channels to the servo rail in one
+ * batch and timestamps the commit.
+ */
+static int __commit_pulses(int n)
 {
-    // sanity check
-    if (*m > 1.0 || *m < 0.0) {
-        printf("\nERROR: in __map_servo_signal_ms, desired thrust must be between 0.0 & 1.0");
-        return -1;
-    }
+    int us[MAX_ROTORS];
+    int i;
 
-    // return quickly for boundary conditions
-    if (*m == 0.0) return servos_lim_min;
-    if (*m == 1.0) return servos_lim_max;
+    for (i = 0; i < n; i++) us[i] = (int)(sstate.m_us[i] + 0.5);
+    if (hal_servo_send_pulses_us(us, n) == -1) return -1;
+    sstate.commit_ns = hal_nanos_since_boot();
+    return 0;
+}
 
-    // Map [0 1] signal to servo pulse width
-    return *m * (servos_lim_max - servos_lim_min) + servos_lim_min;
+/*
+ * Compiles the calibration curve of every channel, from the settings
+ * file or the default table, and keeps its min/nominal/max.
+ */
+static int __compile_calibration(void)
+{
+    servo_cal_t def;
+    int i;
 
-    fprintf(stderr, "ERROR: something in __map_servo_signal_ms went wrong\n");
-    return -1;
+    for (i = 0; i < MAX_ROTORS; i++) {
+        if (i < settings.num_servo_cal) {
+            if (servo_cal_compile(&settings.servo_cal[i], &servos_lut[i]) == -1) {
+                fprintf(stderr, "ERROR in servos_init, bad calibration for servo %d\n", i + 1);
+                return -1;
+            }
+        }
+        else {
+            def.curve = SERVO_CURVE_LINEAR;
+            def.points = 2;
+            def.nominal_us = servos_lim_default[i][1];
+            def.pos[0] = 0.0;
+            def.pos[1] = 1.0;
+            def.us[0] = servos_lim_default[i][0];
+            def.us[1] = servos_lim_default[i][2];
+            if (servo_cal_compile(&def, &servos_lut[i]) == -1) return -1;
+        }
+        sstate.servos_lim[i][0] = servos_lut[i].min_us;
+        sstate.servos_lim[i][1] = servos_lut[i].nominal_us;
+        sstate.servos_lim[i][2] = servos_lut[i].max_us;
+    }
+    return 0;
 }
 
 int servos_init(void)
 {
     sstate.arm_state = DISARMED;
+    if (__compile_calibration() == -1) return -1;
+    for (int i = 0; i < MAX_ROTORS; i++) {
+        if (actuator_init(&servos_shaper[i], &settings.actuator_model[i], settings.dt, 0.0) == -1) return -1;
+    }
     // initialize PRU
-    if (rc_servo_init()) return -1;
+    if (hal_servo_init()) return -1;
 
     for (int i = 0; i < MAX_ROTORS; i++) {
         sstate.m[i] = 0; //zero everything out just in case
@@ -142,10 +186,12 @@ int servos_arm(void)
     }
     // need to set each of the servos to their nominal positions:
     __set_motor_nom_pulse();
+    // shaped commands start from the brakes in
+    for (int i = 0; i < MAX_ROTORS; i++) actuator_reset(&servos_shaper[i], 0.0);
 
 
     //enable power:
-    rc_servo_power_rail_en(1);
+    hal_servo_power_rail_en(1);
 
     sstate.arm_state = ARMED; //set servos to armed and powered
     return 0;
@@ -167,9 +213,7 @@ int servos_return_to_nominal(void)
     }
 
     //send servo signals using Pulse Width in microseconds
-    for (int i = 0; i < MAX_ROTORS; i++) {
-        if (rc_servo_send_pulse_us(i, sstate.m_us[i]) == -1) return -1;
-    }
+    if (__commit_pulses(MAX_ROTORS) == -1) return -1;
     return 0;
 }
 
@@ -179,32 +223,35 @@ int servos_disarm(void)
     __set_motor_nom_pulse(); //won't work, need extra time before power is killed
 
     //send servo signals using Pulse Width in microseconds
-    for (int i = 0; i < MAX_ROTORS; i++) {
-        if (rc_servo_send_pulse_us(i, sstate.m_us[i]) == -1) return -1;
-    }
+    if (__commit_pulses(MAX_ROTORS) == -1) return -1;
 
     //power-off servo rail:
-    rc_servo_power_rail_en(0);
+    hal_servo_power_rail_en(0);
 
     sstate.arm_state = DISARMED;
     return 0;
 }
 
-int servos_march(int i, double* mot)
+int servos_march(const double* mot, int n)
 {
+    int i;
+
     if (sstate.arm_state == DISARMED) {
         //printf("WARNING: trying to march servos when servos disarmed\n");
         return 0;
     }
 
-    // need to do mapping between [0 1] and servo signal in us
-    sstate.m_us[i] = __map_servo_signal_ms(mot, servos_lim[i][0], servos_lim[i][2]);
-
-    //send servo signals using [-1.5 1.5] normalized values
-    //if (rc_servo_send_pulse_normalized(i, mot) == -1) return -1;
+    // optionally hold back what the servos can't follow, then map [0 1] to
+    // servo pulse width for all channels at once through the compiled
+    // calibration curves, which also clamp
+    for (i = 0; i < n; i++) {
+        sstate.m[i] = settings.actuator_shaping ? actuator_shape(&servos_shaper[i], mot[i]) : mot[i];
+        sstate.m_us[i] = servo_cal_map(&servos_lut[i], sstate.m[i]);
+    }
 
     //send servo signals using Pulse Width in microseconds
-    if (rc_servo_send_pulse_us(i+1, sstate.m_us[i]) == -1) return -1;
+    if (__commit_pulses(n) == -1) return -1;
+    isr_timing_output_committed();
 
     return 0;
 }
@@ -228,7 +275,7 @@ int test_servos(void)
         // Start by zeroing out the motors signals and then add from there.
         servos_preflight.preflight_case = 1;
         user_input.requested_arm_mode = ARMED;
-        servos_preflight.init_time = rc_nanos_since_boot();
+        servos_preflight.init_time = hal_nanos_since_boot();
         servos_preflight.pre_flight_check_res = 0;
         servos_preflight.init_cases = 1;
         servos_preflight.initialized = 1;
@@ -241,7 +288,7 @@ int test_servos(void)
         {
             servos_preflight.init_cases = 2;
             servos_preflight.time_delay = 5.0;
-            servos_preflight.time_ns = rc_nanos_since_boot();
+            servos_preflight.time_ns = hal_nanos_since_boot();
 
             printf("Case-1: min/max pulses check\n");
             if (__set_motor_max_pulse()) printf("ERROR: Failed to send the maximum pulse.\n");
@@ -256,15 +303,14 @@ int test_servos(void)
         {
 
             if (__set_motor_min_pulse()) printf("ERROR: Failed to send the minimum pulse.\n");
-            servos_preflight.time_cases = rc_nanos_since_boot();
+            servos_preflight.time_cases = hal_nanos_since_boot();
             servos_preflight.time_delay_cases = 1.0;
             servos_preflight.preflight_case = 2;
             printf("Case-1: Done\n");
         }
 
-        for (i = 0; i < settings.num_rotors; i++)
-            if (rc_servo_send_pulse_us(i + 1, sstate.m_us[i]) == -1)
-                printf("ERROR: Failed to send pulse to servo rail pin %d\n", i + 1);
+        if (__commit_pulses(settings.num_rotors) == -1)
+            printf("ERROR: Failed to send pulses to servo rail\n");
         return 0;
     }
     // 2. test min/max signal mapping
@@ -274,7 +320,7 @@ int test_servos(void)
         {
             servos_preflight.init_cases = 3;
             servos_preflight.time_delay = 5.0;
-            servos_preflight.time_ns = rc_nanos_since_boot();
+            servos_preflight.time_ns = hal_nanos_since_boot();
 
             printf("Case-2: min/max signal mapping\n");
             for (i = 0; i < settings.num_rotors; i++) mot[i] = 1.0;
@@ -288,7 +334,7 @@ int test_servos(void)
                  servos_preflight.time_delay)
         {
             for (i = 0; i < settings.num_rotors; i++) mot[i] = 0.0;
-            servos_preflight.time_cases = rc_nanos_since_boot();
+            servos_preflight.time_cases = hal_nanos_since_boot();
             servos_preflight.time_delay_cases = 1.0;
             servos_preflight.preflight_case = 3;
             printf("Case-2: Done\n");
@@ -299,9 +345,9 @@ int test_servos(void)
             fstate.m[i] = map_motor_signal(mot[i]);
 
             rc_saturate_double(&fstate.m[i], 0.0, 1.0);
-            // finally send mapped signal to servos:
-            servos_march(i, &fstate.m[i]);
         }
+        // finally send mapped signals to servos:
+        servos_march(fstate.m, settings.num_rotors);
         return 0;
     }
     // 3. test min/max pitch channel mixing
@@ -311,7 +357,7 @@ int test_servos(void)
         {
             servos_preflight.init_cases = 4;
             servos_preflight.time_delay = 3.0;
-            servos_preflight.time_ns = rc_nanos_since_boot();
+            servos_preflight.time_ns = hal_nanos_since_boot();
 
             printf("Case-3: min/max pitch channel mixing\n");
             u[VEC_PITCH] = 1.0;
@@ -337,7 +383,7 @@ int test_servos(void)
             u[VEC_PITCH] = 0.0;
             mix_add_input(u[VEC_PITCH], VEC_PITCH, mot);
             servos_preflight.preflight_case = 4;
-            servos_preflight.time_cases = rc_nanos_since_boot();
+            servos_preflight.time_cases = hal_nanos_since_boot();
             servos_preflight.time_delay_cases = 0.5;
             printf("Case-3: Done\n");
         }
@@ -349,9 +395,9 @@ int test_servos(void)
             fstate.m[i] = map_motor_signal(mot[i]);
 
             rc_saturate_double(&fstate.m[i], 0.0, 1.0);
-            // finally send mapped signal to servos:
-            servos_march(i, &fstate.m[i]);
         }
+        // finally send mapped signals to servos:
+        servos_march(fstate.m, settings.num_rotors);
         return 0;
     }
     // 4. test min/max yaw channel mixing
@@ -361,7 +407,7 @@ int test_servos(void)
         {
             servos_preflight.init_cases = 5;
             servos_preflight.time_delay = 3.0;
-            servos_preflight.time_ns = rc_nanos_since_boot();
+            servos_preflight.time_ns = hal_nanos_since_boot();
 
             printf("Case-4: min/max yaw channel mixing\n");
             u[VEC_YAW] = 1.0;
@@ -387,7 +433,7 @@ int test_servos(void)
             mix_add_input(u[VEC_YAW], VEC_YAW, mot);
 
             servos_preflight.preflight_case = 5;
-            servos_preflight.time_cases = rc_nanos_since_boot();
+            servos_preflight.time_cases = hal_nanos_since_boot();
             servos_preflight.time_delay_cases = 1.0;
             printf("Case-4: Done\n");
         }
@@ -399,9 +445,9 @@ int test_servos(void)
             fstate.m[i] = map_motor_signal(mot[i]);
 
             rc_saturate_double(&fstate.m[i], 0.0, 1.0);
-            // finally send mapped signal to servos:
-            servos_march(i, &fstate.m[i]);
         }
+        // finally send mapped signals to servos:
+        servos_march(fstate.m, settings.num_rotors);
         return 0;
     }
     // 5. test min/max brake channel mixing
@@ -412,7 +458,7 @@ int test_servos(void)
         {
             servos_preflight.init_cases = 6;
             servos_preflight.time_delay = 3.0;
-            servos_preflight.time_ns = rc_nanos_since_boot();
+            servos_preflight.time_ns = hal_nanos_since_boot();
 
             u[VEC_X] = -1.0;
             printf("Case-4: min/max brake channel mixing\n");
@@ -431,7 +477,7 @@ int test_servos(void)
             mix_add_input(u[VEC_X], VEC_X, mot);
 
             servos_preflight.preflight_case = 6;
-            servos_preflight.time_cases = rc_nanos_since_boot();
+            servos_preflight.time_cases = hal_nanos_since_boot();
             servos_preflight.time_delay_cases = 0.5;
             printf("Case-5: Done\n");
         }
@@ -442,9 +488,9 @@ int test_servos(void)
             fstate.m[i] = map_motor_signal(mot[i]);
 
             rc_saturate_double(&fstate.m[i], 0.0, 1.0);
-            // finally send mapped signal to servos:
-            servos_march(i, &fstate.m[i]);
         }
+        // finally send mapped signals to servos:
+        servos_march(fstate.m, settings.num_rotors);
         return 0;
     }
     // 6. test incremental increase from min to max on brake channel
@@ -454,7 +500,7 @@ int test_servos(void)
         {
             servos_preflight.init_cases = 7;
             servos_preflight.time_delay = 3.0;
-            servos_preflight.time_ns = rc_nanos_since_boot();
+            servos_preflight.time_ns = hal_nanos_since_boot();
 
             u[VEC_X] = 0.0;
             printf("Case-6: incremental increase from min to max on brake channel\n");
@@ -466,7 +512,7 @@ int test_servos(void)
             u[VEC_X] = -finddt_s(servos_preflight.time_ns) / servos_preflight.time_delay;
             mix_add_input(u[VEC_X], VEC_X, mot);
 
-            servos_preflight.time_cases = rc_nanos_since_boot();
+            servos_preflight.time_cases = hal_nanos_since_boot();
             servos_preflight.time_delay_cases = 1.0;
         }
         else if (servos_preflight.init_cases == 7 &&
@@ -491,9 +537,9 @@ int test_servos(void)
             fstate.m[i] = map_motor_signal(mot[i]);
 
             rc_saturate_double(&fstate.m[i], 0.0, 1.0);
-            // finally send mapped signal to servos:
-            servos_march(i, &fstate.m[i]);
         }
+        // finally send mapped signals to servos:
+        servos_march(fstate.m, settings.num_rotors);
         return 0;
     }
     else 
@@ -506,10 +552,29 @@ int test_servos(void)
 
 
 
+int servos_calibrate(int ch)
+{
+    if (ch < 1 || ch > MAX_ROTORS) {
+        fprintf(stderr, "ERROR in servos_calibrate, channel %d out of range\n", ch);
+        return -1;
+    }
+    if (sstate.initialized != 1)
+    {
+        printf("Servos have not been initialized \n");
+        return -1;
+    }
+    if (sstate.arm_state == ARMED) {
+        fprintf(stderr, "ERROR in servos_calibrate, servos must be disarmed\n");
+        return -1;
+    }
+    return servo_cal_capture(ch, sstate.servos_lim[ch - 1][0], sstate.servos_lim[ch - 1][1],
+                             sstate.servos_lim[ch - 1][2], stdout);
+}
+
 int servos_cleanup(void)
 {
     // turn off power rail and cleanup
-    rc_servo_power_rail_en(0);
-    rc_servo_cleanup();
+    hal_servo_power_rail_en(0);
+    hal_servo_cleanup();
     return 0;
 }
\ No newline at end of file
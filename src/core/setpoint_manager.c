@@ -7,7 +7,7 @@
 #include <math.h>
 #include <string.h> // for memset
 
-#include <rc/time.h> // for nanos
+#include <hal.h> // for nanos
 #include <inttypes.h> // for PRIu64
 #include <rc/start_stop.h>
 #include <rc/math/quaternion.h>
@@ -21,6 +21,7 @@
 #include <rcs_defs.h>
 #include <flight_mode.h>
 #include <tools.h>
+#include <imu_fifo.h>
 
 setpoint_t setpoint; // extern variable in setpoint_manager.h
 flight_status_t flight_status;
@@ -74,7 +75,7 @@ int setpoint_manager_init(void)
 
 	
 	user_input.flight_mode	= IDLE;
-	setpoint.init_time		= rc_nanos_since_boot();
+	setpoint.init_time		= hal_nanos_since_boot();
 	setpoint.initialized	= 1;
 	return 0;
 }
@@ -96,6 +97,10 @@ TODO:
 */
 int __flight_status_update(void)
 {
+	// the full-rate IMU peak (FIFO mode only) flags an ignition before the
+	// filtered climb accel catches up, the confirmation still uses the latter
+	const double launch_accel = fmax(fabs(state_estimate.alt_bmp_accel), imu_fifo_take_accel_peak());
+
 	//Check for tipover:
 	if (events.tipover_detected)
 	{
@@ -155,11 +160,11 @@ int __flight_status_update(void)
 		}
 		else if (flight_status == STANDBY) //ARMED and waiting for IGNITION
 		{
-			if (events.ignition_fl != 1 && fabs(state_estimate.alt_bmp_accel) >= settings.event_launch_accel 
+			if (events.ignition_fl != 1 && launch_accel >= settings.event_launch_accel 
 				&& fabs(state_estimate.alt_bmp - events.ground_alt) >= settings.event_launch_dh)
 			{
 				//Detected ignition
-				events.init_time	= rc_nanos_since_boot();
+				events.init_time	= hal_nanos_since_boot();
 				events.ignition_alt = state_estimate.alt_bmp;
 				events.ignition_fl	= 1; //sensors have shown high accel and change in alt (can be noise)
 
@@ -189,7 +194,7 @@ int __flight_status_update(void)
 				}
 				return -1;
 			}
-			else if (events.ignition_fl && fabs(state_estimate.alt_bmp_accel) >= settings.event_launch_accel 
+			else if (events.ignition_fl && launch_accel >= settings.event_launch_accel 
 				&& fabs(state_estimate.alt_bmp - events.ground_alt) >= settings.event_launch_dh)
 			{
 				events.ignition_fl = 1;
@@ -216,7 +221,7 @@ int __flight_status_update(void)
 			if (events.meco_fl != 1 && state_estimate.alt_bmp_vel > 0.0 && state_estimate.alt_bmp_accel < 0.0)
 			{
 				events.meco_fl = 1; //main engine cutoff detected
-				events.init_time = rc_nanos_since_boot();
+				events.init_time = hal_nanos_since_boot();
 				return 0;
 			}
 			else if (events.meco_fl && finddt_s(events.init_time) >= settings.event_cutoff_delay_s )
@@ -262,7 +267,7 @@ int __flight_status_update(void)
 			if (events.apogee_fl != 1 && events.apogee_alt > state_estimate.alt_bmp) //check if altitude has decreased for the first time
 			{
 				//events.apogee_alt	= state_estimate.alt_bmp; //set apogee to the current alt
-				events.init_time	= rc_nanos_since_boot();
+				events.init_time	= hal_nanos_since_boot();
 				events.apogee_fl	= 1;
 				return 0;
 			}
@@ -348,7 +353,7 @@ int __flight_status_update(void)
 				if (events.land_fl_vel != 1 && fabs(state_estimate.alt_bmp_vel) < settings.event_landing_vel_tol) //velocity should be very close to zero
 				{
 					//this is the begining of the fast landing detection algorithm (based on both alt and velocity)
-					events.init_time	= rc_nanos_since_boot(); //record time
+					events.init_time	= hal_nanos_since_boot(); //record time
 					events.land_fl_vel	= 1; //may have landed - need to verify
 					return 0;
 				}
@@ -373,7 +378,7 @@ int __flight_status_update(void)
 					//the algorithm will only reach this line if:
 					// - altitude change is within tolerance (small, not moving vertically to much) 
 					// - velocity estimation went haywire and it totally off (very large in magnitude, can not come back to zero)
-					events.init_time_landed = rc_nanos_since_boot(); //record time
+					events.init_time_landed = hal_nanos_since_boot(); //record time
 					events.land_fl			= 1;
 					return 0;
 				}
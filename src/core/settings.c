@@ -6,6 +6,7 @@
  **/
 
 #include <stdio.h>
+#include <math.h>
 #include <string.h>	// FOR str_cmp()
 #include <fcntl.h>	// for F_OK
 #include <unistd.h>	// for access()
@@ -135,6 +136,15 @@ if(__parse_controller(tmp, &settings.name)){\
 /// functions for parsing enums
 ////////////////////////////////////////////////////////////////////////////////
 
+// reads a json number into *x, ints are fine too
+static int __get_number(json_object* obj, double* x)
+{
+	if (json_object_is_type(obj, json_type_double) == 0 &&
+		json_object_is_type(obj, json_type_int) == 0) return -1;
+	*x = json_object_get_double(obj);
+	return 0;
+}
+
 /**
  * @brief      pulls rotor layout out of json object into settings struct
  *
@@ -143,7 +153,9 @@ if(__parse_controller(tmp, &settings.name)){\
 static int __parse_layout(void)
 {
 	struct json_object *tmp = NULL;
+	struct json_object *row = NULL;
 	char* tmp_str = NULL;
+	int i, j, len;
 	if(json_object_object_get_ex(jobj, "layout", &tmp)==0){
 		fprintf(stderr,"ERROR: can't find layout in settings file\n");
 		return -1;
@@ -156,15 +168,59 @@ static int __parse_layout(void)
 	if(strcmp(tmp_str, "LAYOUT_4X")==0){
 		settings.num_rotors = 4;
 		settings.layout = LAYOUT_4X;
+		settings.dof = 4;
 	}
 	else if(strcmp(tmp_str, "LAYOUT_4PLUS")==0){
 		settings.num_rotors = 4;
 		settings.layout = LAYOUT_4PLUS;
+		settings.dof = 6;
+	}
+	else if(strcmp(tmp_str, "LAYOUT_CUSTOM")==0){
+		settings.layout = LAYOUT_CUSTOM;
+		settings.dof = 6;
 	}
 	else{
 		fprintf(stderr,"ERROR: invalid layout string\n");
 		return -1;
 	}
+
+	// mix_matrix is "DEFAULT" for the built in layouts, or one row of
+	// X Y Z roll pitch yaw per rotor with LAYOUT_CUSTOM
+	if(json_object_object_get_ex(jobj, "mix_matrix", &tmp)==0){
+		fprintf(stderr,"ERROR: can't find mix_matrix in settings file\n");
+		return -1;
+	}
+	if(settings.layout!=LAYOUT_CUSTOM){
+		if(json_object_is_type(tmp, json_type_string)==0 ||
+			strcmp(json_object_get_string(tmp), "DEFAULT")!=0){
+			fprintf(stderr,"ERROR: mix_matrix should be \"DEFAULT\" unless layout is LAYOUT_CUSTOM\n");
+			return -1;
+		}
+		return 0;
+	}
+	if(json_object_is_type(tmp, json_type_array)==0){
+		fprintf(stderr,"ERROR: mix_matrix should be an array of rows with LAYOUT_CUSTOM\n");
+		return -1;
+	}
+	len = json_object_array_length(tmp);
+	if(len<1 || len>MAX_ROTORS){
+		fprintf(stderr,"ERROR: mix_matrix should have 1 to %d rows\n", MAX_ROTORS);
+		return -1;
+	}
+	for(i=0;i<len;i++){
+		row = json_object_array_get_idx(tmp, i);
+		if(json_object_is_type(row, json_type_array)==0 || json_object_array_length(row)!=MAX_INPUTS){
+			fprintf(stderr,"ERROR: mix_matrix rows should have %d entries (X Y Z roll pitch yaw)\n", MAX_INPUTS);
+			return -1;
+		}
+		for(j=0;j<MAX_INPUTS;j++){
+			if(__get_number(json_object_array_get_idx(row, j), &settings.mix_matrix[i][j])){
+				fprintf(stderr,"ERROR: mix_matrix entries should be numbers\n");
+				return -1;
+			}
+		}
+	}
+	settings.num_rotors = len;
 	return 0;
 }
 
@@ -203,10 +259,178 @@ static int __parse_thrust_map(void)
 	else if(strcmp(tmp_str, "RX2206_4S")==0){
 		settings.thrust_map = RX2206_4S;
 	}
+	else if(strcmp(tmp_str, "THRUST_MAP_FILE")==0){
+		settings.thrust_map = THRUST_MAP_FILE;
+	}
 	else{
 		fprintf(stderr,"ERROR: invalid thrust_map string\n");
 		return -1;
 	}
+
+	// csv or json map, only read with THRUST_MAP_FILE
+	if(json_object_object_get_ex(jobj, "thrust_map_file", &tmp)==0){
+		fprintf(stderr,"ERROR: can't find thrust_map_file in settings file\n");
+		return -1;
+	}
+	if(json_object_is_type(tmp, json_type_string)==0){
+		fprintf(stderr,"ERROR: thrust_map_file should be a string\n");
+		return -1;
+	}
+	tmp_str = (char*)json_object_get_string(tmp);
+	if(strlen(tmp_str)>=sizeof(settings.thrust_map_file)){
+		fprintf(stderr,"ERROR: thrust_map_file path is too long\n");
+		return -1;
+	}
+	strcpy(settings.thrust_map_file, tmp_str);
+	if(settings.thrust_map==THRUST_MAP_FILE && tmp_str[0]=='\0'){
+		fprintf(stderr,"ERROR: THRUST_MAP_FILE needs a thrust_map_file\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief      pulls the servo calibration curves into the settings struct,
+ *             "DEFAULT" leaves num_servo_cal at 0 for the built in table
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __parse_servo_calibration(void)
+{
+	struct json_object *tmp = NULL;
+	struct json_object *entry = NULL;
+	struct json_object *field = NULL;
+	struct json_object *point = NULL;
+	servo_cal_t* cal;
+	const char* tmp_str;
+	int i, j, len, n;
+
+	settings.num_servo_cal = 0;
+	if(json_object_object_get_ex(jobj, "servo_calibration", &tmp)==0){
+		fprintf(stderr,"ERROR: can't find servo_calibration in settings file\n");
+		return -1;
+	}
+	if(json_object_is_type(tmp, json_type_string)){
+		if(strcmp(json_object_get_string(tmp), "DEFAULT")!=0){
+			fprintf(stderr,"ERROR: servo_calibration should be \"DEFAULT\" or an array\n");
+			return -1;
+		}
+		return 0;
+	}
+	if(json_object_is_type(tmp, json_type_array)==0){
+		fprintf(stderr,"ERROR: servo_calibration should be \"DEFAULT\" or an array\n");
+		return -1;
+	}
+	len = json_object_array_length(tmp);
+	if(len<1 || len>MAX_ROTORS){
+		fprintf(stderr,"ERROR: servo_calibration should have 1 to %d entries\n", MAX_ROTORS);
+		return -1;
+	}
+	for(i=0;i<len;i++){
+		entry = json_object_array_get_idx(tmp, i);
+		cal = &settings.servo_cal[i];
+		if(json_object_is_type(entry, json_type_object)==0){
+			fprintf(stderr,"ERROR: servo_calibration entries should be objects\n");
+			return -1;
+		}
+		if(json_object_object_get_ex(entry, "curve", &field)==0 ||
+			json_object_is_type(field, json_type_string)==0){
+			fprintf(stderr,"ERROR: servo_calibration entry %d needs a curve\n", i);
+			return -1;
+		}
+		tmp_str = json_object_get_string(field);
+		if(strcmp(tmp_str, "LINEAR")==0) cal->curve = SERVO_CURVE_LINEAR;
+		else if(strcmp(tmp_str, "SPLINE")==0) cal->curve = SERVO_CURVE_SPLINE;
+		else{
+			fprintf(stderr,"ERROR: servo_calibration curve should be LINEAR or SPLINE\n");
+			return -1;
+		}
+		if(json_object_object_get_ex(entry, "nominal_us", &field)==0 ||
+			__get_number(field, &cal->nominal_us)){
+			fprintf(stderr,"ERROR: servo_calibration entry %d needs a nominal_us\n", i);
+			return -1;
+		}
+		if(json_object_object_get_ex(entry, "points", &field)==0 ||
+			json_object_is_type(field, json_type_array)==0){
+			fprintf(stderr,"ERROR: servo_calibration entry %d needs points\n", i);
+			return -1;
+		}
+		n = json_object_array_length(field);
+		if(n<2 || n>SERVO_CAL_MAX_POINTS){
+			fprintf(stderr,"ERROR: servo_calibration entries should have 2 to %d points\n", SERVO_CAL_MAX_POINTS);
+			return -1;
+		}
+		for(j=0;j<n;j++){
+			point = json_object_array_get_idx(field, j);
+			if(json_object_is_type(point, json_type_array)==0 ||
+				json_object_array_length(point)!=2 ||
+				__get_number(json_object_array_get_idx(point, 0), &cal->pos[j]) ||
+				__get_number(json_object_array_get_idx(point, 1), &cal->us[j])){
+				fprintf(stderr,"ERROR: servo_calibration points should be [position, pulse_us]\n");
+				return -1;
+			}
+		}
+		cal->points = n;
+	}
+	if(len<settings.num_rotors){
+		fprintf(stderr,"ERROR: servo_calibration needs an entry for each of the %d rotors\n", settings.num_rotors);
+		return -1;
+	}
+	settings.num_servo_cal = len;
+	return 0;
+}
+
+// reads one actuator model object, every field has to be there
+static int __get_actuator_model(json_object* obj, actuator_model_t* m)
+{
+	struct json_object *field = NULL;
+
+	if(json_object_is_type(obj, json_type_object)==0 ||
+		json_object_object_get_ex(obj, "rate_max", &field)==0 || __get_number(field, &m->rate_max) ||
+		json_object_object_get_ex(obj, "tau_s", &field)==0 || __get_number(field, &m->tau_s) ||
+		json_object_object_get_ex(obj, "deadband", &field)==0 || __get_number(field, &m->deadband) ||
+		json_object_object_get_ex(obj, "backlash", &field)==0 || __get_number(field, &m->backlash)){
+		fprintf(stderr,"ERROR: actuator_model needs rate_max, tau_s, deadband and backlash\n");
+		return -1;
+	}
+	if(m->rate_max<0.0 || m->tau_s<0.0 || m->tau_s>1.0 ||
+		m->deadband<0.0 || m->deadband>0.5 || m->backlash<0.0 || m->backlash>0.5){
+		fprintf(stderr,"ERROR: actuator_model out of range\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief      pulls the servo dynamics into the settings struct, one model
+ *             for every channel or an array with one per channel
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __parse_actuator_model(void)
+{
+	struct json_object *tmp = NULL;
+	int i, len;
+
+	if(json_object_object_get_ex(jobj, "actuator_model", &tmp)==0){
+		fprintf(stderr,"ERROR: can't find actuator_model in settings file\n");
+		return -1;
+	}
+	if(json_object_is_type(tmp, json_type_array)==0){
+		if(__get_actuator_model(tmp, &settings.actuator_model[0])) return -1;
+		for(i=1;i<MAX_ROTORS;i++) settings.actuator_model[i] = settings.actuator_model[0];
+		return 0;
+	}
+	len = json_object_array_length(tmp);
+	if(len<settings.num_rotors || len>MAX_ROTORS){
+		fprintf(stderr,"ERROR: actuator_model should have %d to %d entries\n", settings.num_rotors, MAX_ROTORS);
+		return -1;
+	}
+	for(i=0;i<len;i++){
+		if(__get_actuator_model(json_object_array_get_idx(tmp, i), &settings.actuator_model[i])) return -1;
+	}
+	// unused channels get the last one
+	for(;i<MAX_ROTORS;i++) settings.actuator_model[i] = settings.actuator_model[len-1];
 	return 0;
 }
 
@@ -236,6 +460,152 @@ static int __parse_orientation(void)
 	return 0;
 }
 
+/**
+ * @brief      fills settings.mount_R, the rotation from the sensor frame to
+ *             the body frame.
+ *
+ * mount_rotation is either "DEFAULT" for the usual mounting of the board in
+ * the chosen orientation, a quaternion [w,x,y,z] or a 3x3 matrix given as an
+ * array of rows. Must be called after __parse_orientation().
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __parse_mount_rotation(void)
+{
+	static const double R_x_up[3][3] = {
+		{ 0.0, 0.0, 1.0},
+		{ 0.0, 1.0, 0.0},
+		{-1.0, 0.0, 0.0}
+	};
+	static const double R_z_down[3][3] = {
+		{ 0.0, 1.0, 0.0},
+		{ 1.0, 0.0, 0.0},
+		{ 0.0, 0.0,-1.0}
+	};
+	struct json_object* tmp = NULL;
+	struct json_object* row = NULL;
+	double (*R)[3] = settings.mount_R;
+	double q[4], norm, dot, det;
+	int i, j, k, len;
+
+	if (json_object_object_get_ex(jobj, "mount_rotation", &tmp) == 0) {
+		fprintf(stderr, "ERROR: can't find mount_rotation in settings file\n");
+		return -1;
+	}
+
+	if (json_object_is_type(tmp, json_type_string)) {
+		if (strcmp(json_object_get_string(tmp), "DEFAULT") != 0) {
+			fprintf(stderr, "ERROR: invalid mount_rotation string\n");
+			return -1;
+		}
+		switch (settings.orientation) {
+		case ORIENTATION_X_UP:
+			memcpy(R, R_x_up, sizeof(R_x_up));
+			return 0;
+		case ORIENTATION_Z_DOWN:
+			memcpy(R, R_z_down, sizeof(R_z_down));
+			return 0;
+		default:
+			fprintf(stderr, "ERROR: no DEFAULT mount_rotation for this orientation\n");
+			return -1;
+		}
+	}
+
+	if (json_object_is_type(tmp, json_type_array) == 0) {
+		fprintf(stderr, "ERROR: mount_rotation should be a string or an array\n");
+		return -1;
+	}
+	len = json_object_array_length(tmp);
+	if (len == 4) {
+		// quaternion, normalize it and build the matrix
+		for (i = 0; i < 4; i++) {
+			if (__get_number(json_object_array_get_idx(tmp, i), &q[i])) {
+				fprintf(stderr, "ERROR: mount_rotation quaternion entries should be numbers\n");
+				return -1;
+			}
+		}
+		norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		if (norm < 1e-6) {
+			fprintf(stderr, "ERROR: mount_rotation quaternion is zero\n");
+			return -1;
+		}
+		for (i = 0; i < 4; i++) q[i] /= norm;
+		R[0][0] = 1.0 - 2.0 * (q[2] * q[2] + q[3] * q[3]);
+		R[0][1] = 2.0 * (q[1] * q[2] - q[0] * q[3]);
+		R[0][2] = 2.0 * (q[1] * q[3] + q[0] * q[2]);
+		R[1][0] = 2.0 * (q[1] * q[2] + q[0] * q[3]);
+		R[1][1] = 1.0 - 2.0 * (q[1] * q[1] + q[3] * q[3]);
+		R[1][2] = 2.0 * (q[2] * q[3] - q[0] * q[1]);
+		R[2][0] = 2.0 * (q[1] * q[3] - q[0] * q[2]);
+		R[2][1] = 2.0 * (q[2] * q[3] + q[0] * q[1]);
+		R[2][2] = 1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]);
+		return 0;
+	}
+	if (len != 3) {
+		fprintf(stderr, "ERROR: mount_rotation should be a quaternion or a 3x3 matrix\n");
+		return -1;
+	}
+	for (i = 0; i < 3; i++) {
+		row = json_object_array_get_idx(tmp, i);
+		if (json_object_is_type(row, json_type_array) == 0 || json_object_array_length(row) != 3) {
+			fprintf(stderr, "ERROR: mount_rotation matrix rows should have 3 entries\n");
+			return -1;
+		}
+		for (j = 0; j < 3; j++) {
+			if (__get_number(json_object_array_get_idx(row, j), &R[i][j])) {
+				fprintf(stderr, "ERROR: mount_rotation matrix entries should be numbers\n");
+				return -1;
+			}
+		}
+	}
+
+	// has to be a proper rotation, R*R' = I and det(R) = 1
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			dot = 0.0;
+			for (k = 0; k < 3; k++) dot += R[i][k] * R[j][k];
+			if (fabs(dot - (i == j ? 1.0 : 0.0)) > 1e-3) {
+				fprintf(stderr, "ERROR: mount_rotation matrix is not orthonormal\n");
+				return -1;
+			}
+		}
+	}
+	det = R[0][0] * (R[1][1] * R[2][2] - R[1][2] * R[2][1])
+		- R[0][1] * (R[1][0] * R[2][2] - R[1][2] * R[2][0])
+		+ R[0][2] * (R[1][0] * R[2][1] - R[1][1] * R[2][0]);
+	if (det < 0.0) {
+		fprintf(stderr, "ERROR: mount_rotation matrix is a reflection, det must be +1\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int __parse_attitude_filter(void)
+{
+	struct json_object* tmp = NULL;
+	char* tmp_str = NULL;
+	if (json_object_object_get_ex(jobj, "attitude_filter", &tmp) == 0) {
+		fprintf(stderr, "ERROR: can't find attitude_filter in settings file\n");
+		return -1;
+	}
+	if (json_object_is_type(tmp, json_type_string) == 0) {
+		fprintf(stderr, "ERROR: attitude_filter should be a string\n");
+		return -1;
+	}
+	tmp_str = (char*)json_object_get_string(tmp);
+	if (strcmp(tmp_str, "ATTITUDE_DMP") == 0) {
+		settings.attitude_filter = ATTITUDE_DMP;
+	}
+	else if (strcmp(tmp_str, "ATTITUDE_MAHONY") == 0) {
+		settings.attitude_filter = ATTITUDE_MAHONY;
+	}
+	else {
+		fprintf(stderr, "ERROR: invalid attitude_filter string\n");
+		return -1;
+	}
+	return 0;
+}
+
 
 /**
  * @brief      parses a json_object and fills in the flight mode.
@@ -401,15 +771,16 @@ static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter)
 				return -1;
 			}
 			tmp_flt = json_object_get_double(tmp);
-			if(rc_filter_c2d_tustin(filter, DT, num_vec, den_vec, tmp_flt)){
+			if(rc_filter_c2d_tustin(filter, settings.dt, num_vec, den_vec, tmp_flt)){
 				fprintf(stderr,"ERROR: failed to c2dtustin while parsing json\n");
 				return -1;
 			}
 		}
 
-		// if DT, much easier, just construct filter
+		// if DT, much easier, just construct filter. Note the coefficients
+		// are only right for the feedback_hz they were designed at.
 		else if(strcmp(tmp_str, "DT")==0){
-			if(rc_filter_alloc(filter,num_vec, den_vec, DT)){
+			if(rc_filter_alloc(filter,num_vec, den_vec, settings.dt)){
 				fprintf(stderr,"ERROR: failed to alloc filter in __parse_controller()");
 				return -1;
 			}
@@ -450,7 +821,7 @@ static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter)
 			return -1;
 		}
 		tmp_flt = json_object_get_double(tmp);
-		if(rc_filter_pid(filter,tmp_kp,tmp_ki,tmp_kd,1.0/tmp_flt, DT)){
+		if(rc_filter_pid(filter,tmp_kp,tmp_ki,tmp_kd,1.0/tmp_flt, settings.dt)){
 				fprintf(stderr,"ERROR: failed to alloc pid filter in __parse_controller()");
 				return -1;
 			}
@@ -512,6 +883,23 @@ int settings_load_from_file(char* path)
 	#endif
 
 
+	// LOOP RATE, needed before any of the filters below are discretized
+	PARSE_INT_MIN_MAX(feedback_hz, 4, 1000)
+	settings.dt = 1.0/settings.feedback_hz;
+	PARSE_DOUBLE_MIN_MAX(isr_budget, 0.1, 1.0)
+	PARSE_BOOL(imu_fifo)
+	PARSE_INT_MIN_MAX(imu_fifo_hz, 4, IMU_FIFO_MAX_HZ)
+	// the MPU divides its 1 kHz clock, the ISR takes whole batches
+	if(settings.imu_fifo && (IMU_FIFO_MAX_HZ%settings.imu_fifo_hz ||
+			settings.imu_fifo_hz%settings.feedback_hz)){
+		fprintf(stderr,"ERROR: imu_fifo_hz must divide %d and be a multiple of feedback_hz\n",
+				IMU_FIFO_MAX_HZ);
+		return -1;
+	}
+	#ifdef DEBUG
+	fprintf(stderr,"feedback_hz: %d\n",settings.feedback_hz);
+	#endif
+
 	// PHYSICAL PARAMETERS
 	// layout populates num_rotors, layout, and dof
 	if(__parse_layout()==-1) return -1; // parse_layout also fill in num_rotors and dof
@@ -522,10 +910,21 @@ int settings_load_from_file(char* path)
 	#ifdef DEBUG
 	fprintf(stderr,"thrust_map: %d\n",settings.thrust_map);
 	#endif
+	if(__parse_servo_calibration()==-1) return -1;
+	if(__parse_actuator_model()==-1) return -1;
+	PARSE_BOOL(actuator_shaping)
 	if (__parse_orientation() == -1) return-1;
 	#ifdef DEBUG
 	fprintf(stderr, "orientation: %d\n", settings.orientation);
 	#endif
+	if (__parse_mount_rotation() == -1) return -1;
+	if (__parse_attitude_filter() == -1) return -1;
+	if (settings.imu_fifo && settings.attitude_filter == ATTITUDE_DMP) {
+		fprintf(stderr, "ERROR: imu_fifo has no DMP, use ATTITUDE_MAHONY\n");
+		return -1;
+	}
+	PARSE_DOUBLE_MIN_MAX(mahony_kp, 0.0, 100.0)
+	PARSE_DOUBLE_MIN_MAX(mahony_ki, 0.0, 10.0)
 	PARSE_DOUBLE_MIN_MAX(v_nominal,6.0,9.0)
 	PARSE_DOUBLE_MIN_MAX(v_nominal_jack, 7.0, 18.0)
 	#ifdef DEBUG
@@ -551,6 +950,36 @@ int settings_load_from_file(char* path)
 	PARSE_DOUBLE_MIN_MAX(event_landing_alt_tol,0.0,100.0)
 	PARSE_DOUBLE_MIN_MAX(event_landing_vel_tol, 0.0, 100.0)
 	PARSE_DOUBLE_MIN_MAX(event_landning_accel_tol, 0.0, 100.0)
+	PARSE_DOUBLE_MIN_MAX(apogee_drag_k, 0.0, 1.0)
+	PARSE_DOUBLE_MIN_MAX(apogee_brake_drag_gain, 0.0, 100.0)
+	if(json_object_object_get_ex(jobj, "aero_table_file", &tmp)==0 ||
+		json_object_is_type(tmp, json_type_string)==0){
+		fprintf(stderr,"ERROR parsing settings file, aero_table_file should be a string\n");
+		return -1;
+	}
+	if(strlen(json_object_get_string(tmp))>=sizeof(settings.aero_table_file)){
+		fprintf(stderr,"ERROR parsing settings file, aero_table_file path is too long\n");
+		return -1;
+	}
+	strcpy(settings.aero_table_file, json_object_get_string(tmp));
+	// without a table the brake drag is linear in this gain, the brakes have
+	// to add some drag or no deflection can be worked out from it
+	if(settings.aero_table_file[0]=='\0' && settings.apogee_brake_drag_gain<=0.0){
+		fprintf(stderr,"ERROR parsing settings file, apogee_brake_drag_gain must be > 0 without an aero_table_file\n");
+		return -1;
+	}
+	PARSE_DOUBLE_MIN_MAX(aero_ref_q_pa, 0.0, 1000000.0)
+	PARSE_DOUBLE_MIN_MAX(apogee_step_s, 0.001, 1.0)
+	PARSE_DOUBLE_MIN_MAX(apogee_budget_us, 1.0, 10000.0)
+	PARSE_BOOL(apogee_lut)
+	// the table is spaced in log(k), it needs some drag to start from
+	if(settings.apogee_lut && settings.apogee_drag_k<=0.0){
+		fprintf(stderr,"ERROR parsing settings file, apogee_lut needs apogee_drag_k > 0\n");
+		return -1;
+	}
+	PARSE_DOUBLE_MIN_MAX(apogee_lut_v_max, 1.0, 2000.0)
+	PARSE_BOOL(drag_rls_en)
+	PARSE_DOUBLE_MIN_MAX(drag_rls_forget, 0.9, 1.0)
 	PARSE_BOOL(enable_magnetometer)
 	PARSE_BOOL(enable_xbee)
 	PARSE_BOOL(use_xbee_yaw)
@@ -591,6 +1020,26 @@ int settings_load_from_file(char* path)
 	PARSE_BOOL(log_motor_signals)
     PARSE_BOOL(log_motor_signals_us)
 	PARSE_BOOL(log_encoders)
+	PARSE_BOOL(log_isr_timing)
+	PARSE_BOOL(log_drag)
+	PARSE_BOOL(log_imu_raw)
+
+	// REAL-TIME
+	PARSE_BOOL(rt_harden)
+	PARSE_INT_MIN_MAX(rt_cpu, -1, 63)
+	PARSE_INT_MIN_MAX(non_rt_cpu, -1, 63)
+	PARSE_INT_MIN_MAX(imu_priority, 1, 99)
+	PARSE_INT_MIN_MAX(input_manager_priority, 1, 99)
+	PARSE_INT_MIN_MAX(log_manager_priority, 1, 99)
+	PARSE_INT_MIN_MAX(printf_manager_priority, 1, 99)
+	PARSE_INT_MIN_MAX(bmp_sampler_priority, 1, 99)
+	PARSE_INT_MIN_MAX(serial_io_priority, 1, 99)
+	// the sensor helpers are woken by the ISR and must not preempt it
+	if(settings.bmp_sampler_priority>settings.imu_priority ||
+			settings.serial_io_priority>settings.imu_priority){
+		fprintf(stderr,"ERROR: bmp_sampler_priority and serial_io_priority must not be above imu_priority\n");
+		return -1;
+	}
 
 	// MAVLINK
 	PARSE_STRING(dest_ip)
@@ -603,6 +1052,13 @@ int settings_load_from_file(char* path)
 	PARSE_CONTROLLER(yaw_controller)
 	PARSE_CONTROLLER(altitude_controller)
 
+#ifdef OFFBOARD_TEST
+	// SIMULATION
+	PARSE_DOUBLE_MIN_MAX(sim_time_scale, 0.0, 1000.0)
+	PARSE_DOUBLE_MIN_MAX(sim_launch_time_s, 0.0, 1000.0)
+	PARSE_DOUBLE_MIN_MAX(sim_auto_arm_s, 0.0, 1000.0)
+#endif
+
 	json_object_put(jobj);	// free memory
 	was_load_successful = 1;
 	return 0;
@@ -0,0 +1,56 @@
+/**
+ * @file snapshot.c
+ *
+ * Seqlock protected copy of the flight state, see snapshot.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <snapshot.h>
+
+static snapshot_t snap_buf;
+static uint32_t seq;		// odd while the ISR is writing
+static uint64_t retries;
+
+void snapshot_publish(void)
+{
+	__atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snap_buf.tick++;
+	snap_buf.state_estimate	= state_estimate;
+	snap_buf.setpoint	= setpoint;
+	snap_buf.fstate		= fstate;
+	snap_buf.sstate		= sstate;
+	snap_buf.events		= events;
+	snap_buf.flight_status	= flight_status;
+
+	__atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int snapshot_read(snapshot_t* snap)
+{
+	uint32_t s0, s1;
+
+	if (snap == NULL) {
+		fprintf(stderr, "ERROR in snapshot_read, received NULL pointer\n");
+		return -1;
+	}
+	while (1) {
+		s0 = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+		if (s0 == 0) return -1;	// never published
+		if (!(s0 & 1)) {
+			memcpy(snap, &snap_buf, sizeof(snapshot_t));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			s1 = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+			if (s0 == s1) return 0;
+		}
+		__atomic_fetch_add(&retries, 1, __ATOMIC_RELAXED);
+	}
+}
+
+uint64_t snapshot_get_retries(void)
+{
+	return __atomic_load_n(&retries, __ATOMIC_RELAXED);
+}
@@ -6,16 +6,20 @@
 #include <stdio.h>
 #include <math.h>
 #include <rc/math/filter.h>
-#include <rc/math/kalman.h>
 #include <rc/math/quaternion.h>
 #include <rc/math/matrix.h>
 #include <rc/math/other.h>
 #include <rc/start_stop.h>
-#include <rc/led.h>
 #include <rc/mpu.h>
-#include <rc/adc.h>
-#include <rc/time.h>
+#include <hal.h>
 #include <rc/bmp.h>
+#include <bmp_sampler.h>
+#include <scheduler.h>
+#include <alt_kf.h>
+#include <apogee.h>
+#include <drag_rls.h>
+#include <aero.h>
+#include <mahony.h>
 
 #include <rcs_defs.h>
 #include <state_estimator.h>
@@ -25,6 +29,7 @@
 #include <fallback_packet.h>
 
 #define TWO_PI (M_PI*2.0)
+#define ALT_KF_R	1000000.0	// barometer measurement covariance at TUNED_DT
 
 state_estimate_t state_estimate; // extern variable in state_estimator.h
 //fallback_packet_t main_state; //extern in fallback_packet.h
@@ -32,31 +37,106 @@ state_estimate_t state_estimate; // extern variable in state_estimator.h
 // sensor data structs
 rc_mpu_data_t mpu_data;
 static rc_bmp_data_t bmp_data;
+static bmp_sample_t bmp_sample;
 
 // battery filter
 static rc_filter_t batt_lp		= RC_FILTER_INITIALIZER;
 static rc_filter_t batt_lp_jack = RC_FILTER_INITIALIZER;
 
 // altitude filter components
-static rc_kalman_t alt_kf = RC_KALMAN_INITIALIZER;
+static alt_kf_t alt_kf;
 static rc_filter_t acc_lp = RC_FILTER_INITIALIZER;
 
-// This function estimates the apogee using current state of the vehicle
+// attitude filter in DMP mode, see mahony.h
+static mahony_t ahrs;
+
+// sensor mounting, set up once in __mount_init()
+static int up_axis;		// body axis along the flight direction, X or Z
+static double up_sign;		// +1 if it points up, -1 if down
+static double* up_pos;		// state_estimate.X or Z, whichever is vertical
+
+// angle and number of turns for unwrapping
+typedef struct spin_count_t {
+	double last;
+	int spins;
+} spin_count_t;
+
+// sensor to body frame, settings.mount_R * v
+static inline void __mount_vec(const double in[3], double out[3])
+{
+	const double (*R)[3] = settings.mount_R;
+	out[0] = R[0][0] * in[0] + R[0][1] * in[1] + R[0][2] * in[2];
+	out[1] = R[1][0] * in[0] + R[1][1] * in[1] + R[1][2] * in[2];
+	out[2] = R[2][0] * in[0] + R[2][1] * in[1] + R[2][2] * in[2];
+}
+
+// the attitude seen from the body: same angle, axis rotated like a vector
+static inline void __mount_quat(const double in[4], double out[4])
+{
+	out[0] = in[0];
+	__mount_vec(in + 1, out + 1);
+}
+
+// continuous angle, counts the crossings of +-PI
+static double __unwrap(double angle, spin_count_t* s)
+{
+	const double diff = angle + (s->spins * TWO_PI) - s->last;
+	if (diff < -M_PI) s->spins++;
+	else if (diff > M_PI) s->spins--;
+	s->last = angle + (s->spins * TWO_PI);
+	return s->last;
+}
+
+/**
+ * @brief      picks the vertical axis of the body frame
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __mount_init(void)
+{
+	switch (settings.orientation) {
+	case ORIENTATION_X_UP:
+		up_axis = 0;
+		up_sign = 1.0;
+		up_pos = &state_estimate.X;
+		return 0;
+	case ORIENTATION_Z_DOWN:
+		up_axis = 2;
+		up_sign = -1.0;
+		up_pos = &state_estimate.Z;
+		return 0;
+	default:
+		fprintf(stderr, "ERROR in __mount_init, unknown body frame orientation %d\n", settings.orientation);
+		return -1;
+	}
+}
+
+// This function estimates the apogee using current state of the vehicle,
+// see apogee.h
 static void __projected_altitude(void) {
-	state_estimate.proj_ap = fabs(state_estimate.alt_bmp_vel * 
-		state_estimate.alt_bmp_vel) / 
-		(2.0 * fabs(state_estimate.alt_bmp_accel + GRAVITY)) * 
-		log(fabs((state_estimate.alt_bmp_accel) / GRAVITY)) +
-		state_estimate.alt_bmp;
+	state_estimate.proj_ap = apogee_march(state_estimate.alt_bmp, state_estimate.alt_bmp_vel);
 	return;
 }
 
 
+// the battery runs in its own rate group, see scheduler.h
+static double __batt_dt(void)
+{
+	return sched_divisor(settings.feedback_hz, BATT_SAMPLE_HZ) * settings.dt;
+}
+
+// same averaging window in seconds at any loop rate
+static int __batt_lp_samples(void)
+{
+	int n = (int)(BATT_LP_WINDOW_S / __batt_dt() + 0.5);
+	return n < 2 ? 2 : n;
+}
+
 static void __batt_init(void)
 {
 	// init the battery low pass filter
-	rc_filter_moving_average(&batt_lp_jack, 20, DT);
-	double dc_read_jack = rc_adc_dc_jack();
+	rc_filter_moving_average(&batt_lp_jack, __batt_lp_samples(), __batt_dt());
+	double dc_read_jack = hal_adc_dc_jack();
 	if (dc_read_jack < 3.0){
 		if (settings.warnings_en) {
 			fprintf(stderr, "WARNING: ADC read %0.1fV on the barrel jack. Please connect\n", dc_read_jack);
@@ -69,8 +149,8 @@ static void __batt_init(void)
 
 
 	// init the battery low pass filter
-	rc_filter_moving_average(&batt_lp, 20, DT);
-	double dc_read = rc_adc_dc_jack();
+	rc_filter_moving_average(&batt_lp, __batt_lp_samples(), __batt_dt());
+	double dc_read = hal_adc_dc_jack();
 	if (dc_read < 3.0) {
 		if (settings.warnings_en) {
 			fprintf(stderr, "WARNING: ADC read %0.1fV on the 2S lipo connector. Please connect\n", dc_read);
@@ -86,21 +166,21 @@ static void __batt_init(void)
 
 
 
-static void __batt_march(void)
+int state_estimator_batt_march(void)
 {
-	double tmp		= rc_adc_batt();
+	double tmp		= hal_adc_batt();
 	if(tmp<3.0) tmp	= settings.v_nominal;
 
 	state_estimate.v_batt_raw = tmp;
 	state_estimate.v_batt_lp = rc_filter_march(&batt_lp, tmp);
 
 
-	double tmp_jack = rc_adc_dc_jack();
+	double tmp_jack = hal_adc_dc_jack();
 	if (tmp_jack < 3.0) tmp_jack = settings.v_nominal_jack;
 
 	state_estimate.v_batt_raw_jack = tmp_jack;
 	state_estimate.v_batt_lp_jack = rc_filter_march(&batt_lp_jack, tmp_jack);
-	return;
+	return 0;
 }
 
 static void __batt_cleanup(void)
@@ -114,11 +194,9 @@ static void __batt_cleanup(void)
 
 static void __imu_march(void)
 {
-	static double last_roll		= 0.0;
-	static int num_roll_spins	= 0;
-	static double last_yaw		= 0.0;
-	static int num_yaw_spins	= 0;
-	double diff;
+	static spin_count_t imu_roll_spins	= {0.0, 0};
+	static spin_count_t imu_yaw_spins	= {0.0, 0};
+	double* q;
 	if (settings.enable_xbee) {
 		state_estimate.quat_mocap[0] = xbeeMsg.qw; // W
 		state_estimate.quat_mocap[1] = xbeeMsg.qx; // X (i)
@@ -135,223 +213,51 @@ static void __imu_march(void)
 		state_estimate.pos_mocap[2] = (double)xbeeMsg.z;
 	}
 
-	switch (settings.orientation)
-	{
-	case ORIENTATION_X_UP:
-		// gyro and accel require converting to body frame
-		state_estimate.gyro[0] = mpu_data.gyro[2];
-		state_estimate.gyro[1] = mpu_data.gyro[1];
-		state_estimate.gyro[2] = -mpu_data.gyro[0];
-		state_estimate.accel[0] = mpu_data.accel[2];
-		state_estimate.accel[1] = mpu_data.accel[1];
-		state_estimate.accel[2] = -mpu_data.accel[0];
-
-		// quaternion also needs coordinate transform
-		state_estimate.quat_imu[0] = mpu_data.dmp_quat[0]; // W
-		state_estimate.quat_imu[1] = mpu_data.dmp_quat[3]; // X (i)
-		state_estimate.quat_imu[2] = mpu_data.dmp_quat[2]; // Y (j)
-		state_estimate.quat_imu[3] = -mpu_data.dmp_quat[1]; // Z (k)
-
-		// normalize it just in case
-		rc_quaternion_norm_array(state_estimate.quat_imu);
-		// generate tait bryan angles
-		rc_quaternion_to_tb_array(state_estimate.quat_imu, state_estimate.tb_imu);
-
-		// roll is more annoying since we have to detect spins
-		// also make sign negative since NED coordinates has Z point down
-		diff = state_estimate.tb_imu[2] + (num_roll_spins * TWO_PI) - last_roll;
-		//detect the crossover point at +-PI and update num yaw spins
-		if (diff < -M_PI) num_roll_spins++;
-		else if (diff > M_PI) num_roll_spins--;
-
-		// finally the new value can be written
-		state_estimate.imu_continuous_roll = state_estimate.tb_imu[0] + (num_roll_spins * TWO_PI);
-		last_roll = state_estimate.imu_continuous_roll;
-		return;
-	case ORIENTATION_Z_DOWN:
-		// gyro and accel require converting to NED coordinates
-		state_estimate.gyro[0] = mpu_data.gyro[1];
-		state_estimate.gyro[1] = mpu_data.gyro[0];
-		state_estimate.gyro[2] = -mpu_data.gyro[2];
-		state_estimate.accel[0] = mpu_data.accel[1];
-		state_estimate.accel[1] = mpu_data.accel[0];
-		state_estimate.accel[2] = -mpu_data.accel[2];
-
-		// quaternion also needs coordinate transform
-		state_estimate.quat_imu[0] = mpu_data.dmp_quat[0]; // W
-		state_estimate.quat_imu[1] = mpu_data.dmp_quat[2]; // X (i)
-		state_estimate.quat_imu[2] = mpu_data.dmp_quat[1]; // Y (j)
-		state_estimate.quat_imu[3] = -mpu_data.dmp_quat[3]; // Z (k)
-
-		// normalize it just in case
-		rc_quaternion_norm_array(state_estimate.quat_imu);
-		// generate tait bryan angles
-		rc_quaternion_to_tb_array(state_estimate.quat_imu, state_estimate.tb_imu);
-
-		// yaw is more annoying since we have to detect spins
-		// also make sign negative since NED coordinates has Z point down
-		diff = state_estimate.tb_imu[2] + (num_yaw_spins * TWO_PI) - last_yaw;
-		//detect the crossover point at +-PI and update num yaw spins
-		if (diff < -M_PI) num_yaw_spins++;
-		else if (diff > M_PI) num_yaw_spins--;
-
-		// finally the new value can be written
-		state_estimate.imu_continuous_yaw = state_estimate.tb_imu[2] + (num_yaw_spins * TWO_PI);
-		last_yaw = state_estimate.imu_continuous_yaw;
-		return;
-	default:
-		fprintf(stderr, "ERROR: Unknown Body Frame Orientation. Assuming ORIENTATION_X_UP. Please check settings.orientation\n");
-
-		// gyro and accel require converting to body frame
-		state_estimate.gyro[0] = mpu_data.gyro[2];
-		state_estimate.gyro[1] = mpu_data.gyro[1];
-		state_estimate.gyro[2] = -mpu_data.gyro[0];
-		state_estimate.accel[0] = mpu_data.accel[2];
-		state_estimate.accel[1] = mpu_data.accel[1];
-		state_estimate.accel[2] = -mpu_data.accel[0];
-
-		// quaternion also needs coordinate transform
-		state_estimate.quat_imu[0] = mpu_data.dmp_quat[0]; // W
-		state_estimate.quat_imu[1] = mpu_data.dmp_quat[3]; // X (i)
-		state_estimate.quat_imu[2] = mpu_data.dmp_quat[2]; // Y (j)
-		state_estimate.quat_imu[3] = -mpu_data.dmp_quat[1]; // Z (k)
-
-		// normalize it just in case
-		rc_quaternion_norm_array(state_estimate.quat_imu);
-		// generate tait bryan angles
-		rc_quaternion_to_tb_array(state_estimate.quat_imu, state_estimate.tb_imu);
-
-		// roll is more annoying since we have to detect spins
-		// also make sign negative since NED coordinates has Z point down
-		diff = state_estimate.tb_imu[2] + (num_roll_spins * TWO_PI) - last_roll;
-		//detect the crossover point at +-PI and update num yaw spins
-		if (diff < -M_PI) num_roll_spins++;
-		else if (diff > M_PI) num_roll_spins--;
-
-		// finally the new value can be written
-		state_estimate.imu_continuous_roll = state_estimate.tb_imu[0] + (num_roll_spins * TWO_PI);
-		last_roll = state_estimate.imu_continuous_roll;
-		return;
+	// attitude source. In FIFO mode imu_fifo has run the filter already and
+	// put its quaternion in dmp_quat.
+	q = mpu_data.dmp_quat;
+	if (!settings.imu_fifo && settings.attitude_filter == ATTITUDE_MAHONY) {
+		mahony_update(&ahrs, mpu_data.gyro, mpu_data.accel,
+			settings.enable_magnetometer ? mpu_data.mag : NULL, settings.dt);
+		q = ahrs.q;
 	}
-}
-
 
-static void __mag_march(void)
-{
-	static double last_roll		= 0.0;
-	static int num_roll_spins	= 0;
-	static double last_yaw		= 0.0;
-	static int num_yaw_spins	= 0;
-	double diff = 0;
-	switch (settings.orientation)
-	{
-	case ORIENTATION_X_UP:
-		// don't do anything if mag isn't enabled
-		if (!settings.enable_magnetometer) return;
-
-		// mag require converting to body coordinates
-		state_estimate.mag[0] = mpu_data.mag[2];
-		state_estimate.mag[1] = mpu_data.mag[1];
-		state_estimate.mag[2] = -mpu_data.mag[0];
-
-		// quaternion also needs coordinate transform
-		state_estimate.quat_mag[0] = mpu_data.fused_quat[0]; // W
-		state_estimate.quat_mag[1] = mpu_data.fused_quat[3]; // X (i)
-		state_estimate.quat_mag[2] = mpu_data.fused_quat[2]; // Y (j)
-		state_estimate.quat_mag[3] = -mpu_data.fused_quat[1]; // Z (k)
-
-
-		// normalize it just in case
-		rc_quaternion_norm_array(state_estimate.quat_mag);
-		// generate tait bryan angles
-		rc_quaternion_to_tb_array(state_estimate.quat_mag, state_estimate.tb_mag);
-
-		// heading
-		state_estimate.mag_heading_raw = mpu_data.compass_heading_raw;
-		state_estimate.mag_heading = state_estimate.tb_mag[0];
-
-		// roll is more annoying since we have to detect spins
-		diff = state_estimate.tb_mag[0] + (num_roll_spins * TWO_PI) + last_roll;
-		//detect the crossover point at +-PI and update num roll spins
-		if (diff < -M_PI) num_roll_spins++;
-		else if (diff > M_PI) num_roll_spins--;
-
-		// finally the new value can be written
-		state_estimate.mag_heading_continuous = state_estimate.tb_mag[0] + (num_roll_spins * TWO_PI);
-		break;
-	case ORIENTATION_Z_DOWN:
-		// don't do anything if mag isn't enabled
-		if (!settings.enable_magnetometer) return;
-
-		// mag require converting to NED coordinates
-		state_estimate.mag[0] = mpu_data.mag[1];
-		state_estimate.mag[1] = mpu_data.mag[0];
-		state_estimate.mag[2] = -mpu_data.mag[2];
-
-		// quaternion also needs coordinate transform
-		state_estimate.quat_mag[0] = mpu_data.fused_quat[0]; // W
-		state_estimate.quat_mag[1] = mpu_data.fused_quat[2]; // X (i)
-		state_estimate.quat_mag[2] = mpu_data.fused_quat[1]; // Y (j)
-		state_estimate.quat_mag[3] = -mpu_data.fused_quat[3]; // Z (k)
-
-
-		// normalize it just in case
-		rc_quaternion_norm_array(state_estimate.quat_mag);
-		// generate tait bryan angles
-		rc_quaternion_to_tb_array(state_estimate.quat_mag, state_estimate.tb_mag);
-
-		// heading
-		state_estimate.mag_heading_raw = mpu_data.compass_heading_raw;
-		state_estimate.mag_heading = state_estimate.tb_mag[2];
-
-		// yaw is more annoying since we have to detect spins
-		// also make sign negative since NED coordinates has Z point down
-		diff = state_estimate.tb_mag[2] + (num_yaw_spins * TWO_PI) - last_yaw;
-		//detect the crossover point at +-PI and update num yaw spins
-		if (diff < -M_PI) num_yaw_spins++;
-		else if (diff > M_PI) num_yaw_spins--;
-
-		// finally the new value can be written
-		state_estimate.mag_heading_continuous = state_estimate.tb_mag[2] + (num_yaw_spins * TWO_PI);
-		break;
-	default:
-		fprintf(stderr, "ERROR: Unknown Body Frame Orientation. Assuming ORIENTATION_X_UP. Please check settings.orientation\n");
+	// gyro, accel and the quaternion into the body frame
+	__mount_vec(mpu_data.gyro, state_estimate.gyro);
+	__mount_vec(mpu_data.accel, state_estimate.accel);
+	__mount_quat(q, state_estimate.quat_imu);
 
-		// don't do anything if mag isn't enabled
-		if (!settings.enable_magnetometer) return;
+	// normalize it just in case
+	rc_quaternion_norm_array(state_estimate.quat_imu);
+	// generate tait bryan angles
+	rc_quaternion_to_tb_array(state_estimate.quat_imu, state_estimate.tb_imu);
 
-		// mag require converting to body coordinates
-		state_estimate.mag[0] = mpu_data.mag[2];
-		state_estimate.mag[1] = mpu_data.mag[1];
-		state_estimate.mag[2] = -mpu_data.mag[0];
+	// roll and yaw are more annoying since we have to detect spins
+	state_estimate.imu_continuous_roll = __unwrap(state_estimate.tb_imu[0], &imu_roll_spins);
+	state_estimate.imu_continuous_yaw = __unwrap(state_estimate.tb_imu[2], &imu_yaw_spins);
+}
 
-		// quaternion also needs coordinate transform
-		state_estimate.quat_mag[0] = mpu_data.fused_quat[0]; // W
-		state_estimate.quat_mag[1] = mpu_data.fused_quat[3]; // X (i)
-		state_estimate.quat_mag[2] = mpu_data.fused_quat[2]; // Y (j)
-		state_estimate.quat_mag[3] = -mpu_data.fused_quat[1]; // Z (k)
 
+static void __mag_march(void)
+{
+	static spin_count_t heading_spins = {0.0, 0};
 
-		// normalize it just in case
-		rc_quaternion_norm_array(state_estimate.quat_mag);
-		// generate tait bryan angles
-		rc_quaternion_to_tb_array(state_estimate.quat_mag, state_estimate.tb_mag);
+	// don't do anything if mag isn't enabled
+	if (!settings.enable_magnetometer) return;
 
-		// heading
-		state_estimate.mag_heading_raw = mpu_data.compass_heading_raw;
-		state_estimate.mag_heading = state_estimate.tb_mag[0];
+	// mag and the fused quaternion into the body frame
+	__mount_vec(mpu_data.mag, state_estimate.mag);
+	__mount_quat(mpu_data.fused_quat, state_estimate.quat_mag);
 
-		// roll is more annoying since we have to detect spins
-		diff = state_estimate.tb_mag[0] + (num_roll_spins * TWO_PI) + last_roll;
-		//detect the crossover point at +-PI and update num roll spins
-		if (diff < -M_PI) num_roll_spins++;
-		else if (diff > M_PI) num_roll_spins--;
+	// normalize it just in case
+	rc_quaternion_norm_array(state_estimate.quat_mag);
+	// generate tait bryan angles
+	rc_quaternion_to_tb_array(state_estimate.quat_mag, state_estimate.tb_mag);
 
-		// finally the new value can be written
-		state_estimate.mag_heading_continuous = state_estimate.tb_mag[0] + (num_roll_spins * TWO_PI);
-	}
-	
-	last_roll = state_estimate.mag_heading_continuous;
+	// heading is the rotation about the vertical axis
+	state_estimate.mag_heading_raw = mpu_data.compass_heading_raw;
+	state_estimate.mag_heading = state_estimate.tb_mag[up_axis];
+	state_estimate.mag_heading_continuous = __unwrap(state_estimate.mag_heading, &heading_spins);
 	return;
 }
 
@@ -363,86 +269,52 @@ static void __mag_march(void)
 static int __altitude_init(void)
 {
 
-	//initialize altitude kalman filter and bmp sensor
-	rc_matrix_t F = RC_MATRIX_INITIALIZER;
-	rc_matrix_t G = RC_MATRIX_INITIALIZER;
-	rc_matrix_t H = RC_MATRIX_INITIALIZER;
-	rc_matrix_t Q = RC_MATRIX_INITIALIZER;
-	rc_matrix_t R = RC_MATRIX_INITIALIZER;
-	rc_matrix_t Pi = RC_MATRIX_INITIALIZER;
-
-	const int Nx = 3;
-	const int Ny = 1;
-	const int Nu = 1;
-
-	// allocate appropirate memory for system
-	rc_matrix_zeros(&F, Nx, Nx);
-	rc_matrix_zeros(&G, Nx, Nu);
-	rc_matrix_zeros(&H, Ny, Nx);
-	rc_matrix_zeros(&Q, Nx, Nx);
-	rc_matrix_zeros(&R, Ny, Ny);
-	rc_matrix_zeros(&Pi, Nx, Nx);
-
-	// define system -DT; // accel bias
-	F.d[0][0] = 1.0;
-	F.d[0][1] = DT;
-	F.d[0][2] = 0.0;
-	F.d[1][0] = 0.0;
-	F.d[1][1] = 1.0;
-	F.d[1][2] = -DT; // subtract accel bias
-	F.d[2][0] = 0.0;
-	F.d[2][1] = 0.0;
-	F.d[2][2] = 1.0; // accel bias state
-
-	G.d[0][0] = 0.5*DT*DT;
-	G.d[0][1] = DT;
-	G.d[0][2] = 0.0;
-
-	H.d[0][0] = 1.0;
-	H.d[0][1] = 0.0;
-	H.d[0][2] = 0.0;
-
-	// covariance matrices
-	Q.d[0][0] = 0.000000001;
-	Q.d[1][1] = 0.000000001;
-	Q.d[2][2] = 0.0001; // don't want bias to change too quickly
-	R.d[0][0] = 1000000.0;
+	//initialize altitude kalman filter and bmp sensor, model in alt_kf.h
+	const double dt = settings.dt;
+
+	// covariance matrices, tuned at TUNED_DT. Process noise per step grows
+	// with dt. The tuning fed the same baro sample in every step, each new
+	// sample is fused once now, so R is scaled down to keep the same trust
+	// in the barometer per second.
+	const double q[3] = {
+		0.000000001 * dt / TUNED_DT,
+		0.000000001 * dt / TUNED_DT,
+		0.0001 * dt / TUNED_DT // don't want bias to change too quickly
+	};
 
 	// initial P, cloned from converged P while running
-	Pi.d[0][0] = 1258.69;
-	Pi.d[0][1] = 158.6114;
-	Pi.d[0][2] = -9.9937;
-	Pi.d[1][0] = 158.6114;
-	Pi.d[1][1] = 29.9870;
-	Pi.d[1][2] = -2.5191;
-	Pi.d[2][0] = -9.9937;
-	Pi.d[2][1] = -2.5191;
-	Pi.d[2][2] = 0.3174;
-
-	// initialize the kalman filter
-	if(rc_kalman_alloc_lin(&alt_kf,F,G,H,Q,R,Pi)==-1) return -1;
-	rc_matrix_free(&F);
-	rc_matrix_free(&G);
-	rc_matrix_free(&H);
-	rc_matrix_free(&Q);
-	rc_matrix_free(&R);
-	rc_matrix_free(&Pi);
+	const double Pi[3][3] = {
+		{1258.69,	158.6114,	-9.9937},
+		{158.6114,	29.9870,	-2.5191},
+		{-9.9937,	-2.5191,	0.3174}
+	};
+
+	const double r = ALT_KF_R * TUNED_DT * BMP_SAMPLE_HZ;
+
+	if(alt_kf_init(&alt_kf, dt, q, r, Pi)) return -1;
 
 	// initialize the little LP filter to take out accel noise
-	if(rc_filter_first_order_lowpass(&acc_lp, DT, 20*DT)) return -1;
+	if(rc_filter_first_order_lowpass(&acc_lp, settings.dt, ACC_LP_TC_S)) return -1;
 
-	// init barometer and read in first data
-	if(rc_bmp_read(&bmp_data)) return -1;
+	// start the barometer thread, this reads in the first data
+	if(bmp_sampler_init()) return -1;
+	bmp_sampler_get_latest(&bmp_sample);
+	bmp_data = bmp_sample.data;
 
 	return 0;
 }
 
 static void __altitude_march(void)
 {
-	int i;
+	int i, new_bmp;
 	double accel_vec[3];
-	static rc_vector_t u = RC_VECTOR_INITIALIZER;
-	static rc_vector_t y = RC_VECTOR_INITIALIZER;
+	double u, y;
+	const uint64_t now = hal_nanos_since_boot();
+
+	// grab newest barometer sample without waiting for the sampler thread
+	new_bmp = bmp_sampler_get_latest(&bmp_sample) == 1;
+	bmp_data = bmp_sample.data;
+	state_estimate.bmp_age_s = (double)(int64_t)(now - bmp_sample.timestamp_ns) / 1e9;
 
 	// grab raw data
 	state_estimate.bmp_pressure_raw = bmp_data.pressure_pa;
@@ -457,74 +329,38 @@ static void __altitude_march(void)
 	// rotate accel vector
 	rc_quaternion_rotate_vector_array(accel_vec, state_estimate.quat_imu);
 
-	switch (settings.orientation) {
-	case ORIENTATION_X_UP:
-		// do first-run filter setup
-		if (alt_kf.step == 0) {
-			rc_vector_zeros(&u, 1);
-			rc_vector_zeros(&y, 1);
-			alt_kf.x_est.d[0] = bmp_data.alt_m;
-			rc_filter_prefill_inputs(&acc_lp, accel_vec[0] - GRAVITY);
-			rc_filter_prefill_outputs(&acc_lp, accel_vec[0] - GRAVITY);
-		}
-
-		// calculate acceleration and smooth it just a tad
-		// put result in u for kalman and flip sign since with altitude, positive
-		// is up whereas acceleration in X points up.
-		rc_filter_march(&acc_lp, accel_vec[0] - GRAVITY);
-		u.d[0] = acc_lp.newest_output;
-
-		// don't bother filtering Barometer, kalman will deal with that
-		y.d[0] = bmp_data.alt_m;
-		break;
-	case (ORIENTATION_Z_DOWN):
-		// do first-run filter setup
-		if (alt_kf.step == 0) {
-			rc_vector_zeros(&u, 1);
-			rc_vector_zeros(&y, 1);
-			alt_kf.x_est.d[0] = -bmp_data.alt_m;
-			rc_filter_prefill_inputs(&acc_lp, accel_vec[2] + GRAVITY);
-			rc_filter_prefill_outputs(&acc_lp, accel_vec[2] + GRAVITY);
-		}
-
-		// calculate acceleration and smooth it just a tad
-		// put result in u for kalman and flip sign since with altitude, positive
-		// is up whereas acceleration in Z points down.
-		rc_filter_march(&acc_lp, accel_vec[2] + GRAVITY);
-		u.d[0] = acc_lp.newest_output;
+	// the filter runs along the vertical axis, which may point down
+	if (alt_kf.step == 0) {
+		alt_kf.x[0] = up_sign * bmp_data.alt_m;
+		rc_filter_prefill_inputs(&acc_lp, accel_vec[up_axis] - up_sign * GRAVITY);
+		rc_filter_prefill_outputs(&acc_lp, accel_vec[up_axis] - up_sign * GRAVITY);
+	}
 
-		// don't bother filtering Barometer, kalman will deal with that
-		y.d[0] = -bmp_data.alt_m;
-		break;
-	default:
-		fprintf(stderr, "ERROR: Unknown Body Frame Orientation. Assuming ORIENTATION_X_UP. Please check settings.orientation\n");
-		// do first-run filter setup
-		if (alt_kf.step == 0) {
-			rc_vector_zeros(&u, 1);
-			rc_vector_zeros(&y, 1);
-			alt_kf.x_est.d[0] = bmp_data.alt_m;
-			rc_filter_prefill_inputs(&acc_lp, accel_vec[0] - GRAVITY);
-			rc_filter_prefill_outputs(&acc_lp, accel_vec[0] - GRAVITY);
-		}
+	// calculate acceleration and smooth it just a tad
+	rc_filter_march(&acc_lp, accel_vec[up_axis] - up_sign * GRAVITY);
+	u = acc_lp.newest_output;
 
-		// calculate acceleration and smooth it just a tad
-		// put result in u for kalman and flip sign since with altitude, positive
-		// is up whereas acceleration in Z points down.
-		rc_filter_march(&acc_lp, accel_vec[0] - GRAVITY);
-		u.d[0] = acc_lp.newest_output;
+	// don't bother filtering Barometer, kalman will deal with that
+	y = up_sign * bmp_data.alt_m;
 
-		// don't bother filtering Barometer, kalman will deal with that
-		y.d[0] = bmp_data.alt_m;
+	// predict every tick, fuse each barometer sample once at the time it was
+	// taken. Nothing is fused while the sampler is stalled.
+	alt_kf_predict(&alt_kf, u, now);
+	if (new_bmp && state_estimate.bmp_age_s <= BMP_STALE_S) {
+		alt_kf_correct(&alt_kf, y, bmp_sample.timestamp_ns);
 	}
 
-	rc_kalman_update_lin(&alt_kf, u, y);
-
 	// altitude estimate
-	state_estimate.alt_bmp		= alt_kf.x_est.d[0] - events.ground_alt;
-	state_estimate.alt_bmp_vel	= alt_kf.x_est.d[1];
-	//state_estimate.alt_bmp_accel= alt_kf.x_est.d[2]; //does not work rn (very slow updates)
+	state_estimate.alt_bmp		= alt_kf.x[0] - events.ground_alt;
+	state_estimate.alt_bmp_vel	= alt_kf.x[1];
+	//state_estimate.alt_bmp_accel= alt_kf.x[2]; //does not work rn (very slow updates)
 	state_estimate.alt_bmp_accel = acc_lp.newest_output; //quick, slightly filtered data
-	// Estimate apogee altitude:
+	// flight condition for the brake effectiveness, see aero.h
+	state_estimate.mach = aero_mach(state_estimate.alt_bmp_vel, state_estimate.bmp_temp);
+	state_estimate.dyn_press = aero_dynamic_pressure(state_estimate.bmp_pressure_raw, state_estimate.mach);
+	// learn the drag during the coast, then estimate apogee altitude:
+	drag_rls_march(state_estimate.alt_bmp_vel, state_estimate.alt_bmp_accel,
+		drag_brake_deflection());
 	__projected_altitude(); //updates state_estimate.proj_ap
 	return;
 }
@@ -574,25 +410,11 @@ static void __feedback_select(void)
 	}
 	else {
 
-		switch (settings.orientation)
-		{
-		case ORIENTATION_X_UP:
-			state_estimate.X = state_estimate.alt_bmp;
-			state_estimate.Y = state_estimate.pos_mocap[1];
-			state_estimate.Z = state_estimate.pos_mocap[2];
-			break;
-		case ORIENTATION_Z_DOWN:
-			state_estimate.X = state_estimate.pos_mocap[0];
-			state_estimate.Y = state_estimate.pos_mocap[1];
-			state_estimate.Z = -state_estimate.alt_bmp;
-			break;
-		default:
-			fprintf(stderr, "ERROR: Unknown Body Frame Orientation. Assuming ORIENTATION_X_UP. Please check settings.orientation\n");
-			state_estimate.X = state_estimate.alt_bmp;
-			state_estimate.Y = state_estimate.pos_mocap[1];
-			state_estimate.Z = state_estimate.pos_mocap[2];
-		}
-		
+		// the barometer gives the position along the vertical axis
+		state_estimate.X = state_estimate.pos_mocap[0];
+		state_estimate.Y = state_estimate.pos_mocap[1];
+		state_estimate.Z = state_estimate.pos_mocap[2];
+		*up_pos = up_sign * state_estimate.alt_bmp;
 	}
 
 	if (settings.enable_serial)
@@ -604,7 +426,6 @@ static void __feedback_select(void)
 
 static void __altitude_cleanup(void)
 {
-	rc_kalman_free(&alt_kf);
 	rc_filter_free(&acc_lp);
 	return;
 }
@@ -614,7 +435,7 @@ static void __altitude_cleanup(void)
 static void __mocap_check_timeout(void)
 {
 	if(state_estimate.mocap_running){
-		uint64_t current_time = rc_nanos_since_boot();
+		uint64_t current_time = hal_nanos_since_boot();
 		// check if mocap data is > 3 steps old
 		if((current_time-state_estimate.mocap_timestamp_ns) > (3*1E7)){
 			state_estimate.mocap_running = 0;
@@ -630,7 +451,12 @@ static void __mocap_check_timeout(void)
 int state_estimator_init(void)
 {
 	__batt_init();
+	if(__mount_init()) return -1;
+	if(mahony_init(&ahrs, settings.mahony_kp, settings.mahony_ki)) return -1;
 	if(__altitude_init()) return -1;
+	if(aero_init()) return -1;
+	if(drag_rls_init()) return -1;
+	if(apogee_init()) return -1;
 	state_estimate.initialized = 1;
 	return 0;
 }
@@ -644,7 +470,7 @@ int state_estimator_march(void)
 	}
 
 	// populate state_estimate struct one setion at a time, top to bottom
-	__batt_march();
+	// (battery is sampled in its own rate group)
 	__imu_march();
 	__mag_march();
 	__altitude_march();
@@ -657,21 +483,16 @@ int state_estimator_march(void)
 
 int state_estimator_jobs_after_feedback(void)
 {
-	static int bmp_sample_counter = 0;
-
-	// check if we need to sample BMP this loop
-	if(bmp_sample_counter>=BMP_RATE_DIV){
-		// perform the i2c reads to the sensor, on bad read just try later
-		if(rc_bmp_read(&bmp_data)) return -1;
-		bmp_sample_counter=0;
-	}
-	bmp_sample_counter++;
+	// runs at BMP_SAMPLE_HZ in its own rate group. The i2c read itself
+	// happens in the bmp_sampler thread once this ISR is done with the bus.
+	bmp_sampler_trigger();
 	return 0;
 }
 
 
 int state_estimator_cleanup(void)
 {
+	bmp_sampler_cleanup();
 	__batt_cleanup();
 	__altitude_cleanup();
 	return 0;
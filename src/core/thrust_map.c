@@ -9,13 +9,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <json-c/json.h>
 
 #include <thrust_map.h>
 
-static double* signal;
-static double* thrust;
+// map as given, thrust normalized to 0-1
+static double signal[THRUST_MAP_MAX_POINTS];
+static double thrust[THRUST_MAP_MAX_POINTS];
 static int points;
 
+// the same map resampled on a uniform thrust grid, in every cell the signal
+// is grid_a + grid_b * thrust. The extra cell catches m = 1.0.
+static double grid_a[THRUST_MAP_GRID + 1];
+static double grid_b[THRUST_MAP_GRID + 1];
+
 // Generic linear mapping
 static const int linear_map_points = 11;
 static double linear_map[][2] = \
@@ -156,93 +166,200 @@ static double rx2206_4s_map[][2] = \
  {1.0	,	566.758535098236}};
 
 
-int thrust_map_init(thrust_map_t map)
+// signal for a normalized thrust by scanning the knots, only used at init
+static double __scan(double m)
+{
+	int i;
+	double pos;
+
+	for(i=1; i<points; i++){
+		if(m <= thrust[i]){
+			pos = (m-thrust[i-1])/(thrust[i]-thrust[i-1]);
+			return signal[i-1]+(pos*(signal[i]-signal[i-1]));
+		}
+	}
+	return signal[points-1];
+}
+
+/**
+ * @brief      checks a map, normalizes it and resamples it on the grid
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __build(double (*data)[2], int n)
 {
 	int i;
-	double max;
+	double max, t0, t1, s0, s1;
+
+	// sanity checks
+	if(n<2 || n>THRUST_MAP_MAX_POINTS){
+		fprintf(stderr,"ERROR: need 2 to %d datapoints in THRUST_MAP\n", THRUST_MAP_MAX_POINTS);
+		return -1;
+	}
+	if(data[0][0] != 0.0){
+		fprintf(stderr,"ERROR: first row input must be 0.0\n");
+		return -1;
+	}
+	if(data[n-1][0] != 1.0){
+		fprintf(stderr,"ERROR: last row input must be 1.0\n");
+		printf("data: %f\n",data[n-1][0]);
+		return -1;
+	}
+	if(data[0][1] != 0.0){
+		fprintf(stderr,"ERROR: first row thrust must be 0.0\n");
+		return -1;
+	}
+	if(data[n-1][1] < 0.0){
+		fprintf(stderr,"ERROR: last row thrust must be > 0.0\n");
+		return -1;
+	}
+	for(i=1;i<n;i++){
+		if(data[i][0]<=data[i-1][0] || data[i][1]<=data[i-1][1]){
+			fprintf(stderr,"ERROR: thrust_map must be monotonically increasing\n");
+			return -1;
+		}
+	}
+
+	// normalized thrust and inputs
+	points = n;
+	max = data[n-1][1];
+	for(i=0; i<n; i++){
+		signal[i] = data[i][0];
+		thrust[i] = data[i][1]/max;
+	}
+
+	// line through the ends of every grid cell
+	for(i=0; i<THRUST_MAP_GRID; i++){
+		t0 = (double)i / THRUST_MAP_GRID;
+		t1 = (double)(i+1) / THRUST_MAP_GRID;
+		s0 = __scan(t0);
+		s1 = __scan(t1);
+		grid_b[i] = (s1-s0) * THRUST_MAP_GRID;
+		grid_a[i] = s0 - grid_b[i]*t0;
+	}
+	grid_a[THRUST_MAP_GRID] = grid_a[THRUST_MAP_GRID-1];
+	grid_b[THRUST_MAP_GRID] = grid_b[THRUST_MAP_GRID-1];
+	return 0;
+}
+
+
+int thrust_map_init(thrust_map_t map)
+{
+	int n;
 	double (*data)[2]; // pointer to constant data
 
 	switch(map){
 
 	case TEAM2_PROP:
-		points = team2_motor_and_prop_points;
+		n = team2_motor_and_prop_points;
 		data = team2_motor_and_prop_map;
 		break;
 	case RS2205_2600KV_3S:
-		points = RS2205_2600KV_3S_points;
+		n = RS2205_2600KV_3S_points;
 		data = RS2205_2600KV_3S_map;
 		break;
 	case LINEAR_MAP:
-		points = linear_map_points;
+		n = linear_map_points;
 		data = linear_map;
 		break;
 	case SERVOS_DEG:
-		points = servos_deg_map_points;
+		n = servos_deg_map_points;
 		data = servos_deg_map;
 		break;
 	case MN1806_1400KV_4S:
-		points = mn1806_1400kv_4s_points;
+		n = mn1806_1400kv_4s_points;
 		data = mn1806_1400kv_4s_map;
 		break;
 	case F20_2300KV_2S:
-		points = f20_2300kv_2s_points;
+		n = f20_2300kv_2s_points;
 		data = f20_2300kv_2s_map;
 		break;
 	case RX2206_4S:
-		points = rx2206_4s_points;
+		n = rx2206_4s_points;
 		data = rx2206_4s_map;
 		break;
+	case THRUST_MAP_FILE:
+		fprintf(stderr,"ERROR: thrust maps from a file need thrust_map_init_file()\n");
+		return -1;
 	default:
 		fprintf(stderr,"ERROR: unknown thrust map\n");
 		return -1;
 	}
 
-	// sanity checks
-	if(points<2){
-		fprintf(stderr,"ERROR: need at least 2 datapoints in THRUST_MAP\n");
-		return -1;
-	}
-	if(data[0][0] != 0.0){
-		fprintf(stderr,"ERROR: first row input must be 0.0\n");
-		return -1;
-	}
-	if(data[points-1][0] != 1.0){
-		fprintf(stderr,"ERROR: last row input must be 1.0\n");
-		printf("data: %f\n",data[points-1][0]);
-		return -1;
-	}
-	if(data[0][1] != 0.0){
-		fprintf(stderr,"ERROR: first row thrust must be 0.0\n");
-		return -1;
-	}
-	if(data[points-1][1] < 0.0){
-		fprintf(stderr,"ERROR: last row thrust must be > 0.0\n");
+	return __build(data, n);
+}
+
+
+int thrust_map_init_file(const char* path)
+{
+	static double data[THRUST_MAP_MAX_POINTS][2];
+	json_object *jobj, *row;
+	FILE* fd;
+	char line[256], *end, *end2;
+	const char* ext;
+	int n = 0, i, ret;
+
+	if(path==NULL || path[0]=='\0'){
+		fprintf(stderr,"ERROR in thrust_map_init_file, no file given\n");
 		return -1;
 	}
-	for(i=1;i<points;i++){
-		if(data[i][0]<=data[i-1][0] || data[i][1]<=data[i-1][1]){
-			fprintf(stderr,"ERROR: thrust_map must be monotonically increasing\n");
+
+	// json: array of [signal, thrust] pairs
+	ext = strrchr(path, '.');
+	if(ext!=NULL && strcmp(ext, ".json")==0){
+		jobj = json_object_from_file(path);
+		if(jobj==NULL || json_object_is_type(jobj, json_type_array)==0){
+			fprintf(stderr,"ERROR in thrust_map_init_file, %s should hold an array of [signal, thrust]\n", path);
+			if(jobj!=NULL) json_object_put(jobj);
 			return -1;
 		}
+		n = json_object_array_length(jobj);
+		if(n>THRUST_MAP_MAX_POINTS) n = THRUST_MAP_MAX_POINTS+1; // fails in __build
+		for(i=0; i<n && i<THRUST_MAP_MAX_POINTS; i++){
+			row = json_object_array_get_idx(jobj, i);
+			if(json_object_is_type(row, json_type_array)==0 || json_object_array_length(row)!=2){
+				fprintf(stderr,"ERROR in thrust_map_init_file, row %d should be [signal, thrust]\n", i);
+				json_object_put(jobj);
+				return -1;
+			}
+			data[i][0] = json_object_get_double(json_object_array_get_idx(row, 0));
+			data[i][1] = json_object_get_double(json_object_array_get_idx(row, 1));
+		}
+		json_object_put(jobj);
+		return __build(data, n);
 	}
 
-	// create new global array of normalized thrust and inputs
-	if(signal!=NULL) free(signal);
-	if(thrust!=NULL) free(thrust);
-	signal = (double*) malloc(points * sizeof(double));
-	thrust = (double*) malloc(points * sizeof(double));
-	max = data[points-1][1];
-	for(i=0; i<points; i++){
-		signal[i] = data[i][0];
-		thrust[i] = data[i][1]/max;
+	// anything else is csv: signal,thrust per line, lines that don't start
+	// with two numbers (header, comments) are skipped
+	fd = fopen(path, "r");
+	if(fd==NULL){
+		fprintf(stderr,"ERROR in thrust_map_init_file, can't open %s\n", path);
+		return -1;
 	}
-	return 0;
+	while(fgets(line, sizeof(line), fd)!=NULL){
+		double s, t;
+		s = strtod(line, &end);
+		if(end==line) continue;
+		while(*end==',' || *end==' ' || *end=='\t' || *end==';') end++;
+		t = strtod(end, &end2);
+		if(end2==end) continue;
+		if(n>=THRUST_MAP_MAX_POINTS){
+			n++;
+			break;
+		}
+		data[n][0] = s;
+		data[n][1] = t;
+		n++;
+	}
+	fclose(fd);
+	ret = __build(data, n);
+	if(ret) fprintf(stderr,"ERROR in thrust_map_init_file, bad map in %s\n", path);
+	return ret;
 }
 
 
 double map_motor_signal(double m){
 	int i;
-	double pos;
 
 	// sanity check
 	if(m>1.0 || m<0.0){
@@ -250,17 +367,25 @@ double map_motor_signal(double m){
 		return -1;
 	}
 
-	// return quickly for boundary conditions
-	if(m==0.0 || m==1.0) return m;
+	// one cell lookup, m = 1.0 lands in the extra cell
+	i = (int)(m * THRUST_MAP_GRID);
+	return fma(grid_b[i], m, grid_a[i]);
+}
 
-	// scan through the data to pick the upper and lower points to interpolate
-	for(i=1; i<points; i++){
-		if(m <= thrust[i]){
-			pos = (m-thrust[i-1])/(thrust[i]-thrust[i-1]);
-			return signal[i-1]+(pos*(signal[i]-signal[i-1]));
-		}
-	}
 
-	fprintf(stderr,"ERROR: something in map_motor_signal went wrong\n");
-	return -1;
+double thrust_map_invert(double s){
+	int lo = 0, hi = points-1, mid;
+	double pos;
+
+	if(s<=0.0) return 0.0;
+	if(s>=1.0) return 1.0;
+
+	// signal increases strictly, find signal[lo] < s <= signal[hi]
+	while(hi-lo>1){
+		mid = (lo+hi)/2;
+		if(s<=signal[mid]) hi = mid;
+		else lo = mid;
+	}
+	pos = (s-signal[lo])/(signal[hi]-signal[lo]);
+	return thrust[lo]+(pos*(thrust[hi]-thrust[lo]));
 }
@@ -0,0 +1,137 @@
+/**
+ * @file alt_kf.c
+ *
+ * Fixed-size altitude Kalman filter, see alt_kf.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <alt_kf.h>
+
+int alt_kf_init(alt_kf_t* kf, double dt, const double q[3], double r, const double P0[3][3])
+{
+	if (kf == NULL || q == NULL || P0 == NULL || dt <= 0.0) {
+		fprintf(stderr, "ERROR in alt_kf_init, invalid argument\n");
+		return -1;
+	}
+	memset(kf, 0, sizeof(*kf));
+	kf->dt = dt;
+	memcpy(kf->q, q, sizeof(kf->q));
+	kf->r = r;
+	memcpy(kf->P, P0, sizeof(kf->P));
+	return 0;
+}
+
+// x = F*x + G*u, P = F*P*F' + Q in place
+static void __predict(const alt_kf_t* kf, double x[3], double P[3][3], double u)
+{
+	const double a = kf->dt;
+	double A00, A01, A02, A11, A12;
+
+	x[0] = x[0] + a * x[1] + 0.5 * a * a * u;
+	x[1] = x[1] - a * x[2] + a * u;
+
+	// upper triangle only since it stays symmetric
+	A00 = P[0][0] + a * P[1][0];
+	A01 = P[0][1] + a * P[1][1];
+	A02 = P[0][2] + a * P[1][2];
+	A11 = P[1][1] - a * P[2][1];
+	A12 = P[1][2] - a * P[2][2];
+	P[0][0] = A00 + a * A01 + kf->q[0];
+	P[0][1] = P[1][0] = A01 - a * A02;
+	P[0][2] = P[2][0] = A02;
+	P[1][1] = A11 - a * A12 + kf->q[1];
+	P[1][2] = P[2][1] = A12;
+	P[2][2] = P[2][2] + kf->q[2];
+}
+
+// barometer update in place
+static void __correct(double x[3], double P[3][3], double y, double r)
+{
+	double N00 = P[0][0], N01 = P[0][1], N02 = P[0][2];
+	double N11 = P[1][1], N12 = P[1][2], N22 = P[2][2];
+	double s, k0, k1, k2, z;
+
+	// scalar innovation: S = H*P*H' + R, K = P*H'/S
+	s = N00 + r;
+	k0 = N00 / s;
+	k1 = N01 / s;
+	k2 = N02 / s;
+	z = y - x[0];
+
+	x[0] += k0 * z;
+	x[1] += k1 * z;
+	x[2] += k2 * z;
+
+	// P = P - K*H*P
+	P[0][0] = N00 - k0 * N00;
+	P[0][1] = P[1][0] = N01 - k0 * N01;
+	P[0][2] = P[2][0] = N02 - k0 * N02;
+	P[1][1] = N11 - k1 * N01;
+	P[1][2] = P[2][1] = N12 - k1 * N02;
+	P[2][2] = N22 - k2 * N02;
+}
+
+static inline void __save(alt_kf_hist_t* h, const double x[3], const double P[3][3])
+{
+	memcpy(h->x, x, sizeof(h->x));
+	memcpy(h->P, P, sizeof(h->P));
+}
+
+void alt_kf_predict(alt_kf_t* kf, double u, uint64_t t_ns)
+{
+	alt_kf_hist_t* h;
+
+	__predict(kf, kf->x, kf->P, u);
+	kf->step++;
+	kf->head = (kf->head + 1) % ALT_KF_HIST;
+	h = &kf->hist[kf->head];
+	h->t_ns = t_ns;
+	h->u = u;
+	h->n_y = 0;
+	__save(h, kf->x, kf->P);
+}
+
+int alt_kf_correct(alt_kf_t* kf, double y, uint64_t t_ns)
+{
+	int n, i, k, len;
+	double x[3], P[3][3];
+	alt_kf_hist_t* h;
+
+	if (kf->step == 0) return -1;
+	len = kf->step < ALT_KF_HIST ? (int)kf->step : ALT_KF_HIST;
+
+	// newest step at or before the sample
+	for (n = 0; n < len; n++) {
+		i = (kf->head - n + ALT_KF_HIST) % ALT_KF_HIST;
+		if (kf->hist[i].t_ns <= t_ns) break;
+	}
+	h = &kf->hist[i];
+	if (n == len || h->n_y == ALT_KF_MEAS) {
+		kf->dropped++;
+		return -1;
+	}
+
+	memcpy(x, h->x, sizeof(x));
+	memcpy(P, h->P, sizeof(P));
+	__correct(x, P, y, kf->r);
+	h->y[h->n_y] = y;
+	h->r[h->n_y] = kf->r;
+	h->n_y++;
+	__save(h, x, P);
+
+	// bring it forward again, fusing the newer samples again on the way and
+	// keeping the corrected history for the next one
+	while (i != kf->head) {
+		i = (i + 1) % ALT_KF_HIST;
+		h = &kf->hist[i];
+		__predict(kf, x, P, h->u);
+		for (k = 0; k < h->n_y; k++) __correct(x, P, h->y[k], h->r[k]);
+		__save(h, x, P);
+	}
+	memcpy(kf->x, x, sizeof(kf->x));
+	memcpy(kf->P, P, sizeof(kf->P));
+	kf->fused++;
+	return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file dfilter.c
+ *
+ * Fixed-size discrete filter, see dfilter.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <dfilter.h>
+
+int dfilter_from_rc(dfilter_t* f, const rc_filter_t* rc)
+{
+	int i, rel_deg;
+
+	if (f == NULL || rc == NULL || !rc->initialized) {
+		fprintf(stderr, "ERROR in dfilter_from_rc, filter not initialized\n");
+		return -1;
+	}
+	if (rc->order > DFILTER_MAX_ORDER || rc->den.len != rc->order + 1 ||
+		rc->num.len < 1 || rc->num.len > rc->den.len) {
+		fprintf(stderr, "ERROR in dfilter_from_rc, order %d not supported, max is %d\n",
+			rc->order, DFILTER_MAX_ORDER);
+		return -1;
+	}
+	memset(f, 0, sizeof(*f));
+	f->order = rc->order;
+	f->dt = rc->dt;
+	f->gain = rc->gain;
+
+	// rc_filter normalizes den[0] to 1, pad the numerator in front so both
+	// line up with the histories
+	rel_deg = rc->den.len - rc->num.len;
+	for (i = 0; i < rc->num.len; i++) f->num[i + rel_deg] = rc->num.d[i];
+	for (i = 0; i <= f->order; i++) f->den[i] = rc->den.d[i];
+
+	f->sat_en = rc->sat_en;
+	f->sat_min = rc->sat_min;
+	f->sat_max = rc->sat_max;
+	f->ss_en = rc->ss_en;
+	f->ss_steps = rc->ss_steps;
+	return 0;
+}
+
+// saturation and soft start, same order as rc_filter_march
+static inline double __limit(dfilter_t* f, double y)
+{
+	double k;
+
+	if (f->sat_en) {
+		if (y > f->sat_max) {
+			y = f->sat_max;
+			f->sat_flag = 1;
+		}
+		else if (y < f->sat_min) {
+			y = f->sat_min;
+			f->sat_flag = 1;
+		}
+		else f->sat_flag = 0;
+	}
+	if (f->ss_en && f->step < f->ss_steps) {
+		k = f->step / f->ss_steps;
+		if (y > k * f->sat_max) y = k * f->sat_max;
+		if (y < k * f->sat_min) y = k * f->sat_min;
+	}
+	return y;
+}
+
+double dfilter_march(dfilter_t* f, double in)
+{
+	int i;
+	double y;
+
+	switch (f->order) {
+	case 0:
+		y = f->gain * f->num[0] * in;
+		f->in[0] = in;
+		break;
+	case 1:
+		f->in[1] = f->in[0];
+		f->in[0] = in;
+		y = f->gain * (f->num[0] * in + f->num[1] * f->in[1])
+			- f->den[1] * f->out[0];
+		f->out[1] = f->out[0];
+		break;
+	case 2:
+		f->in[2] = f->in[1];
+		f->in[1] = f->in[0];
+		f->in[0] = in;
+		y = f->gain * (f->num[0] * in + f->num[1] * f->in[1] + f->num[2] * f->in[2])
+			- f->den[1] * f->out[0] - f->den[2] * f->out[1];
+		f->out[2] = f->out[1];
+		f->out[1] = f->out[0];
+		break;
+	default:
+		for (i = f->order; i > 0; i--) f->in[i] = f->in[i - 1];
+		f->in[0] = in;
+		y = 0.0;
+		for (i = 0; i <= f->order; i++) y += f->num[i] * f->in[i];
+		y *= f->gain;
+		// out[] still holds the previous outputs at 0..order-1
+		for (i = 1; i <= f->order; i++) y -= f->den[i] * f->out[i - 1];
+		for (i = f->order; i > 0; i--) f->out[i] = f->out[i - 1];
+		break;
+	}
+	y = __limit(f, y);
+	f->out[0] = y;
+	f->step++;
+	return y;
+}
+
+void dfilter_reset(dfilter_t* f)
+{
+	memset(f->in, 0, sizeof(f->in));
+	memset(f->out, 0, sizeof(f->out));
+	f->sat_flag = 0;
+	f->step = 0;
+}
+
+void dfilter_set_saturation(dfilter_t* f, double min, double max)
+{
+	f->sat_en = 1;
+	f->sat_min = min;
+	f->sat_max = max;
+}
+
+int dfilter_enable_soft_start(dfilter_t* f, double seconds)
+{
+	if (!f->sat_en) {
+		fprintf(stderr, "ERROR in dfilter_enable_soft_start, saturation must be enabled first\n");
+		return -1;
+	}
+	if (seconds < f->dt) {
+		fprintf(stderr, "ERROR in dfilter_enable_soft_start, seconds must be >= dt\n");
+		return -1;
+	}
+	f->ss_en = 1;
+	f->ss_steps = seconds / f->dt;
+	return 0;
+}
+
+void dfilter_prefill_inputs(dfilter_t* f, double in)
+{
+	int i;
+	for (i = 0; i <= DFILTER_MAX_ORDER; i++) f->in[i] = in;
+}
+
+void dfilter_prefill_outputs(dfilter_t* f, double out)
+{
+	int i;
+	for (i = 0; i <= DFILTER_MAX_ORDER; i++) f->out[i] = out;
+}
+
+void dfilter_print(const dfilter_t* f)
+{
+	int i;
+
+	printf("order %d, dt %.4f, gain %.4f\nnum: ", f->order, f->dt, f->gain);
+	for (i = 0; i <= f->order; i++) printf("%8.4f ", f->num[i]);
+	printf("\nden: ");
+	for (i = 0; i <= f->order; i++) printf("%8.4f ", f->den[i]);
+	printf("\n");
+}
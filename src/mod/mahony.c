@@ -0,0 +1,122 @@
+/**
+ * @file mahony.c
+ *
+ * Mahony attitude filter, see mahony.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <rc/math/quaternion.h>
+
+#include <mahony.h>
+
+#define DEG_TO_RAD	(M_PI / 180.0)
+#define ONE_G		9.80665
+
+int mahony_init(mahony_t* f, double kp, double ki)
+{
+	if (f == NULL || kp < 0.0 || ki < 0.0) {
+		fprintf(stderr, "ERROR in mahony_init, invalid argument\n");
+		return -1;
+	}
+	memset(f, 0, sizeof(*f));
+	f->kp = kp;
+	f->ki = ki;
+	f->q[0] = 1.0;
+	return 0;
+}
+
+// roll and pitch from gravity, heading zero
+static void __level(mahony_t* f, const double a[3])
+{
+	double tb[3];
+
+	tb[0] = atan2(a[1], a[2]);
+	tb[1] = atan2(-a[0], sqrt(a[1] * a[1] + a[2] * a[2]));
+	tb[2] = 0.0;
+	rc_quaternion_from_tb_array(tb, f->q);
+	f->leveled = 1;
+}
+
+void mahony_update(mahony_t* f, const double gyro[3], const double accel[3],
+	const double mag[3], double dt)
+{
+	const double q0 = f->q[0], q1 = f->q[1], q2 = f->q[2], q3 = f->q[3];
+	double gx = gyro[0] * DEG_TO_RAD, gy = gyro[1] * DEG_TO_RAD, gz = gyro[2] * DEG_TO_RAD;
+	double ex = 0.0, ey = 0.0, ez = 0.0;
+	double ax, ay, az, mx, my, mz, n, vx, vy, vz, hx, hy, bx, bz, wx, wy, wz;
+	int i, corrected = 0;
+
+	n = sqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+	if (!f->leveled) {
+		if (n > 0.0) __level(f, accel);
+		return;
+	}
+
+	if (fabs(n - ONE_G) < MAHONY_ACCEL_GATE * ONE_G) {
+		ax = accel[0] / n;
+		ay = accel[1] / n;
+		az = accel[2] / n;
+		// gravity direction the estimate expects
+		vx = 2.0 * (q1 * q3 - q0 * q2);
+		vy = 2.0 * (q0 * q1 + q2 * q3);
+		vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+		ex = ay * vz - az * vy;
+		ey = az * vx - ax * vz;
+		ez = ax * vy - ay * vx;
+		corrected = 1;
+	}
+
+	if (mag != NULL) {
+		n = sqrt(mag[0] * mag[0] + mag[1] * mag[1] + mag[2] * mag[2]);
+		if (n > 0.0) {
+			mx = mag[0] / n;
+			my = mag[1] / n;
+			mz = mag[2] / n;
+			// field in the world frame, flattened onto north and down
+			hx = 2.0 * (mx * (0.5 - q2 * q2 - q3 * q3) + my * (q1 * q2 - q0 * q3) + mz * (q1 * q3 + q0 * q2));
+			hy = 2.0 * (mx * (q1 * q2 + q0 * q3) + my * (0.5 - q1 * q1 - q3 * q3) + mz * (q2 * q3 - q0 * q1));
+			bx = sqrt(hx * hx + hy * hy);
+			bz = 2.0 * (mx * (q1 * q3 - q0 * q2) + my * (q2 * q3 + q0 * q1) + mz * (0.5 - q1 * q1 - q2 * q2));
+			// and back in the sensor frame
+			wx = 2.0 * (bx * (0.5 - q2 * q2 - q3 * q3) + bz * (q1 * q3 - q0 * q2));
+			wy = 2.0 * (bx * (q1 * q2 - q0 * q3) + bz * (q0 * q1 + q2 * q3));
+			wz = 2.0 * (bx * (q0 * q2 + q1 * q3) + bz * (0.5 - q1 * q1 - q2 * q2));
+			ex += my * wz - mz * wy;
+			ey += mz * wx - mx * wz;
+			ez += mx * wy - my * wx;
+			corrected = 1;
+		}
+	}
+
+	if (corrected) {
+		if (f->ki > 0.0) {
+			f->bias[0] += f->ki * ex * dt;
+			f->bias[1] += f->ki * ey * dt;
+			f->bias[2] += f->ki * ez * dt;
+			for (i = 0; i < 3; i++) {
+				if (f->bias[i] > MAHONY_BIAS_MAX) f->bias[i] = MAHONY_BIAS_MAX;
+				else if (f->bias[i] < -MAHONY_BIAS_MAX) f->bias[i] = -MAHONY_BIAS_MAX;
+			}
+		}
+		gx += f->kp * ex;
+		gy += f->kp * ey;
+		gz += f->kp * ez;
+	}
+	gx += f->bias[0];
+	gy += f->bias[1];
+	gz += f->bias[2];
+
+	// q += 0.5 * q x (0, w) * dt
+	gx *= 0.5 * dt;
+	gy *= 0.5 * dt;
+	gz *= 0.5 * dt;
+	f->q[0] = q0 - q1 * gx - q2 * gy - q3 * gz;
+	f->q[1] = q1 + q0 * gx + q2 * gz - q3 * gy;
+	f->q[2] = q2 + q0 * gy - q1 * gz + q3 * gx;
+	f->q[3] = q3 + q0 * gz + q1 * gy - q2 * gx;
+	n = 1.0 / sqrt(f->q[0] * f->q[0] + f->q[1] * f->q[1] + f->q[2] * f->q[2] + f->q[3] * f->q[3]);
+	for (i = 0; i < 4; i++) f->q[i] *= n;
+}
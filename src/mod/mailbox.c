@@ -0,0 +1,52 @@
+/**
+ * @file mailbox.c
+ *
+ * Wait-free latest-value mailbox, see mailbox.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mailbox.h>
+
+// the index of the published buffer lives in the low bits of "ready", the
+// FRESH bit tells the consumer it has not been picked up yet
+#define FRESH	4
+
+int mailbox_init(mailbox_t* mb, void* storage, size_t size)
+{
+	int i;
+
+	if (mb == NULL || storage == NULL || size == 0) {
+		fprintf(stderr, "ERROR in mailbox_init, invalid argument\n");
+		return -1;
+	}
+	for (i = 0; i < 3; i++) mb->slot[i] = (char*)storage + i * size;
+	mb->size = size;
+	mb->ready = 0;
+	mb->back = 1;
+	mb->front = 2;
+	mb->has_data = 0;
+	return 0;
+}
+
+void mailbox_publish(mailbox_t* mb, const void* data)
+{
+	memcpy(mb->slot[mb->back], data, mb->size);
+	// hand over the filled buffer and take the old published one as new back
+	mb->back = __atomic_exchange_n(&mb->ready, mb->back | FRESH, __ATOMIC_ACQ_REL) & ~FRESH;
+	__atomic_store_n(&mb->has_data, 1, __ATOMIC_RELEASE);
+}
+
+int mailbox_take(mailbox_t* mb, void* data)
+{
+	int is_new = 0;
+
+	if (!__atomic_load_n(&mb->has_data, __ATOMIC_ACQUIRE)) return -1;
+	if (__atomic_load_n(&mb->ready, __ATOMIC_ACQUIRE) & FRESH) {
+		mb->front = __atomic_exchange_n(&mb->ready, mb->front, __ATOMIC_ACQ_REL) & ~FRESH;
+		is_new = 1;
+	}
+	memcpy(data, mb->slot[mb->front], mb->size);
+	return is_new;
+}
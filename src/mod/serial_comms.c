@@ -17,11 +17,14 @@ send_serial_t send_serial;
 
 // Information local to this file
 void readRingBuffer();
-#define RING_BUFSIZE 256*2
-#define RING_INC(a)(a<(RING_BUFSIZE-1))?(a+1):0  // Increment ring buffer index macro
-int ring_overflow=0, rdIndex=0, wrIndex=0;
+#define RING_BUFSIZE (256*2)
+int rdIndex=0, wrIndex=0;
 unsigned char ringbuffer[RING_BUFSIZE];
 
+// newest valid packet, handed from the serial_io thread to __imu_isr
+static fallback_packet_t mailbox_storage[3];
+static mailbox_t serial_mailbox;
+
 int serial_init() {
   int baudRate  = settings.serial_port_1_baud;
   char port[20];
@@ -33,35 +36,45 @@ int serial_init() {
     printf("Failed to open Serial Port\n");
     return -1;
   }
-  return 0;
+  return mailbox_init(&serial_mailbox, mailbox_storage, sizeof(fallback_packet_t));
 }
 
 
-// Read message received from XBee; use ring buffer to assure no data loss
-int serial_getData()
+// Drain the port with bulk reads straight into the ring buffer and parse as
+// we go. Called from the serial_io thread whenever the port is readable.
+int serial_rx_service()
 {
-  int k;
-  unsigned char buffer;
-  // Populate ring buffer
-  for (k=0;k<RING_BUFSIZE;k++) {
-    if (ring_overflow) { // Overflow condition on last read attempt
-      if (rdIndex == wrIndex) { // Indices equal:  overflow still in effect
-	return -1;  // Do not read data; reading data would cause overflow
-	break;
-      } else
-	ring_overflow = 0;  // Reset overflow flag
-    }
+  int n, space;
+
+  while (1) {
+    // largest contiguous free block of the ring, one byte always stays empty
+    if (wrIndex >= rdIndex) space = RING_BUFSIZE - wrIndex - (rdIndex == 0);
+    else space = rdIndex - wrIndex - 1;
+
+    n = read(serial_portID, &ringbuffer[wrIndex], space);
+    if (n <= 0) break;
+    wrIndex = (wrIndex + n) % RING_BUFSIZE;
 
-    if (read(serial_portID, &buffer, 1) > 0) { // Read from buffer: returns 0 or -1 if no data
-      ringbuffer[wrIndex] = buffer;
-	  wrIndex = RING_INC(wrIndex);
-      if (wrIndex == rdIndex) ring_overflow = 1;
-    } else
-      break;
+    // parsing empties the ring so there is room for the next read
+    readRingBuffer();
   }
+  // the port is non-blocking, so 0 means it hung up rather than no data
+  if (n == 0) {
+    fprintf(stderr, "ERROR in serial_rx_service, port hung up\n");
+    return -1;
+  }
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    perror("ERROR in serial_rx_service, read");
+    return -1;
+  }
+  return 0;
+}
+
 
-  // Read and process data in ring buffer; print data
-  readRingBuffer();
+// Called from __imu_isr, picks up the newest packet without blocking
+int serial_getData()
+{
+  mailbox_take(&serial_mailbox, &serialMsg);
   return 0;
 }
 
@@ -79,8 +92,7 @@ void readRingBuffer()
   static unsigned char msgdata[SERIAL_DATA_LENGTH], ck0, ck1;
   //printf("\n Trying to read data \n");
 
-  while(ring_overflow || (rdIndex != wrIndex)) { //Don't get ahead of the receiving data 
-    if (ring_overflow) ring_overflow = 0; // Reset buffer overflow flag
+  while(rdIndex != wrIndex) { //Don't get ahead of the receiving data 
     // Case 0:  Current character is first message header byte
     if((ringbuffer[rdIndex] == startByte1) && !msgState) {
 	    //printf("\n Received Start byte!\n"); //test if xbee is working and receiving start byte
@@ -121,15 +133,15 @@ void readRingBuffer()
         if (ck1 == ringbuffer[rdIndex])
         { // Valid message -- copy and print --- must figure out the checksum later (JK)
 
-            //double dt_s = (rc_nanos_since_boot() - last_time) / (1e9); //calculate time since last successful reading
+            //double dt_s = (hal_nanos_since_boot() - last_time) / (1e9); //calculate time since last successful reading
             //if (1 / dt_s < 5) printf("\nWARNING, Low update frequency of Serial %f (Hz)\n", 1 / dt_s); //check the update frequency
-            memcpy(&serialMsg, msgdata, SERIAL_DATA_LENGTH);
+            mailbox_publish(&serial_mailbox, msgdata);
 
-            //last_time = rc_nanos_since_boot();
+            //last_time = hal_nanos_since_boot();
 
         }
     }
-    rdIndex = RING_INC(rdIndex);
+    rdIndex = (rdIndex + 1) % RING_BUFSIZE;
   }  
   return;
 }
@@ -142,40 +154,34 @@ int send_serial_data(void)
     serial_packet[0] = SEND_START_BYTE0;
     serial_packet[1] = SEND_START_BYTE1;
 
-    if (1.0/finddt_s(send_serial.time_ns) < settings.serial_send_update_hz)
-    {
-        send_serial_packet.flight_state = flight_status;
-        send_serial_packet.time_ms = rc_nanos_since_boot() / 1000;
-        //send_serial_packet.flight_state = DESCENT_TO_LAND;
+    // rate is set by the telemetry group in the scheduler (serial_send_update_hz)
+    send_serial_packet.flight_state = flight_status;
+    send_serial_packet.time_ms = hal_nanos_since_boot() / 1000;
+    //send_serial_packet.flight_state = DESCENT_TO_LAND;
 
-        memcpy(data_packet, &send_serial_packet, SEND_DATA_LENGTH);
+    memcpy(data_packet, &send_serial_packet, SEND_DATA_LENGTH);
 
-        fletcher16_append(data_packet, SEND_DATA_LENGTH, serial_packet + SEND_DATA_LENGTH + 2);
+    fletcher16_append(data_packet, SEND_DATA_LENGTH, serial_packet + SEND_DATA_LENGTH + 2);
 
-        memcpy(serial_packet + 2, &data_packet, SEND_DATA_LENGTH);
+    memcpy(serial_packet + 2, &data_packet, SEND_DATA_LENGTH);
 
-        if (write(serial_portID, serial_packet, SEND_PACKET_LENGTH) > 0)
+    if (write(serial_portID, serial_packet, SEND_PACKET_LENGTH) > 0)
+    {
+        /*
+        printf("\nSedning  data....  fr=%f (Hz)\n", 1.0 / finddt_s(send_serial.time_ns));
+        unsigned int i = 0;
+        while (i < SEND_PACKET_LENGTH)
         {
-            /*
-            printf("\nSedning  data....  fr=%f (Hz)\n", 1.0 / finddt_s(send_serial.time_ns));
-            unsigned int i = 0;
-            while (i < SEND_PACKET_LENGTH)
-            {
-                printf("\n %d Byte is: %X", i, serial_packet[i]);
-                i++;
-            }
-            
-            //printf("\nPress ENTER key to Continue\n");
-            //getchar(); 
-            */
-            send_serial.time_ns = rc_nanos_since_boot();
+            printf("\n %d Byte is: %X", i, serial_packet[i]);
+            i++;
         }
+        
+        //printf("\nPress ENTER key to Continue\n");
+        //getchar(); 
+        */
+        send_serial.time_ns = hal_nanos_since_boot();
     }
-    else
-    {
-        //printf("\nWaiting to send data....");
-    }
-    
+
     return 0;
 }
 
@@ -0,0 +1,143 @@
+/**
+ * @file serial_io.c
+ *
+ * epoll based receive thread for the serial links, see serial_io.h
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include <rc/start_stop.h>
+#include <rc/pthread.h>
+#include <hal.h>
+
+#include <thread_defs.h>
+#include <settings.h>
+#include <rt_harden.h>
+#include <serial_io.h>
+#include <serial_comms.h>
+#include <xbee_packet_t.h>
+
+// which link an epoll event belongs to
+#define LINK_SERIAL	0
+#define LINK_XBEE	1
+
+static int epoll_fd = -1;
+static pthread_t serial_io_thread;
+static int running;
+static int initialized = 0;
+
+// stops listening to a link that hung up or failed, so a dead port can't
+// keep waking the thread
+static int __drop_port(uint32_t link)
+{
+	int fd = link == LINK_SERIAL ? serial_portID : xbee_portID;
+
+	fprintf(stderr, "WARNING in serial_io, %s link failed, no longer receiving on it\n",
+		link == LINK_SERIAL ? "serial" : "xbee");
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL)) {
+		perror("ERROR in serial_io, epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+static void* __serial_io_func(__attribute__((unused)) void* ptr)
+{
+	int i, n, ret;
+	struct epoll_event events[2];
+
+	rt_harden_thread(1);
+	while (running && rc_get_state() != EXITING) {
+		// time out now and then to notice the program exiting
+		n = epoll_wait(epoll_fd, events, 2, SERIAL_IO_WAKE_MS);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			perror("ERROR in serial_io, epoll_wait");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			// drain what is left even on a hangup, then drop the port
+			if (events[i].data.u32 == LINK_SERIAL) ret = serial_rx_service();
+			else ret = XBEE_rx_service();
+			if (ret == 0 && (events[i].events & (EPOLLHUP | EPOLLERR)) == 0) continue;
+			if (__drop_port(events[i].data.u32)) return NULL;
+		}
+	}
+	return NULL;
+}
+
+static int __add_port(int fd, uint32_t link)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = link;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		perror("ERROR in serial_io_init, epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+int serial_io_init(void)
+{
+	int num_ports = 0;
+
+	if (initialized) {
+		fprintf(stderr, "ERROR in serial_io_init, already initialized\n");
+		return -1;
+	}
+
+	epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) {
+		perror("ERROR in serial_io_init, epoll_create1");
+		return -1;
+	}
+	if (settings.enable_serial && settings.enable_receive_serial) {
+		if (__add_port(serial_portID, LINK_SERIAL)) goto fail;
+		num_ports++;
+	}
+	if (settings.enable_xbee) {
+		if (__add_port(xbee_portID, LINK_XBEE)) goto fail;
+		num_ports++;
+	}
+	// nothing to listen to
+	if (num_ports == 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+		return 0;
+	}
+
+	running = 1;
+	if (hal_pthread_create(&serial_io_thread, __serial_io_func, NULL,
+		SCHED_FIFO, settings.serial_io_priority) == -1) {
+		fprintf(stderr, "ERROR in serial_io_init, failed to start thread\n");
+		running = 0;
+		goto fail;
+	}
+	initialized = 1;
+	return 0;
+
+fail:
+	close(epoll_fd);
+	epoll_fd = -1;
+	return -1;
+}
+
+int serial_io_cleanup(void)
+{
+	int ret;
+
+	if (!initialized) return 0;
+	running = 0;
+	ret = rc_pthread_timed_join(serial_io_thread, NULL, SERIAL_IO_TOUT);
+	if (ret == 1) fprintf(stderr, "WARNING: serial_io_thread exit timeout\n");
+	else if (ret == -1) fprintf(stderr, "ERROR: failed to join serial_io thread\n");
+	close(epoll_fd);
+	epoll_fd = -1;
+	initialized = 0;
+	return ret;
+}
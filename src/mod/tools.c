@@ -1,10 +1,19 @@
 /**
  * @file tools.c
  */
+#include <time.h>
+
 #include <tools.h>
 
 double finddt_s(uint64_t ti)
 {
-    double dt_s = (rc_nanos_since_boot() - ti) / (1e9);
+    double dt_s = (hal_nanos_since_boot() - ti) / (1e9);
     return dt_s;
-}
\ No newline at end of file
+}
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
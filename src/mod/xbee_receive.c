@@ -14,11 +14,14 @@ int xbee_portID;  // Defined as extern in xbee_packet_t.h
 
 // Information local to this file
 void XBEE_readRingBuffer();
-#define XBEE_RING_BUFSIZE 256*2
-#define XBEE_RING_INC(a)(a<(XBEE_RING_BUFSIZE-1))?(a+1):0  // Increment ring buffer index macro
-int XBEE_ring_overflow=0, XBEE_rdIndex=0, XBEE_wrIndex=0;
+#define XBEE_RING_BUFSIZE (256*2)
+int XBEE_rdIndex=0, XBEE_wrIndex=0;
 unsigned char XBEE_ringbuffer[XBEE_RING_BUFSIZE];
 
+// newest valid packet, handed from the serial_io thread to __imu_isr
+static xbee_packet_t XBEE_mailbox_storage[3];
+static mailbox_t XBEE_mailbox;
+
 int XBEE_init() {
     int baudRate = settings.serial_port_2_baud;
     char port[20];
@@ -34,36 +37,45 @@ int XBEE_init() {
     printf("Failed to open Serial Port\n");
     return -1;
     }
-    return 0;
+    return mailbox_init(&XBEE_mailbox, XBEE_mailbox_storage, sizeof(xbee_packet_t));
 }
 
 
-// Read message received from XBee; use ring buffer to assure no data loss
-int XBEE_getData()
+// Drain the port with bulk reads straight into the ring buffer and parse as
+// we go. Called from the serial_io thread whenever the port is readable.
+int XBEE_rx_service()
 {
-  int k;
-  unsigned char buffer;
-  
-  // Populate ring buffer
-  for (k=0;k<XBEE_RING_BUFSIZE;k++) {
-    if (XBEE_ring_overflow) { // Overflow condition on last read attempt
-      if (XBEE_rdIndex == XBEE_wrIndex) { // Indices equal:  overflow still in effect
-	return -1;  // Do not read data; reading data would cause overflow
-	break;
-      } else
-	XBEE_ring_overflow = 0;  // Reset overflow flag
-    }
+  int n, space;
 
-    if (read(xbee_portID, &buffer, 1) > 0) { // Read from buffer: returns 0 or -1 if no data
-      XBEE_ringbuffer[XBEE_wrIndex] = buffer;
-	  XBEE_wrIndex = XBEE_RING_INC(XBEE_wrIndex);
-      if (XBEE_wrIndex == XBEE_rdIndex) XBEE_ring_overflow = 1;
-    } else
-      break;
+  while (1) {
+    // largest contiguous free block of the ring, one byte always stays empty
+    if (XBEE_wrIndex >= XBEE_rdIndex) space = XBEE_RING_BUFSIZE - XBEE_wrIndex - (XBEE_rdIndex == 0);
+    else space = XBEE_rdIndex - XBEE_wrIndex - 1;
+
+    n = read(xbee_portID, &XBEE_ringbuffer[XBEE_wrIndex], space);
+    if (n <= 0) break;
+    XBEE_wrIndex = (XBEE_wrIndex + n) % XBEE_RING_BUFSIZE;
+
+    // parsing empties the ring so there is room for the next read
+    XBEE_readRingBuffer();
+  }
+  // the port is non-blocking, so 0 means it hung up rather than no data
+  if (n == 0) {
+    fprintf(stderr, "ERROR in XBEE_rx_service, port hung up\n");
+    return -1;
   }
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    perror("ERROR in XBEE_rx_service, read");
+    return -1;
+  }
+  return 0;
+}
 
-  // Read and process data in ring buffer; print data
-  XBEE_readRingBuffer();
+
+// Called from __imu_isr, picks up the newest packet without blocking
+int XBEE_getData()
+{
+  mailbox_take(&XBEE_mailbox, &xbeeMsg);
   return 0;
 }
 
@@ -79,10 +91,10 @@ void XBEE_readRingBuffer()
 {
   static unsigned char msgState = 0, msglength = 0;
   static unsigned char msgdata[OPTI_DATA_LENGTH], ck0, ck1;
+  xbee_packet_t packet;
   
 
-  while(XBEE_ring_overflow || (XBEE_rdIndex != XBEE_wrIndex)) { //Don't get ahead of the receiving data 
-    if (XBEE_ring_overflow) XBEE_ring_overflow = 0; // Reset buffer overflow flag
+  while(XBEE_rdIndex != XBEE_wrIndex) { //Don't get ahead of the receiving data 
     // Case 0:  Current character is first message header byte
     if((XBEE_ringbuffer[XBEE_rdIndex] == XBEE_startByte1) && !msgState) {
 		//printf("\n Received Start byte!\n"); //test if xbee is working and receiving start byte
@@ -119,14 +131,15 @@ void XBEE_readRingBuffer()
       msgState = 0;  // Done reading message data
       //if (ck1 == XBEE_ringbuffer[XBEE_rdIndex]) { // Valid message -- copy and print --- must figure out the checksum later (JK)
 	
-	//double dt_s = (rc_nanos_since_boot()-last_time)/(1e9); //calculate time since last successful reading
+	//double dt_s = (hal_nanos_since_boot()-last_time)/(1e9); //calculate time since last successful reading
 	//if (1/dt_s < 20) printf("\nWARNING, Low update frequency of Xbee %f (Hz)\n",1/dt_s); //check the update frequency
-  	memcpy(&xbeeMsg, msgdata, OPTI_DATA_LENGTH);
+  	memcpy(&packet, msgdata, OPTI_DATA_LENGTH);
+  	mailbox_publish(&XBEE_mailbox, &packet);
 	
-	//last_time = rc_nanos_since_boot();
+	//last_time = hal_nanos_since_boot();
 	
 		//check for xbee connection (move it out later)
-	if(xbeeMsg.trackingValid == 0){
+	if(packet.trackingValid == 0){
 				printf("\nWARNING, MOCAP LOST VISUAL\n");
 	}
 	//######################
@@ -134,7 +147,7 @@ void XBEE_readRingBuffer()
 	//XBEE_printData();
       //}
     }
-    XBEE_rdIndex = XBEE_RING_INC(XBEE_rdIndex);
+    XBEE_rdIndex = (XBEE_rdIndex + 1) % XBEE_RING_BUFSIZE;
   }  
   return;
 }
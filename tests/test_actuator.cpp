@@ -0,0 +1,83 @@
+/**
+ * @file test_actuator.cpp
+ *
+ * Servo dynamics model and command shaping, see actuator.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+
+extern "C" {
+#include <actuator.h>
+}
+
+#define DT	0.01
+
+BOOST_AUTO_TEST_CASE(actuator_rejects_bad_model)
+{
+	actuator_t a;
+	actuator_model_t m = {2.0, 0.0, 0.0, 0.0};
+
+	BOOST_CHECK_EQUAL(actuator_init(&a, &m, 0.0, 0.0), -1);
+	m.tau_s = -1.0;
+	BOOST_CHECK_EQUAL(actuator_init(&a, &m, DT, 0.0), -1);
+	BOOST_CHECK_EQUAL(actuator_init(NULL, &m, DT, 0.0), -1);
+}
+
+BOOST_AUTO_TEST_CASE(actuator_shape_rate_limits)
+{
+	actuator_t a;
+	actuator_model_t m = {2.0, 0.0, 0.0, 0.0};	// full travel in 0.5 s
+	int i;
+
+	BOOST_REQUIRE_EQUAL(actuator_init(&a, &m, DT, 0.0), 0);
+	for (i = 0; i < 10; i++) actuator_shape(&a, 1.0);
+	BOOST_CHECK_CLOSE(a.out, 0.2, 1e-9);
+	for (i = 0; i < 40; i++) actuator_shape(&a, 1.0);
+	BOOST_CHECK_CLOSE(a.out, 1.0, 1e-9);
+	// and never past the command
+	BOOST_CHECK_CLOSE(actuator_shape(&a, 1.0), 1.0, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(actuator_shape_holds_back_small_changes)
+{
+	actuator_t a;
+	actuator_model_t m = {0.0, 0.0, 0.01, 0.0};
+
+	BOOST_REQUIRE_EQUAL(actuator_init(&a, &m, DT, 0.5), 0);
+	BOOST_CHECK_EQUAL(actuator_shape(&a, 0.505), 0.5);
+	BOOST_CHECK_EQUAL(actuator_shape(&a, 0.495), 0.5);
+	BOOST_CHECK_EQUAL(actuator_shape(&a, 0.52), 0.52);
+	// measured from the last command it acted on, not the first one
+	BOOST_CHECK_EQUAL(actuator_shape(&a, 0.515), 0.52);
+}
+
+BOOST_AUTO_TEST_CASE(actuator_march_lag_is_exact)
+{
+	actuator_t a;
+	actuator_model_t m = {0.0, 0.1, 0.0, 0.0};
+	int i;
+
+	BOOST_REQUIRE_EQUAL(actuator_init(&a, &m, DT, 0.0), 0);
+	for (i = 0; i < 10; i++) actuator_march(&a, 1.0);
+	// one time constant
+	BOOST_CHECK_CLOSE(a.pos, 1.0 - exp(-1.0), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(actuator_march_takes_up_the_play)
+{
+	actuator_t a;
+	actuator_model_t m = {0.0, 0.0, 0.0, 0.1};
+	int i;
+
+	BOOST_REQUIRE_EQUAL(actuator_init(&a, &m, DT, 0.5), 0);
+	// inside the play the brake doesn't move
+	BOOST_CHECK_EQUAL(actuator_march(&a, 0.54), 0.5);
+	BOOST_CHECK_EQUAL(actuator_march(&a, 0.46), 0.5);
+	// past it the brake trails the servo by half the play
+	for (i = 0; i < 3; i++) actuator_march(&a, 1.0);
+	BOOST_CHECK_CLOSE(a.out, 0.95, 1e-9);
+	for (i = 0; i < 3; i++) actuator_march(&a, 0.0);
+	BOOST_CHECK_CLOSE(a.out, 0.05, 1e-9);
+}
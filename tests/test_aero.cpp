@@ -0,0 +1,119 @@
+/**
+ * @file test_aero.cpp
+ *
+ * Airbrake effectiveness table and its inverse, see aero.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+extern "C" {
+#include <aero.h>
+#include <settings.h>
+}
+
+// brakes lose half their effect going from subsonic to Mach 1
+static const char* table =
+	"{ \"deflection\": [0.0, 0.25, 0.5, 1.0],\n"
+	"  \"mach\": [0.2, 1.0],\n"
+	"  \"increment\": [[0.0, 0.0], [0.3, 0.15], [1.0, 0.5], [2.0, 1.0]] }\n";
+
+// writes a table to a temporary file and points the settings at it
+static int __use_table(char* path, const char* text)
+{
+	FILE* fd;
+	int fdn = mkstemp(path);
+
+	if (fdn < 0 || (fd = fdopen(fdn, "w")) == NULL) return -1;
+	fputs(text, fd);
+	fclose(fd);
+	strncpy(settings.aero_table_file, path, sizeof(settings.aero_table_file) - 1);
+	return 0;
+}
+
+BOOST_AUTO_TEST_CASE(aero_linear_without_table)
+{
+	aero_cursor_t c = AERO_CURSOR_INITIALIZER;
+
+	settings.aero_table_file[0] = '\0';
+	settings.apogee_brake_drag_gain = 2.0;
+	BOOST_REQUIRE_EQUAL(aero_init(), 0);
+	BOOST_CHECK_EQUAL(aero_max_increment(), 2.0);
+	BOOST_CHECK_CLOSE(aero_increment(&c, 0.3, 0.5), 0.6, 1e-9);
+	BOOST_CHECK_CLOSE(aero_increment(&c, 0.3, 2.0), 0.6, 1e-9);
+	BOOST_CHECK_CLOSE(aero_deflection(&c, 0.6, 0.0), 0.3, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(aero_table_round_trip)
+{
+	char path[] = "/tmp/rcs_aero_XXXXXX";
+	aero_cursor_t c = AERO_CURSOR_INITIALIZER;
+	double d, m, err = 0.0;
+	int i, j;
+
+	BOOST_REQUIRE_EQUAL(__use_table(path, table), 0);
+	BOOST_REQUIRE_EQUAL(aero_init(), 0);
+	unlink(path);
+	BOOST_CHECK_EQUAL(aero_max_increment(), 2.0);
+
+	// bilinear between the breakpoints
+	BOOST_CHECK_CLOSE(aero_increment(&c, 0.75, 0.6), 1.125, 1e-9);
+	// clamped past the ends of the Mach axis
+	BOOST_CHECK_CLOSE(aero_increment(&c, 0.5, 0.0), 1.0, 1e-9);
+	BOOST_CHECK_CLOSE(aero_increment(&c, 0.5, 3.0), 0.5, 1e-9);
+
+	// jumping around so the cursor has to walk both ways
+	for (i = 0; i <= 100; i++) {
+		for (j = 0; j <= 12; j++) {
+			d = ((i * 37) % 101) / 100.0;
+			m = j / 10.0;
+			err = fmax(err, fabs(aero_deflection(&c, aero_increment(&c, d, m), m) - d));
+		}
+	}
+	BOOST_CHECK_SMALL(err, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(aero_deflection_saturates)
+{
+	char path[] = "/tmp/rcs_aero_XXXXXX";
+	aero_cursor_t c = AERO_CURSOR_INITIALIZER;
+
+	BOOST_REQUIRE_EQUAL(__use_table(path, table), 0);
+	BOOST_REQUIRE_EQUAL(aero_init(), 0);
+	unlink(path);
+
+	BOOST_CHECK_EQUAL(aero_deflection(&c, -0.1, 0.5), 0.0);
+	// more than full brake gives at Mach 1
+	BOOST_CHECK_EQUAL(aero_deflection(&c, 1.5, 1.0), 1.0);
+	BOOST_CHECK_LT(aero_deflection(&c, 1.5, 0.2), 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(aero_rejects_bad_tables)
+{
+	char path[] = "/tmp/rcs_aero_XXXXXX";
+
+	// flat at Mach 1
+	BOOST_REQUIRE_EQUAL(__use_table(path,
+		"{ \"deflection\": [0.0, 0.5, 1.0], \"mach\": [0.2, 1.0],"
+		"  \"increment\": [[0.0, 0.0], [1.0, 0.5], [2.0, 0.5]] }"), 0);
+	BOOST_CHECK_EQUAL(aero_init(), -1);
+	unlink(path);
+
+	// not stopping at full brake
+	strcpy(path, "/tmp/rcs_aero_XXXXXX");
+	BOOST_REQUIRE_EQUAL(__use_table(path,
+		"{ \"deflection\": [0.0, 0.5], \"mach\": [0.2],"
+		"  \"increment\": [[0.0], [1.0]] }"), 0);
+	BOOST_CHECK_EQUAL(aero_init(), -1);
+	unlink(path);
+
+	// brakes in must be clean
+	settings.aero_table_file[0] = '\0';
+	settings.apogee_brake_drag_gain = 0.0;
+	BOOST_CHECK_EQUAL(aero_init(), -1);
+}
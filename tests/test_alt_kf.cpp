@@ -0,0 +1,172 @@
+/**
+ * @file test_alt_kf.cpp
+ *
+ * Altitude Kalman filter and its delayed corrections, see alt_kf.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+
+extern "C" {
+#include <alt_kf.h>
+}
+
+#define DT	0.01
+#define STEP_NS	10000000ULL	// DT in ns
+#define R	0.5
+
+static const double q[3] = {1e-4, 1e-3, 1e-5};
+static const double P0[3][3] = {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 0.1}};
+
+// textbook filter with full matrices, what the unrolled one has to match
+typedef struct ref_kf_t {
+	double x[3];
+	double P[3][3];
+} ref_kf_t;
+
+static void __ref_predict(ref_kf_t* k, double u)
+{
+	const double F[3][3] = {{1.0, DT, 0.0}, {0.0, 1.0, -DT}, {0.0, 0.0, 1.0}};
+	const double G[3] = {0.5 * DT * DT, DT, 0.0};
+	double x[3], FP[3][3];
+	int i, j, l;
+
+	for (i = 0; i < 3; i++) {
+		x[i] = G[i] * u;
+		for (j = 0; j < 3; j++) x[i] += F[i][j] * k->x[j];
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			FP[i][j] = 0.0;
+			for (l = 0; l < 3; l++) FP[i][j] += F[i][l] * k->P[l][j];
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		k->x[i] = x[i];
+		for (j = 0; j < 3; j++) {
+			k->P[i][j] = i == j ? q[i] : 0.0;
+			for (l = 0; l < 3; l++) k->P[i][j] += FP[i][l] * F[j][l];
+		}
+	}
+}
+
+static void __ref_correct(ref_kf_t* k, double y)
+{
+	double K[3], P[3][3], s = k->P[0][0] + R, z = y - k->x[0];
+	int i, j;
+
+	for (i = 0; i < 3; i++) K[i] = k->P[i][0] / s;
+	for (i = 0; i < 3; i++) {
+		k->x[i] += K[i] * z;
+		for (j = 0; j < 3; j++) P[i][j] = k->P[i][j] - K[i] * k->P[0][j];
+	}
+	for (i = 0; i < 3; i++) for (j = 0; j < 3; j++) k->P[i][j] = P[i][j];
+}
+
+static double __max_diff(const alt_kf_t* kf, const ref_kf_t* ref)
+{
+	double d = 0.0;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		d = fmax(d, fabs(kf->x[i] - ref->x[i]));
+		for (j = 0; j < 3; j++) d = fmax(d, fabs(kf->P[i][j] - ref->P[i][j]));
+	}
+	return d;
+}
+
+// a climb with the accel running a little off, so the bias has to be found
+static double __accel(int step)
+{
+	return 5.0 * sin(step * DT) + 0.2;
+}
+
+BOOST_AUTO_TEST_CASE(alt_kf_matches_full_matrix_filter)
+{
+	alt_kf_t kf;
+	ref_kf_t ref = {{0.0, 0.0, 0.0}, {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 0.1}}};
+	double d = 0.0;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(alt_kf_init(&kf, DT, q, R, P0), 0);
+	for (i = 1; i <= 2000; i++) {
+		alt_kf_predict(&kf, __accel(i), i * STEP_NS);
+		__ref_predict(&ref, __accel(i));
+		if (i % 10 == 0) {
+			BOOST_REQUIRE_EQUAL(alt_kf_correct(&kf, 0.01 * i, i * STEP_NS), 0);
+			__ref_correct(&ref, 0.01 * i);
+		}
+		d = fmax(d, __max_diff(&kf, &ref));
+	}
+	BOOST_CHECK_SMALL(d, 1e-9);
+	BOOST_CHECK_EQUAL(kf.fused, 200u);
+}
+
+BOOST_AUTO_TEST_CASE(alt_kf_late_sample_same_as_in_order)
+{
+	static alt_kf_t a, b;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(alt_kf_init(&a, DT, q, R, P0), 0);
+	BOOST_REQUIRE_EQUAL(alt_kf_init(&b, DT, q, R, P0), 0);
+	for (i = 1; i <= 60; i++) {
+		alt_kf_predict(&a, __accel(i), i * STEP_NS);
+		alt_kf_predict(&b, __accel(i), i * STEP_NS);
+	}
+	// a gets them in order, b gets the newer one first
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&a, 3.0, 30 * STEP_NS), 0);
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&a, 5.0, 50 * STEP_NS), 0);
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&b, 5.0, 50 * STEP_NS), 0);
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&b, 3.0, 30 * STEP_NS), 0);
+	for (i = 0; i < 3; i++) BOOST_CHECK_SMALL(a.x[i] - b.x[i], 1e-9);
+
+	// and both keep going the same after more steps
+	for (i = 61; i <= 100; i++) {
+		alt_kf_predict(&a, __accel(i), i * STEP_NS);
+		alt_kf_predict(&b, __accel(i), i * STEP_NS);
+	}
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&a, 4.0, 70 * STEP_NS), 0);
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&b, 4.0, 70 * STEP_NS), 0);
+	for (i = 0; i < 3; i++) BOOST_CHECK_SMALL(a.x[i] - b.x[i], 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(alt_kf_sample_fused_at_its_time)
+{
+	static alt_kf_t kf;
+	ref_kf_t ref = {{0.0, 0.0, 0.0}, {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 0.1}}};
+	int i;
+
+	// the reference fuses at step 40, the filter only hears of it at 55
+	BOOST_REQUIRE_EQUAL(alt_kf_init(&kf, DT, q, R, P0), 0);
+	for (i = 1; i <= 55; i++) {
+		alt_kf_predict(&kf, __accel(i), i * STEP_NS);
+		__ref_predict(&ref, __accel(i));
+		if (i == 40) __ref_correct(&ref, 2.0);
+	}
+	// half way between two steps goes to the older one
+	BOOST_REQUIRE_EQUAL(alt_kf_correct(&kf, 2.0, 40 * STEP_NS + STEP_NS / 2), 0);
+	BOOST_CHECK_SMALL(__max_diff(&kf, &ref), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(alt_kf_drops_what_it_cant_fuse)
+{
+	static alt_kf_t kf;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(alt_kf_init(&kf, DT, q, R, P0), 0);
+	BOOST_CHECK_EQUAL(alt_kf_correct(&kf, 1.0, 0), -1);
+
+	for (i = 1; i <= ALT_KF_HIST + 10; i++) alt_kf_predict(&kf, 0.0, i * STEP_NS);
+	// older than the history
+	BOOST_CHECK_EQUAL(alt_kf_correct(&kf, 1.0, 5 * STEP_NS), -1);
+	BOOST_CHECK_EQUAL(kf.dropped, 1u);
+
+	// one step only holds ALT_KF_MEAS samples
+	for (i = 0; i < ALT_KF_MEAS; i++) {
+		BOOST_CHECK_EQUAL(alt_kf_correct(&kf, 1.0, 100 * STEP_NS), 0);
+	}
+	BOOST_CHECK_EQUAL(alt_kf_correct(&kf, 1.0, 100 * STEP_NS), -1);
+	BOOST_CHECK_EQUAL(kf.dropped, 2u);
+	BOOST_CHECK_EQUAL(kf.fused, (uint64_t)ALT_KF_MEAS);
+}
@@ -0,0 +1,104 @@
+/**
+ * @file test_apogee.cpp
+ *
+ * Apogee predictor, integrated and from the table, see apogee.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+
+extern "C" {
+#include <apogee.h>
+#include <aero.h>
+#include <drag_rls.h>
+#include <rcs_defs.h>
+#include <servos.h>
+#include <settings.h>
+#include <state_estimator.h>
+#include <thrust_map.h>
+}
+
+#define DRAG_K	0.001
+#define GAIN	2.0
+
+// closed form rise under gravity and quadratic drag
+static double __rise(double v, double k)
+{
+	return log(1.0 + k * v * v / GRAVITY) / (2.0 * k);
+}
+
+static void __setup(int lut)
+{
+	settings.apogee_drag_k = DRAG_K;
+	settings.apogee_brake_drag_gain = GAIN;
+	settings.aero_table_file[0] = '\0';
+	settings.apogee_step_s = 0.01;
+	settings.apogee_budget_us = 1e6;	// always finishes in one call
+	settings.apogee_lut = lut;
+	settings.apogee_lut_v_max = 300.0;
+	settings.num_rotors = 4;
+	settings.drag_rls_en = 0;
+	state_estimate.mach = 0.0;
+	BOOST_REQUIRE_EQUAL(thrust_map_init(LINEAR_MAP), 0);
+	BOOST_REQUIRE_EQUAL(aero_init(), 0);
+	BOOST_REQUIRE_EQUAL(drag_rls_init(), 0);
+	BOOST_REQUIRE_EQUAL(apogee_init(), 0);
+}
+
+static void __brakes(double b)
+{
+	int i;
+
+	for (i = 0; i < settings.num_rotors; i++) sstate.m[i] = b;
+}
+
+// worst error against the closed form over the climb rates of a flight
+static double __worst(double k)
+{
+	double v, err = 0.0;
+
+	for (v = 0.0; v <= 300.0; v += 7.0) {
+		err = fmax(err, fabs(apogee_march(100.0, v) - 100.0 - __rise(v, k)));
+	}
+	return err;
+}
+
+BOOST_AUTO_TEST_CASE(apogee_integrated_matches_closed_form)
+{
+	__setup(0);
+	__brakes(0.0);
+	BOOST_CHECK_LT(__worst(DRAG_K), 1e-6);
+	__brakes(1.0);
+	BOOST_CHECK_LT(__worst(DRAG_K * (1.0 + GAIN)), 1e-6);
+	// falling already
+	BOOST_CHECK_EQUAL(apogee_march(100.0, -5.0), 100.0);
+}
+
+BOOST_AUTO_TEST_CASE(apogee_table_matches_closed_form)
+{
+	__setup(1);
+	__brakes(0.0);
+	BOOST_CHECK_LT(__worst(DRAG_K), 0.5);
+	__brakes(1.0);
+	BOOST_CHECK_LT(__worst(DRAG_K * (1.0 + GAIN)), 0.5);
+	__brakes(0.5);
+	BOOST_CHECK_LT(__worst(DRAG_K * (1.0 + 0.5 * GAIN)), 0.5);
+}
+
+BOOST_AUTO_TEST_CASE(apogee_integration_spreads_over_ticks)
+{
+	double ap;
+	int ticks = 1;
+
+	__setup(0);
+	__brakes(0.0);
+	settings.apogee_budget_us = 0.0;	// one clock check per tick
+	BOOST_REQUIRE_EQUAL(apogee_init(), 0);
+
+	// the first tick has nothing finished to publish
+	BOOST_CHECK_EQUAL(apogee_march(100.0, 200.0), 0.0);
+	while ((ap = apogee_march(100.0, 200.0)) == 0.0 && ticks < 10000) ticks++;
+	BOOST_CHECK_GT(ticks, 10);
+	BOOST_CHECK_SMALL(ap - 100.0 - __rise(200.0, DRAG_K), 1e-6);
+}
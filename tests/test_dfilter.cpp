@@ -0,0 +1,90 @@
+/**
+ * @file test_dfilter.cpp
+ *
+ * Fixed-size filters against the rc_filter_t they are built from, see
+ * dfilter.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdlib.h>
+#include <math.h>
+
+extern "C" {
+#include <dfilter.h>
+#include <rc/math/filter.h>
+}
+
+#define DT	0.01
+#define STEPS	10000
+
+// marches both with the saturation feedback_march uses, narrow enough to get
+// hit, and returns the largest difference. Frees rc.
+static double __compare(rc_filter_t* rc)
+{
+	rc_filter_t ref = RC_FILTER_INITIALIZER;
+	dfilter_t f;
+	double in, diff = 0.0;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(rc_filter_duplicate(&ref, *rc), 0);
+	BOOST_REQUIRE_EQUAL(dfilter_from_rc(&f, rc), 0);
+	BOOST_REQUIRE_EQUAL(f.order, rc->order);
+	rc_filter_enable_saturation(&ref, -0.5, 0.5);
+	dfilter_set_saturation(&f, -0.5, 0.5);
+	rc_filter_enable_soft_start(&ref, 0.5);
+	BOOST_REQUIRE_EQUAL(dfilter_enable_soft_start(&f, 0.5), 0);
+
+	// error signal of a slow oscillation with some noise on it
+	srand(1);
+	for (i = 0; i < STEPS; i++) {
+		in = 0.3 * sin(i * DT * 2.0) + 0.01 * (rand() / (double)RAND_MAX - 0.5);
+		diff = fmax(diff, fabs(rc_filter_march(&ref, in) - dfilter_march(&f, in)));
+	}
+	BOOST_CHECK_EQUAL(f.sat_flag, ref.sat_flag);
+
+	// and again from the start after a reset
+	rc_filter_reset(&ref);
+	dfilter_reset(&f);
+	for (i = 0; i < STEPS / 10; i++) {
+		in = 0.3 * cos(i * DT * 5.0);
+		diff = fmax(diff, fabs(rc_filter_march(&ref, in) - dfilter_march(&f, in)));
+	}
+	rc_filter_free(&ref);
+	rc_filter_free(rc);
+	return diff;
+}
+
+BOOST_AUTO_TEST_CASE(dfilter_pid_same_as_rc_filter)
+{
+	rc_filter_t rc = RC_FILTER_INITIALIZER;
+
+	BOOST_REQUIRE_EQUAL(rc_filter_pid(&rc, 2.0, 0.5, 0.1, 4.0 * DT, DT), 0);
+	BOOST_CHECK_SMALL(__compare(&rc), 1e-9);
+	// proportional only
+	BOOST_REQUIRE_EQUAL(rc_filter_pid(&rc, 1.5, 0.0, 0.0, 4.0 * DT, DT), 0);
+	BOOST_CHECK_SMALL(__compare(&rc), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(dfilter_lowpass_same_as_rc_filter)
+{
+	rc_filter_t rc = RC_FILTER_INITIALIZER;
+	int order;
+
+	BOOST_REQUIRE_EQUAL(rc_filter_first_order_lowpass(&rc, DT, 0.1), 0);
+	BOOST_CHECK_SMALL(__compare(&rc), 1e-9);
+	for (order = 1; order <= DFILTER_MAX_ORDER; order++) {
+		BOOST_REQUIRE_EQUAL(rc_filter_butterworth_lowpass(&rc, order, DT, 10.0), 0);
+		BOOST_CHECK_SMALL(__compare(&rc), 1e-9);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(dfilter_rejects_high_order)
+{
+	rc_filter_t rc = RC_FILTER_INITIALIZER;
+	dfilter_t f;
+
+	BOOST_REQUIRE_EQUAL(rc_filter_butterworth_lowpass(&rc, DFILTER_MAX_ORDER + 1, DT, 10.0), 0);
+	BOOST_CHECK_EQUAL(dfilter_from_rc(&f, &rc), -1);
+	rc_filter_free(&rc);
+}
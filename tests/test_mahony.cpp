@@ -0,0 +1,119 @@
+/**
+ * @file test_mahony.cpp
+ *
+ * Mahony attitude filter on a still and a rotating sensor, see mahony.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+
+extern "C" {
+#include <mahony.h>
+}
+
+#define DT	0.01
+#define G	9.80665
+#define KP	2.0
+#define KI	0.1
+
+static const double still[3] = {0.0, 0.0, 0.0};
+
+// gravity in the sensor frame as the attitude estimate expects it, unit length
+static void __gravity(const mahony_t* f, double v[3])
+{
+	const double* q = f->q;
+
+	v[0] = 2.0 * (q[1] * q[3] - q[0] * q[2]);
+	v[1] = 2.0 * (q[0] * q[1] + q[2] * q[3]);
+	v[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+// angle between the expected gravity and an accel sample (rad)
+static double __tilt_err(const mahony_t* f, const double a[3])
+{
+	double v[3], n = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+
+	__gravity(f, v);
+	return acos(fmin(1.0, (v[0] * a[0] + v[1] * a[1] + v[2] * a[2]) / n));
+}
+
+// accel of a sensor at rest rolled by r and pitched by p
+static void __accel(double r, double p, double a[3])
+{
+	a[0] = -G * sin(p);
+	a[1] = G * cos(p) * sin(r);
+	a[2] = G * cos(p) * cos(r);
+}
+
+BOOST_AUTO_TEST_CASE(mahony_levels_on_first_sample)
+{
+	mahony_t f;
+	double a[3];
+	int i;
+
+	BOOST_CHECK_EQUAL(mahony_init(&f, -1.0, KI), -1);
+	BOOST_REQUIRE_EQUAL(mahony_init(&f, KP, KI), 0);
+	__accel(0.3, -0.2, a);
+	mahony_update(&f, still, a, NULL, DT);
+	BOOST_CHECK_EQUAL(f.leveled, 1);
+	BOOST_CHECK_SMALL(__tilt_err(&f, a), 1e-9);
+
+	// and stays there
+	for (i = 0; i < 1000; i++) mahony_update(&f, still, a, NULL, DT);
+	BOOST_CHECK_SMALL(__tilt_err(&f, a), 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(mahony_pulled_to_new_tilt)
+{
+	mahony_t f;
+	double a[3], b[3];
+	int i;
+
+	BOOST_REQUIRE_EQUAL(mahony_init(&f, KP, 0.0), 0);
+	__accel(0.0, 0.0, a);
+	mahony_update(&f, still, a, NULL, DT);
+	// the sensor was tipped over without the gyro noticing
+	__accel(0.2, 0.1, b);
+	for (i = 0; i < 500; i++) mahony_update(&f, still, b, NULL, DT);
+	BOOST_CHECK_SMALL(__tilt_err(&f, b), 1e-3);
+}
+
+BOOST_AUTO_TEST_CASE(mahony_learns_gyro_bias)
+{
+	mahony_t f;
+	const double gyro[3] = {0.5, -0.3, 0.0};	// deg/s while sitting still
+	double a[3];
+	int i;
+
+	BOOST_REQUIRE_EQUAL(mahony_init(&f, KP, KI), 0);
+	__accel(0.0, 0.0, a);
+	mahony_update(&f, still, a, NULL, DT);
+	for (i = 0; i < 20000; i++) mahony_update(&f, gyro, a, NULL, DT);
+	BOOST_CHECK_SMALL(f.bias[0] + gyro[0] * M_PI / 180.0, 1e-5);
+	BOOST_CHECK_SMALL(f.bias[1] + gyro[1] * M_PI / 180.0, 1e-5);
+	BOOST_CHECK_SMALL(__tilt_err(&f, a), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(mahony_gyro_only_outside_gate)
+{
+	mahony_t f;
+	const double yaw_rate[3] = {0.0, 0.0, 90.0};
+	double a[3], thrust[3];
+	int i;
+
+	BOOST_REQUIRE_EQUAL(mahony_init(&f, KP, KI), 0);
+	__accel(0.0, 0.0, a);
+	mahony_update(&f, still, a, NULL, DT);
+
+	// 3 g off to the side under thrust, nothing to do with gravity
+	thrust[0] = 3.0 * G;
+	thrust[1] = 0.0;
+	thrust[2] = 0.0;
+	for (i = 0; i < 100; i++) mahony_update(&f, yaw_rate, thrust, NULL, DT);
+	BOOST_CHECK_SMALL(__tilt_err(&f, a), 1e-6);
+	BOOST_CHECK_EQUAL(f.bias[0], 0.0);
+	// one second at 90 deg/s about Z
+	BOOST_CHECK_CLOSE(f.q[0], cos(M_PI / 4.0), 0.01);
+	BOOST_CHECK_CLOSE(f.q[3], sin(M_PI / 4.0), 0.01);
+}
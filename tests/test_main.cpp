@@ -0,0 +1,9 @@
+/**
+ * @file test_main.cpp
+ *
+ * Entry point of the unit tests, the other files in tests/ add their cases
+ * to this module
+ */
+
+#define BOOST_TEST_MODULE rcs
+#include <boost/test/unit_test.hpp>
@@ -0,0 +1,98 @@
+/**
+ * @file test_mix.cpp
+ *
+ * Control allocation against the plain mixing matrix, see mix.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+
+extern "C" {
+#include <mix.h>
+#include <rcs_defs.h>
+}
+
+#define MASK	((1 << VEC_X) | (1 << VEC_PITCH) | (1 << VEC_YAW))
+
+// virtual inputs the + layout gets from its four motors
+static void __virtual(const double* mot, double* u)
+{
+	int i;
+
+	for (i = 0; i < MAX_INPUTS; i++) u[i] = 0.0;
+	u[VEC_X] = -0.25 * (mot[0] + mot[1] + mot[2] + mot[3]);
+	u[VEC_PITCH] = mot[0] - mot[2];
+	u[VEC_YAW] = mot[3] - mot[1];
+}
+
+static double __err(const double* mot, const double* u)
+{
+	double v[MAX_INPUTS];
+
+	__virtual(mot, v);
+	return fabs(v[VEC_X] - u[VEC_X]) + fabs(v[VEC_PITCH] - u[VEC_PITCH])
+		+ fabs(v[VEC_YAW] - u[VEC_YAW]);
+}
+
+BOOST_AUTO_TEST_CASE(mix_allocate_reachable_demand_is_exact)
+{
+	const double want[4] = {0.6, 0.55, 0.4, 0.45};
+	double u[MAX_INPUTS], mot[MAX_ROTORS], achieved[MAX_INPUTS];
+	mix_alloc_stats_t s;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(mix_init(LAYOUT_4PLUS), 0);
+	__virtual(want, u);
+	BOOST_REQUIRE_EQUAL(mix_allocate(u, MASK, mot, achieved), 0);
+	for (i = 0; i < 4; i++) BOOST_CHECK_SMALL(mot[i] - want[i], 1e-5);
+	BOOST_CHECK_SMALL(achieved[VEC_X] - u[VEC_X], 1e-5);
+	BOOST_CHECK_SMALL(achieved[VEC_PITCH] - u[VEC_PITCH], 1e-5);
+	BOOST_CHECK_SMALL(achieved[VEC_YAW] - u[VEC_YAW], 1e-5);
+
+	// the plain matrix gives the same where nothing saturates
+	BOOST_REQUIRE_EQUAL(mix_all_controls(u, mot), 0);
+	for (i = 0; i < 4; i++) BOOST_CHECK_SMALL(mot[i] - want[i], 1e-9);
+
+	BOOST_REQUIRE_EQUAL(mix_alloc_get_stats(&s), 0);
+	BOOST_CHECK_EQUAL(s.count, 1u);
+	BOOST_CHECK_EQUAL(s.unmet, 0u);
+	BOOST_CHECK_EQUAL(s.iter_hist[1], 1u);
+}
+
+BOOST_AUTO_TEST_CASE(mix_allocate_beats_clamping_when_saturated)
+{
+	double u[MAX_INPUTS] = {0.0}, mot[MAX_ROTORS], clamped[MAX_ROTORS];
+	mix_alloc_stats_t s;
+	int i;
+
+	// motor 1 would need 1.2
+	u[VEC_X] = -0.9;
+	u[VEC_PITCH] = 0.6;
+	BOOST_REQUIRE_EQUAL(mix_init(LAYOUT_4PLUS), 0);
+	BOOST_REQUIRE_EQUAL(mix_allocate(u, MASK, mot, NULL), 0);
+	BOOST_REQUIRE_EQUAL(mix_all_controls(u, clamped), 0);
+
+	for (i = 0; i < 4; i++) {
+		BOOST_CHECK_GE(mot[i], 0.0);
+		BOOST_CHECK_LE(mot[i], 1.0);
+	}
+	BOOST_CHECK_LT(__err(mot, u), __err(clamped, u));
+
+	BOOST_REQUIRE_EQUAL(mix_alloc_get_stats(&s), 0);
+	BOOST_CHECK_EQUAL(s.unmet, 1u);
+	BOOST_CHECK_SMALL(s.last_err - __err(mot, u), 1e-9);
+	BOOST_CHECK_GT(s.iter_hist[2] + s.iter_hist[3] + s.iter_hist[4], 0u);
+}
+
+BOOST_AUTO_TEST_CASE(mix_allocate_needs_a_matrix)
+{
+	double u[MAX_INPUTS] = {0.0}, mot[MAX_ROTORS];
+	double m[1][MAX_INPUTS] = {{-1.0, 0.0, 0.0, 0.0, 0.0, 0.0}};
+
+	// a failed init leaves no matrix behind
+	BOOST_CHECK_EQUAL(mix_init_matrix(1, 5, m), -1);
+	BOOST_CHECK_EQUAL(mix_allocate(u, MASK, mot, NULL), -1);
+	BOOST_REQUIRE_EQUAL(mix_init_matrix(1, 4, m), 0);
+	BOOST_CHECK_EQUAL(mix_allocate(u, MASK, mot, NULL), 0);
+}
@@ -0,0 +1,61 @@
+/**
+ * @file test_scheduler.cpp
+ *
+ * Load shedding of the scheduler, see scheduler.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <time.h>
+
+extern "C" {
+#include <scheduler.h>
+}
+
+static int spike_runs;
+static int spikes_left;
+
+static void __spin_ns(uint64_t ns)
+{
+	struct timespec t0, t;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &t);
+	} while ((uint64_t)((t.tv_sec - t0.tv_sec) * 1000000000LL + (t.tv_nsec - t0.tv_nsec)) < ns);
+}
+
+// takes 4 ms the first time, like a stalled SD write, and nothing after
+static int __spike_task(void)
+{
+	spike_runs++;
+	if (spikes_left > 0) {
+		spikes_left--;
+		__spin_ns(4000000);
+	}
+	return 0;
+}
+
+BOOST_AUTO_TEST_CASE(shed_task_recovers_after_one_spike)
+{
+	const int base_hz = 500;	// 2 ms period, the spike is two periods long
+	const int ticks = 2000;
+	sched_group_t groups[] = {
+		{"fast", (double)base_hz, 0, 1.0},
+	};
+	sched_task_t tasks[] = {
+		{0, ISR_STAGE_LOG, __spike_task, 1, SCHED_LOW, 0},
+	};
+	int i;
+
+	BOOST_REQUIRE_EQUAL(isr_timing_init(1000000000 / base_hz), 0);
+	BOOST_REQUIRE_EQUAL(sched_init(base_hz, 0.8, groups, 1, tasks, 1), 0);
+	spike_runs = 0;
+	spikes_left = 1;
+	for (i = 0; i < ticks / 2; i++) sched_run_tick(isr_timing_tick_start());
+	BOOST_CHECK_EQUAL(spikes_left, 0);
+
+	// shed for a while as the estimate decays, every tick once it has
+	spike_runs = 0;
+	for (i = 0; i < ticks / 2; i++) sched_run_tick(isr_timing_tick_start());
+	BOOST_CHECK_EQUAL(spike_runs, ticks / 2);
+}
@@ -0,0 +1,111 @@
+/**
+ * @file test_servo_cal.cpp
+ *
+ * Servo calibration curves and their lookup tables, see servo_cal.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <math.h>
+
+extern "C" {
+#include <servo_cal.h>
+}
+
+// a servo that moves less per microsecond towards the end of its travel,
+// points on grid cell ends so the table has to hit them exactly
+static const servo_cal_t uneven = {
+	SERVO_CURVE_LINEAR, 5, 1000.0,
+	{0.0, 0.25, 0.5, 0.75, 1.0},
+	{900.0, 1000.0, 1150.0, 1400.0, 2100.0}
+};
+
+BOOST_AUTO_TEST_CASE(servo_cal_rejects_bad_curves)
+{
+	servo_cal_t cal = uneven;
+	servo_lut_t lut;
+
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), 0);
+
+	cal.pos[4] = 0.9;
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), -1);
+	cal = uneven;
+	cal.pos[2] = 0.25;
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), -1);
+	cal = uneven;
+	cal.us[2] = 1000.0;
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), -1);
+	cal = uneven;
+	cal.us[4] = SERVO_CAL_MAX_US + 1.0;
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), -1);
+	cal = uneven;
+	cal.nominal_us = 800.0;
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), -1);
+	cal = uneven;
+	cal.points = 1;
+	BOOST_CHECK_EQUAL(servo_cal_compile(&cal, &lut), -1);
+}
+
+BOOST_AUTO_TEST_CASE(servo_cal_linear_is_exact)
+{
+	servo_lut_t lut;
+	double x, want;
+	int i, k;
+
+	BOOST_REQUIRE_EQUAL(servo_cal_compile(&uneven, &lut), 0);
+	BOOST_CHECK_EQUAL(lut.min_us, 900.0);
+	BOOST_CHECK_EQUAL(lut.max_us, 2100.0);
+	BOOST_CHECK_EQUAL(lut.nominal_us, 1000.0);
+	for (i = 0; i <= 1000; i++) {
+		x = i / 1000.0;
+		k = x >= 1.0 ? 3 : (int)(x * 4.0);
+		want = uneven.us[k] + (x - uneven.pos[k]) * 4.0 * (uneven.us[k + 1] - uneven.us[k]);
+		BOOST_REQUIRE_SMALL(servo_cal_map(&lut, x) - want, 1e-9);
+	}
+	// clamped outside the travel
+	BOOST_CHECK_EQUAL(servo_cal_map(&lut, -0.5), 900.0);
+	BOOST_CHECK_EQUAL(servo_cal_map(&lut, 1.5), 2100.0);
+}
+
+BOOST_AUTO_TEST_CASE(servo_cal_spline_is_monotone)
+{
+	servo_cal_t cal = uneven;
+	servo_lut_t lut;
+	double us, last;
+	int i;
+
+	cal.curve = SERVO_CURVE_SPLINE;
+	BOOST_REQUIRE_EQUAL(servo_cal_compile(&cal, &lut), 0);
+	for (i = 0; i < cal.points; i++) {
+		BOOST_CHECK_SMALL(servo_cal_map(&lut, cal.pos[i]) - cal.us[i], 1e-9);
+	}
+	last = servo_cal_map(&lut, 0.0);
+	for (i = 1; i <= 10000; i++) {
+		us = servo_cal_map(&lut, i / 10000.0);
+		BOOST_REQUIRE_GE(us, last);
+		last = us;
+	}
+	BOOST_CHECK_SMALL(last - 2100.0, 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(servo_cal_spline_follows_reversed_servo)
+{
+	servo_cal_t cal = uneven;
+	servo_lut_t lut;
+	double us, last;
+	int i;
+
+	// mounted the other way round, pulse width goes down as the brake opens
+	cal.curve = SERVO_CURVE_SPLINE;
+	for (i = 0; i < cal.points; i++) cal.us[i] = 3000.0 - uneven.us[i];
+	cal.nominal_us = 2000.0;
+	BOOST_REQUIRE_EQUAL(servo_cal_compile(&cal, &lut), 0);
+	last = servo_cal_map(&lut, 0.0);
+	BOOST_CHECK_SMALL(last - 2100.0, 1e-9);
+	for (i = 1; i <= 10000; i++) {
+		us = servo_cal_map(&lut, i / 10000.0);
+		BOOST_REQUIRE_LE(us, last);
+		BOOST_REQUIRE_GE(us, 900.0);
+		last = us;
+	}
+}
@@ -0,0 +1,108 @@
+/**
+ * @file test_thrust_map.cpp
+ *
+ * Thrust map loading, grid lookup and inverse, see thrust_map.h
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+extern "C" {
+#include <thrust_map.h>
+}
+
+#define MAP_POINTS	11
+
+// thrust going with the square of the signal, like a propeller
+static double map_signal[MAP_POINTS], map_thrust[MAP_POINTS];
+
+// writes the map as csv with a header line, returns 0 on success
+static int __write_map(char* path, int monotone)
+{
+	FILE* fd;
+	int i, fdn = mkstemp(path);
+
+	if (fdn < 0 || (fd = fdopen(fdn, "w")) == NULL) return -1;
+	fprintf(fd, "signal,thrust\n");
+	for (i = 0; i < MAP_POINTS; i++) {
+		map_signal[i] = i / (MAP_POINTS - 1.0);
+		map_thrust[i] = 2.0 * map_signal[i] * map_signal[i];	// normalized on load
+		if (!monotone && i == 5) map_thrust[i] = map_thrust[i - 1];
+		fprintf(fd, "%.6f,%.6f\n", map_signal[i], map_thrust[i]);
+	}
+	fclose(fd);
+	return 0;
+}
+
+// signal for a normalized thrust straight from the table
+static double __scan(double t)
+{
+	int i;
+
+	for (i = 1; i < MAP_POINTS - 1 && t > map_thrust[i] / map_thrust[MAP_POINTS - 1]; i++);
+	double t0 = map_thrust[i - 1] / map_thrust[MAP_POINTS - 1];
+	double t1 = map_thrust[i] / map_thrust[MAP_POINTS - 1];
+	return map_signal[i - 1] + (t - t0) / (t1 - t0) * (map_signal[i] - map_signal[i - 1]);
+}
+
+// slope of the table's segment i, signal over normalized thrust
+static double __slope(int i)
+{
+	return (map_signal[i] - map_signal[i - 1]) * map_thrust[MAP_POINTS - 1]
+		/ (map_thrust[i] - map_thrust[i - 1]);
+}
+
+BOOST_AUTO_TEST_CASE(thrust_map_grid_close_to_table)
+{
+	char path[] = "/tmp/rcs_thrust_map_XXXXXX";
+	double m, err = 0.0, jump = 0.0;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(__write_map(path, 1), 0);
+	BOOST_REQUIRE_EQUAL(thrust_map_init_file(path), 0);
+	unlink(path);
+
+	BOOST_CHECK_SMALL(map_motor_signal(0.0), 1e-12);
+	BOOST_CHECK_CLOSE(map_motor_signal(1.0), 1.0, 1e-9);
+	for (i = 0; i <= 100000; i++) {
+		m = i / 100000.0;
+		err = fmax(err, fabs(map_motor_signal(m) - __scan(m)));
+	}
+	// a knot inside a grid cell cuts its corner by at most a quarter of
+	// the change in slope times the cell width
+	for (i = 2; i < MAP_POINTS; i++) jump = fmax(jump, __slope(i - 1) - __slope(i));
+	BOOST_CHECK_LE(err, jump / (4.0 * THRUST_MAP_GRID));
+	BOOST_CHECK_GT(err, 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(thrust_map_invert_round_trip)
+{
+	char path[] = "/tmp/rcs_thrust_map_XXXXXX";
+	double m, err = 0.0;
+	int i;
+
+	BOOST_REQUIRE_EQUAL(__write_map(path, 1), 0);
+	BOOST_REQUIRE_EQUAL(thrust_map_init_file(path), 0);
+	unlink(path);
+
+	for (i = 0; i <= 10000; i++) {
+		m = i / 10000.0;
+		err = fmax(err, fabs(thrust_map_invert(map_motor_signal(m)) - m));
+	}
+	BOOST_CHECK_LT(err, 1e-3);
+	BOOST_CHECK_EQUAL(thrust_map_invert(-0.1), 0.0);
+	BOOST_CHECK_EQUAL(thrust_map_invert(1.1), 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(thrust_map_rejects_flat_map)
+{
+	char path[] = "/tmp/rcs_thrust_map_XXXXXX";
+
+	BOOST_REQUIRE_EQUAL(__write_map(path, 0), 0);
+	BOOST_CHECK_EQUAL(thrust_map_init_file(path), -1);
+	unlink(path);
+}